@@ -238,6 +238,16 @@ public:
     return true;
   }
 
+  size_t fetch (uint8_t *bytes, size_t count)
+  {
+    assert (m_fp);
+#ifdef _MSC_VER
+    return fread_s (bytes, count, sizeof (uint8_t), count, m_fp);
+#else
+    return fread (bytes, sizeof (uint8_t), count, m_fp);
+#endif
+  }
+
   size_t tell ()
   {
     assert (m_fp);
@@ -553,6 +563,7 @@ public:
   {
     fwrite (m_buf, sizeof (uint8_t), m_pos, m_fp);
     fflush (m_fp);
+    m_pos = 0;
   }
 
 private:
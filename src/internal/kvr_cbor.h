@@ -45,7 +45,7 @@ namespace kvr
 
       static const uint8_t CBOR_MAJOR_TYPE_0 = 0x00;  // unsigned integer
       static const uint8_t CBOR_MAJOR_TYPE_1 = 0x20;  // negative integer
-      static const uint8_t CBOR_MAJOR_TYPE_2 = 0x40;  // byte string - unused
+      static const uint8_t CBOR_MAJOR_TYPE_2 = 0x40;  // byte string
       static const uint8_t CBOR_MAJOR_TYPE_3 = 0x60;  // text string
       static const uint8_t CBOR_MAJOR_TYPE_4 = 0x80;  // array
       static const uint8_t CBOR_MAJOR_TYPE_5 = 0xa0;  // map
@@ -66,6 +66,34 @@ namespace kvr
       static const uint8_t CBOR_VALUE_TYPE_FLOAT16  = 25;
       static const uint8_t CBOR_VALUE_TYPE_FLOAT32  = 26;
       static const uint8_t CBOR_VALUE_TYPE_FLOAT64  = 27;
+      static const uint8_t CBOR_VALUE_TYPE_INDEF    = 31;
+      static const uint8_t CBOR_BREAK               = 0xff;
+
+      // stringref extension: http://cbor.schmorp.de/stringref
+      static const uint64_t CBOR_TAG_STRINGREF            = 25;
+      static const uint64_t CBOR_TAG_STRINGREF_NAMESPACE  = 256;
+
+      // typed arrays (rfc 8746): tags 64 to 87 are 0b010fsell (f: float, s: signed, 
+      // e: little-endian, ll: element size) over a byte string of packed elements
+      static const uint64_t CBOR_TAG_TYPED_FIRST          = 64;
+      static const uint64_t CBOR_TAG_TYPED_LAST           = 87;
+      static const uint8_t  CBOR_TAG_TYPED_UINT8          = 64;
+      static const uint8_t  CBOR_TAG_TYPED_UINT16LE       = 69;
+      static const uint8_t  CBOR_TAG_TYPED_UINT32LE       = 70;
+      static const uint8_t  CBOR_TAG_TYPED_UINT64LE       = 71;
+      static const uint8_t  CBOR_TAG_TYPED_SINT8          = 72;
+      static const uint8_t  CBOR_TAG_TYPED_SINT16LE       = 77;
+      static const uint8_t  CBOR_TAG_TYPED_SINT32LE       = 78;
+      static const uint8_t  CBOR_TAG_TYPED_SINT64LE       = 79;
+      static const uint8_t  CBOR_TAG_TYPED_FLOAT32LE      = 85;
+      static const uint8_t  CBOR_TAG_TYPED_FLOAT64LE      = 86;
+      // shorter number arrays are written as plain arrays
+      static const kvr::sz_t CBOR_TYPED_ARRAY_MIN_LENGTH  = 8;
+
+      // numeric columns (private tags 'kd' and 'kx'): an array packed by 
+      // kvr::internal::column_delta_pack or column_xor_pack over a byte string
+      static const uint64_t CBOR_TAG_KVR_DELTA            = 0x6b64;
+      static const uint64_t CBOR_TAG_KVR_XOR              = 0x6b78;
 
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
@@ -82,6 +110,17 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        // reuse for another document
+        void reset (kvr::value *value)
+        {
+          memset (m_stack, 0, sizeof (m_stack));
+          m_root = value;
+          m_temp = NULL;
+          m_depth = 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_null ()
         {
           bool success = false;
@@ -239,6 +278,37 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        bool read_binary (const uint8_t *data, kvr::sz_t size)
+        {
+          bool success = false;
+
+          KVR_ASSERT (data || (size == 0));
+          KVR_ASSERT_SAFE (m_depth != 0, success);
+          kvr::value *node = m_stack [m_depth - 1];
+          KVR_ASSERT (node);
+          KVR_ASSERT (node->is_map () || node->is_array ());
+
+          if (node->is_map ())
+          {
+            KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
+            m_temp->conv_binary ();
+            m_temp->set_binary (data, size);
+            m_temp = NULL;
+            success = true;
+          }
+          else if (node->is_array ())
+          {
+            kvr::value *vbin = node->push_null (); KVR_ASSERT (vbin);
+            vbin->conv_binary ();
+            vbin->set_binary (data, size);
+            success = true;
+          }
+
+          return success;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_map_start (kvr::sz_t size)
         {
           bool success = false;
@@ -254,7 +324,7 @@ namespace kvr
             {
               node = m_temp;
               KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
-              m_temp->conv_map (size);
+              (size > 0) ? m_temp->conv_map (size) : m_temp->conv_map ();
               m_temp = NULL;
               success = true;
             }
@@ -266,7 +336,7 @@ namespace kvr
           }
           else
           {
-            node = m_root->conv_map (size);
+            node = (size > 0) ? m_root->conv_map (size) : m_root->conv_map ();
             success = true;
           }
 
@@ -299,6 +369,21 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        // a numbered key (stringref). the handle is set by its first insert
+        bool read_key_ref (const char *str, kvr::sz_t length, kvr::key **handle)
+        {
+          KVR_ASSERT (str && handle);
+          kvr::value *node = m_stack [m_depth - 1];
+          KVR_ASSERT_SAFE (node && node->is_map (), false);
+
+          KVR_ASSERT (!m_temp);
+          KVR_REF_UNUSED (length);
+          m_temp = *handle ? node->insert_null (*handle) : node->insert_null (str, handle);
+          return (m_temp != NULL);
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_map_end (kvr::sz_t size)
         {
           kvr::value *node = m_stack [m_depth - 1];
@@ -326,7 +411,7 @@ namespace kvr
             {
               node = m_temp;
               KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
-              m_temp->conv_array (length);
+              (length > 0) ? m_temp->conv_array (length) : m_temp->conv_array ();
               m_temp = NULL;
               success = true;
             }
@@ -338,7 +423,7 @@ namespace kvr
           }
           else
           {
-            node = m_root->conv_array (length);
+            node = (length > 0) ? m_root->conv_array (length) : m_root->conv_array ();
             success = true;
           }
 
@@ -372,14 +457,31 @@ namespace kvr
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
 
-      template<typename istr>
+      // numbered keys go to the context by handle where it can take one
+      template<typename rctx>
+      inline bool read_key_ref (rctx &ctx, const char *str, kvr::sz_t length, kvr::key **handle)
+      {
+        KVR_REF_UNUSED (handle);
+        return ctx.read_key (str, length);
+      }
+
+      inline bool read_key_ref (read_ctx &ctx, const char *str, kvr::sz_t length, kvr::key **handle)
+      {
+        return ctx.read_key_ref (str, length, handle);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      template<typename istr, typename rctx = read_ctx>
       struct reader
       {
       public:
 
-        reader () : m_ss (256) {}
+        reader () : m_ss (m_ssbuf, sizeof (m_ssbuf)), m_refs (NULL) {}
 
-        bool parse (istr *is, read_ctx &ctx)
+        bool parse (istr *is, rctx &ctx)
         {
           KVR_ASSERT (is);
 
@@ -447,9 +549,7 @@ namespace kvr
 
               case CBOR_MAJOR_TYPE_2: // byte string
               { 
-                KVR_ASSERT (false && "unsupported major type (2): byte string");
-                // maybe skip bytes? no. client stream interface can't cope atm.
-                success = false; 
+                success = parse_bytes (is, ctx, value_type);
                 break; 
               } 
 
@@ -493,6 +593,10 @@ namespace kvr
                 {
                   success = parse_array32 (is, ctx);
                 }
+                else if (value_type == CBOR_VALUE_TYPE_INDEF)
+                {
+                  success = parse_array_indef (is, ctx);
+                }
 
                 break; 
               }
@@ -515,15 +619,17 @@ namespace kvr
                 {
                   success = parse_map32 (is, ctx);
                 }
+                else if (value_type == CBOR_VALUE_TYPE_INDEF)
+                {
+                  success = parse_map_indef (is, ctx);
+                }
 
                 break; 
               }
 
               case CBOR_MAJOR_TYPE_6: // semantic tagging
               {
-                KVR_ASSERT (false && "unsupported major type (6): semantic tagging");
-                // maybe skip bytes? no. client stream interface can't cope atm.
-                success = false;
+                success = parse_tag (is, ctx, value_type);
                 break;
               }
 
@@ -568,11 +674,9 @@ namespace kvr
           return success;
         }
 
-      private:
-
         ////////////////////////////////////////////////////////////
 
-        bool parse_key (istr *is, read_ctx &ctx)
+        bool parse_key (istr *is, rctx &ctx)
         {
           KVR_ASSERT (is);
 
@@ -608,6 +712,15 @@ namespace kvr
                 break;
               }
 
+              case CBOR_MAJOR_TYPE_6: // stringref
+              {
+                const char *str = NULL;
+                kvr::sz_t slen = 0;
+                kvr::key **handle = NULL;
+                success = parse_ref (is, value_type, &str, &slen, &handle) && read_key_ref (ctx, str, slen, handle);
+                break;
+              }
+
               default:
               {
                 success = false;
@@ -619,9 +732,279 @@ namespace kvr
           return success;
         }
 
+      private:
+
+        ////////////////////////////////////////////////////////////
+
+        // key literal, numbered inside a stringref namespace
+        bool on_key (rctx &ctx, const char *str, kvr::sz_t slen)
+        {
+          if (m_refs)
+          {
+            const char *copy = NULL;
+            kvr::key **handle = m_refs->literal (str, slen, &copy);
+            if (handle)
+            {
+              return read_key_ref (ctx, copy, slen, handle);
+            }
+          }
+          return ctx.read_key (str, slen);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool on_string (rctx &ctx, const char *str, kvr::sz_t slen)
+        {
+          if (m_refs)
+          {
+            const char *copy = NULL;
+            m_refs->literal (str, slen, &copy);
+          }
+          return ctx.read_string (str, slen);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // byte strings are numbered in a stringref namespace too
+        bool on_bytes (rctx &ctx, const uint8_t *data, kvr::sz_t size)
+        {
+          if (m_refs)
+          {
+            const char *copy = NULL;
+            m_refs->literal ((const char *) data, size, &copy, true);
+          }
+          return ctx.read_binary (data, size);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // header argument of an item already read
+        bool parse_arg (istr *is, uint8_t value_type, uint64_t *arg)
+        {
+          if (value_type < CBOR_VALUE_TYPE_UINT8)
+          {
+            *arg = value_type;
+            return true;
+          }
+
+          uint8_t b [8];
+          size_t n = (value_type == CBOR_VALUE_TYPE_UINT8) ? 1 : (value_type == CBOR_VALUE_TYPE_UINT16) ? 2 : 
+                     (value_type == CBOR_VALUE_TYPE_UINT32) ? 4 : (value_type == CBOR_VALUE_TYPE_UINT64) ? 8 : 0;
+
+          if ((n == 0) || !is->read (b, n))
+          {
+            return false;
+          }
+
+          *arg = 0;
+          for (size_t i = 0; i < n; ++i)
+          {
+            *arg = (*arg << 8) | b [i];
+          }
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // stringref (tag 25) to a string numbered earlier in the namespace
+        bool parse_ref (istr *is, uint8_t value_type, const char **str, kvr::sz_t *slen, kvr::key ***handle)
+        {
+          uint64_t tag = 0;
+          uint8_t curr = 0;
+          uint64_t index = 0;
+          bool bin = false;
+
+          return m_refs && parse_arg (is, value_type, &tag) && (tag == CBOR_TAG_STRINGREF) && 
+                 is->get (&curr) && ((curr & 0xe0) == CBOR_MAJOR_TYPE_0) && parse_arg (is, (curr & 0x1f), &index) &&
+                 m_refs->get (index, str, slen, handle, &bin) && !bin;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // definite length only, the bytes are not copied on memory streams
+        bool parse_bytes (istr *is, rctx &ctx, uint8_t value_type)
+        {
+          uint64_t len = 0;
+          if ((value_type == CBOR_VALUE_TYPE_INDEF) || !parse_arg (is, value_type, &len) || (len > 0xffffffffu))
+          {
+            return false;
+          }
+
+          const uint8_t *data = is->push (static_cast<size_t>(len));
+          return data ? on_bytes (ctx, data, static_cast<kvr::sz_t>(len)) : false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_tag (istr *is, rctx &ctx, uint8_t value_type)
+        {
+          uint64_t tag = 0;
+          if (!parse_arg (is, value_type, &tag))
+          {
+            return false;
+          }
+
+          if (tag == CBOR_TAG_STRINGREF_NAMESPACE)
+          {
+            kvr::internal::strref_reader refs (0);
+            kvr::internal::strref_reader *outer = m_refs;
+            m_refs = &refs;
+            bool ok = parse (is, ctx);
+            m_refs = outer;
+            return ok;
+          }
+
+          if ((tag == CBOR_TAG_STRINGREF) && m_refs)
+          {
+            uint8_t curr = 0;
+            uint64_t index = 0;
+            const char *str = NULL;
+            kvr::sz_t slen = 0;
+            kvr::key **handle = NULL;
+            bool bin = false;
+
+            return is->get (&curr) && ((curr & 0xe0) == CBOR_MAJOR_TYPE_0) && parse_arg (is, (curr & 0x1f), &index) &&
+                   m_refs->get (index, &str, &slen, &handle, &bin) && 
+                   (bin ? ctx.read_binary ((const uint8_t *) str, slen) : ctx.read_string (str, slen));
+          }
+
+          if ((tag >= CBOR_TAG_TYPED_FIRST) && (tag <= CBOR_TAG_TYPED_LAST))
+          {
+            return parse_typed (is, ctx, static_cast<uint8_t>(tag));
+          }
+
+          if ((tag == CBOR_TAG_KVR_DELTA) || (tag == CBOR_TAG_KVR_XOR))
+          {
+            uint64_t len = 0;
+            const uint8_t *p = parse_packed (is, &len);
+            if (!p)
+            {
+              return false;
+            }
+            return (tag == CBOR_TAG_KVR_DELTA) ? kvr::internal::column_delta_unpack (p, static_cast<size_t>(len), ctx) : 
+                                                 kvr::internal::column_xor_unpack (p, static_cast<size_t>(len), ctx);
+          }
+
+          KVR_ASSERT (false && "unsupported major type (6): semantic tagging");
+          return false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // typed array, read as a plain array. the packed bytes aren't copied on memory streams
+        bool parse_typed (istr *is, rctx &ctx, uint8_t tag)
+        {
+          const bool fp = (tag & 0x10) != 0;
+          const bool sgn = !fp && ((tag & 0x08) != 0);
+          const bool le = (tag & 0x04) != 0;
+          const size_t esz = fp ? (size_t (2) << (tag & 0x03)) : (size_t (1) << (tag & 0x03));
+
+          // float128 and the reserved sint8 'little-endian' tag (76)
+          if ((esz > 8) || (sgn && le && (esz == 1)))
+          {
+            return false;
+          }
+
+          uint64_t len = 0;
+          const uint8_t *p = parse_packed (is, &len);
+          if (!p || ((len % esz) != 0))
+          {
+            return false;
+          }
+
+#ifdef KVR_LITTLE_ENDIAN
+          const bool swap = !le;
+#else
+          const bool swap = le;
+#endif
+          const kvr::sz_t n = static_cast<kvr::sz_t>(len / esz);
+
+          bool ok = ctx.read_array_start (n);
+          for (kvr::sz_t i = 0; ok && (i < n); ++i, p += esz)
+          {
+            uint64_t u = typed_load (p, esz, swap);
+
+            if (fp)
+            {
+              double d = 0.0;
+              ok = typed_float (u, esz, &d) && ctx.read_float (d);
+            }
+            else if (sgn)
+            {
+              int64_t s = (esz == 1) ? int8_t (u) : (esz == 2) ? int16_t (u) : (esz == 4) ? int32_t (u) : int64_t (u);
+              ok = ctx.read_integer (s);
+            }
+            else
+            {
+              ok = (u <= (uint64_t) 0x7fffffffffffffffULL) && ctx.read_integer (static_cast<int64_t>(u));
+            }
+          }
+          return ok && ctx.read_array_end (n);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // the byte string after a packing tag, numbered inside a stringref namespace
+        const uint8_t *parse_packed (istr *is, uint64_t *len)
+        {
+          uint8_t curr = 0;
+          if (!is->get (&curr) || ((curr & 0xe0) != CBOR_MAJOR_TYPE_2) || !parse_arg (is, (curr & 0x1f), len) || (*len > 0xffffffffu))
+          {
+            return NULL;
+          }
+
+          const uint8_t *p = is->push (static_cast<size_t>(*len));
+
+          if (p && m_refs)
+          {
+            const char *copy = NULL;
+            m_refs->literal ((const char *) p, static_cast<size_t>(*len), &copy, true);
+          }
+
+          return p;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static uint64_t typed_load (const uint8_t *p, size_t esz, bool swap)
+        {
+          switch (esz)
+          {
+            case 1:   { return p [0]; }
+            case 2:   { uint16_t u = 0; memcpy (&u, p, 2); return swap ? kvr::internal::byteswap16 (u) : u; }
+            case 4:   { uint32_t u = 0; memcpy (&u, p, 4); return swap ? kvr::internal::byteswap32 (u) : u; }
+            default:  { uint64_t u = 0; memcpy (&u, p, 8); return swap ? kvr::internal::byteswap64 (u) : u; }
+          }
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static bool typed_float (uint64_t u, size_t esz, double *d)
+        {
+          if (esz == 2)
+          {
+            float f = 0.0f;
+            bool ok = kvr::internal::fp_half_to_single (static_cast<uint16_t>(u), &f);
+            *d = f;
+            return ok;
+          }
+
+          if (esz == 4)
+          {
+            float f = 0.0f;
+            uint32_t u32 = static_cast<uint32_t>(u);
+            memcpy (&f, &u32, sizeof (f));
+            *d = f;
+            return true;
+          }
+
+          memcpy (d, &u, sizeof (*d));
+          return true;
+        }
+
         ////////////////////////////////////////////////////////////
 
-        bool parse_key5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_key5 (istr *is, rctx &ctx, uint8_t data)
         {
           uint8_t slen = (data & 0x1f);
           //char str [32];
@@ -631,14 +1014,14 @@ namespace kvr
           if (is->read (str, slen))
           {
             str [slen] = 0;
-            return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+            return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
           }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key8 (istr *is, read_ctx &ctx)
+        bool parse_key8 (istr *is, rctx &ctx)
         {
           uint8_t slen = 0;
           if (is->get (&slen))
@@ -649,7 +1032,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -657,7 +1040,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key16 (istr *is, read_ctx &ctx)
+        bool parse_key16 (istr *is, rctx &ctx)
         {
           uint16_t len = 0;
           if (is->read ((uint8_t *) &len, 2))
@@ -669,7 +1052,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -677,7 +1060,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key32 (istr *is, read_ctx &ctx)
+        bool parse_key32 (istr *is, rctx &ctx)
         {
           uint32_t len = 0;
           if (is->read ((uint8_t *) &len, 4))
@@ -689,7 +1072,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -697,21 +1080,21 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_null (read_ctx &ctx)
+        bool parse_null (rctx &ctx)
         {
           return ctx.read_null ();
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_bool (read_ctx &ctx, bool val)
+        bool parse_bool (rctx &ctx, bool val)
         {
           return ctx.read_boolean (val);
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_float16 (istr *is, read_ctx &ctx)
+        bool parse_float16 (istr *is, rctx &ctx)
         {
           uint16_t fi = 0;
           if (is->read ((uint8_t *) &fi, 2))
@@ -728,7 +1111,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_float32 (istr *is, read_ctx &ctx)
+        bool parse_float32 (istr *is, rctx &ctx)
         {
           uint32_t u = 0;
           if (is->read ((uint8_t *) &u, 4))
@@ -750,7 +1133,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_float64 (istr *is, read_ctx &ctx)
+        bool parse_float64 (istr *is, rctx &ctx)
         {
           uint64_t u = 0;
           if (is->read ((uint8_t *) &u, 8))
@@ -773,23 +1156,21 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_array5 (istr *is, rctx &ctx, uint8_t data)
         {
-          uint8_t alen = (data & 0x0f);
+          uint8_t alen = (data & 0x1f);
           bool ok = ctx.read_array_start (alen);
           for (uint8_t i = 0; ok && (i < alen); ++i)
           {
             ok &= parse (is, ctx);
           }
-#if KVR_DEBUG
           ok = ok && ctx.read_array_end (alen);
-#endif
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array8 (istr *is, read_ctx &ctx)
+        bool parse_array8 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint8_t alen = 0;
@@ -800,16 +1181,14 @@ namespace kvr
             {
               ok &= parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_array_end (alen);
-#endif
+            ok = ok && ctx.read_array_end (alen);
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array16 (istr *is, read_ctx &ctx)
+        bool parse_array16 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint16_t len = 0;
@@ -821,16 +1200,14 @@ namespace kvr
             {
               ok &= parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_array_end (static_cast<kvr::sz_t>(alen));
-#endif
+            ok = ok && ctx.read_array_end (static_cast<kvr::sz_t>(alen));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array32 (istr *is, read_ctx &ctx)
+        bool parse_array32 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint32_t len = 0;
@@ -842,33 +1219,46 @@ namespace kvr
             {
               ok &= parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_array_end (static_cast<kvr::sz_t>(alen));
-#endif
+            ok = ok && ctx.read_array_end (static_cast<kvr::sz_t>(alen));
+          }
+          return ok;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_array_indef (istr *is, rctx &ctx)
+        {
+          // elements up to a break byte, length reported at the end
+          bool ok = ctx.read_array_start (0);
+          kvr::sz_t alen = 0;
+          while (ok && (is->peek () != CBOR_BREAK))
+          {
+            ok = parse (is, ctx);
+            ++alen;
           }
+          uint8_t brk = 0;
+          ok = ok && is->get (&brk);
+          ok = ok && ctx.read_array_end (alen);
           return ok;
         }
         
         ////////////////////////////////////////////////////////////
 
-        bool parse_map5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_map5 (istr *is, rctx &ctx, uint8_t data)
         {
-          uint8_t msz = (data & 0x0f);
+          uint8_t msz = (data & 0x1f);
           bool ok = ctx.read_map_start (msz);
           for (uint8_t i = 0; ok && (i < msz); ++i)
           {
-            ok &= parse_key (is, ctx);
-            ok &= parse (is, ctx);
+            ok = parse_key (is, ctx) && parse (is, ctx);
           }
-#if KVR_DEBUG
-          ok &= ctx.read_map_end (msz);
-#endif
+          ok = ok && ctx.read_map_end (msz);
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_map8 (istr *is, read_ctx &ctx)
+        bool parse_map8 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint8_t msz = 0;
@@ -877,19 +1267,16 @@ namespace kvr
             ok = ctx.read_map_start (msz);
             for (uint8_t i = 0; ok && (i < msz); ++i)
             {
-              ok &= parse_key (is, ctx);
-              ok &= parse (is, ctx);
+              ok = parse_key (is, ctx) && parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_map_end (msz);
-#endif
+            ok = ok && ctx.read_map_end (msz);
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_map16 (istr *is, read_ctx &ctx)
+        bool parse_map16 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint16_t len = 0;
@@ -899,19 +1286,16 @@ namespace kvr
             ok = ctx.read_map_start (static_cast<kvr::sz_t>(msz));
             for (uint16_t i = 0; ok && (i < msz); ++i)
             {
-              ok &= parse_key (is, ctx);
-              ok &= parse (is, ctx);
+              ok = parse_key (is, ctx) && parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_map_end (static_cast<kvr::sz_t>(msz));
-#endif
+            ok = ok && ctx.read_map_end (static_cast<kvr::sz_t>(msz));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_map32 (istr *is, read_ctx &ctx)
+        bool parse_map32 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint32_t len = 0;
@@ -921,102 +1305,91 @@ namespace kvr
             ok = ctx.read_map_start (static_cast<kvr::sz_t>(msz));
             for (uint32_t i = 0; ok && (i < msz); ++i)
             {
-              ok &= parse_key (is, ctx);
-              ok &= parse (is, ctx);
+              ok = parse_key (is, ctx) && parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_map_end (static_cast<kvr::sz_t>(msz));
-#endif
+            ok = ok && ctx.read_map_end (static_cast<kvr::sz_t>(msz));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_map_indef (istr *is, rctx &ctx)
         {
-          uint8_t slen = (data & 0x1f);
-          //char str [32];
-          m_ss.seek (0);
-          uint8_t *str = m_ss.push (slen + 1);
-          KVR_ASSERT (str);
-          if (is->read (str, slen))
+          // pairs up to a break byte, size reported at the end
+          bool ok = ctx.read_map_start (0);
+          kvr::sz_t msz = 0;
+          while (ok && (is->peek () != CBOR_BREAK))
           {
-            str [slen] = 0;
-            return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+            ok = parse_key (is, ctx) && parse (is, ctx);
+            ++msz;
           }
-          return false;      
+          uint8_t brk = 0;
+          ok = ok && is->get (&brk);
+          ok = ok && ctx.read_map_end (msz);
+          return ok;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_string5 (istr *is, rctx &ctx, uint8_t data)
+        {
+          uint8_t slen = (data & 0x1f);
+          const char *str = (const char *) is->push (slen);
+          return str ? on_string (ctx, str, slen) : false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string8 (istr *is, read_ctx &ctx)
+        bool parse_string8 (istr *is, rctx &ctx)
         {
-          uint8_t slen = 0;      
+          uint8_t slen = 0;
           if (is->get (&slen))
           {
-            m_ss.seek (0);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
-          }      
+            const char *str = (const char *) is->push (slen);
+            return str ? on_string (ctx, str, slen) : false;
+          }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string16 (istr *is, read_ctx &ctx)
+        bool parse_string16 (istr *is, rctx &ctx)
         {
           uint16_t len = 0;
           if (is->read ((uint8_t *) &len, 2))
           {
-            m_ss.seek (0);
             uint16_t slen = kvr_bigendian16 (len);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
+            const char *str = (const char *) is->push (slen);
+            return str ? on_string (ctx, str, slen) : false;
           }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string32 (istr *is, read_ctx &ctx)
+        bool parse_string32 (istr *is, rctx &ctx)
         {
           uint32_t len = 0;
           if (is->read ((uint8_t *) &len, 4))
           {
-            m_ss.seek (0);
             uint32_t slen = kvr_bigendian32 (len);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
+            const char *str = (const char *) is->push (slen);
+            return str ? on_string (ctx, str, static_cast<kvr::sz_t>(slen)) : false;
           }
           return false;
         }
     
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned5 (read_ctx &ctx, uint8_t data)
+        bool parse_unsigned5 (rctx &ctx, uint8_t data)
         {
           return ctx.read_integer (data);
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned8 (istr *is, read_ctx &ctx)
+        bool parse_unsigned8 (istr *is, rctx &ctx)
         {
           uint8_t i = 0;
           if (is->get (&i))
@@ -1028,7 +1401,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned16 (istr *is, read_ctx &ctx)
+        bool parse_unsigned16 (istr *is, rctx &ctx)
         {
           uint16_t u16 = 0;
           if (is->read ((uint8_t *) &u16, 2))
@@ -1041,7 +1414,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned32 (istr *is, read_ctx &ctx)
+        bool parse_unsigned32 (istr *is, rctx &ctx)
         {
           uint32_t u32 = 0;
           if (is->read ((uint8_t *) &u32, 4))
@@ -1054,7 +1427,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned64 (istr *is, read_ctx &ctx)
+        bool parse_unsigned64 (istr *is, rctx &ctx)
         {
           uint64_t u64 = 0;
           if (is->read ((uint8_t *) &u64, 8))
@@ -1075,7 +1448,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_negint5 (read_ctx &ctx, uint8_t data)
+        bool parse_negint5 (rctx &ctx, uint8_t data)
         {
           int64_t ni = -1 - (int64_t) data;
           return ctx.read_integer (ni);
@@ -1083,7 +1456,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_negint8 (istr *is, read_ctx &ctx)
+        bool parse_negint8 (istr *is, rctx &ctx)
         {
           uint8_t u8 = 0;
           if (is->get (&u8))
@@ -1096,7 +1469,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_negint16 (istr *is, read_ctx &ctx)
+        bool parse_negint16 (istr *is, rctx &ctx)
         {
           uint16_t u16 = 0;
           if (is->read ((uint8_t *) &u16, 2))
@@ -1110,7 +1483,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_negint32 (istr *is, read_ctx &ctx)
+        bool parse_negint32 (istr *is, rctx &ctx)
         {
           uint32_t u32 = 0;
           if (is->read ((uint8_t *) &u32, 4))
@@ -1124,7 +1497,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_negint64 (istr *is, read_ctx &ctx)
+        bool parse_negint64 (istr *is, rctx &ctx)
         {
           uint64_t u64 = 0;
           if (is->read ((uint8_t *) &u64, 8))
@@ -1138,61 +1511,18 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        kvr::mem_ostream m_ss;
+        uint8_t                         m_ssbuf [256];
+        kvr::mem_ostream                m_ss;
+        kvr::internal::strref_reader *  m_refs;
       };
 
-      template<>
-      bool reader<kvr::mem_istream>::parse_string5 (kvr::mem_istream *is, read_ctx &ctx, uint8_t data)
-      {
-        uint8_t slen = (data & 0x1f);
-        const char *str = (const char *) is->push (slen);
-        return str ? ctx.read_string (str, slen) : false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string8 (kvr::mem_istream *is, read_ctx &ctx)
-      {
-        uint8_t slen = 0;
-        if (is->get (&slen))
-        {
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_string (str, slen) : false;
-        }
-        return false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string16 (kvr::mem_istream *is, read_ctx &ctx)
-      {
-        uint16_t len = 0;
-        if (is->read ((uint8_t *) &len, 2))
-        {
-          uint16_t slen = kvr_bigendian16 (len);
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_string (str, slen) : false;
-        }
-        return false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string32 (kvr::mem_istream *is, read_ctx &ctx)
-      {    
-        uint32_t len = 0;
-        if (is->read ((uint8_t *) &len, 4))
-        {
-          uint32_t slen = kvr_bigendian32 (len);
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, static_cast<kvr::sz_t>(slen)) : false;
-        }
-        return false;
-      }
     #if KVR_CBOR_READ_KEY_SPECIALIZATION
       template<>
       bool reader<kvr::mem_istream>::parse_key5 (kvr::mem_istream *is, read_ctx &ctx, uint8_t data)
       {
         uint8_t slen = (data & 0x1f);
         const char *str = (const char *) is->push (slen);
-        return str ? ctx.read_key (str, slen) : false;
+        return str ? on_key (ctx, str, slen) : false;
       }
 
       template<>
@@ -1202,7 +1532,7 @@ namespace kvr
         if (is->get (&slen))
         {
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -1215,7 +1545,7 @@ namespace kvr
         {
           uint16_t slen = kvr_bigendian16 (len);
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -1228,7 +1558,7 @@ namespace kvr
         {
           uint32_t slen = kvr_bigendian32 (len);
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -1327,6 +1657,62 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        bool write_array_indef ()
+        {
+          m_os->put (CBOR_MAJOR_TYPE_4 | CBOR_VALUE_TYPE_INDEF);
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_map_indef ()
+        {
+          m_os->put (CBOR_MAJOR_TYPE_5 | CBOR_VALUE_TYPE_INDEF);
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_break ()
+        {
+          m_os->put (CBOR_BREAK);
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_tag (uint64_t tag)
+        {
+          KVR_ASSERT (tag <= 0xffff);
+
+          if (tag < CBOR_VALUE_TYPE_UINT8)
+          {
+            m_os->put (CBOR_MAJOR_TYPE_6 | (uint8_t) tag);
+          }
+          else if (tag <= 0xff)
+          {
+            m_os->put (CBOR_MAJOR_TYPE_6 | CBOR_VALUE_TYPE_UINT8);
+            m_os->put ((uint8_t) tag);
+          }
+          else
+          {
+            uint16_t t = kvr_bigendian16 (tag);
+            m_os->put (CBOR_MAJOR_TYPE_6 | CBOR_VALUE_TYPE_UINT16);
+            m_os->write ((uint8_t *) &t, 2);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_string_ref (uint32_t index)
+        {
+          return this->write_tag (CBOR_TAG_STRINGREF) && this->write_integer (index);
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool write_string (const char *str, kvr::sz_t slen)
         {
           if (slen < CBOR_VALUE_TYPE_UINT8)
@@ -1364,6 +1750,67 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        bool write_binary (const uint8_t *data, kvr::sz_t size)
+        {
+          if (!this->write_bytes_head (size))
+          {
+            return false;
+          }
+
+          if (size > 0)
+          {
+            m_os->write (const_cast<uint8_t *> (data), (size_t) size);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // byte string header, the bytes are written after it
+        bool write_bytes_head (uint64_t size)
+        {
+          if (size < CBOR_VALUE_TYPE_UINT8)
+          {
+            uint8_t len = (uint8_t) size;
+            m_os->put (CBOR_MAJOR_TYPE_2 | len);
+          }
+          else if (size <= 0xff)
+          {
+            uint8_t len = (uint8_t) size;
+            m_os->put (CBOR_MAJOR_TYPE_2 | CBOR_VALUE_TYPE_UINT8);
+            m_os->put (len);
+          }
+          else if (size <= 0xffff)
+          {
+            uint16_t len = kvr_bigendian16 (size);
+            m_os->put (CBOR_MAJOR_TYPE_2 | CBOR_VALUE_TYPE_UINT16);
+            m_os->write ((uint8_t *) &len, 2);
+          }
+          else if (size <= 0xffffffff)
+          {
+            uint32_t len = kvr_bigendian32 (size);
+            m_os->put (CBOR_MAJOR_TYPE_2 | CBOR_VALUE_TYPE_UINT32);
+            m_os->write ((uint8_t *) &len, 4);
+          }
+          else
+          {
+            return false;
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_raw (const uint8_t *data, size_t size)
+        {
+          m_os->write (const_cast<uint8_t *> (data), size);
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool write_integer (int64_t i64)
         {
           if (i64 >= 0) // unsigned
@@ -1508,6 +1955,8 @@ namespace kvr
       template<typename ostr>
       struct writer
       {
+        writer () : m_refs (NULL), m_typed (false), m_cols (NULL) {}
+
         bool print (const kvr::value *val, write_ctx<ostr> &ctx)
         {
           KVR_ASSERT (val);
@@ -1523,7 +1972,7 @@ namespace kvr
             while (ok && c.get (&p))
             {
               kvr::key *k = p.get_key ();
-              ok &= ctx.write_string (k->get_string (), k->get_length ());
+              ok &= print_key (k, ctx);
 
               kvr::value *v = p.get_value ();          
               ok &= print (v, ctx);
@@ -1533,14 +1982,27 @@ namespace kvr
 
           else if (val->is_array ())
           {
-            kvr::sz_t alen = val->length ();
-            bool ok = ctx.write_array (alen);
-            for (kvr::sz_t i = 0; (i < alen) && ok; ++i)
+            kvr::internal::column_t col = m_cols ? kvr::internal::column_type (val) : kvr::internal::COLUMN_NONE;
+            uint8_t tag = (m_typed && (col == kvr::internal::COLUMN_NONE)) ? typed_tag (val) : 0;
+            if (col != kvr::internal::COLUMN_NONE)
             {
-              kvr::value *v = val->element (i);
-              ok &= print (v, ctx);
+              success = print_column (val, col, ctx);
+            }
+            else if (tag != 0)
+            {
+              success = print_typed (val, tag, ctx);
+            }
+            else
+            {
+              kvr::sz_t alen = val->length ();
+              bool ok = ctx.write_array (alen);
+              for (kvr::sz_t i = 0; (i < alen) && ok; ++i)
+              {
+                kvr::value *v = val->element (i);
+                ok &= print (v, ctx);
+              }
+              success = ok;
             }
-            success = ok;
           }
 
           else if (val->is_string ())
@@ -1548,6 +2010,21 @@ namespace kvr
             kvr::sz_t slen = 0;
             const char *str = val->get_string (&slen);
             success = ctx.write_string (str, slen);
+            if (m_refs)
+            {
+              m_refs->literal (NULL, slen);
+            }
+          }
+
+          else if (val->is_binary ())
+          {
+            kvr::sz_t size = 0;
+            const uint8_t *data = val->get_binary (&size);
+            success = ctx.write_binary (data, size);
+            if (m_refs)
+            {
+              m_refs->literal (NULL, size);
+            }
           }
 
           else if (val->is_integer ())
@@ -1575,6 +2052,384 @@ namespace kvr
 
           return success;
         }
+
+        ////////////////////////////////////////////////////////////
+
+        // inside a stringref namespace, keys numbered earlier are written by reference
+        bool print_key (const kvr::key *k, write_ctx<ostr> &ctx)
+        {
+          uint32_t index = 0;
+
+          if (m_refs && m_refs->find (k, &index))
+          {
+            return ctx.write_string_ref (index);
+          }
+
+          if (m_refs)
+          {
+            m_refs->literal (k, k->get_length ());
+          }
+
+          return ctx.write_string (k->get_string (), k->get_length ());
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // typed array tag for an array of only integers or only floats, in the smallest
+        // little-endian element type that holds every value. 0 if it doesn't qualify
+        static uint8_t typed_tag (const kvr::value *arr)
+        {
+          kvr::sz_t alen = arr->length ();
+          if (alen < CBOR_TYPED_ARRAY_MIN_LENGTH)
+          {
+            return 0;
+          }
+
+          const kvr::value *first = arr->element (0);
+
+          if (first->is_integer ())
+          {
+            int64_t lo = first->get_integer (), hi = lo;
+            for (kvr::sz_t i = 1; i < alen; ++i)
+            {
+              const kvr::value *v = arr->element (i);
+              if (!v->is_integer ())
+              {
+                return 0;
+              }
+              int64_t n = v->get_integer ();
+              lo = (n < lo) ? n : lo;
+              hi = (n > hi) ? n : hi;
+            }
+
+            if (lo >= 0)
+            {
+              return (hi <= 0xff) ? CBOR_TAG_TYPED_UINT8 : (hi <= 0xffff) ? CBOR_TAG_TYPED_UINT16LE : 
+                     (hi <= 0xffffffffLL) ? CBOR_TAG_TYPED_UINT32LE : CBOR_TAG_TYPED_UINT64LE;
+            }
+
+            return ((lo >= -128) && (hi <= 127)) ? CBOR_TAG_TYPED_SINT8 : ((lo >= -32768) && (hi <= 32767)) ? CBOR_TAG_TYPED_SINT16LE : 
+                   ((lo >= -2147483648LL) && (hi <= 2147483647LL)) ? CBOR_TAG_TYPED_SINT32LE : CBOR_TAG_TYPED_SINT64LE;
+          }
+
+          if (first->is_float ())
+          {
+            bool single = true;
+            for (kvr::sz_t i = 0; i < alen; ++i)
+            {
+              const kvr::value *v = arr->element (i);
+              if (!v->is_float ())
+              {
+                return 0;
+              }
+              double d = v->get_float ();
+              single = single && (double (float (d)) == d);
+            }
+
+            return single ? CBOR_TAG_TYPED_FLOAT32LE : CBOR_TAG_TYPED_FLOAT64LE;
+          }
+
+          return 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // elements are packed into a stack buffer and written a block at a time
+        bool print_typed (const kvr::value *arr, uint8_t tag, write_ctx<ostr> &ctx)
+        {
+          const bool fp = (tag & 0x10) != 0;
+          const size_t esz = fp ? (size_t (2) << (tag & 0x03)) : (size_t (1) << (tag & 0x03));
+          const kvr::sz_t alen = arr->length ();
+          const uint64_t size = uint64_t (alen) * esz;
+
+          if (!ctx.write_tag (tag) || !ctx.write_bytes_head (size))
+          {
+            return false;
+          }
+
+          uint8_t buf [512];
+          size_t n = 0;
+
+          for (kvr::sz_t i = 0; i < alen; ++i)
+          {
+            const kvr::value *v = arr->element (i);
+            uint64_t u = 0;
+
+            if (fp && (esz == 4))
+            {
+              float f = static_cast<float>(v->get_float ());
+              uint32_t u32 = 0;
+              memcpy (&u32, &f, sizeof (f));
+              u = u32;
+            }
+            else if (fp)
+            {
+              double d = v->get_float ();
+              memcpy (&u, &d, sizeof (d));
+            }
+            else
+            {
+              u = static_cast<uint64_t>(v->get_integer ());
+            }
+
+            for (size_t b = 0; b < esz; ++b)
+            {
+              buf [n++] = static_cast<uint8_t>(u >> (b * 8));
+            }
+
+            if (n == sizeof (buf))
+            {
+              ctx.write_raw (buf, n);
+              n = 0;
+            }
+          }
+
+          if (n > 0)
+          {
+            ctx.write_raw (buf, n);
+          }
+
+          if (m_refs)
+          {
+            m_refs->literal (NULL, static_cast<size_t>(size));
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // numeric column, packed in scratch space first for the byte string length
+        bool print_column (const kvr::value *arr, kvr::internal::column_t col, write_ctx<ostr> &ctx)
+        {
+          m_cols->seek (0);
+
+          if (col == kvr::internal::COLUMN_DELTA)
+          {
+            kvr::internal::column_delta_pack (arr, m_cols);
+          }
+          else
+          {
+            kvr::internal::column_xor_pack (arr, m_cols);
+          }
+
+          const size_t size = m_cols->tell ();
+
+          if (!ctx.write_tag ((col == kvr::internal::COLUMN_DELTA) ? CBOR_TAG_KVR_DELTA : CBOR_TAG_KVR_XOR) || !ctx.write_bytes_head (size))
+          {
+            return false;
+          }
+
+          ctx.write_raw (m_cols->buffer (), size);
+
+          if (m_refs)
+          {
+            m_refs->literal (NULL, size);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        kvr::internal::strref_writer *m_refs;
+        bool                          m_typed;
+        kvr::mem_ostream *            m_cols;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // writes handler events straight out (transcoding). for sources that only know container 
+      // sizes at the end, either 'sizes' has them in start order (from a pre-pass) or, with
+      // 'indef', containers are written indefinite-length so the source is read once
+      template<typename ostr>
+      struct emitter : public kvr::handler
+      {
+        emitter (ostr *os, const kvr::sz_t *sizes = NULL, bool indef = false) : m_ctx (os), m_sizes (sizes), m_next (0), m_indef (indef) {}
+
+        bool on_null () { return m_ctx.write_null (); }
+        bool on_boolean (bool b) { return m_ctx.write_boolean (b); }
+        bool on_integer (int64_t i) { return m_ctx.write_integer (i); }
+        bool on_float (double f) { return m_ctx.write_float (f); }
+        bool on_string (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool on_binary (const uint8_t *data, kvr::sz_t size) { return m_ctx.write_binary (data, size); }
+        bool on_key (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool on_map_start (kvr::sz_t size) { return m_indef ? m_ctx.write_map_indef () : m_ctx.write_map (m_sizes ? m_sizes [m_next++] : size); }
+        bool on_map_end (kvr::sz_t) { return !m_indef || m_ctx.write_break (); }
+        bool on_array_start (kvr::sz_t length) { return m_indef ? m_ctx.write_array_indef () : m_ctx.write_array (m_sizes ? m_sizes [m_next++] : length); }
+        bool on_array_end (kvr::sz_t) { return !m_indef || m_ctx.write_break (); }
+
+        write_ctx<ostr>   m_ctx;
+        const kvr::sz_t * m_sizes;
+        size_t            m_next;
+        bool              m_indef;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // kvr::stream_writer backend. unknown sizes use indefinite-length containers.
+      class stream_encoder : public kvr::internal::stream_encoder
+      {
+      public:
+
+        stream_encoder (kvr::ostream *os) : m_os (os), m_ctx (&m_os) {}
+
+        bool begin_map (kvr::sz_t size, bool known) { return known ? m_ctx.write_map (size) : m_ctx.write_map_indef (); }
+        bool end_map (bool known) { return known || m_ctx.write_break (); }
+        bool begin_array (kvr::sz_t length, bool known) { return known ? m_ctx.write_array (length) : m_ctx.write_array_indef (); }
+        bool end_array (bool known) { return known || m_ctx.write_break (); }
+        bool key (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool null () { return m_ctx.write_null (); }
+        bool boolean (bool b) { return m_ctx.write_boolean (b); }
+        bool integer (int64_t i) { return m_ctx.write_integer (i); }
+        bool floating (double f) { return m_ctx.write_float (f); }
+        bool string (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool binary (const uint8_t *data, kvr::sz_t size) { return m_ctx.write_binary (data, size); }
+        bool value (const kvr::value *val) { return m_wrt.print (val, m_ctx); }
+        bool raw (const uint8_t *data, size_t size) { m_os.write (const_cast<uint8_t *> (data), size); return true; }
+        void finish () { m_os.flush (); }
+
+      private:
+
+        kvr::internal::block_ostream              m_os;
+        write_ctx<kvr::internal::block_ostream>   m_ctx;
+        writer<kvr::internal::block_ostream>      m_wrt;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // single token sizing and decoding for kvr::internal::push_reader
+      template<typename rctx>
+      struct push_tokens
+      {
+        ////////////////////////////////////////////////////////////
+
+        // bytes needed for the token at 'p': the header size until the header is 
+        // complete ('avail'), then the whole token. 0 if unsupported.
+        static size_t need (const uint8_t *p, size_t avail)
+        {
+          KVR_ASSERT (avail > 0);
+
+          const uint8_t major_type = (p [0] & 0xe0);
+          const uint8_t value_type = (p [0] & 0x1f);
+
+          size_t hsz = 0;
+          if (value_type < CBOR_VALUE_TYPE_UINT8)         { hsz = 1; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT8)   { hsz = 2; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT16)  { hsz = 3; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT32)  { hsz = 5; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT64)  { hsz = 9; }
+          else if (value_type == CBOR_VALUE_TYPE_INDEF)   { hsz = 1; }
+
+          switch (major_type)
+          {
+            case CBOR_MAJOR_TYPE_0:
+            case CBOR_MAJOR_TYPE_1:
+            {
+              return (value_type == CBOR_VALUE_TYPE_INDEF) ? 0 : hsz;
+            }
+
+            case CBOR_MAJOR_TYPE_2:
+            case CBOR_MAJOR_TYPE_3:
+            {
+              if ((hsz == 0) || (value_type == CBOR_VALUE_TYPE_INDEF) || (value_type == CBOR_VALUE_TYPE_UINT64)) { return 0; }
+              return (avail < hsz) ? hsz : (hsz + size_t (load (p)));
+            }
+
+            case CBOR_MAJOR_TYPE_4:
+            case CBOR_MAJOR_TYPE_5:
+            {
+              return (value_type == CBOR_VALUE_TYPE_UINT64) ? 0 : hsz;
+            }
+
+            case CBOR_MAJOR_TYPE_6:
+            {
+              // a packed array (numeric column, typed array) is one token: the tag and its
+              // byte string. other tags (stringrefs) need reader state and stay unsupported
+              if ((hsz == 0) || (value_type == CBOR_VALUE_TYPE_INDEF) || (value_type == CBOR_VALUE_TYPE_UINT64)) { return 0; }
+              if (avail < hsz) { return hsz; }
+
+              const uint64_t tag = load (p);
+              const bool packed = (tag == CBOR_TAG_KVR_DELTA) || (tag == CBOR_TAG_KVR_XOR) || ((tag >= CBOR_TAG_TYPED_FIRST) && (tag <= CBOR_TAG_TYPED_LAST));
+              if (!packed) { return 0; }
+              if (avail < (hsz + 1)) { return hsz + 1; }
+              if ((p [hsz] & 0xe0) != CBOR_MAJOR_TYPE_2) { return 0; }
+
+              size_t n = need (&p [hsz], avail - hsz);
+              return (n > 0) ? (hsz + n) : 0;
+            }
+
+            case CBOR_MAJOR_TYPE_7:
+            {
+              bool simple = (value_type == CBOR_VALUE_TYPE_FALSE) || (value_type == CBOR_VALUE_TYPE_TRUE) || (value_type == CBOR_VALUE_TYPE_NULL);
+              bool fp = (value_type == CBOR_VALUE_TYPE_FLOAT16) || (value_type == CBOR_VALUE_TYPE_FLOAT32) || (value_type == CBOR_VALUE_TYPE_FLOAT64);
+              return (simple || fp || (value_type == CBOR_VALUE_TYPE_INDEF)) ? hsz : 0;
+            }
+
+            default:
+            {
+              break;
+            }
+          }
+
+          return 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static push_token_t type (const uint8_t *p, kvr::sz_t *count)
+        {
+          const uint8_t major_type = (p [0] & 0xe0);
+          const uint8_t value_type = (p [0] & 0x1f);
+          const bool indef = (value_type == CBOR_VALUE_TYPE_INDEF);
+
+          switch (major_type)
+          {
+            case CBOR_MAJOR_TYPE_4: { if (indef) { return PUSH_TOKEN_ARRAY_INDEF; } *count = static_cast<kvr::sz_t>(load (p)); return PUSH_TOKEN_ARRAY; }
+            case CBOR_MAJOR_TYPE_5: { if (indef) { return PUSH_TOKEN_MAP_INDEF; } *count = static_cast<kvr::sz_t>(load (p)); return PUSH_TOKEN_MAP; }
+            case CBOR_MAJOR_TYPE_7: { if (indef) { return PUSH_TOKEN_BREAK; } break; }
+            default: { break; }
+          }
+
+          return PUSH_TOKEN_SCALAR;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool scalar (const uint8_t *p, size_t n, rctx &ctx)
+        {
+          kvr::mem_istream is (p, n);
+          return m_reader.parse (&is, ctx);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool key (const uint8_t *p, size_t n, rctx &ctx)
+        {
+          kvr::mem_istream is (p, n);
+          return m_reader.parse_key (&is, ctx);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // header argument (value, length or count) up to 32 bits
+        static uint32_t load (const uint8_t *p)
+        {
+          const uint8_t value_type = (p [0] & 0x1f);
+          if (value_type < CBOR_VALUE_TYPE_UINT8)         { return value_type; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT8)   { return p [1]; }
+          else if (value_type == CBOR_VALUE_TYPE_UINT16)  { uint16_t u = 0; memcpy (&u, &p [1], 2); return kvr_bigendian16 (u); }
+          else if (value_type == CBOR_VALUE_TYPE_UINT32)  { uint32_t u = 0; memcpy (&u, &p [1], 4); return kvr_bigendian32 (u); }
+          return 0;
+        }
+
+        reader<kvr::mem_istream, rctx> m_reader;
       };
 
       /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1585,9 +2440,10 @@ namespace kvr
       {
         KVR_ASSERT (dest);
 
-        reader<kvr::istream> reader;
+        kvr::internal::block_istream bistr (&istr);
+        reader<kvr::internal::block_istream> reader;
         read_ctx ctx (dest);
-        return reader.parse (&istr, ctx);
+        return reader.parse (&bistr, ctx);
       }
 
       ////////////////////////////////////////////////////////////
@@ -1597,12 +2453,13 @@ namespace kvr
         KVR_ASSERT (src);
         KVR_ASSERT (ostr);
     
-        write_ctx<kvr::ostream> ctx (ostr);
-        writer<kvr::ostream> wrt;
+        kvr::internal::block_ostream bostr (ostr);
+        write_ctx<kvr::internal::block_ostream> ctx (&bostr);
+        writer<kvr::internal::block_ostream> wrt;
         
         if (wrt.print (src, ctx))
         {
-          ostr->flush ();
+          bostr.flush ();
           return true;
         }
 
@@ -1622,6 +2479,52 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
+      // documents [offsets [i], offsets [i + 1]) of 'data', read with one reader
+      bool read_batch (kvr::value **dests, const uint8_t *data, const size_t *offsets, size_t count)
+      {
+        KVR_ASSERT (dests || (count == 0));
+        KVR_ASSERT (offsets);
+
+        reader<kvr::mem_istream> reader;
+        read_ctx ctx (NULL);
+        bool success = true;
+
+        for (size_t i = 0; (i < count) && success; ++i)
+        {
+          kvr::mem_istream istr (data + offsets [i], offsets [i + 1] - offsets [i]);
+          dests [i]->conv_null ();
+          ctx.reset (dests [i]);
+          success = reader.parse (&istr, ctx);
+        }
+
+        return success;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        kvr::internal::block_istream bistr (&istr);
+        reader<kvr::internal::block_istream, kvr::internal::handler_ctx> reader;
+        kvr::internal::handler_ctx ctx (h);
+        return reader.parse (&bistr, ctx);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::mem_istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        reader<kvr::mem_istream, kvr::internal::handler_ctx> reader;
+        kvr::internal::handler_ctx ctx (h);
+        return reader.parse (&istr, ctx);
+      }
+
+      ////////////////////////////////////////////////////////////
+
       bool write (const kvr::value *src, kvr::mem_ostream *ostr)
       {
         KVR_ASSERT (src);
@@ -1641,181 +2544,83 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
-      size_t write_approx_size (const kvr::value *val)
+      // kvr::encode_flag_t encodings. key table: the document is a stringref namespace and
+      // repeated keys are references. typed arrays: number arrays are packed (writer::typed_tag).
+      // numeric columns: monotonic integer and float arrays are compressed (writer::print_column)
+      bool write (const kvr::value *src, kvr::mem_ostream *ostr, uint32_t flags)
       {
-        size_t size = 0;
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
 
-        if (val->is_map ())
-        {
-          kvr::sz_t msz = val->size ();
+        write_ctx<kvr::mem_ostream> ctx (ostr);
+        writer<kvr::mem_ostream> wrt;
+        kvr::internal::strref_writer refs (0);
+        kvr::mem_ostream cols (256u);
+        wrt.m_refs = (flags & kvr::ENCODE_KEY_TABLE) ? &refs : NULL;
+        wrt.m_typed = (flags & kvr::ENCODE_TYPED_ARRAYS) != 0;
+        wrt.m_cols = (flags & kvr::ENCODE_NUMERIC_COLUMNS) ? &cols : NULL;
 
-          if (msz < CBOR_VALUE_TYPE_UINT8)
-          {
-            size += 1;
-          }
-          else if (msz < 0xff)
-          {
-            size += 2;
-          }
-          else if (msz <= 0xffff)
-          {
-            size += 3;
-          }
-          else
-          {
-            size += 5;
-          }
+        bool ok = !wrt.m_refs || ctx.write_tag (CBOR_TAG_STRINGREF_NAMESPACE);
 
-          kvr::value::cursor c (val);
-          kvr::pair p;
-          while (c.get (&p))
-          {
-            kvr::key *k = p.get_key ();
-            kvr::value *v = p.get_value ();
-            kvr::sz_t klen = k->get_length ();
+        if (ok && wrt.print (src, ctx))
+        {
+          ostr->flush ();
+          return true;
+        }
 
-            if (klen < CBOR_VALUE_TYPE_UINT8)
-            {
-              size += 1;
-            }
-            else if (klen < 0xff)
-            {
-              size += 2;
-            }
-            else if (klen <= 0xffff)
-            {
-              size += 3;
-            }
-            else
-            {
-              size += 5;
-            }
+        return false;
+      }
 
-            size += klen;
-            size += write_approx_size (v);
-          }
-        }
+      ////////////////////////////////////////////////////////////
 
-        else if (val->is_array ())
-        {
-          kvr::sz_t alen = val->length ();
+      bool write (const kvr::value *src, kvr::ostream *ostr, uint32_t flags)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
 
-          if (alen < CBOR_VALUE_TYPE_UINT8)
-          {
-            size += 1;
-          }
-          else if (alen < 0xff)
-          {
-            size += 2;
-          }
-          else if (alen <= 0xffff)
-          {
-            size += 3;
-          }
-          else
-          {
-            size += 5;
-          }
+        kvr::internal::block_ostream bostr (ostr);
+        write_ctx<kvr::internal::block_ostream> ctx (&bostr);
+        writer<kvr::internal::block_ostream> wrt;
+        kvr::internal::strref_writer refs (0);
+        kvr::mem_ostream cols (256u);
+        wrt.m_refs = (flags & kvr::ENCODE_KEY_TABLE) ? &refs : NULL;
+        wrt.m_typed = (flags & kvr::ENCODE_TYPED_ARRAYS) != 0;
+        wrt.m_cols = (flags & kvr::ENCODE_NUMERIC_COLUMNS) ? &cols : NULL;
 
-          for (kvr::sz_t i = 0, c = val->length (); i < c; ++i)
-          {
-            kvr::value *v = val->element (i);
-            size += write_approx_size (v);
-          }
-        }
+        bool ok = !wrt.m_refs || ctx.write_tag (CBOR_TAG_STRINGREF_NAMESPACE);
 
-        else if (val->is_string ())
+        if (ok && wrt.print (src, ctx))
         {
-          kvr::sz_t slen = 0;
-          const char *str = val->get_string (&slen);
-          KVR_REF_UNUSED (str);
-
-          if (slen < CBOR_VALUE_TYPE_UINT8)
-          {
-            size += 1;
-          }
-          else if (slen < 0xff)
-          {
-            size += 2;
-          }
-          else if (slen <= 0xffff)
-          {
-            size += 3;
-          }
-          else
-          {
-            size += 5;
-          }
-          
-          size += slen;
+          bostr.flush ();
+          return true;
         }
 
-        else if (val->is_integer ())
-        {
-          int64_t n = val->get_integer ();
-          int64_t n64 = (n >= 0) ? n : (-1 - n);
+        return false;
+      }
 
-          if (n64 < CBOR_VALUE_TYPE_UINT8)
-          {
-            size += 1;
-          }
-          else if (n64 < 0xff)
-          {
-            size += 2;
-          }
-          else if (n64 <= 0xffff)
-          {
-            size += 3;
-          }
-          else if (n64 <= 0xffffffff)
-          {
-            size += 5;
-          }
-          else
-          {
-            size += 9;
-          }
-        }
+      ////////////////////////////////////////////////////////////
 
-        else if (val->is_float ())
-        {
-#if KVR_FLAG_ENCODE_COMPACT_FP_PRECISION || KVR_CBOR_WRITE_COMPACT_FP_OVERRIDE
-          double f = val->get_float ();
-          uint16_t hf = 0;
-          if (kvr::internal::fp_single_to_half (static_cast<float>(f), &hf))
-          {
-            size += 3;
-          }
-          else
-          {
-            const double fmin = std::numeric_limits<float>::min ();
-            const double fmax = std::numeric_limits<float>::max ();
+      bool write (const kvr::value *src, kvr::chunk_ostream *ostr)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
 
-            if ((f >= fmin) && (f <= fmax))
-            {
-              size += 5;
-            }
-            else
-            {
-              size += 9;
-            }
-          }
-#else
-          size += 9;
-#endif
-        }
+        write_ctx<kvr::chunk_ostream> ctx (ostr);
+        writer<kvr::chunk_ostream> wrt;
+        return wrt.print (src, ctx);
+      }
 
-        else if (val->is_boolean ())
-        {
-          size += 1;
-        }
+      ////////////////////////////////////////////////////////////
 
-        else if (val->is_null ())
-        {
-          size += 1;
-        }
+      size_t write_size (const kvr::value *val)
+      {
+        KVR_ASSERT (val);
+
+        kvr::internal::size_ostream sostr;
+        write_ctx<kvr::internal::size_ostream> ctx (&sostr);
+        writer<kvr::internal::size_ostream> wrt;
 
-        return size;
+        return wrt.print (val, ctx) ? sostr.size () : 0u;
       }
     }
   }
@@ -248,6 +248,75 @@ namespace kvr
       return hash;
     }
 
+    uint32_t djb_hash (const uint8_t *data, size_t size, uint32_t seed = 5381)
+    {
+      KVR_ASSERT (data || (size == 0));
+
+      uint32_t hash = seed;
+      for (size_t i = 0; i < size; ++i)
+      {
+        hash = ((hash << 5) + hash) ^ data [i];
+      }
+      return hash;
+    }
+
+    inline uint32_t adler32 (const uint8_t *data, size_t size)
+    {
+      KVR_ASSERT (data || (size == 0));
+
+      uint32_t a = 1, b = 0;
+      while (size > 0)
+      {
+        size_t n = (size < 5552u) ? size : 5552u;
+        size -= n;
+        while (n--)
+        {
+          a += *data++;
+          b += a;
+        }
+        a %= 65521u;
+        b %= 65521u;
+      }
+      return (b << 16) | a;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // base64 (rfc 4648, padded). binary values are written to json as base64 strings
+    inline size_t base64_size (size_t size)
+    {
+      return ((size + 2) / 3) * 4;
+    }
+
+    // 'dest' must hold base64_size (size) chars. not null-terminated
+    inline void base64_encode (const uint8_t *data, size_t size, char *dest)
+    {
+      KVR_ASSERT ((data && dest) || (size == 0));
+
+      static const char table [] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      size_t i = 0;
+      for (; (i + 3) <= size; i += 3)
+      {
+        uint32_t n = ((uint32_t) data [i] << 16) | ((uint32_t) data [i + 1] << 8) | (uint32_t) data [i + 2];
+        *dest++ = table [(n >> 18) & 0x3f];
+        *dest++ = table [(n >> 12) & 0x3f];
+        *dest++ = table [(n >> 6) & 0x3f];
+        *dest++ = table [n & 0x3f];
+      }
+
+      if (i < size)
+      {
+        uint32_t n = ((uint32_t) data [i] << 16) | (((i + 1) < size) ? ((uint32_t) data [i + 1] << 8) : 0);
+        *dest++ = table [(n >> 18) & 0x3f];
+        *dest++ = table [(n >> 12) & 0x3f];
+        *dest++ = ((i + 1) < size) ? table [(n >> 6) & 0x3f] : '=';
+        *dest++ = '=';
+      }
+    }
+
     //////////////////////////////////////////////////////////////////////////
     //////////////////////////////////////////////////////////////////////////
     //////////////////////////////////////////////////////////////////////////
@@ -416,9 +485,2101 @@ namespace kvr
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace kvr
+{
+  namespace internal
+  {
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // read-ahead buffer over a custom input stream. 
+    // mirrors the mem_istream interface so codec readers can use the same 
+    // zero-copy paths (push/peek) within a block. tokens straddling a block 
+    // boundary are moved to the front of the buffer before the next fetch.
+    class block_istream
+    {
+    public:
+
+      block_istream (kvr::istream *is, size_t blocksz = KVR_CONSTANT_ISTREAM_BLOCK_SZ) 
+        : m_is (is), m_buf (NULL), m_cap (blocksz), m_sz (0), m_pos (0), m_base (0), m_store (blocksz)
+      {
+        KVR_ASSERT (m_is);
+        m_buf = m_store.push (m_cap); KVR_ASSERT (m_buf);
+        m_base = m_is->tell ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      size_t tell ()
+      {
+        return m_base + m_pos;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      uint8_t peek ()
+      {
+        if ((m_pos < m_sz) || this->fill (1))
+        {
+          return m_buf [m_pos];
+        }
+        return 0u;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool get (uint8_t *byte)
+      {
+        if ((m_pos < m_sz) || this->fill (1))
+        {
+          *byte = m_buf [m_pos++];
+          return true;
+        }
+        return false;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool read (uint8_t *bytes, size_t count)
+      {
+        size_t avail = m_sz - m_pos;
+        if (count > avail)
+        {
+          memcpy (bytes, &m_buf [m_pos], avail);
+          m_pos += avail;
+          bytes += avail;
+          count -= avail;
+
+          if (count >= m_cap)
+          {
+            // large runs bypass the buffer
+            m_base += m_pos + count;
+            m_pos = 0;
+            m_sz = 0;
+            return m_is->read (bytes, count);
+          }
+
+          if (!this->fill (count))
+          {
+            return false;
+          }
+        }
+
+        memcpy (bytes, &m_buf [m_pos], count);
+        m_pos += count;
+        return true;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      const uint8_t * push (size_t count)
+      {
+        if (((m_pos + count) <= m_sz) || this->fill (count))
+        {
+          const uint8_t *start = &m_buf [m_pos];
+          m_pos += count;
+          return start;
+        }
+        return NULL;
+      }
+
+    private:
+
+      block_istream (const block_istream &);
+      block_istream &operator=(const block_istream &);
+
+      ////////////////////////////////////////////////////////////
+
+      bool fill (size_t count)
+      {
+        // carry over unread bytes
+        size_t rem = m_sz - m_pos;
+        if (rem && m_pos) { memmove (m_buf, &m_buf [m_pos], rem); }
+        m_base += m_pos;
+        m_pos = 0;
+        m_sz = rem;
+
+        if (count > m_cap)
+        {
+          size_t cap = m_cap;
+          do { cap += m_cap; } while (cap < count);
+          m_store.reserve (cap);
+          m_store.seek (0);
+          m_buf = m_store.push (cap); KVR_ASSERT (m_buf);
+          m_cap = cap;
+        }
+
+        while (m_sz < count)
+        {
+          size_t n = m_is->fetch (&m_buf [m_sz], m_cap - m_sz);
+          if (n == 0) { break; }
+          m_sz += n;
+        }
+
+        return (m_sz >= count);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::istream    * m_is;
+      uint8_t         * m_buf;
+      size_t            m_cap;
+      size_t            m_sz;
+      size_t            m_pos;
+      size_t            m_base;
+      kvr::mem_ostream  m_store;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // write-combining buffer over a custom output stream.
+    // bytes are gathered into a fixed block which is handed to ostream::write 
+    // when full, so the sink sees a few large writes instead of one call per byte.
+    class block_ostream
+    {
+    public:
+
+      block_ostream (kvr::ostream *os, size_t blocksz = KVR_CONSTANT_OSTREAM_BLOCK_SZ)
+        : m_os (os), m_buf (NULL), m_cap (blocksz), m_pos (0), m_store (blocksz)
+      {
+        KVR_ASSERT (m_os);
+        KVR_ASSERT (m_cap > 0);
+        m_buf = m_store.push (m_cap); KVR_ASSERT (m_buf);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void put (uint8_t byte)
+      {
+        if (m_pos >= m_cap)
+        {
+          this->drain ();
+        }
+        m_buf [m_pos++] = byte;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void write (uint8_t *bytes, size_t count)
+      {
+        if ((m_pos + count) > m_cap)
+        {
+          this->drain ();
+
+          if (count >= m_cap)
+          {
+            // large runs bypass the buffer
+            m_os->write (bytes, count);
+            return;
+          }
+        }
+
+        memcpy (&m_buf [m_pos], bytes, count);
+        m_pos += count;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void flush ()
+      {
+        this->drain ();
+        m_os->flush ();
+      }
+
+    private:
+
+      block_ostream (const block_ostream &);
+      block_ostream &operator=(const block_ostream &);
+
+      ////////////////////////////////////////////////////////////
+
+      void drain ()
+      {
+        if (m_pos > 0)
+        {
+          m_os->write (m_buf, m_pos);
+          m_pos = 0;
+        }
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::ostream    * m_os;
+      uint8_t         * m_buf;
+      size_t            m_cap;
+      size_t            m_pos;
+      kvr::mem_ostream  m_store;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // lets backends that take a kvr::ostream (e.g. stream_encoder) write to a mem_ostream
+    class mem_ostream_ref : public kvr::ostream
+    {
+    public:
+
+      mem_ostream_ref (kvr::mem_ostream *ms) : m_ms (ms) { KVR_ASSERT (ms); }
+
+      void put (uint8_t byte) { m_ms->put (byte); }
+      void write (uint8_t *bytes, size_t count) { m_ms->write (bytes, count); }
+      // null-terminate past the end (for json)
+      void flush () { m_ms->put (0); m_ms->pop (1); }
+
+    private:
+
+      kvr::mem_ostream *m_ms;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // forwards codec reader events to a public kvr::handler
+    struct handler_ctx
+    {
+      handler_ctx (kvr::handler *h) : m_handler (h) { KVR_ASSERT (h); }
+
+      bool read_null () { return m_handler->on_null (); }
+      bool read_boolean (bool b) { return m_handler->on_boolean (b); }
+      bool read_integer (int64_t i) { return m_handler->on_integer (i); }
+      bool read_float (double d) { return m_handler->on_float (d); }
+      bool read_string (const char *str, kvr::sz_t length) { return m_handler->on_string (str, length); }
+      bool read_binary (const uint8_t *data, kvr::sz_t size) { return m_handler->on_binary (data, size); }
+      bool read_key (const char *str, kvr::sz_t length) { return m_handler->on_key (str, length); }
+      bool read_map_start (kvr::sz_t size) { return m_handler->on_map_start (size); }
+      bool read_map_end (kvr::sz_t size) { return m_handler->on_map_end (size); }
+      bool read_array_start (kvr::sz_t length) { return m_handler->on_array_start (length); }
+      bool read_array_end (kvr::sz_t length) { return m_handler->on_array_end (length); }
+
+      kvr::handler *m_handler;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // string references for key-table encodings (kvr::ENCODE_KEY_TABLE). string
+    // literals are numbered in the order they are written; 'min' is the shortest
+    // literal that gets a number. 0 follows cbor stringref, where the bar rises
+    // with the table so a reference is never longer than the string it replaces.
+    inline bool strref_numbered (size_t len, size_t count, size_t min)
+    {
+      if (min > 0)
+      {
+        return len >= min;
+      }
+      return len >= ((count < 24u) ? 3u : (count < 256u) ? 4u : (count < 65536u) ? 5u : (count <= 0xffffffffu) ? 7u : 11u);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // encoder side. keys are interned, so they are looked up by handle
+    class strref_writer
+    {
+    public:
+
+      explicit strref_writer (size_t min) : m_min (min), m_count (0), m_cap (0), m_keys (256u), m_slots (256u) {}
+
+      // reference index of a key that was numbered when first written
+      bool find (const kvr::key *k, uint32_t *index) const
+      {
+        KVR_ASSERT (k && index);
+
+        if (m_cap == 0)
+        {
+          return false;
+        }
+
+        const uint32_t *slots = (const uint32_t *) m_slots.buffer ();
+        const entry *keys = (const entry *) m_keys.buffer ();
+
+        for (size_t i = hash (k) & (m_cap - 1); slots [i] != 0; i = (i + 1) & (m_cap - 1))
+        {
+          const entry &e = keys [slots [i] - 1];
+          if (e.k == k)
+          {
+            *index = e.index;
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      // a string literal was written ('k' is NULL for non-key strings)
+      void literal (const kvr::key *k, size_t len)
+      {
+        if (!strref_numbered (len, m_count, m_min))
+        {
+          return;
+        }
+
+        if (k)
+        {
+          entry e;
+          e.k = k;
+          e.index = static_cast<uint32_t>(m_count);
+          m_keys.write ((uint8_t *) &e, sizeof (e));
+
+          size_t n = m_keys.tell () / sizeof (entry);
+          if ((n * 2) > m_cap)
+          {
+            this->rehash (n * 2);
+          }
+          else
+          {
+            this->insert (n - 1);
+          }
+        }
+
+        ++m_count;
+      }
+
+    private:
+
+      struct entry
+      {
+        const kvr::key *  k;
+        uint32_t          index;
+      };
+
+      static size_t hash (const kvr::key *k)
+      {
+        return static_cast<size_t>((reinterpret_cast<size_t>(k) >> 3) * 2654435761u);
+      }
+
+      void insert (size_t n)
+      {
+        uint32_t *slots = (uint32_t *) m_slots.buffer ();
+        const entry *keys = (const entry *) m_keys.buffer ();
+
+        size_t i = hash (keys [n].k) & (m_cap - 1);
+        while (slots [i] != 0)
+        {
+          i = (i + 1) & (m_cap - 1);
+        }
+        slots [i] = static_cast<uint32_t>(n + 1);
+      }
+
+      void rehash (size_t min)
+      {
+        for (m_cap = 16; m_cap < min; m_cap <<= 1) {}
+
+        m_slots.seek (0);
+        memset (m_slots.push (m_cap * sizeof (uint32_t)), 0, m_cap * sizeof (uint32_t));
+
+        for (size_t n = 0, c = m_keys.tell () / sizeof (entry); n < c; ++n)
+        {
+          this->insert (n);
+        }
+      }
+
+      size_t            m_min;
+      size_t            m_count;
+      size_t            m_cap;
+      kvr::mem_ostream  m_keys;
+      kvr::mem_ostream  m_slots;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // decoder side. numbered strings are copied (the input may be a stream) and
+    // each entry keeps the key handle of its first insert, so repeats of a key
+    // are inserted without hashing or interning the string again.
+    class strref_reader
+    {
+    public:
+
+      explicit strref_reader (size_t min) : m_min (min), m_entries (256u), m_strs (1024u) {}
+
+      // numbers a literal if it qualifies. returns its key handle slot
+      // (NULL if not numbered) and the null-terminated copy. 'bin' marks
+      // byte strings, which can't be referenced as keys or text strings
+      kvr::key ** literal (const char *str, size_t len, const char **copy, bool bin = false)
+      {
+        KVR_ASSERT (str && copy);
+
+        if (!strref_numbered (len, this->count (), m_min))
+        {
+          return NULL;
+        }
+
+        entry e;
+        e.off = m_strs.tell ();
+        e.len = static_cast<kvr::sz_t>(len);
+        e.k = NULL;
+        e.bin = bin;
+
+        m_strs.write ((uint8_t *) str, len);
+        m_strs.put (0);
+        m_entries.write ((uint8_t *) &e, sizeof (e));
+
+        *copy = (const char *) m_strs.buffer () + e.off;
+        return &(this->at (this->count () - 1)->k);
+      }
+
+      bool get (uint64_t index, const char **str, kvr::sz_t *len, kvr::key ***handle, bool *bin = NULL)
+      {
+        KVR_ASSERT (str && len && handle);
+
+        if (index >= this->count ())
+        {
+          return false;
+        }
+
+        entry *e = this->at (static_cast<size_t>(index));
+        *str = (const char *) m_strs.buffer () + e->off;
+        *len = e->len;
+        *handle = &e->k;
+        if (bin) { *bin = e->bin; }
+        return true;
+      }
+
+    private:
+
+      struct entry
+      {
+        size_t      off;
+        kvr::sz_t   len;
+        kvr::key *  k;
+        bool        bin;
+      };
+
+      size_t count () const
+      {
+        return m_entries.tell () / sizeof (entry);
+      }
+
+      entry * at (size_t index)
+      {
+        return const_cast<entry *>((const entry *) m_entries.buffer ()) + index;
+      }
+
+      size_t            m_min;
+      kvr::mem_ostream  m_entries;
+      kvr::mem_ostream  m_strs;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // numeric column compression (kvr::ENCODE_NUMERIC_COLUMNS). a payload is the 
+    // element count (varint) followed by
+    //   delta: zigzag varints of the first integer, then of each difference to the one before
+    //   xor:   the first double (8 bytes, little-endian), then a gorilla bit stream (msb first)
+    //          of each double xor'd with the one before: '0' same value, '10' meaningful bits
+    //          in the previous window, '11' 5 bits leading zeros, 6 bits length - 1, the bits.
+    // the kernels work on blocks of COLUMN_BLOCK values with the tree walk, the transform
+    // and the (un)packing in separate loops, so the transforms are plain array passes.
+    enum column_t
+    {
+      COLUMN_NONE,
+      COLUMN_DELTA,
+      COLUMN_XOR,
+    };
+
+    static const kvr::sz_t COLUMN_MIN_LENGTH = 8;
+    static const size_t    COLUMN_BLOCK      = 256;
+
+    // monotonic integer arrays are delta coded, float arrays xor coded
+    inline column_t column_type (const kvr::value *arr)
+    {
+      KVR_ASSERT (arr && arr->is_array ());
+
+      kvr::sz_t alen = arr->length ();
+      if (alen < COLUMN_MIN_LENGTH)
+      {
+        return COLUMN_NONE;
+      }
+
+      const kvr::value *first = arr->element (0);
+
+      if (first->is_integer ())
+      {
+        bool up = true, down = true;
+        int64_t prev = first->get_integer ();
+        for (kvr::sz_t i = 1; (i < alen) && (up || down); ++i)
+        {
+          const kvr::value *v = arr->element (i);
+          if (!v->is_integer ())
+          {
+            return COLUMN_NONE;
+          }
+          int64_t n = v->get_integer ();
+          up = up && (n >= prev);
+          down = down && (n <= prev);
+          prev = n;
+        }
+        return (up || down) ? COLUMN_DELTA : COLUMN_NONE;
+      }
+
+      if (first->is_float ())
+      {
+        for (kvr::sz_t i = 1; i < alen; ++i)
+        {
+          if (!arr->element (i)->is_float ())
+          {
+            return COLUMN_NONE;
+          }
+        }
+        return COLUMN_XOR;
+      }
+
+      return COLUMN_NONE;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    inline size_t varint_put (uint8_t *p, uint64_t u)
+    {
+      size_t n = 0;
+      while (u >= 0x80)
+      {
+        p [n++] = static_cast<uint8_t>(u | 0x80);
+        u >>= 7;
+      }
+      p [n++] = static_cast<uint8_t>(u);
+      return n;
+    }
+
+    inline bool varint_get (const uint8_t **p, const uint8_t *end, uint64_t *u)
+    {
+      uint64_t v = 0;
+      for (unsigned shift = 0; (*p < end) && (shift < 64); shift += 7)
+      {
+        uint8_t b = *(*p)++;
+        v |= uint64_t (b & 0x7f) << shift;
+        if (b < 0x80)
+        {
+          *u = v;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    inline unsigned clz64 (uint64_t x)
+    {
+      KVR_ASSERT (x != 0);
+      unsigned n = 0;
+      if ((x >> 32) == 0) { n += 32; x <<= 32; }
+      if ((x >> 48) == 0) { n += 16; x <<= 16; }
+      if ((x >> 56) == 0) { n += 8; x <<= 8; }
+      if ((x >> 60) == 0) { n += 4; x <<= 4; }
+      if ((x >> 62) == 0) { n += 2; x <<= 2; }
+      if ((x >> 63) == 0) { n += 1; }
+      return n;
+    }
+
+    inline unsigned ctz64 (uint64_t x)
+    {
+      KVR_ASSERT (x != 0);
+      unsigned n = 0;
+      if ((x & 0xffffffffULL) == 0) { n += 32; x >>= 32; }
+      if ((x & 0xffffULL) == 0) { n += 16; x >>= 16; }
+      if ((x & 0xffULL) == 0) { n += 8; x >>= 8; }
+      if ((x & 0xfULL) == 0) { n += 4; x >>= 4; }
+      if ((x & 0x3ULL) == 0) { n += 2; x >>= 2; }
+      if ((x & 0x1ULL) == 0) { n += 1; }
+      return n;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    // msb-first bit stream, written 8 bytes at a time
+    class bit_writer
+    {
+    public:
+
+      explicit bit_writer (kvr::mem_ostream *os) : m_os (os), m_acc (0), m_bits (0) {}
+
+      // 1 to 64 bits of 'v'
+      void put (uint64_t v, unsigned n)
+      {
+        KVR_ASSERT ((n > 0) && (n <= 64));
+
+        if (n < 64)
+        {
+          v &= (uint64_t (1) << n) - 1;
+        }
+
+        if ((m_bits + n) < 64)
+        {
+          m_acc = (m_acc << n) | v;
+          m_bits += n;
+        }
+        else
+        {
+          unsigned rest = m_bits + n - 64;
+          uint64_t word = (m_bits == 0) ? v : ((m_acc << (64 - m_bits)) | (v >> rest));
+          this->emit (word, 8);
+          m_acc = (rest > 0) ? (v & ((uint64_t (1) << rest) - 1)) : 0;
+          m_bits = rest;
+        }
+      }
+
+      void flush ()
+      {
+        if (m_bits > 0)
+        {
+          this->emit (m_acc << (64 - m_bits), (m_bits + 7) / 8);
+          m_acc = 0;
+          m_bits = 0;
+        }
+      }
+
+    private:
+
+      void emit (uint64_t word, unsigned bytes)
+      {
+        uint8_t *p = m_os->push (bytes);
+        for (unsigned i = 0; i < bytes; ++i)
+        {
+          p [i] = static_cast<uint8_t>(word >> (56 - (i * 8)));
+        }
+      }
+
+      kvr::mem_ostream *  m_os;
+      uint64_t            m_acc;
+      unsigned            m_bits;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+
+    class bit_reader
+    {
+    public:
+
+      bit_reader (const uint8_t *p, const uint8_t *end) : m_p (p), m_end (end), m_acc (0), m_bits (0) {}
+
+      // 1 to 64 bits
+      bool get (unsigned n, uint64_t *v)
+      {
+        KVR_ASSERT ((n > 0) && (n <= 64));
+
+        uint64_t r = 0;
+        while (n > 0)
+        {
+          if (m_bits == 0)
+          {
+            if (m_p == m_end)
+            {
+              return false;
+            }
+            m_acc = *m_p++;
+            m_bits = 8;
+          }
+
+          unsigned take = (n < m_bits) ? n : m_bits;
+          r = (r << take) | ((m_acc >> (m_bits - take)) & ((1u << take) - 1));
+          m_bits -= take;
+          n -= take;
+        }
+
+        *v = r;
+        return true;
+      }
+
+      size_t left () const
+      {
+        return (size_t (m_end - m_p) * 8) + m_bits;
+      }
+
+    private:
+
+      const uint8_t * m_p;
+      const uint8_t * m_end;
+      unsigned        m_acc;
+      unsigned        m_bits;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+
+    inline void column_delta_pack (const kvr::value *arr, kvr::mem_ostream *os)
+    {
+      KVR_ASSERT (arr && os);
+
+      const kvr::sz_t n = arr->length ();
+      uint8_t head [10];
+      os->write (head, varint_put (head, n));
+
+      uint64_t in [COLUMN_BLOCK], zz [COLUMN_BLOCK];
+      uint8_t out [COLUMN_BLOCK * 10];
+      uint64_t prev = 0;
+
+      for (kvr::sz_t i = 0; i < n; i += COLUMN_BLOCK)
+      {
+        const size_t m = ((n - i) < COLUMN_BLOCK) ? size_t (n - i) : COLUMN_BLOCK;
+
+        for (size_t k = 0; k < m; ++k)
+        {
+          in [k] = static_cast<uint64_t>(arr->element (i + k)->get_integer ());
+        }
+
+        // differences (mod 2^64), zigzagged
+        zz [0] = in [0] - prev;
+        for (size_t k = 1; k < m; ++k)
+        {
+          zz [k] = in [k] - in [k - 1];
+        }
+        for (size_t k = 0; k < m; ++k)
+        {
+          zz [k] = (zz [k] << 1) ^ (uint64_t (0) - (zz [k] >> 63));
+        }
+        prev = in [m - 1];
+
+        size_t bytes = 0;
+        for (size_t k = 0; k < m; ++k)
+        {
+          bytes += varint_put (out + bytes, zz [k]);
+        }
+        os->write (out, bytes);
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    template<typename rctx>
+    bool column_delta_unpack (const uint8_t *p, size_t size, rctx &ctx)
+    {
+      const uint8_t *end = p + size;
+
+      // every value takes a byte at least
+      uint64_t n = 0;
+      if (!varint_get (&p, end, &n) || (n > uint64_t (end - p)))
+      {
+        return false;
+      }
+
+      const kvr::sz_t count = static_cast<kvr::sz_t>(n);
+      bool ok = ctx.read_array_start (count);
+
+      uint64_t buf [COLUMN_BLOCK];
+      uint64_t prev = 0;
+
+      for (uint64_t i = 0; ok && (i < n); i += COLUMN_BLOCK)
+      {
+        const size_t m = ((n - i) < COLUMN_BLOCK) ? size_t (n - i) : COLUMN_BLOCK;
+
+        for (size_t k = 0; ok && (k < m); ++k)
+        {
+          ok = varint_get (&p, end, &buf [k]);
+        }
+
+        // unzigzag, then a running sum
+        for (size_t k = 0; k < m; ++k)
+        {
+          buf [k] = (buf [k] >> 1) ^ (uint64_t (0) - (buf [k] & 1));
+        }
+        for (size_t k = 0; k < m; ++k)
+        {
+          prev += buf [k];
+          buf [k] = prev;
+        }
+
+        for (size_t k = 0; ok && (k < m); ++k)
+        {
+          ok = ctx.read_integer (static_cast<int64_t>(buf [k]));
+        }
+      }
+
+      return ok && (p == end) && ctx.read_array_end (count);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    inline void column_xor_pack (const kvr::value *arr, kvr::mem_ostream *os)
+    {
+      KVR_ASSERT (arr && os);
+
+      const kvr::sz_t n = arr->length ();
+      uint8_t head [10];
+      os->write (head, varint_put (head, n));
+
+      if (n == 0)
+      {
+        return;
+      }
+
+      uint64_t in [COLUMN_BLOCK], x [COLUMN_BLOCK];
+      uint64_t prev = 0;
+      unsigned plz = 0, ptz = 0;
+      bool window = false;
+
+      bit_writer bits (os);
+
+      for (kvr::sz_t i = 0; i < n; i += COLUMN_BLOCK)
+      {
+        const size_t m = ((n - i) < COLUMN_BLOCK) ? size_t (n - i) : COLUMN_BLOCK;
+
+        for (size_t k = 0; k < m; ++k)
+        {
+          double d = arr->element (i + k)->get_float ();
+          memcpy (&in [k], &d, sizeof (d));
+        }
+
+        x [0] = in [0] ^ prev;
+        for (size_t k = 1; k < m; ++k)
+        {
+          x [k] = in [k] ^ in [k - 1];
+        }
+        prev = in [m - 1];
+
+        size_t k = 0;
+        if (i == 0)
+        {
+          uint8_t *p = os->push (8);
+          for (unsigned b = 0; b < 8; ++b)
+          {
+            p [b] = static_cast<uint8_t>(in [0] >> (b * 8));
+          }
+          k = 1;
+        }
+
+        for (; k < m; ++k)
+        {
+          if (x [k] == 0)
+          {
+            bits.put (0, 1);
+            continue;
+          }
+
+          unsigned lz = clz64 (x [k]);
+          unsigned tz = ctz64 (x [k]);
+          lz = (lz > 31) ? 31 : lz;
+
+          if (window && (lz >= plz) && (tz >= ptz))
+          {
+            bits.put (2, 2);
+            bits.put (x [k] >> ptz, 64 - plz - ptz);
+          }
+          else
+          {
+            unsigned len = 64 - lz - tz;
+            bits.put (3, 2);
+            bits.put (lz, 5);
+            bits.put (len - 1, 6);
+            bits.put (x [k] >> tz, len);
+            plz = lz;
+            ptz = tz;
+            window = true;
+          }
+        }
+      }
+
+      bits.flush ();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    template<typename rctx>
+    bool column_xor_unpack (const uint8_t *p, size_t size, rctx &ctx)
+    {
+      const uint8_t *end = p + size;
+
+      uint64_t n = 0;
+      if (!varint_get (&p, end, &n))
+      {
+        return false;
+      }
+
+      // the first value takes 8 bytes, the others a bit at least
+      if ((n > 0) && ((size_t (end - p) < 8) || ((n - 1) > (uint64_t (end - p - 8) * 8))))
+      {
+        return false;
+      }
+
+      const kvr::sz_t count = static_cast<kvr::sz_t>(n);
+      bool ok = ctx.read_array_start (count);
+
+      uint64_t buf [COLUMN_BLOCK];
+      uint64_t prev = 0;
+      unsigned plz = 0, ptz = 0;
+      bool window = false;
+
+      bit_reader bits (p + ((n > 0) ? 8 : 0), end);
+
+      for (uint64_t i = 0; ok && (i < n); i += COLUMN_BLOCK)
+      {
+        const size_t m = ((n - i) < COLUMN_BLOCK) ? size_t (n - i) : COLUMN_BLOCK;
+
+        size_t k = 0;
+        if (i == 0)
+        {
+          buf [0] = 0;
+          for (unsigned b = 0; b < 8; ++b)
+          {
+            buf [0] |= uint64_t (p [b]) << (b * 8);
+          }
+          k = 1;
+        }
+
+        for (; ok && (k < m); ++k)
+        {
+          uint64_t ctl = 0, v = 0;
+          ok = bits.get (1, &ctl);
+          if (!ok || (ctl == 0))
+          {
+            buf [k] = 0;
+            continue;
+          }
+
+          ok = bits.get (1, &ctl);
+          if (ok && (ctl == 0))
+          {
+            ok = window && bits.get (64 - plz - ptz, &v);
+            if (ok)
+            {
+              buf [k] = v << ptz;
+            }
+          }
+          else if (ok)
+          {
+            uint64_t lz = 0, len = 0;
+            ok = bits.get (5, &lz) && bits.get (6, &len) && ((lz + len + 1) <= 64) && bits.get (unsigned (len + 1), &v);
+            // a bad window is never kept (its trailing zero count would wrap)
+            if (ok)
+            {
+              plz = unsigned (lz);
+              ptz = unsigned (64 - lz - len - 1);
+              window = true;
+              buf [k] = v << ptz;
+            }
+          }
+        }
+
+        // buf [k..m) is unset after a bad value
+        if (!ok)
+        {
+          break;
+        }
+
+        // running xor
+        buf [0] ^= prev;
+        for (size_t j = 1; j < m; ++j)
+        {
+          buf [j] ^= buf [j - 1];
+        }
+        prev = buf [m - 1];
+
+        for (size_t j = 0; ok && (j < m); ++j)
+        {
+          double d = 0.0;
+          memcpy (&d, &buf [j], sizeof (d));
+          ok = ctx.read_float (d);
+        }
+      }
+
+      // only padding may be left
+      return ok && (bits.left () < 8) && ctx.read_array_end (count);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // records container sizes in the order the containers start. used as a
+    // pre-pass over sources that only report sizes at the end (json).
+    class size_recorder : public kvr::handler
+    {
+    public:
+
+      size_recorder () : m_sizes (256u), m_stack (256u) {}
+
+      bool on_map_start (kvr::sz_t) { return this->start (); }
+      bool on_map_end (kvr::sz_t size) { return this->end (size); }
+      bool on_array_start (kvr::sz_t) { return this->start (); }
+      bool on_array_end (kvr::sz_t length) { return this->end (length); }
+
+      const kvr::sz_t * sizes () const { return (const kvr::sz_t *) m_sizes.buffer (); }
+
+    private:
+
+      bool start ()
+      {
+        size_t idx = m_sizes.tell () / sizeof (kvr::sz_t);
+        *((kvr::sz_t *) m_sizes.push (sizeof (kvr::sz_t))) = 0;
+        *((size_t *) m_stack.push (sizeof (size_t))) = idx;
+        return true;
+      }
+
+      bool end (kvr::sz_t size)
+      {
+        size_t *idx = (size_t *) m_stack.pop (sizeof (size_t));
+        KVR_ASSERT_SAFE (idx, false);
+        ((kvr::sz_t *) m_sizes.buffer ()) [*idx] = size;
+        return true;
+      }
+
+      kvr::mem_ostream m_sizes;
+      kvr::mem_ostream m_stack;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // decodes over an existing tree (value::decode_update). values are matched by key 
+    // or index and overwritten in place; storage is only allocated for new values and 
+    // freed for values the new document no longer has.
+    class update_handler : public kvr::handler
+    {
+    public:
+
+      update_handler (kvr::value *root) : m_root (root), m_pending (NULL), m_seen (256u), m_key (64u), m_depth (0)
+      {
+        KVR_ASSERT (root);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_null ()
+      {
+        kvr::value *v = this->slot ();
+        return v && v->conv_null ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_boolean (bool b)
+      {
+        kvr::value *v = this->slot ();
+        if (v) { v->conv_boolean ()->set_boolean (b); }
+        return (v != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_integer (int64_t i)
+      {
+        kvr::value *v = this->slot ();
+        if (v) { v->conv_integer ()->set_integer (i); }
+        return (v != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_float (double f)
+      {
+        kvr::value *v = this->slot ();
+        if (v) { v->conv_float ()->set_float (f); }
+        return (v != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_string (const char *str, kvr::sz_t length)
+      {
+        kvr::value *v = this->slot ();
+        if (v)
+        {
+          // dynamic strings can't be set empty
+          if (length == 0) { v->conv_null (); }
+          v->conv_string ()->set_string (str, length);
+        }
+        return (v != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_binary (const uint8_t *data, kvr::sz_t size)
+      {
+        kvr::value *v = this->slot ();
+        if (v) { v->conv_binary ()->set_binary (data, size); }
+        return (v != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_key (const char *str, kvr::sz_t length)
+      {
+        KVR_ASSERT_SAFE ((m_depth > 0) && m_stack [m_depth - 1].node->is_map () && !m_pending, false);
+
+        frame &f = m_stack [m_depth - 1];
+
+        // may not be null-terminated
+        m_key.seek (0);
+        m_key.write ((uint8_t *) str, length);
+        m_key.put (0);
+        const char *k = (const char *) m_key.buffer ();
+
+        kvr::value *v = f.node->find (k);
+        m_pending = v ? v : f.node->insert_null (k);
+        m_seen.write ((uint8_t *) &m_pending, sizeof (m_pending));
+        ++f.count;
+
+        return (m_pending != NULL);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_map_start (kvr::sz_t size)
+      {
+        kvr::value *v = this->slot ();
+        KVR_ASSERT_SAFE (v && (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH), false);
+
+        const kvr::sz_t prior = v->is_map () ? v->size () : 0;
+
+        (size > 0) ? v->conv_map (size) : v->conv_map ();
+        return this->push (v, prior);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_map_end (kvr::sz_t)
+      {
+        KVR_ASSERT_SAFE ((m_depth > 0) && !m_pending, false);
+
+        const frame &f = m_stack [--m_depth];
+
+        // comparing sizes is not enough: a repeated key is counted twice but matches
+        // one entry, so a stale entry can hide behind it
+        if (f.prior > 0)
+        {
+          this->remove_unseen (f);
+        }
+
+        m_seen.seek (f.seen);
+        return true;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_array_start (kvr::sz_t length)
+      {
+        kvr::value *v = this->slot ();
+        KVR_ASSERT_SAFE (v && (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH), false);
+
+        (length > 0) ? v->conv_array (length) : v->conv_array ();
+        return this->push (v, 0);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool on_array_end (kvr::sz_t)
+      {
+        KVR_ASSERT_SAFE (m_depth > 0, false);
+
+        const frame &f = m_stack [--m_depth];
+
+        while (f.node->length () > f.count)
+        {
+          f.node->pop ();
+        }
+
+        return true;
+      }
+
+    private:
+
+      struct frame
+      {
+        kvr::value *  node;
+        kvr::sz_t     count;  // keys or elements so far
+        kvr::sz_t     prior;  // map entries before the update
+        size_t        seen;   // start of this map's entries in m_seen
+      };
+
+      ////////////////////////////////////////////////////////////
+
+      // the value the next event overwrites
+      kvr::value * slot ()
+      {
+        if (m_depth == 0)
+        {
+          return m_root;
+        }
+
+        frame &f = m_stack [m_depth - 1];
+
+        if (f.node->is_map ())
+        {
+          kvr::value *v = m_pending;
+          m_pending = NULL;
+          return v;
+        }
+
+        kvr::sz_t i = f.count++;
+        return (i < f.node->length ()) ? f.node->element (i) : f.node->push_null ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool push (kvr::value *node, kvr::sz_t prior)
+      {
+        frame &f = m_stack [m_depth++];
+        f.node = node;
+        f.count = 0;
+        f.prior = prior;
+        f.seen = m_seen.tell ();
+        return true;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // removes the keys of a map that were not in the document. the values 
+      // that were go in a small open-addressed set first.
+      void remove_unseen (const frame &f)
+      {
+        const size_t count = (m_seen.tell () - f.seen) / sizeof (kvr::value *);
+        size_t cap = 16;
+        while (cap < (count * 2)) { cap <<= 1; }
+
+        const size_t setpos = m_seen.tell ();
+        m_seen.push (cap * sizeof (kvr::value *));
+        memset ((uint8_t *) m_seen.buffer () + setpos, 0, cap * sizeof (kvr::value *));
+
+        kvr::value **set = (kvr::value **) (m_seen.buffer () + setpos);
+        kvr::value * const *seen = (kvr::value * const *) (m_seen.buffer () + f.seen);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+          size_t h = slot_hash (seen [i], cap);
+          while (set [h] && (set [h] != seen [i])) { h = (h + 1) & (cap - 1); }
+          set [h] = seen [i];
+        }
+
+        // collect first, removing invalidates the cursor
+        uint8_t stalebuf [128];
+        kvr::mem_ostream stale (stalebuf, sizeof (stalebuf));
+        kvr::value::cursor c (f.node);
+        kvr::pair p;
+        while (c.get (&p))
+        {
+          kvr::value *v = p.get_value ();
+          size_t h = slot_hash (v, cap);
+          while (set [h] && (set [h] != v)) { h = (h + 1) & (cap - 1); }
+          if (!set [h])
+          {
+            const char *k = p.get_key ()->get_string ();
+            stale.write ((uint8_t *) &k, sizeof (k));
+          }
+        }
+
+        const char * const *keys = (const char * const *) stale.buffer ();
+        for (size_t i = 0, n = stale.tell () / sizeof (const char *); i < n; ++i)
+        {
+          f.node->remove (keys [i]);
+        }
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      static size_t slot_hash (const kvr::value *v, size_t cap)
+      {
+        size_t h = (size_t) v;
+        h ^= (h >> 4) ^ (h >> 12);
+        return h & (cap - 1);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::value *      m_root;
+      kvr::value *      m_pending;
+      kvr::mem_ostream  m_seen;
+      kvr::mem_ostream  m_key;
+      frame             m_stack [KVR_CONSTANT_MAX_TREE_DEPTH];
+      size_t            m_depth;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // codec side of kvr::stream_writer. calls arrive in a valid sequence.
+    class stream_encoder
+    {
+    public:
+
+      virtual ~stream_encoder () {}
+
+      // 'known' is false for kvr::stream_writer::UNKNOWN_SIZE
+      virtual bool begin_map (kvr::sz_t size, bool known) = 0;
+      virtual bool end_map (bool known) = 0;
+      virtual bool begin_array (kvr::sz_t length, bool known) = 0;
+      virtual bool end_array (bool known) = 0;
+      virtual bool key (const char *str, kvr::sz_t length) = 0;
+      virtual bool null () = 0;
+      virtual bool boolean (bool b) = 0;
+      virtual bool integer (int64_t i) = 0;
+      virtual bool floating (double f) = 0;
+      virtual bool string (const char *str, kvr::sz_t length) = 0;
+      virtual bool binary (const uint8_t *data, kvr::sz_t size) = 0;
+      virtual bool value (const kvr::value *val) = 0;
+      // already encoded items, written as is (see value::encode_parallel)
+      virtual bool raw (const uint8_t *data, size_t size) = 0;
+      virtual void finish () = 0;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // codec side of kvr::push_decoder
+    class push_parser
+    {
+    public:
+
+      virtual ~push_parser () {}
+
+      virtual kvr::push_decoder::status_t feed (const uint8_t *data, size_t size, size_t *used) = 0;
+      virtual void reset () = 0;
+      virtual void retarget (kvr::value *dest) = 0;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    enum push_token_t
+    {
+      PUSH_TOKEN_SCALAR,
+      PUSH_TOKEN_MAP,
+      PUSH_TOKEN_ARRAY,
+      PUSH_TOKEN_MAP_INDEF,
+      PUSH_TOKEN_ARRAY_INDEF,
+      PUSH_TOKEN_BREAK,
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // resumable decoder for the binary codecs. input is cut into whole tokens
+    // (a scalar, or a container header) using 'tokens' (see msgpack::push_tokens);
+    // only a token split across feeds is copied. containers are tracked on an 
+    // explicit stack so parsing can stop and resume at any byte.
+    template<typename tokens, typename rctx>
+    class push_reader : public push_parser
+    {
+    public:
+
+      push_reader (kvr::value *dest) : m_dest (dest), m_ctx (dest), m_pending (64u), m_depth (0), m_status (kvr::push_decoder::STATUS_NEED_MORE)
+      {
+        KVR_ASSERT (dest);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void retarget (kvr::value *dest)
+      {
+        KVR_ASSERT (dest);
+        m_dest = dest;
+        this->reset ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void reset ()
+      {
+        m_dest->conv_null ();
+        m_ctx = rctx (m_dest);
+        m_pending.seek (0);
+        m_depth = 0;
+        m_status = kvr::push_decoder::STATUS_NEED_MORE;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::push_decoder::status_t feed (const uint8_t *data, size_t size, size_t *used)
+      {
+        size_t pos = 0;
+
+        while ((m_status == kvr::push_decoder::STATUS_NEED_MORE) && ((pos < size) || (m_pending.tell () > 0)))
+        {
+          const uint8_t *tok = NULL;
+          size_t toksz = 0;
+
+          if (m_pending.tell () > 0)
+          {
+            // finish the token split across feeds
+            size_t have = m_pending.tell ();
+            size_t need = tokens::need (m_pending.buffer (), have);
+            while ((need > have) && (pos < size))
+            {
+              size_t take = kvr::internal::min (need - have, size - pos);
+              m_pending.write (const_cast<uint8_t *>(&data [pos]), take);
+              pos += take;
+              have += take;
+              need = tokens::need (m_pending.buffer (), have);
+            }
+
+            if (need == 0) { m_status = kvr::push_decoder::STATUS_ERROR; break; }
+            if (need > have) { break; }
+
+            tok = m_pending.buffer ();
+            toksz = need;
+          }
+          else
+          {
+            size_t avail = size - pos;
+            size_t need = tokens::need (&data [pos], avail);
+
+            if (need == 0) { m_status = kvr::push_decoder::STATUS_ERROR; break; }
+            if (need > avail)
+            {
+              m_pending.write (const_cast<uint8_t *>(&data [pos]), avail);
+              pos = size;
+              break;
+            }
+
+            tok = &data [pos];
+            toksz = need;
+            pos += need;
+          }
+
+          if (!this->token (tok, toksz))
+          {
+            m_status = kvr::push_decoder::STATUS_ERROR;
+          }
+
+          m_pending.seek (0);
+        }
+
+        if (used) { *used = pos; }
+        return m_status;
+      }
+
+    private:
+
+      struct frame
+      {
+        size_t    left;   // items (keys and values) to go, if not indefinite
+        kvr::sz_t count;  // pairs or elements so far
+        bool      map;
+        bool      indef;
+        bool      key;    // next item is a key
+      };
+
+      ////////////////////////////////////////////////////////////
+
+      bool token (const uint8_t *tok, size_t toksz)
+      {
+        kvr::sz_t count = 0;
+        push_token_t type = tokens::type (tok, &count);
+        frame *top = (m_depth > 0) ? &m_stack [m_depth - 1] : NULL;
+
+        if (type == PUSH_TOKEN_BREAK)
+        {
+          return top && top->indef && (!top->map || top->key) && this->close ();
+        }
+
+        if (top && top->map && top->key)
+        {
+          return (type == PUSH_TOKEN_SCALAR) && m_tokens.key (tok, toksz, m_ctx) && this->item ();
+        }
+
+        bool ok = false;
+
+        switch (type)
+        {
+          case PUSH_TOKEN_SCALAR:
+          {
+            ok = m_tokens.scalar (tok, toksz, m_ctx) && this->item ();
+            break;
+          }
+
+          case PUSH_TOKEN_MAP:
+          case PUSH_TOKEN_MAP_INDEF:
+          {
+            bool indef = (type == PUSH_TOKEN_MAP_INDEF);
+            ok = m_ctx.read_map_start (indef ? 0 : count) && this->open (true, indef, count);
+            break;
+          }
+
+          case PUSH_TOKEN_ARRAY:
+          case PUSH_TOKEN_ARRAY_INDEF:
+          {
+            bool indef = (type == PUSH_TOKEN_ARRAY_INDEF);
+            ok = m_ctx.read_array_start (indef ? 0 : count) && this->open (false, indef, count);
+            break;
+          }
+
+          default:
+          {
+            break;
+          }
+        }
+
+        return ok;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool open (bool map, bool indef, kvr::sz_t count)
+      {
+        KVR_ASSERT_SAFE (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH, false);
+
+        frame &f = m_stack [m_depth++];
+        f.left = map ? (size_t (count) * 2) : size_t (count);
+        f.count = 0;
+        f.map = map;
+        f.indef = indef;
+        f.key = map;
+
+        return (indef || (f.left > 0)) ? true : this->close ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool close ()
+      {
+        const frame &f = m_stack [--m_depth];
+        bool ok = f.map ? m_ctx.read_map_end (f.count) : m_ctx.read_array_end (f.count);
+        return ok && this->item ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool item ()
+      {
+        if (m_depth == 0)
+        {
+          m_status = kvr::push_decoder::STATUS_DONE;
+          return true;
+        }
+
+        frame &f = m_stack [m_depth - 1];
+        if (f.map)
+        {
+          if (!f.key) { ++f.count; }
+          f.key = !f.key;
+        }
+        else
+        {
+          ++f.count;
+        }
+
+        return (f.indef || (--f.left > 0)) ? true : this->close ();
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::value *                m_dest;
+      rctx                        m_ctx;
+      tokens                      m_tokens;
+      kvr::mem_ostream            m_pending;
+      frame                       m_stack [KVR_CONSTANT_MAX_TREE_DEPTH];
+      size_t                      m_depth;
+      kvr::push_decoder::status_t m_status;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // captures the one scalar a reader parses, for kvr::view
+    struct view_ctx
+    {
+      enum type_t
+      {
+        VIEW_NONE,
+        VIEW_NULL,
+        VIEW_BOOLEAN,
+        VIEW_INTEGER,
+        VIEW_FLOAT,
+        VIEW_STRING,
+        VIEW_BINARY,
+      };
+
+      view_ctx () : m_type (VIEW_NONE), m_b (false), m_i (0), m_f (0.0), m_s (NULL), m_len (0) {}
+
+      bool read_null () { m_type = VIEW_NULL; return true; }
+      bool read_boolean (bool b) { m_type = VIEW_BOOLEAN; m_b = b; return true; }
+      bool read_integer (int64_t i) { m_type = VIEW_INTEGER; m_i = i; return true; }
+      bool read_float (double d) { m_type = VIEW_FLOAT; m_f = d; return true; }
+      bool read_string (const char *str, kvr::sz_t length) { m_type = VIEW_STRING; m_s = str; m_len = length; return true; }
+      bool read_binary (const uint8_t *data, kvr::sz_t size) { m_type = VIEW_BINARY; m_s = (const char *) data; m_len = size; return true; }
+      bool read_key (const char *str, kvr::sz_t length) { return this->read_string (str, length); }
+      bool read_map_start (kvr::sz_t) { return false; }
+      bool read_map_end (kvr::sz_t) { return false; }
+      bool read_array_start (kvr::sz_t) { return false; }
+      bool read_array_end (kvr::sz_t) { return false; }
+
+      type_t        m_type;
+      bool          m_b;
+      int64_t       m_i;
+      double        m_f;
+      const char *  m_s;
+      kvr::sz_t     m_len;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // kvr::view operations on encoded values, in terms of 'tokens' (see msgpack::push_tokens).
+    // everything is bounds checked against 'avail'; 0 means malformed or truncated.
+    template<typename tokens>
+    struct view_ops
+    {
+      ////////////////////////////////////////////////////////////
+
+      // size of the token (scalar or container header) at 'p'
+      static size_t token (const uint8_t *p, size_t avail)
+      {
+        size_t n = (avail > 0) ? tokens::need (p, avail) : 0;
+        return (n <= avail) ? n : 0;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      static push_token_t type (const uint8_t *p, kvr::sz_t *count)
+      {
+        return tokens::type (p, count);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // size of the whole value at 'p', containers included. walks the 
+      // tokens with a stack of item counts, nothing is decoded.
+      static size_t skip (const uint8_t *p, size_t avail)
+      {
+        struct level
+        {
+          size_t  left;
+          bool    indef;
+        };
+
+        level stack [KVR_CONSTANT_MAX_TREE_DEPTH];
+        size_t depth = 0;
+        size_t pos = 0;
+
+        do
+        {
+          size_t n = token (&p [pos], avail - pos);
+          if (n == 0) { return 0; }
+
+          kvr::sz_t count = 0;
+          push_token_t type = tokens::type (&p [pos], &count);
+          pos += n;
+
+          bool item = false;
+
+          switch (type)
+          {
+            case PUSH_TOKEN_SCALAR: { item = true; break; }
+
+            case PUSH_TOKEN_MAP:
+            case PUSH_TOKEN_ARRAY:
+            case PUSH_TOKEN_MAP_INDEF:
+            case PUSH_TOKEN_ARRAY_INDEF:
+            {
+              bool indef = (type == PUSH_TOKEN_MAP_INDEF) || (type == PUSH_TOKEN_ARRAY_INDEF);
+              size_t left = (type == PUSH_TOKEN_MAP) ? (size_t (count) * 2) : size_t (count);
+
+              if (indef || (left > 0))
+              {
+                if (depth == KVR_CONSTANT_MAX_TREE_DEPTH) { return 0; }
+                stack [depth].left = left;
+                stack [depth].indef = indef;
+                ++depth;
+              }
+              else
+              {
+                item = true;
+              }
+              break;
+            }
+
+            case PUSH_TOKEN_BREAK:
+            {
+              if ((depth == 0) || !stack [depth - 1].indef) { return 0; }
+              --depth;
+              item = true;
+              break;
+            }
+          }
+
+          // a finished item may finish its parents too
+          while (item && (depth > 0) && !stack [depth - 1].indef)
+          {
+            item = (--stack [depth - 1].left == 0);
+            depth -= item ? 1 : 0;
+          }
+        }
+        while (depth > 0);
+
+        return pos;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      static bool scalar (const uint8_t *p, size_t n, view_ctx &ctx)
+      {
+        tokens t;
+        return t.scalar (p, n, ctx);
+      }
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // path expressions for a projected decode, split into segments on 'delim'. decoders walk
+    // the document once and keep, per level, the set of paths that still match 
+    // (a range of path indices on an internal stack).
+    class projection
+    {
+    public:
+
+      enum match_t
+      {
+        MATCH_NONE,     // no path goes through this child: skip it
+        MATCH_PARTIAL,  // some paths continue below this child
+        MATCH_FULL,     // a path ends at this child: decode all of it
+      };
+
+      ////////////////////////////////////////////////////////////
+
+      projection (const char **paths, kvr::sz_t count, char delim) : m_segs (256u), m_paths (64u), m_active (64u), m_count (0)
+      {
+        for (kvr::sz_t i = 0; paths && (i < count); ++i)
+        {
+          const char *e = paths [i];
+          if (!e || (*e == 0)) { continue; }
+
+          path p;
+          p.first = m_segs.tell () / sizeof (segment);
+          p.count = 0;
+
+          for (const char *e1 = e, *e2 = NULL; e1; e1 = e2 ? (e2 + 1) : NULL)
+          {
+            e2 = strchr (e1, delim);
+
+            segment s;
+            s.str = e1;
+            s.len = e2 ? static_cast<size_t>(e2 - e1) : strlen (e1);
+            s.index = this->index (e1, s.len);
+            m_segs.write ((uint8_t *) &s, sizeof (s));
+            ++p.count;
+          }
+
+          m_paths.write ((uint8_t *) &p, sizeof (p));
+          size_t idx = m_count++;
+          m_active.write ((uint8_t *) &idx, sizeof (idx));
+        }
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // number of (non-empty) paths. the root level is [0, count)
+      size_t count () const
+      {
+        return m_count;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // tests the child 'key' of a map, or element 'index' of an array if 'key' is 
+      // NULL, against paths [first, first + n) at 'depth'. on MATCH_PARTIAL the paths 
+      // for the child's level are [*nfirst, *nfirst + *nn), to be released after.
+      match_t match (size_t first, size_t n, size_t depth, const char *key, size_t keylen, size_t index, size_t *nfirst, size_t *nn)
+      {
+        *nfirst = m_active.tell () / sizeof (size_t);
+        *nn = 0;
+
+        for (size_t i = first; i < (first + n); ++i)
+        {
+          const path &p = ((const path *) m_paths.buffer ()) [((const size_t *) m_active.buffer ()) [i]];
+          const segment &s = ((const segment *) m_segs.buffer ()) [p.first + depth];
+
+          bool hit = key ? ((s.len == keylen) && (memcmp (s.str, key, keylen) == 0)) : (s.index == index);
+          if (hit)
+          {
+            if ((depth + 1) == p.count)
+            {
+              this->release (*nfirst);
+              *nn = 0;
+              return MATCH_FULL;
+            }
+
+            size_t idx = ((const size_t *) m_active.buffer ()) [i];
+            m_active.write ((uint8_t *) &idx, sizeof (idx));
+            ++(*nn);
+          }
+        }
+
+        return (*nn > 0) ? MATCH_PARTIAL : MATCH_NONE;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void release (size_t first)
+      {
+        m_active.seek (first * sizeof (size_t));
+      }
+
+    private:
+
+      struct segment
+      {
+        const char *  str;
+        size_t        len;
+        size_t        index;  // array index, or -1
+      };
+
+      struct path
+      {
+        size_t first;
+        size_t count;
+      };
+
+      ////////////////////////////////////////////////////////////
+
+      static size_t index (const char *str, size_t len)
+      {
+        size_t idx = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+          if ((str [i] < '0') || (str [i] > '9')) { return (size_t) -1; }
+          idx = (idx * 10) + size_t (str [i] - '0');
+        }
+        return (len > 0) ? idx : (size_t) -1;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      kvr::mem_ostream  m_segs;
+      kvr::mem_ostream  m_paths;
+      kvr::mem_ostream  m_active;
+      size_t            m_count;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+
+    // output stream that only counts bytes. running a codec writer over it 
+    // gives the exact encoded size without touching memory.
+    class size_ostream
+    {
+    public:
+
+      size_ostream () : m_size (0) {}
+
+      void    put (uint8_t) { ++m_size; }
+      void    write (uint8_t *, size_t count) { m_size += count; }
+      void    flush () {}
+      size_t  size () const { return m_size; }
+
+    private:
+
+      size_t m_size;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+  }
+}
+
+#if defined (_MSC_VER)
+#include <intrin.h>
+#define kvr_spin_lock(L)    do { while (_InterlockedExchange (&(L), 1)) {} } while (0,0)
+#define kvr_spin_unlock(L)  _InterlockedExchange (&(L), 0)
+#else
+#define kvr_spin_lock(L)    do { while (__sync_lock_test_and_set (&(L), 1)) {} } while (0)
+#define kvr_spin_unlock(L)  __sync_lock_release (&(L))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined (_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+
+namespace kvr
+{
+  namespace internal
+  {
+    // minimal portable thread, runs 'fn (arg)' once until joined
+    class thread
+    {
+    public:
+
+      typedef void (*func_t) (void *arg);
+
+      thread () : m_fn (NULL), m_arg (NULL), m_started (false) {}
+
+      ////////////////////////////////////////////////////////////
+
+      bool start (func_t fn, void *arg)
+      {
+        KVR_ASSERT (fn && !m_started);
+
+        m_fn = fn;
+        m_arg = arg;
+#if defined (_WIN32)
+        m_handle = (HANDLE) _beginthreadex (NULL, 0, &thread::_entry, this, 0, NULL);
+        m_started = (m_handle != 0);
+#else
+        m_started = (pthread_create (&m_handle, NULL, &thread::_entry, this) == 0);
+#endif
+        return m_started;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      void join ()
+      {
+        if (m_started)
+        {
+#if defined (_WIN32)
+          WaitForSingleObject (m_handle, INFINITE);
+          CloseHandle (m_handle);
+#else
+          pthread_join (m_handle, NULL);
+#endif
+          m_started = false;
+        }
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      static size_t hardware_concurrency ()
+      {
+#if defined (_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo (&info);
+        long n = (long) info.dwNumberOfProcessors;
+#else
+        long n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+        return (n > 0) ? (size_t) n : 1u;
+      }
+
+    private:
+
+      thread (const thread &);
+      thread &operator=(const thread &);
+
+#if defined (_WIN32)
+      static unsigned __stdcall _entry (void *self)
+      {
+        thread *t = (thread *) self;
+        t->m_fn (t->m_arg);
+        return 0;
+      }
+
+      HANDLE    m_handle;
+#else
+      static void * _entry (void *self)
+      {
+        thread *t = (thread *) self;
+        t->m_fn (t->m_arg);
+        return NULL;
+      }
+
+      pthread_t m_handle;
+#endif
+      func_t    m_fn;
+      void *    m_arg;
+      bool      m_started;
+    };
+
+    ////////////////////////////////////////////////////////////
+
+    class mutex
+    {
+    public:
+
+#if defined (_WIN32)
+      mutex () { InitializeSRWLock (&m_handle); }
+      ~mutex () {}
+      void lock () { AcquireSRWLockExclusive (&m_handle); }
+      void unlock () { ReleaseSRWLockExclusive (&m_handle); }
+#else
+      mutex () { pthread_mutex_init (&m_handle, NULL); }
+      ~mutex () { pthread_mutex_destroy (&m_handle); }
+      void lock () { pthread_mutex_lock (&m_handle); }
+      void unlock () { pthread_mutex_unlock (&m_handle); }
+#endif
+
+    private:
+
+      mutex (const mutex &);
+      mutex &operator=(const mutex &);
+
+      friend class condition;
+
+#if defined (_WIN32)
+      SRWLOCK         m_handle;
+#else
+      pthread_mutex_t m_handle;
+#endif
+    };
+
+    ////////////////////////////////////////////////////////////
+
+    // waits are always in a loop on the caller's predicate (wakeups can be spurious)
+    class condition
+    {
+    public:
+
+#if defined (_WIN32)
+      condition () { InitializeConditionVariable (&m_handle); }
+      ~condition () {}
+      void wait (mutex *m) { SleepConditionVariableSRW (&m_handle, &m->m_handle, INFINITE, 0); }
+      void signal () { WakeConditionVariable (&m_handle); }
+#else
+      condition () { pthread_cond_init (&m_handle, NULL); }
+      ~condition () { pthread_cond_destroy (&m_handle); }
+      void wait (mutex *m) { pthread_cond_wait (&m_handle, &m->m_handle); }
+      void signal () { pthread_cond_signal (&m_handle); }
+#endif
+
+    private:
+
+      condition (const condition &);
+      condition &operator=(const condition &);
+
+#if defined (_WIN32)
+      CONDITION_VARIABLE  m_handle;
+#else
+      pthread_cond_t      m_handle;
+#endif
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 #include "kvr_json.h"
 #include "kvr_msgpack.h"
 #include "kvr_cbor.h"
+#include "kvr_kvrb.h"
+#include "kvr_lz.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
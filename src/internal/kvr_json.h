@@ -38,29 +38,67 @@ namespace kvr
         kvr::mem_ostream *m_stream;
       };
 
-      // custom output stream interface wrapper
+      // custom output stream interface wrapper (write-combined in blocks)
       struct ostream_custom
       {
-        ostream_custom (kvr::ostream *mem_ostream) : m_stream (mem_ostream) {}
+        ostream_custom (kvr::ostream *ostream) : m_stream (ostream) {}
+        void Put (char ch) { m_stream.put (ch); }
+        void Flush () {} // see json::write
+
+        kvr::internal::block_ostream m_stream;
+      };
+
+      // chunked memory output stream interface wrapper
+      struct ostream_chunk
+      {
+        ostream_chunk (kvr::chunk_ostream *chunk_ostream) : m_stream (chunk_ostream) {}
         void Put (char ch) { m_stream->put (ch); }
-        void Flush () { m_stream->flush (); }
+        void Flush () {}
 
-        kvr::ostream *m_stream;
+        kvr::chunk_ostream *m_stream;
       };
 
-      // custom input stream interface wrapper
+      // byte counting output stream (for exact size pre-pass)
+      struct ostream_size
+      {
+        ostream_size () : m_size (0) {}
+        void Put (char) { ++m_size; }
+        void Flush () {}
+
+        size_t m_size;
+      };
+
+      // custom input stream interface wrapper (reads ahead in blocks)
       struct istream_custom
       {
         typedef char Ch;
-        istream_custom (kvr::istream *mem_istream) : m_stream (mem_istream) {}
-        char    Peek () { return (char) m_stream->peek (); }
-        char    Take () { uint8_t byte = 0;  m_stream->get (&byte); return (char) byte; }
-        size_t  Tell () { return m_stream->tell (); }
+        istream_custom (kvr::istream *istream) : m_stream (istream) {}
+        char    Peek () { return (char) m_stream.peek (); }
+        char    Take () { uint8_t byte = 0;  m_stream.get (&byte); return (char) byte; }
+        size_t  Tell () { return m_stream.tell (); }
         char *  PutBegin () { return NULL; }
         size_t  PutEnd (char *) { return 0u; }
         void    Put (char) { KVR_ASSERT (false); } // ?!
 
-        kvr::istream *m_stream;
+        kvr::internal::block_istream m_stream;
+      };
+
+      // memory input stream that stops at 'end', for buffers with no null 
+      // after them (e.g. a mapped file). reads as '\0' past the end.
+      struct istream_bounded
+      {
+        typedef char Ch;
+        istream_bounded (const char *str, size_t size) : m_beg (str), m_cur (str), m_end (str + size) {}
+        char    Peek () const { return (m_cur < m_end) ? *m_cur : '\0'; }
+        char    Take () { return (m_cur < m_end) ? *m_cur++ : '\0'; }
+        size_t  Tell () const { return size_t (m_cur - m_beg); }
+        char *  PutBegin () { return NULL; }
+        size_t  PutEnd (char *) { return 0u; }
+        void    Put (char) { KVR_ASSERT (false); }
+
+        const char *m_beg;
+        const char *m_cur;
+        const char *m_end;
       };
     }
   }
@@ -119,6 +157,17 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        // reuse for another document
+        void reset (kvr::value *value)
+        {
+          memset (m_stack, 0, sizeof (m_stack));
+          m_root = value;
+          m_temp = NULL;
+          m_depth = 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool Null ()
         {
           KVR_ASSERT_SAFE (m_depth != 0, false);
@@ -411,6 +460,68 @@ namespace kvr
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
 
+      // forwards parser events to a public kvr::handler
+      struct handler_ctx
+      {
+        handler_ctx (kvr::handler *h) : m_handler (h) { KVR_ASSERT (h); }
+
+        bool Null () { return m_handler->on_null (); }
+        bool Bool (bool b) { return m_handler->on_boolean (b); }
+        bool Int (int i) { return m_handler->on_integer ((int64_t) i); }
+        bool Uint (unsigned u) { return m_handler->on_integer ((int64_t) u); }
+        bool Int64 (int64_t i) { return m_handler->on_integer (i); }
+        bool Uint64 (uint64_t u) { if (u > (uint64_t) 0x7fffffffffffffffULL) { return false; } return m_handler->on_integer ((int64_t) u); }
+        bool Double (double d) { return m_handler->on_float (d); }
+        bool String (const char *str, kvr_rapidjson::SizeType length, bool) { return m_handler->on_string (str, (kvr::sz_t) length); }
+        bool Key (const char *str, kvr_rapidjson::SizeType length, bool) { return m_handler->on_key (str, (kvr::sz_t) length); }
+        bool StartObject () { return m_handler->on_map_start (0); }
+        bool EndObject (kvr_rapidjson::SizeType memberCount) { return m_handler->on_map_end ((kvr::sz_t) memberCount); }
+        bool StartArray () { return m_handler->on_array_start (0); }
+        bool EndArray (kvr_rapidjson::SizeType elementCount) { return m_handler->on_array_end ((kvr::sz_t) elementCount); }
+
+        kvr::handler *m_handler;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // rapidjson writer with binary values, written as base64 strings
+      template<typename ostr>
+      class binary_writer : public kvr_rapidjson::Writer<ostr>
+      {
+      public:
+
+        explicit binary_writer (ostr &os) : kvr_rapidjson::Writer<ostr> (os) {}
+
+        bool Binary (const uint8_t *data, kvr::sz_t size)
+        {
+          KVR_ASSERT (data || (size == 0));
+
+          this->Prefix (kvr_rapidjson::kStringType);
+          this->os_->Put ('\"');
+
+          // 3 bytes to 4 chars, so whole blocks don't pad
+          char buf [256];
+          for (kvr::sz_t i = 0; i < size; i += 192)
+          {
+            size_t n = ((size - i) < 192) ? (size_t) (size - i) : 192u;
+            kvr::internal::base64_encode (data + i, n, buf);
+            for (size_t c = 0, e = kvr::internal::base64_size (n); c < e; ++c)
+            {
+              this->os_->Put (buf [c]);
+            }
+          }
+
+          this->os_->Put ('\"');
+          return true;
+        }
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
       template<typename ostr>
       struct writer
       {
@@ -456,6 +567,13 @@ namespace kvr
             success = m_wrt.String (str, slen);
           }
 
+          else if (val->is_binary ())
+          {
+            kvr::sz_t size = 0;
+            const uint8_t *data = val->get_binary (&size);
+            success = m_wrt.Binary (data, size);
+          }
+
           else if (val->is_integer ())
           {
             int64_t n = val->get_integer ();
@@ -482,9 +600,67 @@ namespace kvr
           return success;
         }
 
-        kvr_rapidjson::Writer<ostr> m_wrt;
+        binary_writer<ostr> m_wrt;
       };
 
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // writes handler events straight out (transcoding)
+      template<typename ostr>
+      struct emitter : public kvr::handler
+      {
+        emitter (ostr &os) : m_wrt (os) {}
+
+        bool on_null () { return m_wrt.Null (); }
+        bool on_boolean (bool b) { return m_wrt.Bool (b); }
+        bool on_integer (int64_t i) { return m_wrt.Int64 (i); }
+        bool on_float (double f) { return m_wrt.Double (f); }
+        bool on_string (const char *str, kvr::sz_t length) { return m_wrt.String (str, (kvr_rapidjson::SizeType) length); }
+        bool on_binary (const uint8_t *data, kvr::sz_t size) { return m_wrt.Binary (data, size); }
+        bool on_key (const char *str, kvr::sz_t length) { return m_wrt.Key (str, (kvr_rapidjson::SizeType) length); }
+        bool on_map_start (kvr::sz_t) { return m_wrt.StartObject (); }
+        bool on_map_end (kvr::sz_t) { return m_wrt.EndObject (); }
+        bool on_array_start (kvr::sz_t) { return m_wrt.StartArray (); }
+        bool on_array_end (kvr::sz_t) { return m_wrt.EndArray (); }
+
+        binary_writer<ostr> m_wrt;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // kvr::stream_writer backend. sizes are not needed.
+      class stream_encoder : public kvr::internal::stream_encoder
+      {
+      public:
+
+        stream_encoder (kvr::ostream *os) : m_os (os), m_wrt (m_os) {}
+
+        bool begin_map (kvr::sz_t, bool) { return m_wrt.m_wrt.StartObject (); }
+        bool end_map (bool) { return m_wrt.m_wrt.EndObject (); }
+        bool begin_array (kvr::sz_t, bool) { return m_wrt.m_wrt.StartArray (); }
+        bool end_array (bool) { return m_wrt.m_wrt.EndArray (); }
+        bool key (const char *str, kvr::sz_t length) { return m_wrt.m_wrt.Key (str, (kvr_rapidjson::SizeType) length); }
+        bool null () { return m_wrt.m_wrt.Null (); }
+        bool boolean (bool b) { return m_wrt.m_wrt.Bool (b); }
+        bool integer (int64_t i) { return m_wrt.m_wrt.Int64 (i); }
+        bool floating (double f) { return m_wrt.m_wrt.Double (f); }
+        bool string (const char *str, kvr::sz_t length) { return m_wrt.m_wrt.String (str, (kvr_rapidjson::SizeType) length); }
+        bool binary (const uint8_t *data, kvr::sz_t size) { return m_wrt.m_wrt.Binary (data, size); }
+        bool value (const kvr::value *val) { return m_wrt.print (val); }
+        bool raw (const uint8_t *data, size_t size) { m_os.m_stream.write (const_cast<uint8_t *> (data), size); return true; }
+        void finish () { m_os.m_stream.flush (); }
+
+      private:
+
+        ostream_custom          m_os;
+        writer<ostream_custom>  m_wrt;
+      };
+
+
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
@@ -513,7 +689,16 @@ namespace kvr
 
         ostream_custom wostr (ostr);
         writer<ostream_custom> wrt (wostr);
-        return wrt.print (src);
+        
+        // the writer only flushes after a map or array, so flush here to 
+        // hand over any pending block once, whatever the root type
+        if (wrt.print (src))
+        {
+          wostr.m_stream.flush ();
+          return true;
+        }
+
+        return false;
       }
 
       ////////////////////////////////////////////////////////////
@@ -542,6 +727,75 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
+      // 'data' need not be null-terminated
+      bool read_bounded (kvr::value *dest, const uint8_t *data, size_t size)
+      {
+        KVR_ASSERT (dest);
+        KVR_ASSERT (data || (size == 0));
+
+        read_ctx rctx (dest);
+        istream_bounded ss ((const char *) data, size);
+        kvr_rapidjson::Reader reader;
+        kvr_rapidjson::ParseResult ok = reader.Parse<KVR_JSON_PARSE_FLAGS> (ss, rctx);
+        return ok && (rctx.m_depth == 0);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // documents [offsets [i], offsets [i + 1]) of 'data', read with one parser (and parse stack)
+      bool read_batch (kvr::value **dests, const uint8_t *data, const size_t *offsets, size_t count)
+      {
+        KVR_ASSERT (dests || (count == 0));
+        KVR_ASSERT (offsets);
+
+        read_ctx rctx (NULL);
+        kvr_rapidjson::Reader reader;
+        bool success = true;
+
+        for (size_t i = 0; (i < count) && success; ++i)
+        {
+          istream_bounded ss ((const char *) (data + offsets [i]), offsets [i + 1] - offsets [i]);
+          dests [i]->conv_null ();
+          rctx.reset (dests [i]);
+          kvr_rapidjson::ParseResult ok = reader.Parse<KVR_JSON_PARSE_FLAGS> (ss, rctx);
+          success = ok && (rctx.m_depth == 0);
+        }
+
+        return success;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        handler_ctx hctx (h);
+        istream_custom ss (&istr);
+
+        kvr_rapidjson::Reader reader;
+        kvr_rapidjson::ParseResult ok = reader.Parse<KVR_JSON_PARSE_FLAGS> (ss, hctx);
+        return ok;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::mem_istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        const char *str = (const char *) istr.buffer ();
+        KVR_ASSERT (str);
+
+        handler_ctx hctx (h);
+        kvr_rapidjson::StringStream ss (str);
+        kvr_rapidjson::Reader reader;
+        kvr_rapidjson::ParseResult ok = reader.Parse<KVR_JSON_PARSE_FLAGS> (ss, hctx);
+        return ok;
+      }
+
+      ////////////////////////////////////////////////////////////
+
       bool write (const kvr::value *src, kvr::mem_ostream *ostr) 
       {
         KVR_ASSERT (src);
@@ -554,71 +808,418 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
-      size_t write_approx_size (const kvr::value *val)
+      bool write (const kvr::value *src, kvr::chunk_ostream *ostr)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
+
+        ostream_chunk wostr (ostr);
+        writer<ostream_chunk> wrt (wostr);
+        return wrt.print (src);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      size_t write_size (const kvr::value *val)
       {
-        size_t size = 0;
+        KVR_ASSERT (val);
+
+        ostream_size sostr;
+        writer<ostream_size> wrt (sostr);
+        return wrt.print (val) ? sostr.m_size : 0u;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      // kvr::push_decoder backend. the reader can't pause mid-document, so bytes are 
+      // collected (tracking strings, comments and nesting) until the root map or array 
+      // closes, then parsed in one go.
+      class push_reader : public kvr::internal::push_parser
+      {
+      public:
+
+        push_reader (kvr::value *dest) : m_dest (dest), m_buf (256u)
+        {
+          KVR_ASSERT (dest);
+          this->clear ();
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        void retarget (kvr::value *dest)
+        {
+          KVR_ASSERT (dest);
+          m_dest = dest;
+          this->reset ();
+        }
+
+        ////////////////////////////////////////////////////////////
 
-        if (val->is_map ())
+        void reset ()
         {
-          size += 2; // brackets
-          kvr::value::cursor c (val);
-          kvr::pair p;
-          while (c.get (&p))
+          m_dest->conv_null ();
+          m_buf.seek (0);
+          this->clear ();
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        kvr::push_decoder::status_t feed (const uint8_t *data, size_t size, size_t *used)
+        {
+          size_t pos = 0;
+          bool complete = false;
+
+          while ((m_status == kvr::push_decoder::STATUS_NEED_MORE) && !complete && (pos < size))
+          {
+            const char c = (char) data [pos++];
+
+            switch (m_scan)
+            {
+              case SCAN_STRING:         { if (c == '\\') { m_scan = SCAN_ESCAPE; } else if (c == '"') { m_scan = SCAN_VALUE; } break; }
+              case SCAN_ESCAPE:         { m_scan = SCAN_STRING; break; }
+              case SCAN_SLASH:          { m_scan = (c == '/') ? SCAN_LINE_COMMENT : ((c == '*') ? SCAN_BLOCK_COMMENT : SCAN_VALUE); break; }
+              case SCAN_LINE_COMMENT:   { if (c == '\n') { m_scan = SCAN_VALUE; } break; }
+              case SCAN_BLOCK_COMMENT:  { if (c == '*') { m_scan = SCAN_BLOCK_STAR; } break; }
+              case SCAN_BLOCK_STAR:     { m_scan = (c == '/') ? SCAN_VALUE : ((c == '*') ? SCAN_BLOCK_STAR : SCAN_BLOCK_COMMENT); break; }
+              case SCAN_VALUE:
+              {
+                if (c == '"') { m_scan = SCAN_STRING; }
+                else if (c == '/') { m_scan = SCAN_SLASH; }
+                else if ((c == '{') || (c == '[')) { ++m_depth; }
+                else if ((c == '}') || (c == ']'))
+                {
+                  if (m_depth == 0) { m_status = kvr::push_decoder::STATUS_ERROR; }
+                  else { complete = (--m_depth == 0); }
+                }
+                break;
+              }
+            }
+          }
+
+          m_buf.write (const_cast<uint8_t *>(data), pos);
+
+          if (complete)
           {
-            kvr::key *k = p.get_key ();
-            kvr::value *v = p.get_value ();
+            // null-terminate for the reader
+            m_buf.put (0);
+            m_buf.pop (1);
 
-            size += k->get_length () + 2; // + quotes
-            size += write_approx_size (v);
-            size += 2; // colon and comma
+            kvr::mem_istream istr (m_buf.buffer (), m_buf.tell ());
+            bool ok = json::read (m_dest, istr);
+            m_status = ok ? kvr::push_decoder::STATUS_DONE : kvr::push_decoder::STATUS_ERROR;
           }
+
+          if (used) { *used = pos; }
+          return m_status;
+        }
+
+      private:
+
+        enum scan_t
+        {
+          SCAN_VALUE,
+          SCAN_STRING,
+          SCAN_ESCAPE,
+          SCAN_SLASH,
+          SCAN_LINE_COMMENT,
+          SCAN_BLOCK_COMMENT,
+          SCAN_BLOCK_STAR,
+        };
+
+        void clear ()
+        {
+          m_scan = SCAN_VALUE;
+          m_depth = 0;
+          m_status = kvr::push_decoder::STATUS_NEED_MORE;
+        }
+
+        kvr::value *                m_dest;
+        kvr::mem_ostream            m_buf;
+        scan_t                      m_scan;
+        size_t                      m_depth;
+        kvr::push_decoder::status_t m_status;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // parses the value at 'str' as a new child of 'parent' (under 'key' if parent is 
+      // a map, appended if an array). stops at the end of the value, 'used' returns its length.
+      bool read_child (kvr::value *parent, const char *key, const char *str, size_t *used)
+      {
+        KVR_ASSERT (parent && (parent->is_map () || parent->is_array ()));
+        KVR_ASSERT (!parent->is_map () || key);
+
+        // resume as if the parser was just inside 'parent'
+        read_ctx rctx (parent);
+        rctx.m_stack [0] = parent;
+        rctx.m_depth = 1;
+        rctx.m_temp = parent->is_map () ? parent->insert_null (key) : NULL;
+
+        kvr_rapidjson::StringStream ss (str);
+        kvr_rapidjson::Reader reader;
+        kvr_rapidjson::ParseResult ok = reader.Parse<KVR_JSON_PARSE_FLAGS> (ss, rctx);
+
+        *used = ss.Tell ();
+        return ok && (rctx.m_depth == 1);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // projected decode (see kvr::internal::projection). only the selected subtrees go 
+      // through rapidjson, everything else is skipped by matching braces and quotes.
+      class projector
+      {
+      public:
+
+        projector (const char *str, size_t len, projection *proj) : m_p (str), m_end (str + len), m_proj (proj)
+        {
+          KVR_ASSERT (str && proj);
         }
 
-        else if (val->is_array ())
+        ////////////////////////////////////////////////////////////
+
+        bool read (kvr::value *dest)
         {
-          size += 2; // brackets
-          for (kvr::sz_t i = 0, c = val->length (); i < c; ++i)
+          this->ws ();
+
+          if (m_p < m_end)
           {
-            kvr::value *v = val->element (i);
-            size += kvr::internal::ndigitsu32 (i);
-            size += write_approx_size (v);
-            size += 1; // comma
+            if (*m_p == '{')      { dest->conv_map (); }
+            else if (*m_p == '[') { dest->conv_array (); }
+            else                  { return false; }
+
+            return this->level (dest, 0, m_proj->count (), 0);
           }
+
+          return false;
         }
 
-        else if (val->is_string ())
+      private:
+
+        // gets the unescaped key of an escaped key string
+        struct key_ctx : public kvr_rapidjson::BaseReaderHandler<kvr_rapidjson::UTF8<>, key_ctx>
         {
-          kvr::sz_t slen = 0;
-          const char *str = val->get_string (&slen);
-          KVR_REF_UNUSED (str);
-          size += (slen + 2); // + quotes
+          key_ctx (kvr::mem_ostream *os) : m_os (os) {}
+          bool String (const char *str, kvr_rapidjson::SizeType length, bool) { m_os->write ((uint8_t *) str, length); return true; }
+          bool Default () { return false; }
+
+          kvr::mem_ostream *m_os;
+        };
+
+        ////////////////////////////////////////////////////////////
+
+        bool level (kvr::value *dst, size_t first, size_t n, size_t depth)
+        {
+          const bool map = (*m_p == '{');
+          const char close = map ? '}' : ']';
+
+          ++m_p;
+          this->ws ();
+
+          if ((m_p < m_end) && (*m_p == close))
+          {
+            ++m_p;
+            return true;
+          }
+
+          uint8_t kbuf [256];
+          kvr::mem_ostream kos (kbuf, 256);
+
+          for (size_t index = 0; m_p < m_end; ++index)
+          {
+            kos.seek (0);
+
+            if (map)
+            {
+              if (!this->key (&kos)) { return false; }
+              this->ws ();
+              if ((m_p == m_end) || (*m_p++ != ':')) { return false; }
+              this->ws ();
+            }
+
+            // null-terminated for insertion, length excludes it
+            size_t klen = kos.tell ();
+            kos.put (0);
+            const char *k = map ? (const char *) kos.buffer () : NULL;
+
+            size_t nfirst = 0, nn = 0;
+            projection::match_t m = m_proj->match (first, n, depth, k, klen, index, &nfirst, &nn);
+
+            bool ok = true;
+
+            if (m == projection::MATCH_FULL)
+            {
+              size_t used = 0;
+              ok = read_child (dst, k, m_p, &used);
+              m_p += used;
+            }
+            else if ((m == projection::MATCH_PARTIAL) && (m_p < m_end) && ((*m_p == '{') || (*m_p == '[')))
+            {
+              bool cmap = (*m_p == '{');
+              kvr::value *child = map ? (cmap ? dst->insert_map (k) : dst->insert_array (k)) : (cmap ? dst->push_map () : dst->push_array ());
+              ok = child && this->level (child, nfirst, nn, depth + 1);
+
+              // nothing selected below
+              if (ok && ((cmap ? child->size () : child->length ()) == 0))
+              {
+                if (map) { dst->remove (k); } else { dst->pop (); }
+              }
+            }
+            else
+            {
+              ok = this->skip ();
+            }
+
+            m_proj->release (nfirst);
+
+            if (!ok) { return false; }
+
+            this->ws ();
+            if (m_p == m_end) { return false; }
+
+            char c = *m_p++;
+            if (c == close) { return true; }
+            if (c != ',') { return false; }
+
+            this->ws ();
+          }
+
+          return false;
         }
 
-        else if (val->is_integer ())
+        ////////////////////////////////////////////////////////////
+
+        bool key (kvr::mem_ostream *os)
         {
-          int64_t n = val->get_integer ();
-          size += kvr::internal::ndigitsi64 (n);
+          if ((m_p == m_end) || (*m_p != '"')) { return false; }
+
+          const char *s = m_p + 1;
+          bool escaped = false;
+          if (!this->skip_string (&escaped)) { return false; }
+
+          if (escaped)
+          {
+            key_ctx kctx (os);
+            kvr_rapidjson::StringStream ss (s - 1);
+            kvr_rapidjson::Reader reader;
+            return !reader.Parse<kvr_rapidjson::kParseStopWhenDoneFlag> (ss, kctx).IsError ();
+          }
+
+          os->write ((uint8_t *) s, static_cast<size_t>(m_p - 1 - s));
+          return true;
         }
 
-        else if (val->is_float ())
+        ////////////////////////////////////////////////////////////
+
+        // skips any value. containers are matched by depth, not validated.
+        bool skip ()
         {
-          //size += 13; // average (guess)     
-          size += 25; // 25 is max
+          size_t depth = 0;
+
+          while (m_p < m_end)
+          {
+            char c = *m_p;
+
+            if (c == '"')
+            {
+              if (!this->skip_string (NULL)) { return false; }
+            }
+            else if ((c == '{') || (c == '['))
+            {
+              ++depth;
+              ++m_p;
+            }
+            else if ((c == '}') || (c == ']'))
+            {
+              if (depth == 0) { return true; }
+              ++m_p;
+              if (--depth == 0) { return true; }
+            }
+            else if ((depth == 0) && ((c == ',') || (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '/')))
+            {
+              return true;
+            }
+            else if (c == '/')
+            {
+              const char *p0 = m_p;
+              this->ws ();
+              m_p += (m_p == p0) ? 1 : 0;
+            }
+            else if (c == 0)
+            {
+              return false;
+            }
+            else
+            {
+              ++m_p;
+            }
+          }
+
+          return (depth == 0);
         }
 
-        else if (val->is_boolean ())
+        ////////////////////////////////////////////////////////////
+
+        bool skip_string (bool *escaped)
         {
-          bool b = val->get_boolean ();
-          size += b ? 4 : 5;
+          KVR_ASSERT (*m_p == '"');
+
+          for (++m_p; m_p < m_end; ++m_p)
+          {
+            if (*m_p == '\\')
+            {
+              if (escaped) { *escaped = true; }
+              ++m_p;
+            }
+            else if (*m_p == '"')
+            {
+              ++m_p;
+              return true;
+            }
+          }
+
+          return false;
         }
 
-        else if (val->is_null ())
+        ////////////////////////////////////////////////////////////
+
+        // whitespace and comments
+        void ws ()
         {
-          size += 4;
+          while (m_p < m_end)
+          {
+            char c = *m_p;
+
+            if ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'))
+            {
+              ++m_p;
+            }
+            else if ((c == '/') && ((m_p + 1) < m_end) && (m_p [1] == '/'))
+            {
+              while ((m_p < m_end) && (*m_p != '\n')) { ++m_p; }
+            }
+            else if ((c == '/') && ((m_p + 1) < m_end) && (m_p [1] == '*'))
+            {
+              for (m_p += 2; (m_p < m_end) && !((*m_p == '*') && ((m_p + 1) < m_end) && (m_p [1] == '/')); ++m_p) {}
+              m_p = (m_p < m_end) ? (m_p + 2) : m_end;
+            }
+            else
+            {
+              break;
+            }
+          }
         }
 
-        return size;
-      }  
+        ////////////////////////////////////////////////////////////
+
+        const char *  m_p;
+        const char *  m_end;
+        projection *  m_proj;
+      };
     }
   }
 }
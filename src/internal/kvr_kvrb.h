@@ -0,0 +1,762 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE for details.
+ */
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef KVR_KVRB_H
+#define KVR_KVRB_H
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace kvr
+{
+  namespace internal
+  {
+    namespace kvrb
+    {
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // kvr binary snapshot. a flat, little-endian layout meant to be mapped and
+      // queried in place (see kvr::view); nothing is parsed when it is opened.
+      //
+      // header (48 bytes):
+      //   [0]  "KVRB"  [4] u16 version  [6] u16 header size  [8] u64 total size
+      //   [16] u32 adler-32 of bytes [48, total)  [20] u32 key count
+      //   [24] u64 key dictionary offset  [32] root slot
+      //
+      // slot (16 bytes): [0] u8 type [1] 3 bytes pad [4] u32 count [8] u64 payload.
+      //   scalars keep their value in the payload (integer, or float bits).
+      //   strings, arrays, maps and binaries keep an offset relative to the slot
+      //   itself, always forward, so a slot pointer and the bytes left in the buffer
+      //   are all that's needed to bounds-check a lookup. strings are null-terminated,
+      //   binaries are 'count' raw bytes.
+      //
+      // array block: 'count' packed slots.
+      // map block:   u32 bucket count (power of 2, 0 if empty), u32 pad,
+      //              buckets {u32 entry + 1, u32 key hash} with linear probing,
+      //              then 'count' entries {key slot, value slot} in map order.
+      //
+      // key slots point into the key dictionary at the end of the snapshot:
+      // {u64 offset, u32 length, u32 hash} per distinct key, then the key strings.
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      enum slot_t
+      {
+        SLOT_NULL,
+        SLOT_FALSE,
+        SLOT_TRUE,
+        SLOT_INTEGER,
+        SLOT_FLOAT,
+        SLOT_STRING,
+        SLOT_ARRAY,
+        SLOT_MAP,
+        SLOT_BINARY,
+      };
+
+      static const uint16_t VERSION         = 1;
+      static const size_t   HEADER_SIZE     = 48;
+      static const size_t   ROOT_OFFSET     = 32;
+      static const size_t   SLOT_SIZE       = 16;
+      static const size_t   BUCKET_SIZE     = 8;
+      static const size_t   MAP_HEAD_SIZE   = 8;
+      static const size_t   ENTRY_SIZE      = SLOT_SIZE * 2;
+      static const size_t   DICT_ENTRY_SIZE = 16;
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline uint32_t get_u32 (const uint8_t *p)
+      {
+        return uint32_t (p [0]) | (uint32_t (p [1]) << 8) | (uint32_t (p [2]) << 16) | (uint32_t (p [3]) << 24);
+      }
+
+      inline uint64_t get_u64 (const uint8_t *p)
+      {
+        return uint64_t (get_u32 (p)) | (uint64_t (get_u32 (p + 4)) << 32);
+      }
+
+      inline void set_u32 (uint8_t *p, uint32_t v)
+      {
+        p [0] = uint8_t (v); p [1] = uint8_t (v >> 8); p [2] = uint8_t (v >> 16); p [3] = uint8_t (v >> 24);
+      }
+
+      inline void set_u64 (uint8_t *p, uint64_t v)
+      {
+        set_u32 (p, uint32_t (v)); set_u32 (p + 4, uint32_t (v >> 32));
+      }
+
+      inline size_t align (size_t n)
+      {
+        return (n + 7u) & ~size_t (7u);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // fnv-1a (part of the format, so independent of the ctx key seed)
+      inline uint32_t hash (const char *str, size_t len)
+      {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; ++i)
+        {
+          h = (h ^ uint8_t (str [i])) * 16777619u;
+        }
+        return h;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline uint32_t checksum (const uint8_t *data, size_t size)
+      {
+        return kvr::internal::adler32 (data, size);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // root slot and the bytes it may address. header checks only, O(1).
+      inline bool open (const uint8_t *data, size_t size, const uint8_t **root, size_t *avail)
+      {
+        KVR_ASSERT (root && avail);
+
+        if (!data || (size < HEADER_SIZE) || (memcmp (data, "KVRB", 4) != 0))
+        {
+          return false;
+        }
+
+        uint32_t vh = get_u32 (data + 4);
+        uint64_t total = get_u64 (data + 8);
+
+        if (((vh & 0xffff) != VERSION) || ((vh >> 16) != HEADER_SIZE) || (total < HEADER_SIZE) || (total > size))
+        {
+          return false;
+        }
+
+        *root = data + ROOT_OFFSET;
+        *avail = static_cast<size_t>(total) - ROOT_OFFSET;
+        return true;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline bool verify (const uint8_t *data, size_t size)
+      {
+        const uint8_t *root = NULL;
+        size_t avail = 0;
+
+        if (!open (data, size, &root, &avail))
+        {
+          return false;
+        }
+
+        size_t total = avail + ROOT_OFFSET;
+        return checksum (data + HEADER_SIZE, total - HEADER_SIZE) == get_u32 (data + 16);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // view_ops counterparts. a slot is always SLOT_SIZE bytes; token() also
+      // bounds-checks what it points to, so the accessors below can trust it.
+
+      // size of the slot at 'p', 0 if malformed or out of bounds
+      inline size_t token (const uint8_t *p, size_t avail)
+      {
+        if (!p || (avail < SLOT_SIZE))
+        {
+          return 0;
+        }
+
+        uint64_t count = get_u32 (p + 4);
+        uint64_t off = get_u64 (p + 8);
+        uint64_t left = (off <= avail) ? (avail - off) : 0;
+        bool ok = false;
+
+        switch (p [0])
+        {
+          case SLOT_NULL:
+          case SLOT_FALSE:
+          case SLOT_TRUE:
+          case SLOT_INTEGER:
+          case SLOT_FLOAT:
+          {
+            ok = true;
+            break;
+          }
+
+          case SLOT_STRING:
+          {
+            ok = (off >= SLOT_SIZE) && (left > count) && (p [off + count] == 0);
+            break;
+          }
+
+          case SLOT_ARRAY:
+          {
+            ok = (off >= SLOT_SIZE) && ((count * SLOT_SIZE) <= left);
+            break;
+          }
+
+          case SLOT_BINARY:
+          {
+            ok = (off >= SLOT_SIZE) && (left >= count);
+            break;
+          }
+
+          case SLOT_MAP:
+          {
+            if ((off >= SLOT_SIZE) && (left >= MAP_HEAD_SIZE))
+            {
+              uint64_t nb = get_u32 (p + off);
+              bool pow2 = (nb & (nb - 1)) == 0;
+              ok = pow2 && ((count == 0) || (nb > count)) && ((MAP_HEAD_SIZE + (nb * BUCKET_SIZE) + (count * ENTRY_SIZE)) <= left);
+            }
+            break;
+          }
+
+          default:
+          {
+            break;
+          }
+        }
+
+        return ok ? SLOT_SIZE : 0;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline push_token_t type (const uint8_t *p, kvr::sz_t *count)
+      {
+        KVR_ASSERT (count);
+
+        *count = static_cast<kvr::sz_t>(get_u32 (p + 4));
+
+        switch (p [0])
+        {
+          case SLOT_ARRAY:  { return PUSH_TOKEN_ARRAY; }
+          case SLOT_MAP:    { return PUSH_TOKEN_MAP; }
+          default:          { *count = 0; return PUSH_TOKEN_SCALAR; }
+        }
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline bool scalar (const uint8_t *p, view_ctx &ctx)
+      {
+        uint64_t payload = get_u64 (p + 8);
+
+        switch (p [0])
+        {
+          case SLOT_NULL:     { return ctx.read_null (); }
+          case SLOT_FALSE:    { return ctx.read_boolean (false); }
+          case SLOT_TRUE:     { return ctx.read_boolean (true); }
+          case SLOT_INTEGER:  { return ctx.read_integer (static_cast<int64_t>(payload)); }
+          case SLOT_STRING:   { return ctx.read_string ((const char *) (p + payload), static_cast<kvr::sz_t>(get_u32 (p + 4))); }
+          case SLOT_BINARY:   { return ctx.read_binary (p + payload, static_cast<kvr::sz_t>(get_u32 (p + 4))); }
+
+          case SLOT_FLOAT:
+          {
+            double d;
+            memcpy (&d, &payload, sizeof (d));
+            return ctx.read_float (d);
+          }
+
+          default:
+          {
+            return false;
+          }
+        }
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // first element slot of an array, or first entry of a map
+      inline const uint8_t * children (const uint8_t *p)
+      {
+        const uint8_t *block = p + get_u64 (p + 8);
+        return (p [0] == SLOT_MAP) ? (block + MAP_HEAD_SIZE + (size_t (get_u32 (block)) * BUCKET_SIZE)) : block;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // value slot for 'key' in the (token-checked) map at 'p', or NULL
+      inline const uint8_t * find (const uint8_t *p, size_t avail, const char *key, size_t len)
+      {
+        const uint8_t *block = p + get_u64 (p + 8);
+        uint32_t count = get_u32 (p + 4);
+        uint32_t nb = get_u32 (block);
+
+        if (nb == 0)
+        {
+          return NULL;
+        }
+
+        const uint8_t *buckets = block + MAP_HEAD_SIZE;
+        const uint8_t *entries = buckets + (size_t (nb) * BUCKET_SIZE);
+        const uint8_t *end = p + avail;
+
+        uint32_t h = hash (key, len);
+        uint32_t i = h & (nb - 1);
+
+        for (uint32_t probe = 0; probe < nb; ++probe)
+        {
+          const uint8_t *b = buckets + (size_t (i) * BUCKET_SIZE);
+          uint32_t e = get_u32 (b);
+
+          if ((e == 0) || (e > count))
+          {
+            break;
+          }
+
+          if (get_u32 (b + 4) == h)
+          {
+            const uint8_t *k = entries + (size_t (e - 1) * ENTRY_SIZE);
+            if ((k [0] == SLOT_STRING) && token (k, size_t (end - k)) && (get_u32 (k + 4) == len) && (memcmp (k + get_u64 (k + 8), key, len) == 0))
+            {
+              return k + SLOT_SIZE;
+            }
+          }
+
+          i = (i + 1) & (nb - 1);
+        }
+
+        return NULL;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      class writer
+      {
+      public:
+
+        explicit writer (kvr::mem_ostream *os) : m_os (os), m_base (os->tell ()), m_keys (256u), m_nkeys (0) {}
+
+        ////////////////////////////////////////////////////////////
+
+        bool write (const kvr::value *root)
+        {
+          KVR_ASSERT (root);
+
+          this->reserve (HEADER_SIZE);
+
+          if (!this->node (root, ROOT_OFFSET, 0))
+          {
+            return false;
+          }
+
+          size_t dict = this->keys ();
+          size_t total = this->reserve (0);
+
+          uint8_t *h = this->at (0);
+          memcpy (h, "KVRB", 4);
+          set_u32 (h + 4, uint32_t (VERSION) | (uint32_t (HEADER_SIZE) << 16));
+          set_u64 (h + 8, total);
+          set_u32 (h + 20, static_cast<uint32_t>(m_nkeys));
+          set_u64 (h + 24, dict);
+          set_u32 (h + 16, checksum (h + HEADER_SIZE, total - HEADER_SIZE));
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static size_t write_size (const kvr::value *val)
+        {
+          return HEADER_SIZE + node_size (val);
+        }
+
+      private:
+
+        // a map key waiting for its dictionary offset
+        struct keyref
+        {
+          size_t        slot;
+          const char *  str;
+          uint32_t      len;
+          uint32_t      hash;
+          uint32_t      id;
+        };
+
+        ////////////////////////////////////////////////////////////
+
+        size_t tell () const
+        {
+          return m_os->tell () - m_base;
+        }
+
+        uint8_t * at (size_t pos)
+        {
+          return const_cast<uint8_t *>(m_os->buffer ()) + m_base + pos;
+        }
+
+        // zeroed, 8-byte aligned block
+        size_t reserve (size_t n)
+        {
+          size_t pad = align (this->tell ()) - this->tell ();
+          size_t pos = this->tell () + pad;
+          memset (m_os->push (pad + n), 0, pad + n);
+          return pos;
+        }
+
+        void slot (size_t pos, slot_t type, uint32_t count, uint64_t payload)
+        {
+          uint8_t *s = this->at (pos);
+          s [0] = uint8_t (type);
+          set_u32 (s + 4, count);
+          set_u64 (s + 8, payload);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool node (const kvr::value *val, size_t pos, size_t depth)
+        {
+          KVR_ASSERT_SAFE (depth < KVR_CONSTANT_MAX_TREE_DEPTH, false);
+
+          if (val->is_map ())
+          {
+            uint32_t count = static_cast<uint32_t>(val->size ());
+            uint32_t nb = 0;
+            if (count > 0)
+            {
+              for (nb = 2; nb < (count * 2); nb <<= 1) {}
+            }
+
+            size_t block = this->reserve (MAP_HEAD_SIZE + (size_t (nb) * BUCKET_SIZE) + (size_t (count) * ENTRY_SIZE));
+            size_t entries = block + MAP_HEAD_SIZE + (size_t (nb) * BUCKET_SIZE);
+
+            this->slot (pos, SLOT_MAP, count, block - pos);
+            set_u32 (this->at (block), nb);
+
+            kvr::value::cursor c (val);
+            kvr::pair p;
+            uint32_t e = 0;
+
+            while (c.get (&p))
+            {
+              kvr::key *k = p.get_key ();
+              size_t kpos = entries + (size_t (e) * ENTRY_SIZE);
+
+              keyref ref;
+              ref.slot = kpos;
+              ref.str = k->get_string ();
+              ref.len = static_cast<uint32_t>(k->get_length ());
+              ref.hash = hash (ref.str, ref.len);
+              ref.id = 0;
+              m_keys.write ((uint8_t *) &ref, sizeof (ref));
+
+              this->slot (kpos, SLOT_STRING, ref.len, 0);
+
+              uint32_t i = ref.hash & (nb - 1);
+              while (get_u32 (this->at (block + MAP_HEAD_SIZE + (size_t (i) * BUCKET_SIZE))) != 0)
+              {
+                i = (i + 1) & (nb - 1);
+              }
+              set_u32 (this->at (block + MAP_HEAD_SIZE + (size_t (i) * BUCKET_SIZE)), e + 1);
+              set_u32 (this->at (block + MAP_HEAD_SIZE + (size_t (i) * BUCKET_SIZE) + 4), ref.hash);
+
+              if (!this->node (p.get_value (), kpos + SLOT_SIZE, depth + 1))
+              {
+                return false;
+              }
+
+              ++e;
+            }
+          }
+
+          else if (val->is_array ())
+          {
+            uint32_t count = static_cast<uint32_t>(val->length ());
+            size_t block = this->reserve (size_t (count) * SLOT_SIZE);
+
+            this->slot (pos, SLOT_ARRAY, count, block - pos);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+              if (!this->node (val->element (i), block + (size_t (i) * SLOT_SIZE), depth + 1))
+              {
+                return false;
+              }
+            }
+          }
+
+          else if (val->is_string ())
+          {
+            kvr::sz_t len = 0;
+            const char *str = val->get_string (&len);
+            size_t spos = this->reserve (size_t (len) + 1);
+            memcpy (this->at (spos), str, len);
+            this->slot (pos, SLOT_STRING, static_cast<uint32_t>(len), spos - pos);
+          }
+
+          else if (val->is_binary ())
+          {
+            kvr::sz_t size = 0;
+            const uint8_t *data = val->get_binary (&size);
+            size_t bpos = this->reserve (size_t (size));
+            if (size > 0)
+            {
+              memcpy (this->at (bpos), data, size);
+            }
+            this->slot (pos, SLOT_BINARY, static_cast<uint32_t>(size), bpos - pos);
+          }
+
+          else if (val->is_integer ())
+          {
+            this->slot (pos, SLOT_INTEGER, 0, static_cast<uint64_t>(val->get_integer ()));
+          }
+
+          else if (val->is_float ())
+          {
+            double d = val->get_float ();
+            uint64_t bits;
+            memcpy (&bits, &d, sizeof (bits));
+            this->slot (pos, SLOT_FLOAT, 0, bits);
+          }
+
+          else if (val->is_boolean ())
+          {
+            this->slot (pos, val->get_boolean () ? SLOT_TRUE : SLOT_FALSE, 0, 0);
+          }
+
+          else
+          {
+            this->slot (pos, SLOT_NULL, 0, 0);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // de-duplicates the recorded keys into the dictionary and
+        // points every key slot at it. returns the dictionary offset.
+        size_t keys ()
+        {
+          size_t nrefs = m_keys.tell () / sizeof (keyref);
+          keyref *refs = (keyref *) m_keys.buffer ();
+
+          // open-addressed set of distinct keys (id + 1)
+          size_t cap = 16;
+          while (cap < (nrefs * 2)) { cap <<= 1; }
+
+          kvr::mem_ostream setbuf (cap * sizeof (uint32_t));
+          uint32_t *set = (uint32_t *) setbuf.push (cap * sizeof (uint32_t));
+          memset (set, 0, cap * sizeof (uint32_t));
+
+          // first occurrence of each distinct key
+          kvr::mem_ostream firstbuf ((nrefs + 1) * sizeof (uint32_t));
+          uint32_t *first = (uint32_t *) firstbuf.push ((nrefs + 1) * sizeof (uint32_t));
+
+          for (size_t r = 0; r < nrefs; ++r)
+          {
+            keyref &ref = refs [r];
+            size_t i = ref.hash & (cap - 1);
+
+            while (set [i] != 0)
+            {
+              const keyref &other = refs [first [set [i] - 1]];
+              if ((other.hash == ref.hash) && (other.len == ref.len) && (memcmp (other.str, ref.str, ref.len) == 0))
+              {
+                break;
+              }
+              i = (i + 1) & (cap - 1);
+            }
+
+            if (set [i] == 0)
+            {
+              first [m_nkeys] = static_cast<uint32_t>(r);
+              set [i] = static_cast<uint32_t>(++m_nkeys);
+            }
+
+            ref.id = set [i] - 1;
+          }
+
+          size_t dict = this->reserve (m_nkeys * DICT_ENTRY_SIZE);
+
+          kvr::mem_ostream offbuf ((m_nkeys + 1) * sizeof (uint64_t));
+          uint64_t *offs = (uint64_t *) offbuf.push ((m_nkeys + 1) * sizeof (uint64_t));
+
+          for (size_t k = 0; k < m_nkeys; ++k)
+          {
+            const keyref &ref = refs [first [k]];
+            size_t spos = this->reserve (size_t (ref.len) + 1);
+            memcpy (this->at (spos), ref.str, ref.len);
+
+            uint8_t *d = this->at (dict + (k * DICT_ENTRY_SIZE));
+            set_u64 (d, spos);
+            set_u32 (d + 8, ref.len);
+            set_u32 (d + 12, ref.hash);
+            offs [k] = spos;
+          }
+
+          for (size_t r = 0; r < nrefs; ++r)
+          {
+            set_u64 (this->at (refs [r].slot + 8), offs [refs [r].id] - refs [r].slot);
+          }
+
+          return dict;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static size_t node_size (const kvr::value *val)
+        {
+          size_t sz = 0;
+
+          if (val->is_map ())
+          {
+            size_t count = val->size ();
+            size_t nb = 0;
+            if (count > 0)
+            {
+              for (nb = 2; nb < (count * 2); nb <<= 1) {}
+            }
+
+            sz = 7 + MAP_HEAD_SIZE + (nb * BUCKET_SIZE) + (count * ENTRY_SIZE);
+
+            kvr::value::cursor c (val);
+            kvr::pair p;
+            while (c.get (&p))
+            {
+              sz += DICT_ENTRY_SIZE + align (size_t (p.get_key ()->get_length ()) + 1) + node_size (p.get_value ());
+            }
+          }
+
+          else if (val->is_array ())
+          {
+            kvr::sz_t count = val->length ();
+            sz = 7 + (size_t (count) * SLOT_SIZE);
+            for (kvr::sz_t i = 0; i < count; ++i)
+            {
+              sz += node_size (val->element (i));
+            }
+          }
+
+          else if (val->is_string ())
+          {
+            kvr::sz_t len = 0;
+            val->get_string (&len);
+            sz = 7 + align (size_t (len) + 1);
+          }
+
+          else if (val->is_binary ())
+          {
+            kvr::sz_t size = 0;
+            val->get_binary (&size);
+            sz = 7 + align (size_t (size));
+          }
+
+          return sz;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        kvr::mem_ostream *  m_os;
+        size_t              m_base;
+        kvr::mem_ostream    m_keys;
+        size_t              m_nkeys;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline bool write (const kvr::value *src, kvr::mem_ostream *ostr)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
+
+        // sized up front: one allocation, and room for flush's terminator
+        ostr->reserve (ostr->tell () + writer::write_size (src) + 1);
+
+        writer wrt (ostr);
+
+        if (wrt.write (src))
+        {
+          ostr->flush ();
+          return true;
+        }
+
+        return false;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // offsets are patched after the fact, so the snapshot is
+      // staged in memory and handed to the stream in one go
+      inline bool write (const kvr::value *src, kvr::ostream *ostr)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
+
+        kvr::mem_ostream staged (writer::write_size (src));
+        writer wrt (&staged);
+
+        if (wrt.write (src))
+        {
+          ostr->write (const_cast<uint8_t *>(staged.buffer ()), staged.tell ());
+          ostr->flush ();
+          return true;
+        }
+
+        return false;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline size_t write_size (const kvr::value *val)
+      {
+        KVR_ASSERT (val);
+        return writer::write_size (val);
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,300 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE for details.
+ */
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef KVR_LZ_H
+#define KVR_LZ_H
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace kvr
+{
+  namespace internal
+  {
+    namespace lz
+    {
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // block compressor (lz77, greedy, one hash probe per position). a block is a run of
+      // sequences: a token (literal count << 4 | match length - 4, 15 meaning more length
+      // bytes follow, each added until one is below 255), the literals, then a u16
+      // little-endian match offset and any more match length bytes. the last sequence
+      // is literals only. offsets reach back 65535 bytes, never past the block start.
+      //
+      // framed container (kvr::compressed_ostream, all little-endian):
+      //   header:  "KVRZ" u32 block size
+      //   block:   u32 raw size, u32 packed size, u32 adler-32 of the raw bytes, packed bytes
+      //            (packed size equal to raw size: stored uncompressed)
+      //   end:     u32 0, u32 index size, u32 adler-32 of the index, index (u64 offset of
+      //            each block from the header)
+      //   footer:  u64 offset of the end block, "KVRZ"
+
+      static const size_t   MIN_MATCH         = 4;
+      static const size_t   MAX_OFFSET        = 65535;
+      static const unsigned HASH_BITS         = 14;
+      static const size_t   HASH_SIZE         = size_t (1) << HASH_BITS;
+
+      static const uint8_t  FRAME_MAGIC [4]   = { 'K', 'V', 'R', 'Z' };
+      static const size_t   FRAME_HEADER_SIZE = 8;
+      static const size_t   BLOCK_HEADER_SIZE = 12;
+      static const size_t   FOOTER_SIZE       = 12;
+      static const size_t   MIN_BLOCK_SIZE    = 64;
+      static const size_t   MAX_BLOCK_SIZE    = size_t (1) << 26;
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline uint32_t get_u32 (const uint8_t *p)
+      {
+        return uint32_t (p [0]) | (uint32_t (p [1]) << 8) | (uint32_t (p [2]) << 16) | (uint32_t (p [3]) << 24);
+      }
+
+      inline uint64_t get_u64 (const uint8_t *p)
+      {
+        return uint64_t (get_u32 (p)) | (uint64_t (get_u32 (p + 4)) << 32);
+      }
+
+      inline void set_u32 (uint8_t *p, uint32_t v)
+      {
+        p [0] = uint8_t (v); p [1] = uint8_t (v >> 8); p [2] = uint8_t (v >> 16); p [3] = uint8_t (v >> 24);
+      }
+
+      inline void set_u64 (uint8_t *p, uint64_t v)
+      {
+        set_u32 (p, uint32_t (v)); set_u32 (p + 4, uint32_t (v >> 32));
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // packed size of 'size' bytes at worst (no matches)
+      inline size_t bound (size_t size)
+      {
+        return size + (size / 255) + 16;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline uint32_t read32 (const uint8_t *p)
+      {
+        uint32_t u = 0;
+        memcpy (&u, p, 4);
+        return u;
+      }
+
+      inline size_t hash (uint32_t seq)
+      {
+        return size_t ((seq * 2654435761u) >> (32 - HASH_BITS));
+      }
+
+      inline uint8_t * put_length (uint8_t *op, size_t len)
+      {
+        while (len >= 255)
+        {
+          *op++ = 255;
+          len -= 255;
+        }
+        *op++ = uint8_t (len);
+        return op;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // 'match' of 0: the last sequence
+      inline uint8_t * put_sequence (uint8_t *op, const uint8_t *lit, size_t litlen, size_t offset, size_t match)
+      {
+        uint8_t *token = op++;
+        size_t mlen = (match > 0) ? (match - MIN_MATCH) : 0;
+        *token = uint8_t (((litlen < 15) ? litlen : 15) << 4) | uint8_t ((mlen < 15) ? mlen : 15);
+
+        if (litlen >= 15)
+        {
+          op = put_length (op, litlen - 15);
+        }
+        memcpy (op, lit, litlen);
+        op += litlen;
+
+        if (match > 0)
+        {
+          *op++ = uint8_t (offset);
+          *op++ = uint8_t (offset >> 8);
+          if (mlen >= 15)
+          {
+            op = put_length (op, mlen - 15);
+          }
+        }
+
+        return op;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // 'dest' must hold bound (size) bytes, 'table' HASH_SIZE entries. returns the packed size
+      inline size_t compress (const uint8_t *src, size_t size, uint8_t *dest, uint32_t *table)
+      {
+        KVR_ASSERT (src || (size == 0));
+        KVR_ASSERT (dest && table);
+
+        // entries left from another block would still be safe; clearing keeps the output deterministic
+        memset (table, 0, sizeof (uint32_t) * HASH_SIZE);
+
+        uint8_t *op = dest;
+        size_t anchor = 0, i = 0, misses = 0;
+
+        // a match needs MIN_MATCH bytes to compare
+        const size_t limit = (size > MIN_MATCH) ? (size - MIN_MATCH) : 0;
+
+        while (i < limit)
+        {
+          uint32_t seq = read32 (src + i);
+          size_t h = hash (seq);
+          size_t ref = table [h];
+          table [h] = uint32_t (i);
+
+          if ((ref >= i) || ((i - ref) > MAX_OFFSET) || (read32 (src + ref) != seq))
+          {
+            // step up through incompressible data
+            i += 1 + (misses++ >> 6);
+            continue;
+          }
+
+          misses = 0;
+
+          while ((i > anchor) && (ref > 0) && (src [i - 1] == src [ref - 1]))
+          {
+            --i;
+            --ref;
+          }
+
+          size_t match = MIN_MATCH;
+          while (((i + match) < size) && (src [i + match] == src [ref + match]))
+          {
+            ++match;
+          }
+
+          op = put_sequence (op, src + anchor, i - anchor, i - ref, match);
+          i += match;
+          anchor = i;
+        }
+
+        op = put_sequence (op, src + anchor, size - anchor, 0, 0);
+
+        return size_t (op - dest);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      inline bool get_length (const uint8_t *src, size_t size, size_t *ip, size_t *len)
+      {
+        uint8_t b = 0;
+        do
+        {
+          if (*ip >= size)
+          {
+            return false;
+          }
+          b = src [(*ip)++];
+          *len += b;
+        } while (b == 255);
+        return true;
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // true if 'src' unpacks to exactly 'rawsz' bytes
+      inline bool decompress (const uint8_t *src, size_t size, uint8_t *dest, size_t rawsz)
+      {
+        KVR_ASSERT (src || (size == 0));
+        KVR_ASSERT (dest || (rawsz == 0));
+
+        size_t ip = 0, op = 0;
+
+        while (ip < size)
+        {
+          uint8_t token = src [ip++];
+
+          size_t lit = token >> 4;
+          if ((lit == 15) && !get_length (src, size, &ip, &lit))
+          {
+            return false;
+          }
+          if ((lit > (size - ip)) || (lit > (rawsz - op)))
+          {
+            return false;
+          }
+          memcpy (dest + op, src + ip, lit);
+          ip += lit;
+          op += lit;
+
+          if (ip == size)
+          {
+            break;
+          }
+
+          if ((size - ip) < 2)
+          {
+            return false;
+          }
+          size_t offset = size_t (src [ip]) | (size_t (src [ip + 1]) << 8);
+          ip += 2;
+
+          size_t match = token & 0x0f;
+          if ((match == 15) && !get_length (src, size, &ip, &match))
+          {
+            return false;
+          }
+          match += MIN_MATCH;
+
+          if ((offset == 0) || (offset > op) || (match > (rawsz - op)))
+          {
+            return false;
+          }
+
+          const uint8_t *ref = dest + op - offset;
+          if (offset >= match)
+          {
+            memcpy (dest + op, ref, match);
+          }
+          else
+          {
+            // overlapping: a repeating run
+            for (size_t k = 0; k < match; ++k)
+            {
+              dest [op + k] = ref [k];
+            }
+          }
+          op += match;
+        }
+
+        return op == rawsz;
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
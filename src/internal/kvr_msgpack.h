@@ -68,6 +68,27 @@ namespace kvr
       static const uint8_t MSGPACK_HEADER_STRING_8    = 0xd9;
       static const uint8_t MSGPACK_HEADER_STRING_16   = 0xda;
       static const uint8_t MSGPACK_HEADER_STRING_32   = 0xdb;
+      static const uint8_t MSGPACK_HEADER_BINARY_8    = 0xc4;
+      static const uint8_t MSGPACK_HEADER_BINARY_16   = 0xc5;
+      static const uint8_t MSGPACK_HEADER_BINARY_32   = 0xc6;
+      static const uint8_t MSGPACK_HEADER_FIXEXT_1    = 0xd4;
+      static const uint8_t MSGPACK_HEADER_FIXEXT_2    = 0xd5;
+      static const uint8_t MSGPACK_HEADER_FIXEXT_4    = 0xd6;
+      static const uint8_t MSGPACK_HEADER_EXT_8       = 0xc7;
+      static const uint8_t MSGPACK_HEADER_EXT_16      = 0xc8;
+      static const uint8_t MSGPACK_HEADER_EXT_32      = 0xc9;
+
+      // key tables (application ext types): a document wrapped in KEY_TABLE numbers 
+      // its key literals of KEY_TABLE_MIN_LEN or more bytes, in order; KEY_REF 
+      // (fixext 1/2/4, big-endian index) stands in for a numbered key.
+      static const uint8_t MSGPACK_EXT_KEY_TABLE      = 0x4b;
+      static const uint8_t MSGPACK_EXT_KEY_REF        = 0x6b;
+      static const size_t  MSGPACK_KEY_TABLE_MIN_LEN  = 3;
+
+      // numeric columns (application ext types): an array packed by 
+      // kvr::internal::column_delta_pack (DELTA) or column_xor_pack (XOR).
+      static const uint8_t MSGPACK_EXT_DELTA          = 0x44;
+      static const uint8_t MSGPACK_EXT_XOR            = 0x58;
 
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
@@ -84,6 +105,17 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        // reuse for another document
+        void reset (kvr::value *value)
+        {
+          memset (m_stack, 0, sizeof (m_stack));
+          m_root = value;
+          m_temp = NULL;
+          m_depth = 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_null ()
         {
           bool success = false;
@@ -241,6 +273,37 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        bool read_binary (const uint8_t *data, kvr::sz_t size)
+        {
+          bool success = false;
+
+          KVR_ASSERT (data || (size == 0));
+          KVR_ASSERT_SAFE (m_depth != 0, success);
+          kvr::value *node = m_stack [m_depth - 1];
+          KVR_ASSERT (node);
+          KVR_ASSERT (node->is_map () || node->is_array ());
+
+          if (node->is_map ())
+          {
+            KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
+            m_temp->conv_binary ();
+            m_temp->set_binary (data, size);
+            m_temp = NULL;
+            success = true;
+          }
+          else if (node->is_array ())
+          {
+            kvr::value *vbin = node->push_null (); KVR_ASSERT (vbin);
+            vbin->conv_binary ();
+            vbin->set_binary (data, size);
+            success = true;
+          }
+
+          return success;
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_map_start (kvr::sz_t size)
         {
           bool success = false;
@@ -256,7 +319,7 @@ namespace kvr
             {
               node = m_temp;
               KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
-              m_temp->conv_map (size);
+              (size > 0) ? m_temp->conv_map (size) : m_temp->conv_map ();
               m_temp = NULL;
               success = true;
             }
@@ -268,7 +331,7 @@ namespace kvr
           }
           else
           {
-            node = m_root->conv_map (size);
+            node = (size > 0) ? m_root->conv_map (size) : m_root->conv_map ();
             success = true;
           }
 
@@ -301,6 +364,21 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
+        // a numbered key (key table). the handle is set by its first insert
+        bool read_key_ref (const char *str, kvr::sz_t length, kvr::key **handle)
+        {
+          KVR_ASSERT (str && handle);
+          kvr::value *node = m_stack [m_depth - 1];
+          KVR_ASSERT_SAFE (node && node->is_map (), false);
+
+          KVR_ASSERT (!m_temp);
+          KVR_REF_UNUSED (length);
+          m_temp = *handle ? node->insert_null (*handle) : node->insert_null (str, handle);
+          return (m_temp != NULL);
+        }
+
+        ////////////////////////////////////////////////////////////
+
         bool read_map_end (kvr::sz_t size)
         {
           kvr::value *node = m_stack [m_depth - 1];
@@ -328,7 +406,7 @@ namespace kvr
             {
               node = m_temp;
               KVR_ASSERT_SAFE (m_temp && m_temp->is_null (), false);
-              m_temp->conv_array (length);
+              (length > 0) ? m_temp->conv_array (length) : m_temp->conv_array ();
               m_temp = NULL;
               success = true;
             }
@@ -340,7 +418,7 @@ namespace kvr
           }
           else
           {
-            node = m_root->conv_array (length);
+            node = (length > 0) ? m_root->conv_array (length) : m_root->conv_array ();
             success = true;
           }
 
@@ -374,14 +452,31 @@ namespace kvr
       /////////////////////////////////////////////////////////////////////////////////////////////
       /////////////////////////////////////////////////////////////////////////////////////////////
 
-      template<typename istr>
+      // numbered keys go to the context by handle where it can take one
+      template<typename rctx>
+      inline bool read_key_ref (rctx &ctx, const char *str, kvr::sz_t length, kvr::key **handle)
+      {
+        KVR_REF_UNUSED (handle);
+        return ctx.read_key (str, length);
+      }
+
+      inline bool read_key_ref (read_ctx &ctx, const char *str, kvr::sz_t length, kvr::key **handle)
+      {
+        return ctx.read_key_ref (str, length, handle);
+      }
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      template<typename istr, typename rctx = read_ctx>
       struct reader
       {
       public:
 
-        reader () : m_ss (256) {}
+        reader () : m_ss (m_ssbuf, sizeof (m_ssbuf)), m_refs (NULL) {}
 
-        bool parse (istr *is, read_ctx &ctx)
+        bool parse (istr *is, rctx &ctx)
         {
           KVR_ASSERT (is);
 
@@ -400,6 +495,9 @@ namespace kvr
               case MSGPACK_HEADER_STRING_8:     { success = parse_string8 (is, ctx); break; }
               case MSGPACK_HEADER_STRING_16:    { success = parse_string16 (is, ctx); break; }
               case MSGPACK_HEADER_STRING_32:    { success = parse_string32 (is, ctx); break; }
+              case MSGPACK_HEADER_BINARY_8:     { success = parse_binary8 (is, ctx); break; }
+              case MSGPACK_HEADER_BINARY_16:    { success = parse_binary16 (is, ctx); break; }
+              case MSGPACK_HEADER_BINARY_32:    { success = parse_binary32 (is, ctx); break; }
               case MSGPACK_HEADER_ARRAY_16:     { success = parse_array16 (is, ctx); break; }
               case MSGPACK_HEADER_ARRAY_32:     { success = parse_array32 (is, ctx); break; }
               case MSGPACK_HEADER_MAP_16:       { success = parse_map16 (is, ctx); break; }
@@ -412,6 +510,9 @@ namespace kvr
               case MSGPACK_HEADER_SIGNED_16:    { success = parse_signed16 (is, ctx); break; }
               case MSGPACK_HEADER_SIGNED_32:    { success = parse_signed32 (is, ctx); break; }
               case MSGPACK_HEADER_SIGNED_64:    { success = parse_signed64 (is, ctx); break; }
+              case MSGPACK_HEADER_EXT_8:        { success = parse_ext (is, ctx, 1); break; }
+              case MSGPACK_HEADER_EXT_16:       { success = parse_ext (is, ctx, 2); break; }
+              case MSGPACK_HEADER_EXT_32:       { success = parse_ext (is, ctx, 4); break; }
               default:
               {
                 if (curr <= 127)                                    { success = parse_unsigned7 (ctx, curr); }
@@ -431,11 +532,9 @@ namespace kvr
           return success;
         }
 
-      private:
-
         ////////////////////////////////////////////////////////////
 
-        bool parse_key (istr *is, read_ctx &ctx)
+        bool parse_key (istr *is, rctx &ctx)
         {
           KVR_ASSERT (is);
 
@@ -449,6 +548,9 @@ namespace kvr
               case MSGPACK_HEADER_STRING_8:   { success = parse_key8 (is, ctx); break; }
               case MSGPACK_HEADER_STRING_16:  { success = parse_key16 (is, ctx); break; }
               case MSGPACK_HEADER_STRING_32:  { success = parse_key32 (is, ctx); break; }
+              case MSGPACK_HEADER_FIXEXT_1:   { success = parse_key_ref (is, ctx, 1); break; }
+              case MSGPACK_HEADER_FIXEXT_2:   { success = parse_key_ref (is, ctx, 2); break; }
+              case MSGPACK_HEADER_FIXEXT_4:   { success = parse_key_ref (is, ctx, 4); break; }
               default:
               {
                 if ((curr & 0xe0) == MSGPACK_HEADER_STRING_5) { success = parse_key5 (is, ctx, curr); }
@@ -460,9 +562,92 @@ namespace kvr
           return success;
         }
 
+      private:
+
+        ////////////////////////////////////////////////////////////
+
+        // key literal, numbered inside a key table
+        bool on_key (rctx &ctx, const char *str, kvr::sz_t slen)
+        {
+          if (m_refs)
+          {
+            const char *copy = NULL;
+            kvr::key **handle = m_refs->literal (str, slen, &copy);
+            if (handle)
+            {
+              return read_key_ref (ctx, copy, slen, handle);
+            }
+          }
+          return ctx.read_key (str, slen);
+        }
+
         ////////////////////////////////////////////////////////////
 
-        bool parse_key5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_key_ref (istr *is, rctx &ctx, size_t n)
+        {
+          uint8_t b [5];
+          if (!m_refs || !is->read (b, n + 1) || (b [0] != MSGPACK_EXT_KEY_REF))
+          {
+            return false;
+          }
+
+          uint32_t index = 0;
+          for (size_t i = 1; i <= n; ++i)
+          {
+            index = (index << 8) | b [i];
+          }
+
+          const char *str = NULL;
+          kvr::sz_t slen = 0;
+          kvr::key **handle = NULL;
+          return m_refs->get (index, &str, &slen, &handle) && read_key_ref (ctx, str, slen, handle);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // key table (the wrapped document follows) or numeric column
+        bool parse_ext (istr *is, rctx &ctx, size_t n)
+        {
+          uint8_t b [5];
+          if (!is->read (b, n + 1))
+          {
+            return false;
+          }
+
+          uint32_t len = 0;
+          for (size_t i = 0; i < n; ++i)
+          {
+            len = (len << 8) | b [i];
+          }
+
+          uint8_t type = b [n];
+
+          if (type == MSGPACK_EXT_KEY_TABLE)
+          {
+            kvr::internal::strref_reader refs (MSGPACK_KEY_TABLE_MIN_LEN);
+            kvr::internal::strref_reader *outer = m_refs;
+            m_refs = &refs;
+            bool ok = parse (is, ctx);
+            m_refs = outer;
+            return ok;
+          }
+
+          if ((type == MSGPACK_EXT_DELTA) || (type == MSGPACK_EXT_XOR))
+          {
+            const uint8_t *data = is->push (len);
+            if (!data)
+            {
+              return false;
+            }
+            return (type == MSGPACK_EXT_DELTA) ? kvr::internal::column_delta_unpack (data, len, ctx) : kvr::internal::column_xor_unpack (data, len, ctx);
+          }
+
+          return false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_key5 (istr *is, rctx &ctx, uint8_t data)
         {
           uint8_t slen = (data & 0x1f);
           //char str [32];
@@ -472,14 +657,14 @@ namespace kvr
           if (is->read (str, slen))
           {
             str [slen] = 0;
-            return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+            return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
           }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key8 (istr *is, read_ctx &ctx)
+        bool parse_key8 (istr *is, rctx &ctx)
         {
           uint8_t slen = 0;
           if (is->get (&slen))
@@ -490,7 +675,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -498,7 +683,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key16 (istr *is, read_ctx &ctx)
+        bool parse_key16 (istr *is, rctx &ctx)
         {
           uint16_t len = 0;
           if (is->read ((uint8_t *) &len, 2))
@@ -510,7 +695,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -518,7 +703,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_key32 (istr *is, read_ctx &ctx)
+        bool parse_key32 (istr *is, rctx &ctx)
         {
           uint32_t len = 0;
           if (is->read ((uint8_t *) &len, 4))
@@ -530,7 +715,7 @@ namespace kvr
             if (is->read (str, slen))
             {
               str [slen] = 0;
-              return ctx.read_key (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
+              return on_key (ctx, reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
             }
           }
           return false;
@@ -538,21 +723,21 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_null (read_ctx &ctx)
+        bool parse_null (rctx &ctx)
         {
           return ctx.read_null ();
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_bool (read_ctx &ctx, bool val)
+        bool parse_bool (rctx &ctx, bool val)
         {
           return ctx.read_boolean (val);
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_float32 (istr *is, read_ctx &ctx)
+        bool parse_float32 (istr *is, rctx &ctx)
         {
           uint32_t u = 0;
           if (is->read ((uint8_t *) &u, 4))
@@ -574,7 +759,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_float64 (istr *is, read_ctx &ctx)
+        bool parse_float64 (istr *is, rctx &ctx)
         {
           uint64_t u = 0;
           if (is->read ((uint8_t *) &u, 8))
@@ -596,7 +781,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array4 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_array4 (istr *is, rctx &ctx, uint8_t data)
         {
           uint8_t alen = (data & 0x0f);
           bool ok = ctx.read_array_start (alen);
@@ -604,15 +789,13 @@ namespace kvr
           {
             ok &= parse (is, ctx);
           }
-#if KVR_DEBUG
           ok = ok && ctx.read_array_end (alen);
-#endif
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array16 (istr *is, read_ctx &ctx)
+        bool parse_array16 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint16_t len = 0;
@@ -624,16 +807,14 @@ namespace kvr
             {
               ok &= parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_array_end (static_cast<kvr::sz_t>(alen));
-#endif
+            ok = ok && ctx.read_array_end (static_cast<kvr::sz_t>(alen));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_array32 (istr *is, read_ctx &ctx)
+        bool parse_array32 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint32_t len = 0;
@@ -645,33 +826,28 @@ namespace kvr
             {
               ok &= parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_array_end (static_cast<kvr::sz_t>(alen));
-#endif
+            ok = ok && ctx.read_array_end (static_cast<kvr::sz_t>(alen));
           }
           return ok;
         }
         
         ////////////////////////////////////////////////////////////
 
-        bool parse_map4 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_map4 (istr *is, rctx &ctx, uint8_t data)
         {
           uint8_t msz = (data & 0x0f);
           bool ok = ctx.read_map_start (msz);
           for (uint8_t i = 0; ok && (i < msz); ++i)
           {
-            ok &= parse_key (is, ctx);
-            ok &= parse (is, ctx);
+            ok = parse_key (is, ctx) && parse (is, ctx);
           }
-#if KVR_DEBUG
-          ok &= ctx.read_map_end (msz);
-#endif
+          ok = ok && ctx.read_map_end (msz);
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_map16 (istr *is, read_ctx &ctx)
+        bool parse_map16 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint16_t len = 0;
@@ -681,19 +857,16 @@ namespace kvr
             ok = ctx.read_map_start (static_cast<kvr::sz_t>(msz));
             for (uint16_t i = 0; ok && (i < msz); ++i)
             {
-              ok &= parse_key (is, ctx);
-              ok &= parse (is, ctx);
+              ok = parse_key (is, ctx) && parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_map_end (static_cast<kvr::sz_t>(msz));
-#endif
+            ok = ok && ctx.read_map_end (static_cast<kvr::sz_t>(msz));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_map32 (istr *is, read_ctx &ctx)
+        bool parse_map32 (istr *is, rctx &ctx)
         {
           bool ok = false;
           uint32_t len = 0;
@@ -703,103 +876,114 @@ namespace kvr
             ok = ctx.read_map_start (static_cast<kvr::sz_t>(msz));
             for (uint32_t i = 0; ok && (i < msz); ++i)
             {
-              ok &= parse_key (is, ctx);
-              ok &= parse (is, ctx);
+              ok = parse_key (is, ctx) && parse (is, ctx);
             }
-#if KVR_DEBUG
-            ok &= ctx.read_map_end (static_cast<kvr::sz_t>(msz));
-#endif
+            ok = ok && ctx.read_map_end (static_cast<kvr::sz_t>(msz));
           }
           return ok;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string5 (istr *is, read_ctx &ctx, uint8_t data)
+        bool parse_string5 (istr *is, rctx &ctx, uint8_t data)
         {
-          uint8_t slen = (data & 0x1f);          
-          //KVR_ASSERT (slen < 32);
-          //char str [32];
-          m_ss.seek (0);
-          uint8_t *str = m_ss.push (slen + 1);
-          KVR_ASSERT (str);
-          if (is->read (str, slen))
-          {
-            str [slen] = 0;
-            return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-          }
-          return false;      
+          uint8_t slen = (data & 0x1f);
+          const char *str = (const char *) is->push (slen);
+          return str ? ctx.read_string (str, slen) : false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string8 (istr *is, read_ctx &ctx)
+        bool parse_string8 (istr *is, rctx &ctx)
         {
-          uint8_t slen = 0;      
+          uint8_t slen = 0;
           if (is->get (&slen))
           {
-            m_ss.seek (0);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
-          }      
+            const char *str = (const char *) is->push (slen);
+            return str ? ctx.read_string (str, slen) : false;
+          }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string16 (istr *is, read_ctx &ctx)
+        bool parse_string16 (istr *is, rctx &ctx)
         {
           uint16_t len = 0;
           if (is->read ((uint8_t *) &len, 2))
           {
-            m_ss.seek (0);
             uint16_t slen = kvr_bigendian16 (len);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
+            const char *str = (const char *) is->push (slen);
+            return str ? ctx.read_string (str, slen) : false;
           }
           return false;
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_string32 (istr *is, read_ctx &ctx)
+        bool parse_string32 (istr *is, rctx &ctx)
         {
           uint32_t len = 0;
           if (is->read ((uint8_t *) &len, 4))
           {
-            m_ss.seek (0);
             uint32_t slen = kvr_bigendian32 (len);
-            uint8_t *str = m_ss.push (slen + 1);
-            KVR_ASSERT (str);
-            if (is->read (str, slen))
-            {
-              str [slen] = 0;
-              return ctx.read_string (reinterpret_cast<const char *>(str), static_cast<kvr::sz_t>(slen));
-            }
+            const char *str = (const char *) is->push (slen);
+            return str ? ctx.read_string (str, static_cast<kvr::sz_t>(slen)) : false;
+          }
+          return false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_binary8 (istr *is, rctx &ctx)
+        {
+          uint8_t size = 0;
+          if (is->get (&size))
+          {
+            const uint8_t *data = is->push (size);
+            return data ? ctx.read_binary (data, size) : false;
+          }
+          return false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_binary16 (istr *is, rctx &ctx)
+        {
+          uint16_t len = 0;
+          if (is->read ((uint8_t *) &len, 2))
+          {
+            uint16_t size = kvr_bigendian16 (len);
+            const uint8_t *data = is->push (size);
+            return data ? ctx.read_binary (data, size) : false;
+          }
+          return false;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool parse_binary32 (istr *is, rctx &ctx)
+        {
+          uint32_t len = 0;
+          if (is->read ((uint8_t *) &len, 4))
+          {
+            uint32_t size = kvr_bigendian32 (len);
+            const uint8_t *data = is->push (size);
+            return data ? ctx.read_binary (data, static_cast<kvr::sz_t>(size)) : false;
           }
           return false;
         }
     
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned7 (read_ctx &ctx, uint8_t data)
+        bool parse_unsigned7 (rctx &ctx, uint8_t data)
         {
           return ctx.read_integer (data);
         }
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned8 (istr *is, read_ctx &ctx)
+        bool parse_unsigned8 (istr *is, rctx &ctx)
         {
           uint8_t i = 0;
           if (is->get (&i))
@@ -811,7 +995,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned16 (istr *is, read_ctx &ctx)
+        bool parse_unsigned16 (istr *is, rctx &ctx)
         {
           uint16_t u16 = 0;
           if (is->read ((uint8_t *) &u16, 2))
@@ -824,7 +1008,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned32 (istr *is, read_ctx &ctx)
+        bool parse_unsigned32 (istr *is, rctx &ctx)
         {
           uint32_t u32 = 0;
           if (is->read ((uint8_t *) &u32, 4))
@@ -837,7 +1021,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_unsigned64 (istr *is, read_ctx &ctx)
+        bool parse_unsigned64 (istr *is, rctx &ctx)
         {
     #if 1
           KVR_ASSERT (false && "not supported");
@@ -857,7 +1041,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_signed5 (read_ctx &ctx, uint8_t data)
+        bool parse_signed5 (rctx &ctx, uint8_t data)
         {
           int8_t i = (int8_t) data;
           return ctx.read_integer (i);
@@ -865,7 +1049,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_signed8 (istr *is, read_ctx &ctx)
+        bool parse_signed8 (istr *is, rctx &ctx)
         {
           uint8_t u8 = 0;
           if (is->get (&u8))
@@ -878,7 +1062,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_signed16 (istr *is, read_ctx &ctx)
+        bool parse_signed16 (istr *is, rctx &ctx)
         {
           uint16_t u16 = 0;
           if (is->read ((uint8_t *) &u16, 2))
@@ -892,7 +1076,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_signed32 (istr *is, read_ctx &ctx)
+        bool parse_signed32 (istr *is, rctx &ctx)
         {
           uint32_t u32 = 0;
           if (is->read ((uint8_t *) &u32, 4))
@@ -906,7 +1090,7 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool parse_signed64 (istr *is, read_ctx &ctx)
+        bool parse_signed64 (istr *is, rctx &ctx)
         {
           uint64_t u64 = 0;
           if (is->read ((uint8_t *) &u64, 8))
@@ -920,61 +1104,18 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        kvr::mem_ostream m_ss;
+        uint8_t                         m_ssbuf [256];
+        kvr::mem_ostream                m_ss;
+        kvr::internal::strref_reader *  m_refs;
       };
 
-      template<>
-      bool reader<kvr::mem_istream>::parse_string5 (kvr::mem_istream *is, read_ctx &ctx, uint8_t data)
-      {
-        uint8_t slen = (data & 0x1f);
-        const char *str = (const char *) is->push (slen);
-        return str ? ctx.read_string (str, slen) : false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string8 (kvr::mem_istream *is, read_ctx &ctx)
-      {
-        uint8_t slen = 0;
-        if (is->get (&slen))
-        {
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_string (str, slen) : false;
-        }
-        return false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string16 (kvr::mem_istream *is, read_ctx &ctx)
-      {
-        uint16_t len = 0;
-        if (is->read ((uint8_t *) &len, 2))
-        {
-          uint16_t slen = kvr_bigendian16 (len);
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_string (str, slen) : false;
-        }
-        return false;
-      }
-
-      template<>
-      bool reader<kvr::mem_istream>::parse_string32 (kvr::mem_istream *is, read_ctx &ctx)
-      {    
-        uint32_t len = 0;
-        if (is->read ((uint8_t *) &len, 4))
-        {
-          uint32_t slen = kvr_bigendian32 (len);
-          const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, static_cast<kvr::sz_t>(slen)) : false;
-        }
-        return false;
-      }
     #if KVR_MSGPACK_READ_KEY_SPECIALIZATION
       template<>
       bool reader<kvr::mem_istream>::parse_key5 (kvr::mem_istream *is, read_ctx &ctx, uint8_t data)
       {
         uint8_t slen = (data & 0x1f);
         const char *str = (const char *) is->push (slen);
-        return str ? ctx.read_key (str, slen) : false;
+        return str ? on_key (ctx, str, slen) : false;
       }
 
       template<>
@@ -984,7 +1125,7 @@ namespace kvr
         if (is->get (&slen))
         {
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -997,7 +1138,7 @@ namespace kvr
         {
           uint16_t slen = kvr_bigendian16 (len);
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -1010,7 +1151,7 @@ namespace kvr
         {
           uint32_t slen = kvr_bigendian32 (len);
           const char *str = (const char *) is->push (slen);
-          return str ? ctx.read_key (str, slen) : false;
+          return str ? on_key (ctx, str, slen) : false;
         }
         return false;
       }
@@ -1130,55 +1271,149 @@ namespace kvr
 
         ////////////////////////////////////////////////////////////
 
-        bool write_integer (int64_t i64)
+        bool write_binary (const uint8_t *data, kvr::sz_t size)
         {
-          if (i64 >= 0) // unsigned
+          if (size <= 0xff)
           {
-            if (i64 <= 127)
-            {
-              uint8_t i = static_cast<uint8_t>(i64);
-              m_os->put (i);
-            }
-            else if (i64 <= 0xff)
-            {
-              uint8_t i = static_cast<uint8_t>(i64);
-              m_os->put (MSGPACK_HEADER_UNSIGNED_8);
-              m_os->put (i);
-            }
-            else if (i64 <= 0xffff)
-            {
-              uint16_t i = kvr_bigendian16 (i64);
-              m_os->put (MSGPACK_HEADER_UNSIGNED_16);              
-              m_os->write ((uint8_t *) &i, 2);
-            }
-            else if (i64 <= 0xffffffff)
-            {
-              uint32_t i = kvr_bigendian32 (i64);
-              m_os->put (MSGPACK_HEADER_UNSIGNED_32);              
-              m_os->write ((uint8_t *) &i, 4);
-            }
-            else // max is int64_t;
-            {
-              uint64_t i = kvr_bigendian64 (i64);
-              m_os->put (MSGPACK_HEADER_SIGNED_64);              
-              m_os->write ((uint8_t *) &i, 8);
-            }
+            uint8_t len = static_cast<uint8_t>(size);
+            m_os->put (MSGPACK_HEADER_BINARY_8);
+            m_os->put (len);
           }
-          else // signed
+          else if (size <= 0xffff)
           {
-            const int64_t nint5 = -((1 << 5) - 1);
-            const int64_t nint8 = -((1 << 7) - 1);
-            const int64_t nint16 = -((1 << 15) - 1);
-            const int64_t nint32 = -((1LL << 31) - 1);
-
-            if (i64 >= nint5)
-            {
-              uint8_t i = static_cast<uint8_t>(i64);
-              m_os->put (MSGPACK_HEADER_SIGNED_5 | i);
-            }
-            else if (i64 >= nint8)
-            {
-              uint8_t i = static_cast<uint8_t>(i64);
+            uint16_t len = kvr_bigendian16 (size);
+            m_os->put (MSGPACK_HEADER_BINARY_16);
+            m_os->write ((uint8_t *) &len, 2);
+          }
+          else if (size <= 0xffffffff)
+          {
+            uint32_t len = kvr_bigendian32 (size);
+            m_os->put (MSGPACK_HEADER_BINARY_32);
+            m_os->write ((uint8_t *) &len, 4);
+          }
+          else
+          {
+            return false;
+          }
+
+          if (size > 0)
+          {
+            m_os->write (const_cast<uint8_t *> (data), (size_t) size);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_ext (uint8_t type, const uint8_t *data, size_t size)
+        {
+          if (size <= 0xff)
+          {
+            m_os->put (MSGPACK_HEADER_EXT_8);
+            m_os->put (static_cast<uint8_t>(size));
+          }
+          else if (size <= 0xffff)
+          {
+            uint16_t len = kvr_bigendian16 (size);
+            m_os->put (MSGPACK_HEADER_EXT_16);
+            m_os->write ((uint8_t *) &len, 2);
+          }
+          else if (size <= 0xffffffff)
+          {
+            uint32_t len = kvr_bigendian32 (size);
+            m_os->put (MSGPACK_HEADER_EXT_32);
+            m_os->write ((uint8_t *) &len, 4);
+          }
+          else
+          {
+            return false;
+          }
+
+          m_os->put (type);
+          m_os->write (const_cast<uint8_t *> (data), size);
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_key_ref (uint32_t index)
+        {
+          if (index <= 0xff)
+          {
+            m_os->put (MSGPACK_HEADER_FIXEXT_1);
+            m_os->put (MSGPACK_EXT_KEY_REF);
+            m_os->put (static_cast<uint8_t>(index));
+          }
+          else if (index <= 0xffff)
+          {
+            uint16_t i = kvr_bigendian16 (index);
+            m_os->put (MSGPACK_HEADER_FIXEXT_2);
+            m_os->put (MSGPACK_EXT_KEY_REF);
+            m_os->write ((uint8_t *) &i, 2);
+          }
+          else
+          {
+            uint32_t i = kvr_bigendian32 (index);
+            m_os->put (MSGPACK_HEADER_FIXEXT_4);
+            m_os->put (MSGPACK_EXT_KEY_REF);
+            m_os->write ((uint8_t *) &i, 4);
+          }
+
+          return true;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool write_integer (int64_t i64)
+        {
+          if (i64 >= 0) // unsigned
+          {
+            if (i64 <= 127)
+            {
+              uint8_t i = static_cast<uint8_t>(i64);
+              m_os->put (i);
+            }
+            else if (i64 <= 0xff)
+            {
+              uint8_t i = static_cast<uint8_t>(i64);
+              m_os->put (MSGPACK_HEADER_UNSIGNED_8);
+              m_os->put (i);
+            }
+            else if (i64 <= 0xffff)
+            {
+              uint16_t i = kvr_bigendian16 (i64);
+              m_os->put (MSGPACK_HEADER_UNSIGNED_16);              
+              m_os->write ((uint8_t *) &i, 2);
+            }
+            else if (i64 <= 0xffffffff)
+            {
+              uint32_t i = kvr_bigendian32 (i64);
+              m_os->put (MSGPACK_HEADER_UNSIGNED_32);              
+              m_os->write ((uint8_t *) &i, 4);
+            }
+            else // max is int64_t;
+            {
+              uint64_t i = kvr_bigendian64 (i64);
+              m_os->put (MSGPACK_HEADER_SIGNED_64);              
+              m_os->write ((uint8_t *) &i, 8);
+            }
+          }
+          else // signed
+          {
+            const int64_t nint5 = -((1 << 5) - 1);
+            const int64_t nint8 = -((1 << 7) - 1);
+            const int64_t nint16 = -((1 << 15) - 1);
+            const int64_t nint32 = -((1LL << 31) - 1);
+
+            if (i64 >= nint5)
+            {
+              uint8_t i = static_cast<uint8_t>(i64);
+              m_os->put (MSGPACK_HEADER_SIGNED_5 | i);
+            }
+            else if (i64 >= nint8)
+            {
+              uint8_t i = static_cast<uint8_t>(i64);
               m_os->put (MSGPACK_HEADER_SIGNED_8);
               m_os->put (i);
             }
@@ -1264,6 +1499,8 @@ namespace kvr
       template<typename ostr>
       struct writer
       {
+        writer () : m_refs (NULL), m_cols (NULL) {}
+
         bool print (const kvr::value *val, write_ctx<ostr> &ctx)
         {
           KVR_ASSERT (val);
@@ -1279,7 +1516,7 @@ namespace kvr
             while (ok && c.get (&p))
             {
               kvr::key *k = p.get_key ();
-              ok &= ctx.write_string (k->get_string (), k->get_length ());
+              ok &= print_key (k, ctx);
 
               kvr::value *v = p.get_value ();          
               ok &= print (v, ctx);
@@ -1289,14 +1526,22 @@ namespace kvr
 
           else if (val->is_array ())
           {
-            kvr::sz_t alen = val->length ();
-            bool ok = ctx.write_array (alen);
-            for (kvr::sz_t i = 0; (i < alen) && ok; ++i)
+            kvr::internal::column_t col = m_cols ? kvr::internal::column_type (val) : kvr::internal::COLUMN_NONE;
+            if (col != kvr::internal::COLUMN_NONE)
             {
-              kvr::value *v = val->element (i);
-              ok &= print (v, ctx);
+              success = print_column (val, col, ctx);
+            }
+            else
+            {
+              kvr::sz_t alen = val->length ();
+              bool ok = ctx.write_array (alen);
+              for (kvr::sz_t i = 0; (i < alen) && ok; ++i)
+              {
+                kvr::value *v = val->element (i);
+                ok &= print (v, ctx);
+              }
+              success = ok;
             }
-            success = ok;
           }
 
           else if (val->is_string ())
@@ -1306,6 +1551,13 @@ namespace kvr
             success = ctx.write_string (str, slen);
           }
 
+          else if (val->is_binary ())
+          {
+            kvr::sz_t size = 0;
+            const uint8_t *data = val->get_binary (&size);
+            success = ctx.write_binary (data, size);
+          }
+
           else if (val->is_integer ())
           {
             int64_t n = val->get_integer ();
@@ -1331,6 +1583,235 @@ namespace kvr
 
           return success;
         }
+
+        ////////////////////////////////////////////////////////////
+
+        // inside a key table, keys numbered earlier are written by reference
+        bool print_key (const kvr::key *k, write_ctx<ostr> &ctx)
+        {
+          uint32_t index = 0;
+
+          if (m_refs && m_refs->find (k, &index))
+          {
+            return ctx.write_key_ref (index);
+          }
+
+          if (m_refs)
+          {
+            m_refs->literal (k, k->get_length ());
+          }
+
+          return ctx.write_string (k->get_string (), k->get_length ());
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // numeric column, packed in scratch space first for the ext length
+        bool print_column (const kvr::value *arr, kvr::internal::column_t col, write_ctx<ostr> &ctx)
+        {
+          m_cols->seek (0);
+
+          if (col == kvr::internal::COLUMN_DELTA)
+          {
+            kvr::internal::column_delta_pack (arr, m_cols);
+            return ctx.write_ext (MSGPACK_EXT_DELTA, m_cols->buffer (), m_cols->tell ());
+          }
+
+          kvr::internal::column_xor_pack (arr, m_cols);
+          return ctx.write_ext (MSGPACK_EXT_XOR, m_cols->buffer (), m_cols->tell ());
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        kvr::internal::strref_writer *m_refs;
+        kvr::mem_ostream *m_cols;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // writes handler events straight out (transcoding). if 'sizes' is set, container 
+      // sizes are taken from it in start order (for sources that only know them at the end)
+      template<typename ostr>
+      struct emitter : public kvr::handler
+      {
+        emitter (ostr *os, const kvr::sz_t *sizes = NULL) : m_ctx (os), m_sizes (sizes), m_next (0) {}
+
+        bool on_null () { return m_ctx.write_null (); }
+        bool on_boolean (bool b) { return m_ctx.write_boolean (b); }
+        bool on_integer (int64_t i) { return m_ctx.write_integer (i); }
+        bool on_float (double f) { return m_ctx.write_float (f); }
+        bool on_string (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool on_binary (const uint8_t *data, kvr::sz_t size) { return m_ctx.write_binary (data, size); }
+        bool on_key (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool on_map_start (kvr::sz_t size) { return m_ctx.write_map (m_sizes ? m_sizes [m_next++] : size); }
+        bool on_array_start (kvr::sz_t length) { return m_ctx.write_array (m_sizes ? m_sizes [m_next++] : length); }
+
+        write_ctx<ostr>   m_ctx;
+        const kvr::sz_t * m_sizes;
+        size_t            m_next;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // kvr::stream_writer backend. msgpack has no unknown-length containers.
+      class stream_encoder : public kvr::internal::stream_encoder
+      {
+      public:
+
+        stream_encoder (kvr::ostream *os) : m_os (os), m_ctx (&m_os) {}
+
+        bool begin_map (kvr::sz_t size, bool known) { return known && m_ctx.write_map (size); }
+        bool end_map (bool known) { KVR_REF_UNUSED (known); return true; }
+        bool begin_array (kvr::sz_t length, bool known) { return known && m_ctx.write_array (length); }
+        bool end_array (bool known) { KVR_REF_UNUSED (known); return true; }
+        bool key (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool null () { return m_ctx.write_null (); }
+        bool boolean (bool b) { return m_ctx.write_boolean (b); }
+        bool integer (int64_t i) { return m_ctx.write_integer (i); }
+        bool floating (double f) { return m_ctx.write_float (f); }
+        bool string (const char *str, kvr::sz_t length) { return m_ctx.write_string (str, length); }
+        bool binary (const uint8_t *data, kvr::sz_t size) { return m_ctx.write_binary (data, size); }
+        bool value (const kvr::value *val) { return m_wrt.print (val, m_ctx); }
+        bool raw (const uint8_t *data, size_t size) { m_os.write (const_cast<uint8_t *> (data), size); return true; }
+        void finish () { m_os.flush (); }
+
+      private:
+
+        kvr::internal::block_ostream              m_os;
+        write_ctx<kvr::internal::block_ostream>   m_ctx;
+        writer<kvr::internal::block_ostream>      m_wrt;
+      };
+
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+      /////////////////////////////////////////////////////////////////////////////////////////////
+
+      // single token sizing and decoding for kvr::internal::push_reader
+      template<typename rctx>
+      struct push_tokens
+      {
+        ////////////////////////////////////////////////////////////
+
+        // bytes needed for the token at 'p': the header size until the header is 
+        // complete ('avail'), then the whole token. 0 if unsupported.
+        static size_t need (const uint8_t *p, size_t avail)
+        {
+          KVR_ASSERT (avail > 0);
+
+          const uint8_t curr = p [0];
+
+          switch (curr)
+          {
+            case MSGPACK_HEADER_NULL:         { return 1; }
+            case MSGPACK_HEADER_BOOL_FALSE:   { return 1; }
+            case MSGPACK_HEADER_BOOL_TRUE:    { return 1; }
+            case MSGPACK_HEADER_FLOAT_32:     { return 5; }
+            case MSGPACK_HEADER_FLOAT_64:     { return 9; }
+            case MSGPACK_HEADER_STRING_8:     { return (avail < 2) ? 2 : (2 + size_t (p [1])); }
+            case MSGPACK_HEADER_STRING_16:    { return (avail < 3) ? 3 : (3 + size_t (load16 (&p [1]))); }
+            case MSGPACK_HEADER_STRING_32:    { return (avail < 5) ? 5 : (5 + size_t (load32 (&p [1]))); }
+            case MSGPACK_HEADER_BINARY_8:     { return (avail < 2) ? 2 : (2 + size_t (p [1])); }
+            case MSGPACK_HEADER_BINARY_16:    { return (avail < 3) ? 3 : (3 + size_t (load16 (&p [1]))); }
+            case MSGPACK_HEADER_BINARY_32:    { return (avail < 5) ? 5 : (5 + size_t (load32 (&p [1]))); }
+            case MSGPACK_HEADER_ARRAY_16:     { return 3; }
+            case MSGPACK_HEADER_ARRAY_32:     { return 5; }
+            case MSGPACK_HEADER_MAP_16:       { return 3; }
+            case MSGPACK_HEADER_MAP_32:       { return 5; }
+            case MSGPACK_HEADER_UNSIGNED_8:   { return 2; }
+            case MSGPACK_HEADER_UNSIGNED_16:  { return 3; }
+            case MSGPACK_HEADER_UNSIGNED_32:  { return 5; }
+            case MSGPACK_HEADER_UNSIGNED_64:  { return 9; }
+            case MSGPACK_HEADER_SIGNED_8:     { return 2; }
+            case MSGPACK_HEADER_SIGNED_16:    { return 3; }
+            case MSGPACK_HEADER_SIGNED_32:    { return 5; }
+            case MSGPACK_HEADER_SIGNED_64:    { return 9; }
+            case MSGPACK_HEADER_EXT_8:        { return need_ext (p, avail, 1); }
+            case MSGPACK_HEADER_EXT_16:       { return need_ext (p, avail, 2); }
+            case MSGPACK_HEADER_EXT_32:       { return need_ext (p, avail, 4); }
+            default:
+            {
+              if (curr <= 127)                                    { return 1; }
+              else if ((curr & 0xe0) == MSGPACK_HEADER_SIGNED_5)  { return 1; }
+              else if ((curr & 0xe0) == MSGPACK_HEADER_STRING_5)  { return 1 + size_t (curr & 0x1f); }
+              else if ((curr & 0xf0) == MSGPACK_HEADER_MAP_4)     { return 1; }
+              else if ((curr & 0xf0) == MSGPACK_HEADER_ARRAY_4)   { return 1; }
+              break;
+            }
+          }
+
+          return 0;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        // numeric columns are one token (a scalar that reads as an array). the key 
+        // table wraps the whole document and isn't a token, so it stays unsupported
+        static size_t need_ext (const uint8_t *p, size_t avail, size_t n)
+        {
+          if (avail < (n + 2))
+          {
+            return n + 2;
+          }
+
+          const uint8_t type = p [n + 1];
+          if ((type != MSGPACK_EXT_DELTA) && (type != MSGPACK_EXT_XOR))
+          {
+            return 0;
+          }
+
+          size_t len = (n == 1) ? size_t (p [1]) : (n == 2) ? size_t (load16 (&p [1])) : size_t (load32 (&p [1]));
+          return n + 2 + len;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static push_token_t type (const uint8_t *p, kvr::sz_t *count)
+        {
+          const uint8_t curr = p [0];
+
+          switch (curr)
+          {
+            case MSGPACK_HEADER_ARRAY_16: { *count = static_cast<kvr::sz_t>(load16 (&p [1])); return PUSH_TOKEN_ARRAY; }
+            case MSGPACK_HEADER_ARRAY_32: { *count = static_cast<kvr::sz_t>(load32 (&p [1])); return PUSH_TOKEN_ARRAY; }
+            case MSGPACK_HEADER_MAP_16:   { *count = static_cast<kvr::sz_t>(load16 (&p [1])); return PUSH_TOKEN_MAP; }
+            case MSGPACK_HEADER_MAP_32:   { *count = static_cast<kvr::sz_t>(load32 (&p [1])); return PUSH_TOKEN_MAP; }
+            default:
+            {
+              if ((curr & 0xf0) == MSGPACK_HEADER_MAP_4)        { *count = (curr & 0x0f); return PUSH_TOKEN_MAP; }
+              else if ((curr & 0xf0) == MSGPACK_HEADER_ARRAY_4) { *count = (curr & 0x0f); return PUSH_TOKEN_ARRAY; }
+              break;
+            }
+          }
+
+          return PUSH_TOKEN_SCALAR;
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool scalar (const uint8_t *p, size_t n, rctx &ctx)
+        {
+          kvr::mem_istream is (p, n);
+          return m_reader.parse (&is, ctx);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        bool key (const uint8_t *p, size_t n, rctx &ctx)
+        {
+          kvr::mem_istream is (p, n);
+          return m_reader.parse_key (&is, ctx);
+        }
+
+        ////////////////////////////////////////////////////////////
+
+        static uint16_t load16 (const uint8_t *p) { uint16_t u = 0; memcpy (&u, p, 2); return kvr_bigendian16 (u); }
+        static uint32_t load32 (const uint8_t *p) { uint32_t u = 0; memcpy (&u, p, 4); return kvr_bigendian32 (u); }
+
+        reader<kvr::mem_istream, rctx> m_reader;
       };
 
       /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1341,9 +1822,10 @@ namespace kvr
       {
         KVR_ASSERT (dest);
 
-        reader<kvr::istream> reader;
+        kvr::internal::block_istream bistr (&istr);
+        reader<kvr::internal::block_istream> reader;
         read_ctx ctx (dest);
-        return reader.parse (&istr, ctx);
+        return reader.parse (&bistr, ctx);
       }
 
       ////////////////////////////////////////////////////////////
@@ -1353,12 +1835,13 @@ namespace kvr
         KVR_ASSERT (src);
         KVR_ASSERT (ostr);
     
-        write_ctx<kvr::ostream> ctx (ostr);
-        writer<kvr::ostream> wrt;
+        kvr::internal::block_ostream bostr (ostr);
+        write_ctx<kvr::internal::block_ostream> ctx (&bostr);
+        writer<kvr::internal::block_ostream> wrt;
         
         if (wrt.print (src, ctx))
         {
-          ostr->flush ();
+          bostr.flush ();
           return true;
         }
 
@@ -1378,6 +1861,52 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
+      // documents [offsets [i], offsets [i + 1]) of 'data', read with one reader
+      bool read_batch (kvr::value **dests, const uint8_t *data, const size_t *offsets, size_t count)
+      {
+        KVR_ASSERT (dests || (count == 0));
+        KVR_ASSERT (offsets);
+
+        reader<kvr::mem_istream> reader;
+        read_ctx ctx (NULL);
+        bool success = true;
+
+        for (size_t i = 0; (i < count) && success; ++i)
+        {
+          kvr::mem_istream istr (data + offsets [i], offsets [i + 1] - offsets [i]);
+          dests [i]->conv_null ();
+          ctx.reset (dests [i]);
+          success = reader.parse (&istr, ctx);
+        }
+
+        return success;
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        kvr::internal::block_istream bistr (&istr);
+        reader<kvr::internal::block_istream, kvr::internal::handler_ctx> reader;
+        kvr::internal::handler_ctx ctx (h);
+        return reader.parse (&bistr, ctx);
+      }
+
+      ////////////////////////////////////////////////////////////
+
+      bool scan (kvr::mem_istream &istr, kvr::handler *h)
+      {
+        KVR_ASSERT (h);
+
+        reader<kvr::mem_istream, kvr::internal::handler_ctx> reader;
+        kvr::internal::handler_ctx ctx (h);
+        return reader.parse (&istr, ctx);
+      }
+
+      ////////////////////////////////////////////////////////////
+
       bool write (const kvr::value *src, kvr::mem_ostream *ostr)
       {
         KVR_ASSERT (src);
@@ -1397,193 +1926,107 @@ namespace kvr
 
       ////////////////////////////////////////////////////////////
 
-      size_t write_approx_size (const kvr::value *val)
+      // kvr::encode_flag_t encodings. key table: the document is wrapped in a KEY_TABLE ext
+      // and repeated keys are references; the ext length is patched in once the document
+      // is written. numeric columns: number arrays are packed (writer::print_column)
+      bool write (const kvr::value *src, kvr::mem_ostream *ostr, uint32_t flags)
       {
-        size_t size = 0;
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
+
+        const bool keyed = (flags & kvr::ENCODE_KEY_TABLE) != 0;
 
-        if (val->is_map ())
+        size_t start = ostr->tell ();
+        if (keyed)
         {
-          kvr::sz_t msz = val->size ();
+          ostr->put (MSGPACK_HEADER_EXT_32);
+          ostr->push (4);
+          ostr->put (MSGPACK_EXT_KEY_TABLE);
+        }
 
-          if (msz <= 15)
-          {
-            size += 1;
-          }
-          else if (msz <= 0xffff)
-          {
-            size += 3;
-          }
-          else if (msz <= 0xffffffff)
-          {
-            size += 5;
-          }
+        write_ctx<kvr::mem_ostream> ctx (ostr);
+        writer<kvr::mem_ostream> wrt;
+        kvr::internal::strref_writer refs (MSGPACK_KEY_TABLE_MIN_LEN);
+        kvr::mem_ostream cols (256u);
+        wrt.m_refs = keyed ? &refs : NULL;
+        wrt.m_cols = (flags & kvr::ENCODE_NUMERIC_COLUMNS) ? &cols : NULL;
 
-          kvr::value::cursor c (val);
-          kvr::pair p;
-          while (c.get (&p))
+        if (wrt.print (src, ctx))
+        {
+          if (keyed)
           {
-            kvr::key *k = p.get_key ();
-            kvr::value *v = p.get_value ();
-            kvr::sz_t klen = k->get_length ();
-
-            if (klen <= 31)
-            {
-              size += 1;
-            }
-            else if (klen <= 0xff)
-            {
-              size += 2;
-            }
-            else if (klen <= 0xffff)
-            {
-              size += 3;
-            }
-            else
-            {
-              size += 5;
-            }
-
-            size += klen;
-            size += write_approx_size (v);
+            size_t body = ostr->tell () - start - 6;
+            KVR_ASSERT_SAFE (body <= 0xffffffff, false);
+            uint32_t len = kvr_bigendian32 (body);
+            memcpy (const_cast<uint8_t *>(ostr->buffer ()) + start + 1, &len, 4);
           }
+          ostr->flush ();
+          return true;
         }
 
-        else if (val->is_array ())
-        {
-          kvr::sz_t alen = val->length ();
+        return false;
+      }
 
-          if (alen <= 15)
-          {
-            size += 1;
-          }
-          else if (alen <= 0xffff)
-          {
-            size += 3;
-          }
-          else if (alen <= 0xffffffff)
-          {
-            size += 5;
-          }
+      ////////////////////////////////////////////////////////////
 
-          for (kvr::sz_t i = 0, c = val->length (); i < c; ++i)
-          {
-            kvr::value *v = val->element (i);
-            size += write_approx_size (v);
-          }
-        }
+      // a key table is staged for its length, anything else is streamed
+      bool write (const kvr::value *src, kvr::ostream *ostr, uint32_t flags)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
 
-        else if (val->is_string ())
+        if (flags & kvr::ENCODE_KEY_TABLE)
         {
-          kvr::sz_t slen = 0;
-          const char *str = val->get_string (&slen);
-          KVR_REF_UNUSED (str);
+          kvr::mem_ostream staged (1024u);
 
-          if (slen <= 31)
-          {
-            size += 1;
-          }
-          else if (slen <= 0xff)
-          {
-            size += 2;
-          }
-          else if (slen <= 0xffff)
-          {
-            size += 3;
-          }
-          else
+          if (write (src, &staged, flags))
           {
-            size += 5;
+            ostr->write (const_cast<uint8_t *>(staged.buffer ()), staged.tell ());
+            ostr->flush ();
+            return true;
           }
 
-          size += slen;
+          return false;
         }
 
-        else if (val->is_integer ())
+        kvr::internal::block_ostream bostr (ostr);
+        write_ctx<kvr::internal::block_ostream> ctx (&bostr);
+        writer<kvr::internal::block_ostream> wrt;
+        kvr::mem_ostream cols (256u);
+        wrt.m_cols = (flags & kvr::ENCODE_NUMERIC_COLUMNS) ? &cols : NULL;
+
+        if (wrt.print (src, ctx))
         {
-          int64_t n = val->get_integer ();
+          bostr.flush ();
+          return true;
+        }
 
-          if (n >= 0) // unsigned
-          {
-            if (n <= 127)
-            {
-              size += 1;
-            }
-            else if (n <= 0xff)
-            {
-              size += 2;
-            }
-            else if (n <= 0xffff)
-            {
-              size += 3;
-            }
-            else if (n <= 0xffffffff)
-            {
-              size += 5;
-            }
-            else
-            {
-              size += 9;
-            }
-          }
-          else // signed
-          {
-            const int64_t nint5 = -((1 << 5) - 1);
-            const int64_t nint8 = -((1 << 7) - 1);
-            const int64_t nint16 = -((1 << 15) - 1);
-            const int64_t nint32 = -((1LL << 31) - 1);
+        return false;
+      }
 
-            if (n >= nint5)
-            {
-              size += 1;
-            }
-            else if (n >= nint8)
-            {
-              size += 2;
-            }
-            else if (n >= nint16)
-            {
-              size += 3;
-            }
-            else if (n >= nint32)
-            {
-              size += 5;
-            }
-            else
-            {
-              size += 9;
-            }
-          }
-        }
+      ////////////////////////////////////////////////////////////
 
-        else if (val->is_float ())
-        {
-#if KVR_FLAG_ENCODE_COMPACT_FP_PRECISION || KVR_MSGPACK_WRITE_COMPACT_FP_OVERRIDE
-          const double fmin = std::numeric_limits<float>::min ();
-          const double fmax = std::numeric_limits<float>::max ();
+      bool write (const kvr::value *src, kvr::chunk_ostream *ostr)
+      {
+        KVR_ASSERT (src);
+        KVR_ASSERT (ostr);
 
-          double n = val->get_float ();
-          if ((n >= fmin) && (n <= fmax))
-          {
-            size += 5;
-          }
-          else
-#endif
-          {
-            size += 9;
-          }
-        }
+        write_ctx<kvr::chunk_ostream> ctx (ostr);
+        writer<kvr::chunk_ostream> wrt;
+        return wrt.print (src, ctx);
+      }
 
-        else if (val->is_boolean ())
-        {
-          size += 1;
-        }
+      ////////////////////////////////////////////////////////////
 
-        else if (val->is_null ())
-        {
-          size += 1;
-        }
+      size_t write_size (const kvr::value *val)
+      {
+        KVR_ASSERT (val);
+
+        kvr::internal::size_ostream sostr;
+        write_ctx<kvr::internal::size_ostream> ctx (&sostr);
+        writer<kvr::internal::size_ostream> wrt;
 
-        return size;
+        return wrt.print (val, ctx) ? sostr.size () : 0u;
       }
     }
   }
@@ -32,7 +32,7 @@ static const char * const kvr_const_str_rem   = "rem";
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 // type mask for kvr::m_flags
-static const uint32_t KVR_VALUE_TYPE_MASK = 0x000000ff;
+static const uint32_t KVR_VALUE_TYPE_MASK = 0x000008ff;
 // delimiter token for path expressions
 static const char     KVR_TOKEN_DELIMITER = '/';
 // token for search grep expression
@@ -47,9 +47,10 @@ static const char     KVR_TOKEN_MAP_GREP  = '@';
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 #if KVR_DEBUG
-#define kvr_memory_track_ctr_decl(C, X) C (): X (0) {} ~C () { KVR_ASSERT (X == 0); KVR_ASSERT (Y == 0); } size_t X, Y
-#define kvr_memory_track_ctr_incr(X, S) { X++; Y += S; }
-#define kvr_memory_track_ctr_decr(X, S) { X--; Y -= S; }
+// counters are locked, parallel_decoder allocates from several threads
+#define kvr_memory_track_ctr_decl(C, X) C (): X (0), Y (0), L (0) {} ~C () { KVR_ASSERT (X == 0); KVR_ASSERT (Y == 0); } size_t X, Y; volatile long L
+#define kvr_memory_track_ctr_incr(X, S) { kvr_spin_lock (L); X++; Y += S; kvr_spin_unlock (L); }
+#define kvr_memory_track_ctr_decr(X, S) { kvr_spin_lock (L); X--; Y -= S; kvr_spin_unlock (L); }
 #else
 #define kvr_memory_track_ctr_decl(C, X)
 #define kvr_memory_track_ctr_incr(X, S)
@@ -977,6 +978,21 @@ kvr::value * kvr::value::conv_string ()
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+kvr::value * kvr::value::conv_binary ()
+{
+  if (!is_binary ())
+  {
+    this->_clear ();
+    m_flags |= FLAG_TYPE_BINARY;
+  }
+
+  return this;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
 kvr::value * kvr::value::conv_boolean ()
 {
   if (!is_boolean ())
@@ -1087,6 +1103,22 @@ void kvr::value::set_string (const char *str)
   this->_string_set (str, (sz_t) len);
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::set_binary (const uint8_t *data, sz_t size)
+{
+  KVR_ASSERT_SAFE (data || (size == 0), (void) 0);
+
+#if KVR_FLAG_DISABLE_IMPLICIT_TYPE_CONVERSION 
+  KVR_ASSERT (is_binary ());
+#else
+  conv_binary ();
+#endif
+  m_data.bin.set (data, size, m_ctx->m_allocator);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1172,6 +1204,21 @@ const char * kvr::value::get_string (sz_t *len) const
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+const uint8_t * kvr::value::get_binary (sz_t *size) const
+{
+  KVR_ASSERT_SAFE (is_binary () && size, NULL);
+
+  // never null, so the bytes can always be handed to memcpy and writers
+  static const uint8_t empty [1] = { 0 };
+
+  *size = m_data.bin.m_len;
+  return m_data.bin.m_data ? m_data.bin.m_data : empty;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
 int64_t kvr::value::get_integer () const
 {
   KVR_ASSERT_SAFE (this->_is_number (), 0);
@@ -1648,6 +1695,55 @@ kvr::value * kvr::value::insert_null (const char *keystr)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+kvr::value * kvr::value::insert_null (key *handle)
+{
+  KVR_ASSERT (handle && handle->m_str && "invalid input");
+
+#if KVR_FLAG_DISABLE_IMPLICIT_TYPE_CONVERSION
+  KVR_ASSERT (is_map ());
+#else
+  conv_map ();
+#endif
+
+  // the reference _create_key would have taken
+  ++(handle->m_ref);
+
+  map::node *n = NULL;
+
+#if !KVR_FLAG_ALLOW_DUPLICATE_MAP_KEYS
+  n = m_data.m.find (handle);
+  if (n)
+  {
+    n->v->conv_null ();
+    m_ctx->_destroy_key (handle);
+  }
+  else
+#endif
+  {
+    n = m_data.m.insert (handle, m_ctx->_create_value_null (FLAG_PARENT_MAP), m_ctx->m_allocator);
+    KVR_ASSERT (n);
+  }
+
+  return n ? n->v : NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::insert_null (const char *keystr, key **handle)
+{
+  KVR_ASSERT (keystr && handle && "invalid input");
+
+  value *v = this->insert_null (keystr);
+  *handle = v ? m_ctx->_find_key (keystr) : NULL;
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
 kvr::value * kvr::value::find (const char *keystr) const
 {
   KVR_ASSERT (keystr);
@@ -1757,7 +1853,8 @@ kvr::value * kvr::value::copy (const value *rhs)
     //////////////////////////////////
     {
       this->_clear ();
-      this->conv_map (rhs->size ());
+      sz_t rsize = rhs->size ();
+      this->conv_map (rsize ? rsize : 1);
 
       cursor c (rhs);
       pair rp;
@@ -1786,7 +1883,7 @@ kvr::value * kvr::value::copy (const value *rhs)
     {
       this->_clear ();
       sz_t rlen = rhs->length ();
-      this->conv_array (rlen);
+      this->conv_array (rlen ? rlen : 1);
 
       for (sz_t i = 0; i < rlen; ++i)
       {
@@ -1807,6 +1904,18 @@ kvr::value * kvr::value::copy (const value *rhs)
       this->set_string (str);
     }
 
+    //////////////////////////////////
+    else if (rhs->is_binary ())
+    //////////////////////////////////
+    {
+#if KVR_FLAG_DISABLE_IMPLICIT_TYPE_CONVERSION
+      this->conv_binary ();
+#endif
+      sz_t size = 0;
+      const uint8_t *data = rhs->get_binary (&size);
+      this->set_binary (data, size);
+    }
+
     //////////////////////////////////
     else if (rhs->is_integer ())
     //////////////////////////////////
@@ -1934,6 +2043,15 @@ kvr::value * kvr::value::merge (const value *rhs)
       this->_string_move (buf, bufsize); 
     }
     //////////////////////////////////
+    else if (this->is_binary ())
+    //////////////////////////////////
+    {
+      // append
+      sz_t rvsize = 0;
+      const uint8_t *rv = rhs->get_binary (&rvsize);
+      m_data.bin.append (rv, rvsize, m_ctx->m_allocator);
+    }
+    //////////////////////////////////
     else if (this->is_integer ())
     //////////////////////////////////
     {
@@ -2018,6 +2136,19 @@ kvr::value * kvr::value::diff (const value *original, const value *modified)
       }
     }
 
+    //////////////////////////////////
+    else if (og->is_binary ())
+    //////////////////////////////////
+    {
+      sz_t ogsize = 0, mdsize = 0;
+      const uint8_t *ogbin = og->get_binary (&ogsize);
+      const uint8_t *mdbin = md->get_binary (&mdsize);
+      if ((ogsize != mdsize) || (memcmp (ogbin, mdbin, ogsize) != 0))
+      {
+        diff->copy (md);
+      }
+    }
+
     //////////////////////////////////
     else if (og->is_integer ())
     //////////////////////////////////
@@ -2160,6 +2291,16 @@ uint32_t kvr::value::hash (uint32_t seed) const
     hc += kvr::internal::djb_hash (str);
   }
 
+  //////////////////////////////////
+  else if (this->is_binary ())
+  //////////////////////////////////
+  {
+    hc += (FLAG_TYPE_BINARY);
+    sz_t size = 0;
+    const uint8_t *data = this->get_binary (&size);
+    hc += kvr::internal::djb_hash (data, size);
+  }
+
   //////////////////////////////////
   else if (this->is_integer ())
   //////////////////////////////////
@@ -2212,6 +2353,12 @@ bool kvr::value::encode (codec_t codec, obuffer *obuf)
 
   obuf->m_stream.seek (0);
 
+  // size large trees exactly up front so the buffer is allocated once
+  if (this->_count (KVR_CONSTANT_ENCODE_PREPASS_MIN_NODES) >= KVR_CONSTANT_ENCODE_PREPASS_MIN_NODES)
+  {
+    obuf->m_stream.reserve (this->encode_bound (codec));
+  }
+
   switch (codec)
   {
     case kvr::CODEC_JSON:
@@ -2232,44 +2379,9 @@ bool kvr::value::encode (codec_t codec, obuffer *obuf)
       break;
     }
 
-    default:
-    {
-      break;
-    }
-  }
-
-  return success;
-}
-
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-
-bool kvr::value::decode (codec_t codec, const uint8_t *data, size_t size)
-{
-  bool success = false;
-
-  this->conv_null ();
-
-  mem_istream istr (data, size);
-
-  switch (codec)
-  {
-    case kvr::CODEC_JSON:
-    {
-      success = kvr::internal::json::read (this, istr);
-      break;
-    }
-
-    case kvr::CODEC_MSGPACK:
-    {
-      success = kvr::internal::msgpack::read (this, istr);
-      break;
-    }
-
-    case kvr::CODEC_CBOR:
+    case kvr::CODEC_KVRB:
     {
-      success = kvr::internal::cbor::read (this, istr);
+      success = kvr::internal::kvrb::write (this, &obuf->m_stream);
       break;
     }
 
@@ -2279,6 +2391,11 @@ bool kvr::value::decode (codec_t codec, const uint8_t *data, size_t size)
     }
   }
 
+  if (success && obuf->m_pool)
+  {
+    obuf->m_pool->record (obuf->m_stream.tell ());
+  }
+
   return success;
 }
 
@@ -2286,29 +2403,31 @@ bool kvr::value::decode (codec_t codec, const uint8_t *data, size_t size)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool kvr::value::encode (codec_t codec, ostream *ostr)
+bool kvr::value::encode (codec_t codec, chunk_obuffer *cbuf)
 {
-  KVR_ASSERT_SAFE (ostr, false);
+  KVR_ASSERT_SAFE (cbuf, false);
 
   bool success = false;
 
+  cbuf->m_stream.reset ();
+
   switch (codec)
   {
     case kvr::CODEC_JSON:
     {
-      success = kvr::internal::json::write (this, ostr);
+      success = kvr::internal::json::write (this, &cbuf->m_stream);
       break;
     }
 
     case kvr::CODEC_MSGPACK:
     {
-      success = kvr::internal::msgpack::write (this, ostr);
+      success = kvr::internal::msgpack::write (this, &cbuf->m_stream);
       break;
     }
 
     case kvr::CODEC_CBOR:
     {
-      success = kvr::internal::cbor::write (this, ostr);
+      success = kvr::internal::cbor::write (this, &cbuf->m_stream);
       break;
     }
 
@@ -2325,12 +2444,14 @@ bool kvr::value::encode (codec_t codec, ostream *ostr)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool kvr::value::decode (codec_t codec, istream &istr)
+bool kvr::value::decode (codec_t codec, const uint8_t *data, size_t size)
 {
   bool success = false;
 
   this->conv_null ();
 
+  mem_istream istr (data, size);
+
   switch (codec)
   {
     case kvr::CODEC_JSON:
@@ -2351,6 +2472,13 @@ bool kvr::value::decode (codec_t codec, istream &istr)
       break;
     }
 
+    case kvr::CODEC_KVRB:
+    {
+      kvr::view root (codec, data, size);
+      success = root.is_valid () && root.materialize (this);
+      break;
+    }
+
     default:
     {
       break;
@@ -2364,27 +2492,35 @@ bool kvr::value::decode (codec_t codec, istream &istr)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t kvr::value::encode_bound (codec_t codec) const
+bool kvr::value::encode (codec_t codec, ostream *ostr)
 {
-  size_t size = 0;
+  KVR_ASSERT_SAFE (ostr, false);
+
+  bool success = false;
 
   switch (codec)
   {
     case kvr::CODEC_JSON:
     {
-      size = kvr::internal::json::write_approx_size (this);
+      success = kvr::internal::json::write (this, ostr);
       break;
     }
 
     case kvr::CODEC_MSGPACK:
     {
-      size = kvr::internal::msgpack::write_approx_size (this);
+      success = kvr::internal::msgpack::write (this, ostr);
       break;
     }
 
     case kvr::CODEC_CBOR:
     {
-      size = kvr::internal::cbor::write_approx_size (this);
+      success = kvr::internal::cbor::write (this, ostr);
+      break;
+    }
+
+    case kvr::CODEC_KVRB:
+    {
+      success = kvr::internal::kvrb::write (this, ostr);
       break;
     }
 
@@ -2394,898 +2530,5967 @@ size_t kvr::value::encode_bound (codec_t codec) const
     }
   }
 
-  size = ((size + 7u) & ~7u);
-
-  return size;
+  return success;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::dump () const
+// encode_flag_t bits a codec supports
+static uint32_t kvr_encode_flags (kvr::codec_t codec)
 {
-#if KVR_DEBUG
-  this->_dump (0, NULL);
-  std::fprintf (stderr, "\n");
-#endif
+  switch (codec)
+  {
+    case kvr::CODEC_MSGPACK:  { return kvr::ENCODE_KEY_TABLE | kvr::ENCODE_NUMERIC_COLUMNS; }
+    case kvr::CODEC_CBOR:     { return kvr::ENCODE_KEY_TABLE | kvr::ENCODE_TYPED_ARRAYS | kvr::ENCODE_NUMERIC_COLUMNS; }
+    default:                  { return 0; }
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_string_set (const char *str, sz_t len)
+bool kvr::value::encode (codec_t codec, obuffer *obuf, uint32_t flags)
 {
-  KVR_ASSERT (str);
-  KVR_ASSERT (is_string ());
+  KVR_ASSERT_SAFE (obuf, false);
 
-  if (this->_is_string_static () && (len >= string::stt_str::CAP))
+  flags &= kvr_encode_flags (codec);
+
+  if (flags == 0)
   {
-    this->_clear ();
-    m_flags |= FLAG_TYPE_STRING_DYNAMIC;
+    return this->encode (codec, obuf);
   }
-  
-  if (this->_is_string_dynamic ())
+
+  bool success = false;
+
+  obuf->m_stream.seek (0);
+
+  if (this->_count (KVR_CONSTANT_ENCODE_PREPASS_MIN_NODES) >= KVR_CONSTANT_ENCODE_PREPASS_MIN_NODES)
   {
-    this->m_data.s.m_dyn.set (str, len, m_ctx->m_allocator);
+    obuf->m_stream.reserve (this->encode_bound (codec, flags));
+  }
+
+  if (codec == kvr::CODEC_MSGPACK)
+  {
+    success = kvr::internal::msgpack::write (this, &obuf->m_stream, flags);
   }
   else
   {
-    this->m_data.s.m_stt.set (str, len);
+    success = kvr::internal::cbor::write (this, &obuf->m_stream, flags);
   }
-}
-
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_string_move (char *str, sz_t size)
-{
-  KVR_ASSERT (str);
-  KVR_ASSERT (size > 0);
-  KVR_ASSERT (is_string ());
-  
-  this->_clear ();
-  m_flags |= FLAG_TYPE_STRING_DYNAMIC;
+  if (success && obuf->m_pool)
+  {
+    obuf->m_pool->record (obuf->m_stream.tell ());
+  }
 
-  m_data.s.m_dyn.m_data = str;
-  m_data.s.m_dyn.m_size = size;
-  m_data.s.m_dyn.m_len = size - 1;
+  return success;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value * kvr::value::_search_path_expr (const char *expr, const char **lastkey, value **lastparent) const
+bool kvr::value::encode (codec_t codec, ostream *ostr, uint32_t flags)
 {
-  KVR_ASSERT (expr);
-  KVR_ASSERT (expr [0] != 0);
-
-  value *v = (value *) this;
-
-  const char delim = KVR_TOKEN_DELIMITER;
-  const char *e1 = expr;
-  const char *e2 = strchr (e1, delim);
+  KVR_ASSERT_SAFE (ostr, false);
 
-  uint8_t kbuf [256];
-  kvr::mem_ostream kos (kbuf, 256);
+  flags &= kvr_encode_flags (codec);
 
-  while (v && e2)
+  if (flags == 0)
   {
-    size_t klen = static_cast<size_t>(e2 - e1);
-    char *k = (char *) kos.push (klen + 1);    
-    kvr_strncpy (k, kos.size (), e1, klen);
-
-    v = v->_search_key (k);
-
-    e1 = ++e2;
-    e2 = strchr (e1, delim);
-    kos.seek (0);
+    return this->encode (codec, ostr);
   }
 
-  if (lastparent)
+  if (codec == kvr::CODEC_MSGPACK)
   {
-    *lastparent = v;
+    return kvr::internal::msgpack::write (this, ostr, flags);
   }
 
-  if (lastkey)
-  {
-    *lastkey = e1;
-  }
+  return kvr::internal::cbor::write (this, ostr, flags);
+}
 
-  if (v && e1 && (*e1 != 0))
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// drops the elements of 'arr', a materialized packed array, that 'proj' doesn't select
+static void kvr_view_project_packed (kvr::value *arr, kvr::internal::projection *proj, size_t first, size_t n, size_t depth)
+{
+  for (kvr::sz_t i = arr->length (); i > 0; --i)
   {
-    v = v->_search_key (e1);
-  }
+    size_t nfirst = 0, nn = 0;
+    kvr::internal::projection::match_t m = proj->match (first, n, depth, NULL, 0, size_t (i - 1), &nfirst, &nn);
+    proj->release (nfirst);
 
-  return v;
+    if (m != kvr::internal::projection::MATCH_FULL)
+    {
+      arr->pop (i - 1);
+    }
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value * kvr::value::_search_key (const char *keystr) const
+// walks 'src' with a cursor, materializing children selected by 'proj'
+static bool kvr_view_project (const kvr::view &src, kvr::value *dst, kvr::internal::projection *proj, size_t first, size_t n, size_t depth)
 {
-  KVR_ASSERT (keystr);
-
-  value *v = NULL;
-
-  //////////////////////////////////
-  if (this->is_map ())
-  //////////////////////////////////
-  {
-    v = this->find (keystr);
-  }
+  const bool map = src.is_map ();
 
-  //////////////////////////////////
-  else if (this->is_array ())
-  //////////////////////////////////
-  {
-    char k0 = keystr [0];
-    switch (k0)
-    {
-      case KVR_TOKEN_MAP_GREP: // pattern match in array of maps
-      {
-        const char eq = '=';
-        const char *pattern = &keystr [1];
-        const char *s = strchr (pattern, eq);
+  kvr::view::cursor c (src);
+  kvr::view k, v;
 
-        if (s)
-        {
-          sz_t sklen = static_cast<sz_t>(s - pattern);
-          const char *sk = pattern;
-          const char *sv = s + 1;
+  uint8_t kbuf [256];
+  kvr::mem_ostream kos (kbuf, 256);
 
-          for (sz_t i = 0, c = this->length (), f = 0; (i < c) && !f; ++i)
-          {
-            value *m = this->element (i);
+  bool ok = true;
 
-            if (m && m->is_map ())
-            {
-              cursor cur (m);
-              pair p;
+  for (size_t index = 0; ok && (map ? c.get (&k, &v) : c.get (&v)); ++index)
+  {
+    kvr::sz_t klen = 0;
+    const char *ks = NULL;
 
-              while (cur.get (&p))
-              {
-                key *pk = p.get_key ();
-                const char *pks = pk->get_string ();
-                sz_t pkslen = pk->get_length ();
+    if (map)
+    {
+      KVR_ASSERT_SAFE (k.is_string (), false);
+      ks = k.get_string (&klen);
+
+      kos.seek (0);
+      char *kz = (char *) kos.push (klen + 1);
+      memcpy (kz, ks, klen);
+      kz [klen] = 0;
+      ks = kz;
+    }
 
-                if (pks && (pkslen == sklen) && (strncmp (pks, sk, sklen) == 0)) 
-                {
-                  // got key (unique), now check value
-                  value *pv = p.get_value ();
-                  KVR_ASSERT (pv);
+    size_t nfirst = 0, nn = 0;
+    kvr::internal::projection::match_t m = proj->match (first, n, depth, ks, klen, index, &nfirst, &nn);
 
-                  if (pv->is_string ())
-                  {
-                    const char *pvstr = pv->get_string ();
-                    if (strcmp (sv, pvstr) == 0)
-                    {
-                      v = m;
-                      f = 1;
-                    }
-                  }
-                  else if (pv->is_float ())
-                  {
-                    double svf = strtod (sv, NULL);
-                    double pvf = pv->get_float (); 
-                    if (kvr::internal::fp_equal (svf, pvf))
-                    {
-                      v = m;
-                      f = 1;
-                    }
-                  }
-                  else if (pv->is_integer ())
-                  {
-                    char *end = NULL;
-                    int64_t svi = strtoll (sv, &end, 10);
-                    int64_t pvi = pv->get_integer ();
-                    if (end && (!*end) && (svi == pvi))
-                    {
-                      v = m;
-                      f = 1;
-                    }
-                  }
-                  else if (pv->is_boolean ())
-                  {
-                    int valid = (strcmp (sv, kvr_const_str_false) == 0) ? 0 : (strcmp (sv, kvr_const_str_true) == 0) ? 1 : -1;
-                    if (valid != -1)
-                    {
-                      bool svb = valid ? true : false;
-                      bool pvb = pv->get_boolean ();
-                      if (svb == pvb)
-                      {
-                        v = m;
-                        f = 1;
-                      }
-                    }
-                  }
-                  else if (pv->is_null ())
-                  {
-                    bool svnull = (strcmp (sv, kvr_const_str_null) == 0);
-                    if (svnull)
-                    {
-                      v = m;
-                      f = 1;
-                    }
-                  }
+    if (m == kvr::internal::projection::MATCH_FULL)
+    {
+      kvr::value *child = map ? dst->insert_null (ks) : dst->push_null ();
+      ok = child && v.materialize (child);
+    }
+    else if ((m == kvr::internal::projection::MATCH_PARTIAL) && (v.is_map () || v.is_array ()))
+    {
+      bool cmap = v.is_map ();
+      kvr::value *child = map ? (cmap ? dst->insert_map (ks) : dst->insert_array (ks)) : (cmap ? dst->push_map () : dst->push_array ());
+      ok = child && kvr_view_project (v, child, proj, nfirst, nn, depth + 1);
 
-                  break;
-                }
-              }
-            }
-          }
-        }        
-        break;
+      // nothing selected below
+      if (ok && ((cmap ? child->size () : child->length ()) == 0))
+      {
+        if (map) { dst->remove (ks); } else { dst->pop (); }
+      }
+    }
+    else if (m == kvr::internal::projection::MATCH_PARTIAL)
+    {
+      // a packed array is one token: materialize it whole, then keep what's selected
+      kvr::value *child = map ? dst->insert_null (ks) : dst->push_null ();
+      if (child && v.materialize (child) && child->is_array ())
+      {
+        kvr_view_project_packed (child, proj, nfirst, nn, depth + 1);
       }
 
-      default:
+      if (child && (!child->is_array () || (child->length () == 0)))
       {
-        char *end = NULL;
-        int64_t ki64 = strtoll (keystr, &end, 10);
-        KVR_ASSERT_SAFE ((end && (!*end) && "non-integral array index"), NULL);
-        KVR_ASSERT (ki64 >= 0);
-        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
-        sz_t ki = (sz_t) ki64;
-        v = this->element (ki);
-        break;
+        if (map) { dst->remove (ks); } else { dst->pop (); }
       }
     }
+
+    proj->release (nfirst);
   }
 
-  return v;
+  return ok;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-uint8_t kvr::value::_type () const
+bool kvr::value::decode (codec_t codec, const uint8_t *data, size_t size, const char **paths, sz_t pathsz)
 {
-  uint8_t t = m_flags & KVR_VALUE_TYPE_MASK;
-  return t;
-}
+  KVR_ASSERT_SAFE (data && (size > 0), false);
+  KVR_ASSERT_SAFE (paths || (pathsz == 0), false);
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
+  bool success = false;
 
-bool kvr::value::_type_equiv (const value *rhs) const
-{
-  KVR_ASSERT (rhs);
+  this->conv_null ();
 
-  if ((this->_type () == rhs->_type ()) || 
-      (this->_is_number () && rhs->_is_number ()) || 
-      (this->is_string () && rhs->is_string ()))
+  kvr::internal::projection proj (paths, pathsz, KVR_TOKEN_DELIMITER);
+
+  switch (codec)
   {
-    return true;
+    case kvr::CODEC_JSON:
+    {
+      kvr::internal::json::projector p ((const char *) data, size, &proj);
+      success = p.read (this);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    case kvr::CODEC_CBOR:
+    {
+      kvr::view root (codec, data, size);
+      if (root.is_map () || root.is_array ())
+      {
+        root.is_map () ? this->conv_map () : this->conv_array ();
+        success = kvr_view_project (root, this, &proj, 0, proj.count (), 0);
+      }
+      else if (root.materialize (this) && this->is_array ())
+      {
+        kvr_view_project_packed (this, &proj, 0, proj.count (), 0);
+        success = true;
+      }
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
   }
 
-  return false;
+  return success;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_destruct ()
+bool kvr::value::decode (codec_t codec, istream &istr)
 {
-  if (this->is_map ())
+  bool success = false;
+
+  this->conv_null ();
+
+  switch (codec)
   {
-    cursor c (this);
-    pair   p;
-    while (c.get (&p))
+    case kvr::CODEC_JSON:
     {
-      m_ctx->_destroy_key (p.m_k);
-      m_ctx->_destroy_value (FLAG_PARENT_MAP, p.m_v);      
+      success = kvr::internal::json::read (this, istr);
+      break;
     }
-    m_data.m.deinit (m_ctx->m_allocator);
-  }
-  else if (this->is_array ())
-  {
-    sz_t c = this->length ();
-    while (c)
+
+    case kvr::CODEC_MSGPACK:
     {
-      this->pop ();
-      c = this->length ();
+      success = kvr::internal::msgpack::read (this, istr);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      success = kvr::internal::cbor::read (this, istr);
+      break;
+    }
+
+    default:
+    {
+      break;
     }
-    m_data.a.deinit (m_ctx->m_allocator);
-  }
-  else if (this->_is_string_dynamic ())
-  {
-    m_data.s.m_dyn.cleanup (m_ctx->m_allocator);
   }
+
+  return success;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_clear ()
+bool kvr::value::decode_update (codec_t codec, const uint8_t *data, size_t size)
 {
-  // release memory
-  this->_destruct ();
+  kvr::internal::update_handler h (this);
+  return kvr::scan (codec, data, size, &h);
+}
 
-  // zero data
-  memset (&m_data, 0, sizeof (m_data));
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-  // clear type flag
-  m_flags &= ~KVR_VALUE_TYPE_MASK;
+bool kvr::value::decode_update (codec_t codec, istream &istr)
+{
+  kvr::internal::update_handler h (this);
+  return kvr::scan (codec, istr, &h);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_dump (size_t lpad, const char *key) const
+bool kvr::value::decode_file (codec_t codec, const char *path)
 {
-#if KVR_DEBUG
-  for (size_t t = 0; t < lpad; ++t)
+  KVR_ASSERT_SAFE (path, false);
+
+  mmap_istream file (path);
+
+  // an empty file is not a document in any codec
+  if (!file.is_open () || (file.size () == 0))
   {
-    std::fprintf (stderr, "  ");
+    return false;
   }
 
-  if (key)
+  // nothing follows the mapping, so json is read up to the file size and not up to a null
+  if (codec == kvr::CODEC_JSON)
   {
-    std::fprintf (stderr, "key = %s : ", key);
+    this->conv_null ();
+    return kvr::internal::json::read_bounded (this, file.data (), file.size ());
   }
 
-  //////////////////////////////////
-  if (this->is_map ())
-  //////////////////////////////////
-  {
-    std::fprintf (stderr, "value = -> [map]\n");
+  return this->decode (codec, file.data (), file.size ());
+}
 
-    cursor c (this);
-    pair   p;
-    while (c.get (&p))
-    {
-      const char *k = p.get_key ()->get_string ();
-      value *v = p.get_value ();
-      v->_dump (lpad + 1, k);
-    }
-  }
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-  //////////////////////////////////
-  else if (this->is_array ())
-  //////////////////////////////////
-  {
-    std::fprintf (stderr, "value = -> [array]\n");
+bool kvr::value::encode_file (codec_t codec, const char *path, uint32_t flags)
+{
+  KVR_ASSERT_SAFE (path, false);
+
+  flags &= kvr_encode_flags (codec);
+
+  size_t bound = this->encode_bound (codec, flags);
+
+  // one extent holds the whole document
+  mmap_ostream file (path, bound);
+  uint8_t *dest = file.push (bound);
+  if (!dest)
+  {
+    file.close ();
+    return false;
+  }
+
+  mem_ostream ostr (dest, bound);
+
+  bool success = false;
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      success = kvr::internal::json::write (this, &ostr);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      success = flags ? kvr::internal::msgpack::write (this, &ostr, flags) : kvr::internal::msgpack::write (this, &ostr);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      success = flags ? kvr::internal::cbor::write (this, &ostr, flags) : kvr::internal::cbor::write (this, &ostr);
+      break;
+    }
+
+    case kvr::CODEC_KVRB:
+    {
+      success = kvr::internal::kvrb::write (this, &ostr);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  if (ostr.buffer () == dest)
+  {
+    file.pop (bound - ostr.tell ());
+  }
+  else
+  {
+    // outgrew the bound into a heap buffer
+    file.pop (bound);
+    file.write (const_cast<uint8_t *> (ostr.buffer ()), ostr.tell ());
+  }
+
+  return file.close () && success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::scan (codec_t codec, const uint8_t *data, size_t size, handler *h)
+{
+  KVR_ASSERT_SAFE (h, false);
+
+  bool success = false;
+
+  mem_istream istr (data, size);
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      success = kvr::internal::json::scan (istr, h);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      success = kvr::internal::msgpack::scan (istr, h);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      success = kvr::internal::cbor::scan (istr, h);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::scan (codec_t codec, istream &istr, handler *h)
+{
+  KVR_ASSERT_SAFE (h, false);
+
+  bool success = false;
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      success = kvr::internal::json::scan (istr, h);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      success = kvr::internal::msgpack::scan (istr, h);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      success = kvr::internal::cbor::scan (istr, h);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool kvr_transcode_memory (kvr::codec_t from, const uint8_t *data, size_t size, kvr::codec_t to, kvr::mem_ostream *ostr)
+{
+  KVR_ASSERT (ostr);
+
+  bool success = false;
+
+  // json only reports container sizes at the end, so binary 
+  // targets get them from a pre-pass over the source
+  kvr::internal::size_recorder rec;
+  const kvr::sz_t *sizes = NULL;
+
+  if ((from == kvr::CODEC_JSON) && (to != kvr::CODEC_JSON))
+  {
+    if (!kvr::scan (from, data, size, &rec))
+    {
+      return false;
+    }
+
+    sizes = rec.sizes ();
+  }
+
+  switch (to)
+  {
+    case kvr::CODEC_JSON:
+    {
+      kvr::internal::json::ostream_memory wostr (ostr);
+      kvr::internal::json::emitter<kvr::internal::json::ostream_memory> emt (wostr);
+      success = kvr::scan (from, data, size, &emt);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      kvr::internal::msgpack::emitter<kvr::mem_ostream> emt (ostr, sizes);
+      success = kvr::scan (from, data, size, &emt);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      kvr::internal::cbor::emitter<kvr::mem_ostream> emt (ostr, sizes);
+      success = kvr::scan (from, data, size, &emt);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::transcode (codec_t from, const uint8_t *data, size_t size, codec_t to, obuffer *obuf)
+{
+  KVR_ASSERT_SAFE (obuf, false);
+
+  obuf->m_stream.seek (0);
+
+  bool success = kvr_transcode_memory (from, data, size, to, &obuf->m_stream);
+
+  if (success && obuf->m_pool)
+  {
+    obuf->m_pool->record (obuf->m_stream.tell ());
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::transcode (codec_t from, istream &istr, codec_t to, ostream *ostr)
+{
+  KVR_ASSERT_SAFE (ostr, false);
+
+  bool success = false;
+
+  if ((from == kvr::CODEC_JSON) && (to == kvr::CODEC_MSGPACK))
+  {
+    // msgpack has no indefinite-length containers and the size pre-pass 
+    // needs the source twice, so read it into memory
+    const size_t blocksz = KVR_CONSTANT_ISTREAM_BLOCK_SZ;
+    mem_ostream spool (blocksz);
+    size_t n = 0;
+    do
+    {
+      n = istr.fetch (spool.push (blocksz), blocksz);
+      spool.pop (blocksz - n);
+    } while (n > 0);
+    spool.flush (); // null-terminate for the json reader
+
+    mem_ostream out (spool.tell ());
+    success = kvr_transcode_memory (from, spool.buffer (), spool.tell (), to, &out);
+    if (success)
+    {
+      ostr->write ((uint8_t *) out.buffer (), out.tell ());
+      ostr->flush ();
+    }
+
+    return success;
+  }
+
+  switch (to)
+  {
+    case kvr::CODEC_JSON:
+    {
+      kvr::internal::json::ostream_custom wostr (ostr);
+      kvr::internal::json::emitter<kvr::internal::json::ostream_custom> emt (wostr);
+      success = kvr::scan (from, istr, &emt);
+      if (success) { wostr.m_stream.flush (); }
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      kvr::internal::block_ostream bostr (ostr);
+      kvr::internal::msgpack::emitter<kvr::internal::block_ostream> emt (&bostr);
+      success = kvr::scan (from, istr, &emt);
+      if (success) { bostr.flush (); }
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      // json sizes come at the end: indefinite-length containers keep it one pass
+      kvr::internal::block_ostream bostr (ostr);
+      kvr::internal::cbor::emitter<kvr::internal::block_ostream> emt (&bostr, NULL, (from == kvr::CODEC_JSON));
+      success = kvr::scan (from, istr, &emt);
+      if (success) { bostr.flush (); }
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::value::encode_bound (codec_t codec) const
+{
+  size_t size = 0;
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      size = kvr::internal::json::write_size (this);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      size = kvr::internal::msgpack::write_size (this);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      size = kvr::internal::cbor::write_size (this);
+      break;
+    }
+
+    case kvr::CODEC_KVRB:
+    {
+      size = kvr::internal::kvrb::write_size (this);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  // + eos
+  size = ((size + 1u + 7u) & ~7u);
+
+  return size;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// worst-case growth of a flagged encoding over the plain one (see encode_flag_t). the key 
+// table adds its wrapper, and msgpack refers to a 3-byte key (4 bytes plain) with up to 6.
+// a packed column adds its headers, the count and 10 bytes a value: a 10-byte delta varint,
+// or an xor value of up to 77 bits. a typed array adds its headers and 8 bytes a value.
+static size_t kvr_encode_flags_bound (const kvr::value *val, kvr::codec_t codec, uint32_t flags)
+{
+  size_t size = 0;
+
+  if (val->is_map ())
+  {
+    kvr::value::cursor cursor (val);
+    kvr::pair p;
+
+    while (cursor.get (&p))
+    {
+      size += ((flags & kvr::ENCODE_KEY_TABLE) && (codec == kvr::CODEC_MSGPACK)) ? 2u : 0u;
+      size += kvr_encode_flags_bound (p.get_value (), codec, flags);
+    }
+  }
+  else if (val->is_array ())
+  {
+    const kvr::sz_t alen = val->length ();
+
+    if ((flags & kvr::ENCODE_NUMERIC_COLUMNS) && (kvr::internal::column_type (val) != kvr::internal::COLUMN_NONE))
+    {
+      size += 8u + 10u + (size_t (alen) * 10u);
+    }
+    else if ((flags & kvr::ENCODE_TYPED_ARRAYS) && (kvr::internal::cbor::writer<kvr::mem_ostream>::typed_tag (val) != 0))
+    {
+      size += 8u + (size_t (alen) * 8u);
+    }
+    else
+    {
+      for (kvr::sz_t i = 0; i < alen; ++i)
+      {
+        size += kvr_encode_flags_bound (val->element (i), codec, flags);
+      }
+    }
+  }
+
+  return size;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::value::encode_bound (codec_t codec, uint32_t flags) const
+{
+  size_t size = this->encode_bound (codec);
+
+  flags &= kvr_encode_flags (codec);
+
+  if (flags != 0)
+  {
+    // + key table wrapper (msgpack ext 32, cbor stringref namespace tag)
+    size += (flags & ENCODE_KEY_TABLE) ? 8u : 0u;
+    size += kvr_encode_flags_bound (this, codec, flags);
+  }
+
+  return size;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::dump () const
+{
+#if KVR_DEBUG
+  this->_dump (0, NULL);
+  std::fprintf (stderr, "\n");
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_string_set (const char *str, sz_t len)
+{
+  KVR_ASSERT (str);
+  KVR_ASSERT (is_string ());
+
+  if (this->_is_string_static () && (len >= string::stt_str::CAP))
+  {
+    this->_clear ();
+    m_flags |= FLAG_TYPE_STRING_DYNAMIC;
+  }
+  
+  if (this->_is_string_dynamic ())
+  {
+    this->m_data.s.m_dyn.set (str, len, m_ctx->m_allocator);
+  }
+  else
+  {
+    this->m_data.s.m_stt.set (str, len);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_string_move (char *str, sz_t size)
+{
+  KVR_ASSERT (str);
+  KVR_ASSERT (size > 0);
+  KVR_ASSERT (is_string ());
+  
+  this->_clear ();
+  m_flags |= FLAG_TYPE_STRING_DYNAMIC;
+
+  m_data.s.m_dyn.m_data = str;
+  m_data.s.m_dyn.m_size = size;
+  m_data.s.m_dyn.m_len = size - 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::_search_path_expr (const char *expr, const char **lastkey, value **lastparent) const
+{
+  KVR_ASSERT (expr);
+  KVR_ASSERT (expr [0] != 0);
+
+  value *v = (value *) this;
+
+  const char delim = KVR_TOKEN_DELIMITER;
+  const char *e1 = expr;
+  const char *e2 = strchr (e1, delim);
+
+  uint8_t kbuf [256];
+  kvr::mem_ostream kos (kbuf, 256);
+
+  while (v && e2)
+  {
+    size_t klen = static_cast<size_t>(e2 - e1);
+    char *k = (char *) kos.push (klen + 1);    
+    kvr_strncpy (k, kos.size (), e1, klen);
+
+    v = v->_search_key (k);
+
+    e1 = ++e2;
+    e2 = strchr (e1, delim);
+    kos.seek (0);
+  }
+
+  if (lastparent)
+  {
+    *lastparent = v;
+  }
+
+  if (lastkey)
+  {
+    *lastkey = e1;
+  }
+
+  if (v && e1 && (*e1 != 0))
+  {
+    v = v->_search_key (e1);
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::_search_key (const char *keystr) const
+{
+  KVR_ASSERT (keystr);
+
+  value *v = NULL;
+
+  //////////////////////////////////
+  if (this->is_map ())
+  //////////////////////////////////
+  {
+    v = this->find (keystr);
+  }
+
+  //////////////////////////////////
+  else if (this->is_array ())
+  //////////////////////////////////
+  {
+    char k0 = keystr [0];
+    switch (k0)
+    {
+      case KVR_TOKEN_MAP_GREP: // pattern match in array of maps
+      {
+        const char eq = '=';
+        const char *pattern = &keystr [1];
+        const char *s = strchr (pattern, eq);
+
+        if (s)
+        {
+          sz_t sklen = static_cast<sz_t>(s - pattern);
+          const char *sk = pattern;
+          const char *sv = s + 1;
+
+          for (sz_t i = 0, c = this->length (), f = 0; (i < c) && !f; ++i)
+          {
+            value *m = this->element (i);
+
+            if (m && m->is_map ())
+            {
+              cursor cur (m);
+              pair p;
+
+              while (cur.get (&p))
+              {
+                key *pk = p.get_key ();
+                const char *pks = pk->get_string ();
+                sz_t pkslen = pk->get_length ();
+
+                if (pks && (pkslen == sklen) && (strncmp (pks, sk, sklen) == 0)) 
+                {
+                  // got key (unique), now check value
+                  value *pv = p.get_value ();
+                  KVR_ASSERT (pv);
+
+                  if (pv->is_string ())
+                  {
+                    const char *pvstr = pv->get_string ();
+                    if (strcmp (sv, pvstr) == 0)
+                    {
+                      v = m;
+                      f = 1;
+                    }
+                  }
+                  else if (pv->is_float ())
+                  {
+                    double svf = strtod (sv, NULL);
+                    double pvf = pv->get_float (); 
+                    if (kvr::internal::fp_equal (svf, pvf))
+                    {
+                      v = m;
+                      f = 1;
+                    }
+                  }
+                  else if (pv->is_integer ())
+                  {
+                    char *end = NULL;
+                    int64_t svi = strtoll (sv, &end, 10);
+                    int64_t pvi = pv->get_integer ();
+                    if (end && (!*end) && (svi == pvi))
+                    {
+                      v = m;
+                      f = 1;
+                    }
+                  }
+                  else if (pv->is_boolean ())
+                  {
+                    int valid = (strcmp (sv, kvr_const_str_false) == 0) ? 0 : (strcmp (sv, kvr_const_str_true) == 0) ? 1 : -1;
+                    if (valid != -1)
+                    {
+                      bool svb = valid ? true : false;
+                      bool pvb = pv->get_boolean ();
+                      if (svb == pvb)
+                      {
+                        v = m;
+                        f = 1;
+                      }
+                    }
+                  }
+                  else if (pv->is_null ())
+                  {
+                    bool svnull = (strcmp (sv, kvr_const_str_null) == 0);
+                    if (svnull)
+                    {
+                      v = m;
+                      f = 1;
+                    }
+                  }
+
+                  break;
+                }
+              }
+            }
+          }
+        }        
+        break;
+      }
+
+      default:
+      {
+        char *end = NULL;
+        int64_t ki64 = strtoll (keystr, &end, 10);
+        KVR_ASSERT_SAFE ((end && (!*end) && "non-integral array index"), NULL);
+        KVR_ASSERT (ki64 >= 0);
+        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
+        sz_t ki = (sz_t) ki64;
+        v = this->element (ki);
+        break;
+      }
+    }
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t kvr::value::_type () const
+{
+  uint32_t t = m_flags & KVR_VALUE_TYPE_MASK;
+  return t;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::value::_type_equiv (const value *rhs) const
+{
+  KVR_ASSERT (rhs);
+
+  if ((this->_type () == rhs->_type ()) || 
+      (this->_is_number () && rhs->_is_number ()) || 
+      (this->is_string () && rhs->is_string ()))
+  {
+    return true;
+  }
+
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::_count (sz_t limit) const
+{
+  // number of nodes in tree (stops counting at limit)
+  sz_t count = 1;
+
+  if (this->is_map ())
+  {
+    cursor c (this);
+    pair   p;
+    while ((count < limit) && c.get (&p))
+    {
+      count += p.m_v->_count (limit - count);
+    }
+  }
+  else if (this->is_array ())
+  {
+    for (sz_t i = 0, c = this->length (); (i < c) && (count < limit); ++i)
+    {
+      count += this->element (i)->_count (limit - count);
+    }
+  }
+
+  return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_destruct ()
+{
+  if (this->is_map ())
+  {
+    cursor c (this);
+    pair   p;
+    while (c.get (&p))
+    {
+      m_ctx->_destroy_key (p.m_k);
+      m_ctx->_destroy_value (FLAG_PARENT_MAP, p.m_v);      
+    }
+    m_data.m.deinit (m_ctx->m_allocator);
+  }
+  else if (this->is_array ())
+  {
+    sz_t c = this->length ();
+    while (c)
+    {
+      this->pop ();
+      c = this->length ();
+    }
+    m_data.a.deinit (m_ctx->m_allocator);
+  }
+  else if (this->_is_string_dynamic ())
+  {
+    m_data.s.m_dyn.cleanup (m_ctx->m_allocator);
+  }
+  else if (this->is_binary ())
+  {
+    m_data.bin.cleanup (m_ctx->m_allocator);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_clear ()
+{
+  // release memory
+  this->_destruct ();
+
+  // zero data
+  memset (&m_data, 0, sizeof (m_data));
+
+  // clear type flag
+  m_flags &= ~KVR_VALUE_TYPE_MASK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_dump (size_t lpad, const char *key) const
+{
+#if KVR_DEBUG
+  for (size_t t = 0; t < lpad; ++t)
+  {
+    std::fprintf (stderr, "  ");
+  }
+
+  if (key)
+  {
+    std::fprintf (stderr, "key = %s : ", key);
+  }
+
+  //////////////////////////////////
+  if (this->is_map ())
+  //////////////////////////////////
+  {
+    std::fprintf (stderr, "value = -> [map]\n");
+
+    cursor c (this);
+    pair   p;
+    while (c.get (&p))
+    {
+      const char *k = p.get_key ()->get_string ();
+      value *v = p.get_value ();
+      v->_dump (lpad + 1, k);
+    }
+  }
+
+  //////////////////////////////////
+  else if (this->is_array ())
+  //////////////////////////////////
+  {
+    std::fprintf (stderr, "value = -> [array]\n");
 
     char k [21];
     for (sz_t i = 0, c = this->length (); i < c; ++i)
     {
-      size_t kl = kvr::internal::u64toa (i, k);
-      k [kl] = 0;
-      value *v = this->element (i);
-      v->_dump (lpad + 1, k);
+      size_t kl = kvr::internal::u64toa (i, k);
+      k [kl] = 0;
+      value *v = this->element (i);
+      v->_dump (lpad + 1, k);
+    }
+  }
+
+  //////////////////////////////////
+  else if (this->is_string ())
+  //////////////////////////////////
+  {
+    const char *str = this->get_string ();
+    std::fprintf (stderr, "value = %s -> [string]\n", str);
+  }
+
+  //////////////////////////////////
+  else if (this->is_binary ())
+  //////////////////////////////////
+  {
+    sz_t size = 0;
+    this->get_binary (&size);
+    std::fprintf (stderr, "value = (%u bytes) -> [binary]\n", (unsigned) size);
+  }
+
+  //////////////////////////////////
+  else if (this->is_integer ())
+  //////////////////////////////////
+  {
+    int64_t n = this->get_integer ();
+#if 0
+    std::fprintf (stderr, "value = %" PRId64 " -> [int]\n", n);
+#else
+    // PRId64 not supported by travis-ci
+    char ns [22];
+    size_t c = kvr::internal::i64toa (n, ns);
+    ns [c] = 0;
+    fprintf (stderr, "value = %s -> [int]\n", ns);
+#endif
+  }
+
+  //////////////////////////////////
+  else if (this->is_float ())
+  //////////////////////////////////
+  {
+    double n = this->get_float ();
+    std::fprintf (stderr, "value = %g -> [float]\n", n);
+  }
+
+  //////////////////////////////////
+  else if (this->is_boolean ())
+  //////////////////////////////////
+  {
+    bool b = this->get_boolean ();
+    std::fprintf (stderr, "value = %s -> [bool]\n", b ? kvr_const_str_true : kvr_const_str_false);
+  }
+
+  //////////////////////////////////
+  else if (this->is_null ())
+  //////////////////////////////////
+  {
+    std::fprintf (stderr, "value = %s -> [null]\n", kvr_const_str_null);
+  }
+#else
+  KVR_REF_UNUSED (lpad);
+  KVR_REF_UNUSED (key);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_diff_set_rem (value *set, value *rem, const value *og, const value *md,
+                                const char **path, const sz_t pathsz, sz_t pathcnt)
+{
+  KVR_ASSERT (set);
+  KVR_ASSERT (rem);
+
+  // find og values in md that need to be updated
+  // if missing, mark for removal
+
+  if (og)
+  {
+    //////////////////////////////////
+    if (md == NULL)
+    //////////////////////////////////
+    {
+      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
+      KVR_ASSERT (pathcnt > 0);
+      // add og to rem list
+      kvr::ctx *ctx = m_ctx;
+      value *v = ctx->_create_value_null (FLAG_PARENT_ARRAY);
+      v->conv_string ();
+
+      if (pathcnt == 1)
+      {
+        const char *pk = path [0];
+        v->set_string (pk);
+      }
+      else
+      {
+        sz_t pksz = 0;
+        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+        v->_string_move (pk, pksz);
+      }
+
+      rem->_push_v (v);
+    }
+
+    //////////////////////////////////
+    else if (!og->_type_equiv (md))
+    //////////////////////////////////
+    {
+      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
+      KVR_ASSERT (pathcnt > 0);
+
+      kvr::ctx *ctx = m_ctx;
+      key *k = NULL;
+      //if ((pathcnt == 1) && (ctx == og->m_ctx)) // path key must already be in the key store
+      if (pathcnt == 1)
+      {
+        const char *pk = path [0];       
+        k = ctx->_create_key (pk); 
+      }
+      else
+      {
+        sz_t pksz = 0;
+        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+        KVR_ASSERT (pk && pksz);
+        k = ctx->_create_key (pk, pksz - 1);
+        if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+      }
+
+      value *v = ctx->_create_value_null (FLAG_PARENT_MAP);
+      v->copy (md);
+      set->_insert_kv (k, v);
+    }
+
+    //////////////////////////////////
+    else if (og->is_map ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (md->is_map ());
+
+      value::cursor c (og);
+      pair ogp;
+
+      while (c.get (&ogp))
+      {
+        const char *k = ogp.get_key ()->get_string ();
+
+        KVR_ASSERT (pathcnt < pathsz);
+        path [pathcnt++] = k;
+
+        value *mdv = md->find (k);
+        value *ogv = ogp.get_value ();
+
+        this->_diff_set_rem (set, rem, ogv, mdv, path, pathsz, pathcnt);
+
+        path [--pathcnt] = NULL;
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_array ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (md->is_array ());
+
+      char k [21];
+      for (sz_t i = 0, c = og->length (); i < c; ++i)
+      {
+        size_t kl = kvr::internal::u64toa (i, k);
+        k [kl] = 0;
+
+        KVR_ASSERT (pathcnt < pathsz);
+        path [pathcnt++] = k;
+
+        value *mdv = md->element (i);
+        value *ogv = og->element (i);
+
+        this->_diff_set_rem (set, rem, ogv, mdv, path, pathsz, pathcnt);
+
+        path [--pathcnt] = NULL;
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_string ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (pathcnt > 0);
+      KVR_ASSERT (md->is_string ());
+
+      sz_t mdstrlen = 0;
+      const char *ogstr = og->get_string ();
+      const char *mdstr = md->get_string (&mdstrlen);
+
+      if (strcmp (ogstr, mdstr) != 0)
+      {
+        kvr::ctx *ctx = m_ctx;
+        key *k = NULL;
+        if (pathcnt == 1)
+        {
+          const char *pk = path [0];
+          k = ctx->_create_key (pk);
+        }
+        else
+        {
+          sz_t pksz = 0;
+          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+          KVR_ASSERT (pk && pksz);
+          k = ctx->_create_key (pk, pksz - 1);
+          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+        }
+
+        value *v = ctx->_create_value_string (FLAG_PARENT_MAP, mdstr, mdstrlen);
+        set->_insert_kv (k, v);
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_binary ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (pathcnt > 0);
+      KVR_ASSERT (md->is_binary ());
+
+      sz_t ogsize = 0, mdsize = 0;
+      const uint8_t *ogbin = og->get_binary (&ogsize);
+      const uint8_t *mdbin = md->get_binary (&mdsize);
+
+      if ((ogsize != mdsize) || (memcmp (ogbin, mdbin, ogsize) != 0))
+      {
+        kvr::ctx *ctx = m_ctx;
+        key *k = NULL;
+        if (pathcnt == 1)
+        {
+          const char *pk = path [0];
+          k = ctx->_create_key (pk);
+        }
+        else
+        {
+          sz_t pksz = 0;
+          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+          KVR_ASSERT (pk && pksz);
+          k = ctx->_create_key (pk, pksz - 1);
+          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+        }
+
+        value *v = ctx->_create_value_null (FLAG_PARENT_MAP);
+        v->set_binary (mdbin, mdsize);
+        set->_insert_kv (k, v);
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_integer ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (pathcnt > 0);
+      KVR_ASSERT (md->_is_number ());
+
+      if (md->is_integer ())
+      {
+        int64_t ogn = og->get_integer ();
+        int64_t mdn = md->get_integer ();
+
+        if (ogn != mdn)
+        {
+          kvr::ctx *ctx = m_ctx;
+          key *k = NULL;
+          if (pathcnt == 1)
+          {
+            const char *pk = path [0];
+            k = ctx->_create_key (pk);
+          }
+          else
+          {
+            sz_t pksz = 0;
+            char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+            KVR_ASSERT (pk && pksz);
+            k = ctx->_create_key (pk, pksz - 1);
+            if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+          }
+
+          value *v = ctx->_create_value_integer (FLAG_PARENT_MAP, mdn);
+          set->_insert_kv (k, v);
+        }
+      }
+      else if (md->is_float ())
+      {
+        double ogn = og->get_float ();
+        double mdn = md->get_float ();
+
+        if (!kvr::internal::fp_equal (ogn, mdn, KVR_CONSTANT_DIFF_FP_EQ_EPSILON))
+        {
+          kvr::ctx *ctx = m_ctx;
+          key *k = NULL;
+          if (pathcnt == 1)
+          {
+            const char *pk = path [0];
+            k = ctx->_create_key (pk);
+          }
+          else
+          {
+            sz_t pksz = 0;
+            char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+            KVR_ASSERT (pk && pksz);
+            k = ctx->_create_key (pk, pksz - 1);
+            if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+          }
+
+          value *v = ctx->_create_value_float (FLAG_PARENT_MAP, mdn);
+          set->_insert_kv (k, v);
+        }
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_float ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (pathcnt > 0);
+      KVR_ASSERT (md->_is_number ());
+
+      double ogn = og->get_float ();
+      double mdn = md->get_float ();
+
+      if (!kvr::internal::fp_equal (ogn, mdn, KVR_CONSTANT_DIFF_FP_EQ_EPSILON))
+      {
+        kvr::ctx *ctx = m_ctx;
+        key *k = NULL;
+        if (pathcnt == 1)
+        {
+          const char *pk = path [0];
+          k = ctx->_create_key (pk);
+        }
+        else
+        {
+          sz_t pksz = 0;
+          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+          KVR_ASSERT (pk && pksz);
+          k = ctx->_create_key (pk, pksz - 1);
+          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+        }
+
+        value *v = ctx->_create_value_float (FLAG_PARENT_MAP, mdn);
+        set->_insert_kv (k, v);
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_boolean ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (pathcnt > 0);
+      KVR_ASSERT (md->is_boolean ());
+
+      bool ogb = og->get_boolean ();
+      bool mdb = md->get_boolean ();
+
+      if (ogb != mdb)
+      {
+        kvr::ctx *ctx = m_ctx;
+        key *k = NULL;
+        if (pathcnt == 1)
+        {
+          const char *pk = path [0];
+          k = ctx->_create_key (pk);
+        }
+        else
+        {
+          sz_t pksz = 0;
+          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+          KVR_ASSERT (pk && pksz);
+          k = ctx->_create_key (pk, pksz - 1);
+          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+        }
+
+        value *v = ctx->_create_value_boolean (FLAG_PARENT_MAP, mdb);
+        set->_insert_kv (k, v);
+      }
+    }
+
+    //////////////////////////////////
+    else if (og->is_null ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (md->is_null ());
+      // should already be taken care of in type check
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_diff_add (value *add, const value *og, const value *md,
+                            const char **path, const sz_t pathsz, sz_t pathcnt)
+{
+  KVR_ASSERT (add);
+
+  // go through md and og and look for nodes in md that are not in og
+
+  if (md)
+  {
+    //////////////////////////////////
+    if (og == NULL)
+    //////////////////////////////////
+    {
+      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
+      KVR_ASSERT (pathcnt > 0);
+      // add md to add list
+
+      kvr::ctx *ctx = m_ctx;
+      key *k = NULL;      
+      //if ((pathcnt == 1) && (ctx == md->m_ctx))
+      if (pathcnt == 1)
+      {
+        const char *pk = path [0];
+        k = ctx->_create_key (pk);
+      }
+      else
+      {
+        sz_t pksz = 0;
+        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
+        KVR_ASSERT (pk && pksz);
+        k = ctx->_create_key (pk, pksz - 1);
+        if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+      }
+
+      value *v = ctx->_create_value_null (FLAG_PARENT_MAP);
+      v->copy (md);
+      add->_insert_kv (k, v);
+    }
+
+    //////////////////////////////////
+    else if (!og->_type_equiv (md))
+    //////////////////////////////////
+    {
+      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
+      KVR_ASSERT (pathcnt > 0);
+      // case handled by _diff_set_rem (which must be called before _diff_add)
+    }
+
+    //////////////////////////////////
+    else if (md->is_map ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (og->is_map ());
+
+      value::cursor c (md);
+      pair mdp;
+
+      while (c.get (&mdp))
+      {
+        const char *k = mdp.get_key ()->get_string ();
+
+        KVR_ASSERT (pathcnt < pathsz);
+        path [pathcnt++] = k;
+
+        value *ogv = og->find (k);
+        value *mdv = mdp.get_value ();
+
+        _diff_add (add, ogv, mdv, path, pathsz, pathcnt);
+
+        path [--pathcnt] = NULL;
+      }
+    }
+
+    //////////////////////////////////
+    else if (md->is_array ())
+    //////////////////////////////////
+    {
+      KVR_ASSERT (og->is_array ());
+
+      char k [21];
+      for (sz_t i = 0, c = md->length (); i < c; ++i)
+      {
+        size_t kl = kvr::internal::u64toa (i, k); k [kl] = 0;
+
+        KVR_ASSERT (pathcnt < pathsz);
+        path [pathcnt++] = k;
+
+        value *ogv = og->element (i);
+        value *mdv = md->element (i);
+
+        _diff_add (add, ogv, mdv, path, pathsz, pathcnt);
+
+        path [--pathcnt] = NULL;
+      }
+    }
+  }
+}                   
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_patch_set (const value *set)
+{
+  KVR_ASSERT (set);
+  
+  kvr::value *tg = this;
+
+  kvr::value::cursor cursor (set);
+  kvr::pair p;
+
+  while (cursor.get (&p))
+  {
+    const char *skey = p.get_key ()->get_string ();
+    kvr::value *sval = p.get_value ();
+    kvr::value *tgv  = tg->_search_path_expr (skey);
+
+    if (tgv)
+    {
+      tgv->copy (sval);
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_patch_add (const value *add)
+{
+  KVR_ASSERT (add);
+
+  value *tg = this;
+
+  kvr::value::cursor cursor (add);
+  kvr::pair p;
+
+  while (cursor.get (&p))
+  {
+    const char *akey = p.get_key ()->get_string ();
+    value *aval = p.get_value ();
+
+    const char *tgk = NULL;
+    value *tgp = NULL;
+    value *tgv = tg->_search_path_expr (akey, &tgk, &tgp);
+    KVR_ASSERT (tgv == NULL); // path shouldn't exist but we're interested in key and parent
+    KVR_REF_UNUSED (tgv);
+
+    if (tgk && tgp)
+    {
+      KVR_ASSERT (tgp->is_map () || tgp->is_array ());
+
+      if (tgp->is_map ())
+      {
+        value *v = tgp->insert_null (tgk);
+        KVR_ASSERT (v);
+        v->copy (aval);
+      }
+      else if (tgp->is_array ())
+      {
+#if KVR_DEBUG
+        char *end;
+        int64_t ki64 = strtoll (tgk, &end, 10); KVR_ASSERT (!*end);
+        KVR_ASSERT (ki64 >= 0);
+        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
+        sz_t ki = (sz_t) ki64;
+        sz_t sz = tgp->length ();
+        KVR_ASSERT (ki == sz);
+#endif
+        value *v = tgp->push_null ();
+        v->copy (aval);
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_patch_rem (const value *rem)
+{
+  KVR_ASSERT (rem);
+
+  value *tg = this;
+
+  for (sz_t c = rem->length (); c >= 1; --c) // start from bottom (for array pop)
+  {
+    sz_t i = c - 1;
+
+    value *rval = rem->element (i);
+    KVR_ASSERT (rval);
+
+    const char *rkey = rval->get_string ();
+    KVR_ASSERT (rkey);
+
+    const char *tgk = NULL;
+    value *tgp = NULL;
+    value *tgv = tg->_search_path_expr (rkey, &tgk, &tgp);
+
+    if (tgp && tgv)
+    {
+      KVR_ASSERT (tgp->is_map () || tgp->is_array ());
+
+      if (tgp->is_map ())
+      {
+        KVR_ASSERT (tgv == tgp->find (tgk));
+        tgp->remove (tgk);
+      }
+      else if (tgp->is_array ())
+      {
+#if KVR_DEBUG
+        char *end;
+        int64_t ki64 = strtoll (tgk, &end, 10); KVR_ASSERT (!*end);
+        KVR_ASSERT (ki64 >= 0);
+        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
+        sz_t ki = (sz_t) ki64;
+        sz_t sz = tgp->length ();
+        KVR_ASSERT ((ki + 1) == sz);
+#endif
+        tgp->pop ();
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_insert_kv (key *k, value *v)
+{
+  KVR_ASSERT (k);
+  KVR_ASSERT (v);
+  KVR_ASSERT (is_map ());
+
+  map::node *n = NULL;
+
+#if KVR_DEBUG
+  n = (k->m_ref <= 1) ? NULL : m_data.m.find (k);
+  KVR_ASSERT (n == NULL);
+#endif
+
+  n = m_data.m.insert (k, v, m_ctx->m_allocator);
+  KVR_ASSERT (n != NULL);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_push_v (value *v)
+{
+  KVR_ASSERT (v);
+  KVR_ASSERT (is_array ());
+
+  this->m_data.a.push (v, m_ctx->m_allocator);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::_conv_map (sz_t cap)
+{
+  if (!is_map ())
+  {
+    this->_clear ();
+    m_flags |= FLAG_TYPE_MAP;
+    m_data.m.init (cap, m_ctx->m_allocator);
+  }
+
+  return this;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::_conv_array (sz_t cap)
+{
+  if (!is_array ())
+  {
+    this->_clear ();
+    m_flags |= FLAG_TYPE_ARRAY;
+    m_data.a.init (cap, m_ctx->m_allocator);
+  }
+
+  return this;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::string
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *kvr::value::string::stt_str::get () const
+{
+  return m_data;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::string::stt_str::length () const
+{
+  size_t length = strlen (m_data);
+  return static_cast<sz_t>(length);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::string::stt_str::set (const char *str, sz_t len)
+{
+  KVR_ASSERT (str);
+  KVR_ASSERT (len < stt_str::CAP);
+  kvr_strncpy (m_data, string::stt_str::CAP, str, len);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *kvr::value::string::dyn_str::get () const
+{
+  return m_data;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::string::dyn_str::length () const
+{
+  return m_len;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::string::dyn_str::set (const char *str, sz_t len, allocator *a)
+{
+  KVR_ASSERT (str);
+  KVR_ASSERT (len > 0);
+  KVR_ASSERT (a);
+
+  sz_t allocsz = ((len + 1) + string::dyn_str::PAD) & ~string::dyn_str::PAD;  
+  if (allocsz > m_size)
+  {
+    if (m_data) { a->deallocate (m_data, m_size); }
+    m_data = (char *) a->allocate (allocsz); KVR_ASSERT (m_data);
+    m_size = allocsz;
+  }
+
+  kvr_strncpy (m_data, m_size, str, len);
+  m_len = len;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::string::dyn_str::cleanup (allocator *a)
+{
+  KVR_ASSERT (a);
+
+  if (m_data)
+  {
+    a->deallocate (m_data, m_size);
+    m_data = NULL;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::binary
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::binary::set (const uint8_t *data, sz_t len, allocator *a)
+{
+  m_len = 0;
+  this->append (data, len, a);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::binary::append (const uint8_t *data, sz_t len, allocator *a)
+{
+  KVR_ASSERT (data || (len == 0));
+  KVR_ASSERT (a);
+
+  sz_t allocsz = ((m_len + len) + binary::PAD) & ~binary::PAD;
+  if (allocsz > m_size)
+  {
+    uint8_t *grown = (uint8_t *) a->allocate (allocsz); KVR_ASSERT (grown);
+    if (m_data)
+    {
+      memcpy (grown, m_data, m_len);
+      a->deallocate (m_data, m_size);
+    }
+    m_data = grown;
+    m_size = allocsz;
+  }
+
+  if (len > 0)
+  {
+    memcpy (m_data + m_len, data, len);
+    m_len += len;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::binary::cleanup (allocator *a)
+{
+  KVR_ASSERT (a);
+
+  if (m_data)
+  {
+    a->deallocate (m_data, m_size);
+    m_data = NULL;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::array
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::array::init (sz_t size, allocator *a)
+{
+  KVR_ASSERT (size > 0);
+  KVR_ASSERT (a);
+
+  sz_t allocsz = kvr::internal::align_size (size, CAP_INCR);
+  m_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * allocsz); KVR_ASSERT (m_ptr);
+#if KVR_DEBUG  
+  memset (m_ptr, 0, sizeof (kvr::value *) * allocsz); // debug-only
+#endif
+  m_cap = allocsz;
+  m_len = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::array::deinit (allocator *a)
+{
+  KVR_ASSERT (m_ptr);
+  KVR_ASSERT (a);
+
+  a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
+  m_ptr = NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::array::push (value *v, allocator *a)
+{
+  KVR_ASSERT (v);
+  KVR_ASSERT (a);
+
+  if (m_len >= m_cap)
+  {
+    // resize
+#if KVR_INTERNAL_FLAG_REALLOC_TYPE_FIXED
+    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - CAP_INCR));
+    KVR_ASSERT (m_ptr);
+
+    sz_t new_cap = m_cap + CAP_INCR;
+    value ** new_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * new_cap); KVR_ASSERT (new_ptr);
+    memcpy (new_ptr, m_ptr, sizeof (kvr::value *) * m_cap);
+#if KVR_DEBUG
+    memset (new_ptr + m_cap, 0, sizeof (kvr::value *) * CAP_INCR);
+#endif
+    a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
+#else
+    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - m_cap));
+    KVR_ASSERT (m_ptr);
+
+    sz_t new_cap = m_cap + m_cap;
+    value ** new_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * new_cap); KVR_ASSERT (new_ptr);
+    memcpy (new_ptr, m_ptr, sizeof (kvr::value *) * m_cap);
+#if KVR_DEBUG
+    memset (new_ptr + m_cap, 0, sizeof (kvr::value *) * m_cap);
+#endif
+    a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
+#endif
+    m_ptr = new_ptr;
+    m_cap = new_cap;
+  }
+
+  m_ptr [m_len++] = v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value *kvr::value::array::pop ()
+{
+#if KVR_DEBUG
+  value *v = NULL;
+
+  if (m_len > 0)
+  {
+    v = m_ptr [--m_len];
+    m_ptr [m_len] = NULL;
+  }
+#else
+  value *v = (m_len > 0) ? m_ptr [--m_len] : NULL;
+#endif
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::array::pop (sz_t index)
+{
+  value *v = NULL;
+
+  if (index < m_len) // implies m_len > 0
+  {
+    v = m_ptr [index];
+
+    for (sz_t i = index + 1; i < m_len; ++i)
+    {
+      m_ptr [i - 1] = m_ptr [i];
+    }
+
+    m_ptr [--m_len] = NULL;
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value * kvr::value::array::elem (sz_t index) const
+{
+  value *v = (index < m_len) ? m_ptr [index] : NULL;
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::map
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::map::init (sz_t size, allocator *a)
+{
+  KVR_ASSERT (m_ptr == NULL);
+  KVR_ASSERT (a);
+  KVR_ASSERT (size > 0); //if (size == 0) { size = 1U; }
+
+  sz_t allocsz = kvr::internal::align_size (size, CAP_INCR);
+  m_ptr = (node *) a->allocate (sizeof (node) * allocsz); KVR_ASSERT (m_ptr);
+  memset (m_ptr, 0, sizeof (node) * allocsz);
+  m_cap = allocsz;
+  m_len = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::map::deinit (allocator *a)
+{
+  KVR_ASSERT (a);
+
+#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
+  sz_t cap = _cap ();
+#else
+  sz_t cap = m_cap;
+#endif
+  a->deallocate (m_ptr, sizeof (node) * cap);
+  m_ptr = NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value::map::node *kvr::value::map::insert (key *k, value *v, allocator *a)
+{
+  KVR_ASSERT (k);
+  KVR_ASSERT (v);
+  KVR_ASSERT (a);
+  KVR_ASSERT (m_ptr);
+
+#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
+
+  sz_t cap = _cap ();
+  // first, see if we can garbage-collect removed nodes
+  if ((m_len >= cap) && ((m_cap % CAP_INCR) != 0))
+  {
+    sz_t ir = 0, iw = 0;
+    while (ir < cap)
+    {
+      if (m_ptr [ir].k)
+      {
+        m_ptr [iw++] = m_ptr [ir++];
+      }
+      else
+      {
+        ir++;
+      }
+    }
+    m_len -= (ir - iw);
+    m_cap += (ir - iw);
+    KVR_ASSERT (m_len < cap);
+  }
+
+  // check again
+  if (m_len >= cap)
+  {
+    // resize
+    sz_t new_cap = cap + CAP_INCR;
+    node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
+    memcpy (new_ptr, m_ptr, sizeof (node) * cap);
+    memset (new_ptr + cap, 0, (sizeof (node) * CAP_INCR));
+    a->deallocate (m_ptr, sizeof (node) * cap);
+
+    m_ptr = new_ptr;
+    m_cap += CAP_INCR;
+    KVR_ASSERT (new_cap >= m_cap);
+  }
+#else
+
+#if KVR_INTERNAL_FLAG_REALLOC_TYPE_FIXED
+
+  if (m_len >= m_cap)
+  {
+    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - CAP_INCR));
+    KVR_ASSERT (m_ptr);
+
+    // first, see if we can garbage-collect removed nodes
+    sz_t ir = 0, iw = 0;
+    while (ir < m_cap)
+    {
+      if (m_ptr [ir].k)
+      {
+        m_ptr [iw++] = m_ptr [ir++];
+      }
+      else
+      {
+        ir++;
+      }
+    }
+    m_len -= (ir - iw);
+
+    // now check again and if resize if necessary
+    if (m_len >= m_cap)
+    {
+      // resize
+      sz_t new_cap = m_cap + CAP_INCR;
+      node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
+      // copy over old nodes and set new nodes to null
+      memcpy (new_ptr, m_ptr, sizeof (node) * m_cap);      
+      memset (new_ptr + m_cap, 0, (sizeof (node) * CAP_INCR));
+      a->deallocate (m_ptr, sizeof (node) * m_cap);
+
+      m_ptr = new_ptr;
+      m_cap = new_cap;
+    }
+  }
+#else
+  if (m_len >= m_cap)
+  {
+    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - m_cap));
+    KVR_ASSERT (m_ptr);
+
+    // first, see if we can garbage-collect removed nodes
+    sz_t ir = 0, iw = 0;
+    while (ir < m_cap)
+    {
+      if (m_ptr [ir].k)
+      {
+        m_ptr [iw++] = m_ptr [ir++];
+      }
+      else
+      {
+        ir++;
+      }
+    }
+    m_len -= (ir - iw);
+
+    // now check again and if resize if necessary
+    if (m_len >= m_cap)
+    {
+      // resize
+      sz_t new_cap = m_cap + m_cap;
+      node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
+      // copy over old nodes and set new nodes to null
+      memcpy (new_ptr, m_ptr, sizeof (node) * m_cap);
+      memset (new_ptr + m_cap, 0, (sizeof (node) * m_cap));
+      a->deallocate (m_ptr, sizeof (node) * m_cap);
+
+      m_ptr = new_ptr;
+      m_cap = new_cap;
+    }
+  }
+#endif
+
+#endif
+  node *n = &m_ptr [m_len++];
+  n->k = k;
+  n->v = v;
+
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::map::remove (node *n)
+{
+  KVR_ASSERT (n);
+  KVR_ASSERT (n->k);
+  KVR_ASSERT (n->v);
+  
+  if (m_len > 0)
+  {
+    n->k = NULL;
+    n->v = NULL;
+#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
+    --m_cap;
+#endif
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value::map::node *kvr::value::map::find (const key *k) const
+{
+  KVR_ASSERT (k);
+
+#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
+  sz_t cap = _cap ();
+#else
+  sz_t cap = m_cap;
+#endif
+
+#if KVR_FLAG_ALLOW_DUPLICATE_MAP_KEYS // search from end (last inserted is active)
+  for (sz_t c = cap; c >= 1; --c)
+  {
+    sz_t i = c - 1;
+#else
+  for (sz_t i = 0, c = cap; i < c; ++i)
+  {
+#endif
+    node *n = &m_ptr [i];
+    if (n->k == k)
+    {
+      KVR_ASSERT (n->v);
+      return n;
+    }
+  }
+
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::map::size_l () const // size in linear time
+{
+  sz_t size = 0;
+  sz_t i = 0;
+
+  while (i < m_len)
+  {
+    if (m_ptr [i].k)
+    {
+      KVR_ASSERT (m_ptr [i].v);
+      ++size;
+    }
+    ++i;
+  }
+
+  return size;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::map::size_c () const // size in constant time
+{
+  sz_t size = m_cap - (_cap () - m_len);
+  return size;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::value::map::_cap () const
+{
+  // for experimental constant time map size calculator
+  // only called if #define KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE is enabled
+
+  sz_t capa = 0;
+
+  // (m_cap >= m_len) otherwise (m_cap % CAP_INCR) == 0) might not be correct 
+  // i.e might be less than actual capacity e.g. if m_cap is decremented to multiple of CAP_INCR
+
+  if ((m_cap >= m_len) && ((m_cap % CAP_INCR) == 0))
+  {
+    capa = m_cap;
+  }
+  else if (m_len)
+  {
+    capa = kvr::internal::align_size (m_len, CAP_INCR);
+  }
+  else
+  {
+    capa = m_cap;
+  }
+
+  return capa;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::cursor
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::value::cursor::cursor (const value *map) : m_map (map), m_index (0)
+{
+  KVR_ASSERT (map);
+  KVR_ASSERT (map->is_map ());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::value::cursor::get (pair *p)
+{
+  KVR_ASSERT (p);
+  const map::node *n = this->_get ();
+  if (p && n)
+  {
+    KVR_ASSERT (n->k && n->v);
+    p->m_k = n->k;
+    p->m_v = n->v;
+    return true;
+  }
+  return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const kvr::value::map::node * kvr::value::cursor::_get ()
+{
+  const map::node *n = NULL;
+
+  if (m_map && m_map->is_map ())
+  {
+    const map *m = &m_map->m_data.m;
+
+    n = (m_index < m->m_len) ? &m->m_ptr [m_index++] : NULL;
+
+    while (n && !n->k)
+    {
+      KVR_ASSERT (!n->v);
+      n = (m_index < m->m_len) ? &m->m_ptr [m_index++] : NULL;
+    }
+  }
+
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::mem_ostream
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const size_t kvr::mem_ostream::MIN_BUF_SZ = 64u;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::mem_ostream::mem_ostream (uint8_t *buf, size_t sz, allocator *alloc) : m_buf (buf), m_sz (sz), m_pos (0), m_btype (BUF_EXTERNAL)
+{
+  KVR_ASSERT (m_buf);
+  KVR_ASSERT (m_sz > 0);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::mem_ostream::mem_ostream (size_t sz, allocator *alloc) : m_buf (NULL), m_sz (0), m_pos (0), m_btype (BUF_INTERNAL)
+{
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_sz = kvr::internal::max (MIN_BUF_SZ, sz);
+  m_buf = (uint8_t *) m_alloc->allocate (m_sz); KVR_ASSERT (m_buf);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::mem_ostream::~mem_ostream ()
+{
+  if (m_btype == BUF_INTERNAL) { m_alloc->deallocate (m_buf, m_sz); }  
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_ostream::put (uint8_t byte)
+{
+  if (m_pos >= m_sz)
+  {
+    size_t sz = m_sz + m_sz;
+    this->reserve (sz);
+  }
+  m_buf [m_pos++] = byte;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_ostream::write (uint8_t *bytes, size_t count)
+{  
+  size_t desired_sz = m_pos + count;
+  if (desired_sz > m_sz)
+  {
+    size_t sz = m_sz;
+    do { sz += m_sz; } while (sz < desired_sz);
+    this->reserve (sz);
+  }
+  memcpy (&m_buf [m_pos], bytes, count);
+  m_pos += count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint8_t * kvr::mem_ostream::push (size_t count)
+{
+  size_t desired_sz = m_pos + count;
+  if (desired_sz > m_sz)
+  {
+    size_t sz = m_sz;
+    do { sz += m_sz; } while (sz < desired_sz);
+    this->reserve (sz);
+  }
+
+  uint8_t *ret = &m_buf [m_pos];
+  m_pos += count;
+  return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint8_t * kvr::mem_ostream::pop (size_t count)
+{
+  if (m_pos >= count)
+  {
+    m_pos -= count;
+    uint8_t *ret = &m_buf [m_pos];
+    return ret;
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::mem_ostream::buffer () const
+{
+  return m_buf;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::mem_ostream::size () const
+{
+  return m_sz;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::mem_ostream::tell () const
+{
+  return m_pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_ostream::seek (size_t pos)
+{
+  m_pos = pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_ostream::flush ()
+{
+  // EOS == 0
+  KVR_ASSERT_SAFE ((m_pos < m_sz), (void) 0);
+  m_buf [m_pos] = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_ostream::reserve (size_t sz)
+{
+  if (sz > m_sz)
+  {
+    uint8_t *buf = (uint8_t *) m_alloc->allocate (sz); KVR_ASSERT (buf);
+
+    if (m_buf)
+    {
+      // only the written part is kept
+      memcpy (buf, m_buf, m_pos);
+      if (m_btype == BUF_INTERNAL) { m_alloc->deallocate (m_buf, m_sz); }
+    }
+
+    m_buf = buf;
+    m_sz = sz;
+    m_btype = BUF_INTERNAL;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::mem_istream
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::mem_istream::mem_istream (const uint8_t *buf, size_t sz) : m_buf (buf), m_sz (sz), m_pos (0)
+{
+  KVR_ASSERT (m_buf);
+  KVR_ASSERT (m_sz > 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::mem_istream::buffer () const
+{
+  return m_buf;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::mem_istream::size () const
+{
+  return m_sz;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::mem_istream::tell ()
+{
+  return m_pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint8_t kvr::mem_istream::peek ()
+{
+  return (m_pos < m_sz) ? m_buf [m_pos] : 0u;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mem_istream::seek (size_t pos)
+{
+  m_pos = pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::mem_istream::get (uint8_t *byte)
+{
+  if (m_pos < m_sz)
+  {
+    *byte = m_buf [m_pos++];
+    return true;
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::mem_istream::read (uint8_t *bytes, size_t count)
+{
+  if ((m_pos + count) <= m_sz)
+  {
+    memcpy (bytes, &m_buf [m_pos], count);
+    m_pos += count;
+    return true;
+  }
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::mem_istream::push (size_t count)
+{
+  if ((m_pos + count) <= m_sz)
+  {
+    const uint8_t *start = &m_buf [m_pos];
+    m_pos += count;
+    return start;
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::mem_istream::pop (size_t count)
+{
+  if (m_pos >= count)
+  {
+    m_pos -= count;
+    const uint8_t *ret = &m_buf [m_pos];
+    return ret;
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::chunk_ostream
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::chunk_ostream::chunk_ostream (size_t chunksz, allocator *alloc) : m_head (NULL), m_tail (NULL), m_chunksz (chunksz), m_count (0), m_sz (0)
+{
+  KVR_ASSERT (m_chunksz > 0);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::chunk_ostream::~chunk_ostream ()
+{
+  this->_release (m_head);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::chunk_ostream::put (uint8_t byte)
+{
+  chunk *c = m_tail;
+  if (!c || (c->len >= c->cap))
+  {
+    c = this->_append (m_chunksz);
+    KVR_ASSERT_SAFE (c, (void) 0);
+  }
+
+  c->data () [c->len++] = byte;
+  ++m_sz;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::chunk_ostream::write (uint8_t *bytes, size_t count)
+{
+  while (count > 0)
+  {
+    chunk *c = m_tail;
+    if (!c || (c->len >= c->cap))
+    {
+      c = this->_append (m_chunksz);
+      KVR_ASSERT_SAFE (c, (void) 0);
+    }
+
+    size_t n = kvr::internal::min (count, c->cap - c->len);
+    memcpy (c->data () + c->len, bytes, n);
+    c->len += n;
+    m_sz += n;
+    bytes += n;
+    count -= n;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::chunk_ostream::flush ()
+{
+  // nothing to terminate; chunks are addressed by length
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::chunk_ostream::tell () const
+{
+  return m_sz;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::chunk_ostream::reset ()
+{
+  // keep the first chunk for reuse
+  if (m_head)
+  {
+    this->_release (m_head->next);
+    m_head->next = NULL;
+    m_head->len = 0;
+    m_tail = m_head;
+    m_count = 1;
+  }
+  m_sz = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::chunk_ostream::chunk_count () const
+{
+  // only an empty head chunk (kept by reset) can hold no bytes
+  return (m_sz > 0) ? m_count : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::chunk_ostream::chunks (iovec *vec, size_t count) const
+{
+  KVR_ASSERT_SAFE (vec || (count == 0), 0);
+
+  size_t i = 0;
+  for (chunk *c = m_head; c && (i < count); c = c->next)
+  {
+    if (c->len > 0)
+    {
+      vec [i].base = c->data ();
+      vec [i].len = c->len;
+      ++i;
+    }
+  }
+  return i;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::chunk_ostream::flatten ()
+{
+  if (!m_head)
+  {
+    return NULL;
+  }
+
+  if (m_head->next)
+  {
+    size_t sz = kvr::internal::max (m_sz, m_chunksz);
+    chunk *f = (chunk *) m_alloc->allocate (sizeof (chunk) + sz);
+    KVR_ASSERT_SAFE (f, NULL);
+    f->next = NULL;
+    f->len = 0;
+    f->cap = sz;
+
+    for (chunk *c = m_head; c; c = c->next)
+    {
+      memcpy (f->data () + f->len, c->data (), c->len);
+      f->len += c->len;
+    }
+
+    this->_release (m_head);
+    m_head = f;
+    m_tail = f;
+    m_count = 1;
+  }
+
+  return m_head->data ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::chunk_ostream::chunk * kvr::chunk_ostream::_append (size_t cap)
+{
+  chunk *c = (chunk *) m_alloc->allocate (sizeof (chunk) + cap);
+  if (c)
+  {
+    c->next = NULL;
+    c->len = 0;
+    c->cap = cap;
+
+    if (m_tail) { m_tail->next = c; }
+    else { m_head = c; }
+
+    m_tail = c;
+    ++m_count;
+  }
+  return c;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::chunk_ostream::_release (chunk *c)
+{
+  while (c)
+  {
+    chunk *next = c->next;
+    m_alloc->deallocate (c, sizeof (chunk) + c->cap);
+    --m_count;
+    c = next;
+  }
+
+  if (!m_count)
+  {
+    m_head = NULL;
+    m_tail = NULL;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::buffer_pool
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::buffer_pool::buffer_pool (size_t max_cached_per_class, allocator *alloc) : m_nsamples (0), m_max_cached (max_cached_per_class), m_lock (0)
+{
+  m_alloc = alloc ? alloc : get_default_allocator ();
+
+  for (size_t i = 0; i < NUM_CLASSES; ++i)
+  {
+    m_free [i] = NULL;
+    m_nfree [i] = 0;
+    m_hist [i] = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::buffer_pool::~buffer_pool ()
+{
+  this->trim ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// constant-initialized, so it is ready before any constructor can run
+static volatile long kvr_buffer_pool_global_lock = 0;
+
+kvr::buffer_pool * kvr::buffer_pool::global ()
+{
+  // first-use construction of a local static is not thread-safe in c++98 (msvc 
+  // before 2015, -fno-threadsafe-statics), so only one thread may reach it at a time
+  kvr_spin_lock (kvr_buffer_pool_global_lock);
+  static buffer_pool p;
+  kvr_spin_unlock (kvr_buffer_pool_global_lock);
+  return &p;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void * kvr::buffer_pool::allocate (size_t sz)
+{
+  size_t c = _class (sz);
+  if (c >= NUM_CLASSES)
+  {
+    return m_alloc->allocate (sz);
+  }
+
+  block *b = NULL;
+
+  kvr_spin_lock (m_lock);
+  if (m_free [c])
+  {
+    b = m_free [c];
+    m_free [c] = b->next;
+    --m_nfree [c];
+  }
+  kvr_spin_unlock (m_lock);
+
+  return b ? b : m_alloc->allocate (size_t (1) << (c + MIN_CLASS_SHIFT));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::buffer_pool::deallocate (void *p, size_t sz)
+{
+  if (!p)
+  {
+    return;
+  }
+
+  size_t c = _class (sz);
+  if (c >= NUM_CLASSES)
+  {
+    m_alloc->deallocate (p, sz);
+    return;
+  }
+
+  bool cached = false;
+
+  kvr_spin_lock (m_lock);
+  if (m_nfree [c] < m_max_cached)
+  {
+    block *b = static_cast<block *>(p);
+    b->next = m_free [c];
+    m_free [c] = b;
+    ++m_nfree [c];
+    cached = true;
+  }
+  kvr_spin_unlock (m_lock);
+
+  if (!cached)
+  {
+    m_alloc->deallocate (p, size_t (1) << (c + MIN_CLASS_SHIFT));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::buffer_pool::suggest_size () const
+{
+  size_t c = 0;
+
+  kvr_spin_lock (m_lock);
+  if (m_nsamples > 0)
+  {
+    uint32_t threshold = m_nsamples - (m_nsamples / 10u);
+    uint32_t sum = 0;
+    for (c = 0; c < (NUM_CLASSES - 1); ++c)
+    {
+      sum += m_hist [c];
+      if (sum >= threshold) { break; }
+    }
+  }
+  else
+  {
+    c = _class (256u);
+  }
+  kvr_spin_unlock (m_lock);
+
+  return size_t (1) << (c + MIN_CLASS_SHIFT);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::buffer_pool::record (size_t sz)
+{
+  // +1 for eos
+  size_t c = kvr::internal::min (_class (sz + 1), size_t (NUM_CLASSES - 1));
+
+  kvr_spin_lock (m_lock);
+  if (m_nsamples >= MAX_HISTOGRAM_SAMPLES)
+  {
+    // decay old samples
+    m_nsamples = 0;
+    for (size_t i = 0; i < NUM_CLASSES; ++i)
+    {
+      m_hist [i] >>= 1;
+      m_nsamples += m_hist [i];
+    }
+  }
+  ++m_hist [c];
+  ++m_nsamples;
+  kvr_spin_unlock (m_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::buffer_pool::trim ()
+{
+  for (size_t c = 0; c < NUM_CLASSES; ++c)
+  {
+    kvr_spin_lock (m_lock);
+    block *b = m_free [c];
+    m_free [c] = NULL;
+    m_nfree [c] = 0;
+    kvr_spin_unlock (m_lock);
+
+    while (b)
+    {
+      block *next = b->next;
+      m_alloc->deallocate (b, size_t (1) << (c + MIN_CLASS_SHIFT));
+      b = next;
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::buffer_pool::_class (size_t sz)
+{
+  size_t c = 0;
+  size_t csz = size_t (1) << MIN_CLASS_SHIFT;
+  while ((csz < sz) && (c < NUM_CLASSES))
+  {
+    csz <<= 1;
+    ++c;
+  }
+  return c;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::stream_writer
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const kvr::sz_t kvr::stream_writer::UNKNOWN_SIZE;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static kvr::internal::stream_encoder * kvr_stream_encoder_create (kvr::allocator *a, kvr::ostream *ostr)
+{
+  void *p = a->allocate (sizeof (T));
+  return p ? (new (p) T (ostr)) : NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::stream_writer::stream_writer (codec_t codec, ostream *ostr, allocator *alloc) : m_enc (NULL), m_encsz (0), m_depth (0), m_key (false), m_done (false), m_ok (false)
+{
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_obuf.m_stream = NULL;
+
+  this->_init (codec, ostr);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::stream_writer::stream_writer (codec_t codec, obuffer *obuf, allocator *alloc) : m_enc (NULL), m_encsz (0), m_depth (0), m_key (false), m_done (false), m_ok (false)
+{
+  KVR_ASSERT (obuf);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_obuf.m_stream = &obuf->m_stream;
+  m_obuf.m_stream->seek (0);
+
+  this->_init (codec, &m_obuf);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::stream_writer::~stream_writer ()
+{
+  if (m_enc)
+  {
+    m_enc->~stream_encoder ();
+    m_alloc->deallocate (m_enc, m_encsz);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::stream_writer::_init (codec_t codec, ostream *ostr)
+{
+  KVR_ASSERT (ostr);
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      m_encsz = sizeof (kvr::internal::json::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::json::stream_encoder> (m_alloc, ostr);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      m_encsz = sizeof (kvr::internal::msgpack::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::msgpack::stream_encoder> (m_alloc, ostr);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      m_encsz = sizeof (kvr::internal::cbor::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::cbor::stream_encoder> (m_alloc, ostr);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  m_ok = (m_enc != NULL);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::_item ()
+{
+  if (m_ok)
+  {
+    if (m_depth == 0)
+    {
+      // one root value per document
+      m_ok = !m_done;
+      m_done = true;
+    }
+    else
+    {
+      level &l = m_stack [m_depth - 1];
+      if (l.map)
+      {
+        m_ok = m_key;
+        m_key = false;
+      }
+      else
+      {
+        m_ok = (l.size == UNKNOWN_SIZE) || (l.count < l.size);
+        ++l.count;
+      }
+    }
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::_end (bool map)
+{
+  if (m_ok && (m_depth > 0))
+  {
+    const level &l = m_stack [m_depth - 1];
+    const bool known = (l.size != UNKNOWN_SIZE);
+
+    m_ok = (l.map == map) && !m_key && (!known || (l.count == l.size));
+
+    if (m_ok)
+    {
+      --m_depth;
+      m_ok = map ? m_enc->end_map (known) : m_enc->end_array (known);
+    }
+  }
+  else
+  {
+    m_ok = false;
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::begin_map (sz_t size)
+{
+  if (this->_item () && (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH))
+  {
+    level &l = m_stack [m_depth++];
+    l.size = size;
+    l.count = 0;
+    l.map = true;
+
+    m_ok = m_enc->begin_map (size, (size != UNKNOWN_SIZE));
+  }
+  else
+  {
+    m_ok = false;
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::end_map ()
+{
+  return this->_end (true);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::begin_array (sz_t length)
+{
+  if (this->_item () && (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH))
+  {
+    level &l = m_stack [m_depth++];
+    l.size = length;
+    l.count = 0;
+    l.map = false;
+
+    m_ok = m_enc->begin_array (length, (length != UNKNOWN_SIZE));
+  }
+  else
+  {
+    m_ok = false;
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::end_array ()
+{
+  return this->_end (false);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::key (const char *str)
+{
+  KVR_ASSERT_SAFE (str, (m_ok = false));
+  return this->key (str, (sz_t) strlen (str));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::key (const char *str, sz_t length)
+{
+  KVR_ASSERT_SAFE (str, (m_ok = false));
+
+  if (m_ok && (m_depth > 0) && m_stack [m_depth - 1].map && !m_key)
+  {
+    level &l = m_stack [m_depth - 1];
+    m_ok = (l.size == UNKNOWN_SIZE) || (l.count < l.size);
+    ++l.count;
+
+    m_key = true;
+    m_ok = m_ok && m_enc->key (str, length);
+  }
+  else
+  {
+    m_ok = false;
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::null ()
+{
+  m_ok = this->_item () && m_enc->null ();
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::boolean (bool b)
+{
+  m_ok = this->_item () && m_enc->boolean (b);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::int64 (int64_t i)
+{
+  m_ok = this->_item () && m_enc->integer (i);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::float64 (double f)
+{
+  m_ok = this->_item () && m_enc->floating (f);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::string (const char *str)
+{
+  KVR_ASSERT_SAFE (str, (m_ok = false));
+  return this->string (str, (sz_t) strlen (str));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::string (const char *str, sz_t length)
+{
+  KVR_ASSERT_SAFE (str, (m_ok = false));
+
+  m_ok = this->_item () && m_enc->string (str, length);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::binary (const uint8_t *data, sz_t size)
+{
+  KVR_ASSERT_SAFE (data || (size == 0), (m_ok = false));
+
+  m_ok = this->_item () && m_enc->binary (data, size);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::write_value (const value *val)
+{
+  KVR_ASSERT_SAFE (val, (m_ok = false));
+
+  m_ok = this->_item () && m_enc->value (val);
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::stream_writer::finish ()
+{
+  m_ok = m_ok && m_done && (m_depth == 0);
+
+  if (m_ok)
+  {
+    m_enc->finish ();
+  }
+
+  return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::push_decoder
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static kvr::internal::push_parser * kvr_push_parser_create (kvr::allocator *a, kvr::value *dest)
+{
+  void *p = a->allocate (sizeof (T));
+  return p ? (new (p) T (dest)) : NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::push_decoder::push_decoder (codec_t codec, value *dest, allocator *alloc) : m_parser (NULL), m_parsersz (0)
+{
+  KVR_ASSERT (dest);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+
+  typedef kvr::internal::push_reader<kvr::internal::msgpack::push_tokens<kvr::internal::msgpack::read_ctx>, kvr::internal::msgpack::read_ctx> msgpack_parser;
+  typedef kvr::internal::push_reader<kvr::internal::cbor::push_tokens<kvr::internal::cbor::read_ctx>, kvr::internal::cbor::read_ctx> cbor_parser;
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      m_parsersz = sizeof (kvr::internal::json::push_reader);
+      m_parser = kvr_push_parser_create<kvr::internal::json::push_reader> (m_alloc, dest);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      m_parsersz = sizeof (msgpack_parser);
+      m_parser = kvr_push_parser_create<msgpack_parser> (m_alloc, dest);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      m_parsersz = sizeof (cbor_parser);
+      m_parser = kvr_push_parser_create<cbor_parser> (m_alloc, dest);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  if (m_parser)
+  {
+    m_parser->reset ();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::push_decoder::~push_decoder ()
+{
+  if (m_parser)
+  {
+    m_parser->~push_parser ();
+    m_alloc->deallocate (m_parser, m_parsersz);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::push_decoder::status_t kvr::push_decoder::feed (const uint8_t *data, size_t size, size_t *used)
+{
+  if (used) { *used = 0; }
+
+  KVR_ASSERT_SAFE (m_parser, STATUS_ERROR);
+  KVR_ASSERT_SAFE (data || (size == 0), STATUS_ERROR);
+
+  return m_parser->feed (data, size, used);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::push_decoder::reset ()
+{
+  if (m_parser)
+  {
+    m_parser->reset ();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::push_decoder::reset (value *dest)
+{
+  KVR_ASSERT_SAFE (dest, (void) 0);
+
+  if (m_parser)
+  {
+    m_parser->retarget (dest);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::record_reader
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::record_reader::record_reader (codec_t codec, istream *istr, allocator *alloc) : m_codec (codec), m_istr (istr), m_dec (NULL), m_block (NULL), m_data (NULL), m_size (0), m_pos (0), m_count (0), m_failed (false)
+{
+  KVR_ASSERT (istr);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_block = (uint8_t *) m_alloc->allocate (KVR_CONSTANT_ISTREAM_BLOCK_SZ);
+  m_data = m_block;
+  m_failed = !m_block || !istr;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::record_reader::record_reader (codec_t codec, const uint8_t *data, size_t size, allocator *alloc) : m_codec (codec), m_istr (NULL), m_dec (NULL), m_block (NULL), m_data (data), m_size (size), m_pos (0), m_count (0), m_failed (false)
+{
+  KVR_ASSERT (data || (size == 0));
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::record_reader::~record_reader ()
+{
+  if (m_dec)
+  {
+    m_dec->~push_decoder ();
+    m_alloc->deallocate (m_dec, sizeof (push_decoder));
+  }
+
+  if (m_block)
+  {
+    m_alloc->deallocate (m_block, KVR_CONSTANT_ISTREAM_BLOCK_SZ);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::record_reader::next (value *dest)
+{
+  KVR_ASSERT_SAFE (dest, false);
+
+  if (m_failed)
+  {
+    return false;
+  }
+
+  // one decoder serves every record, it's just pointed at the next destination
+  if (m_dec)
+  {
+    m_dec->reset (dest);
+  }
+  else
+  {
+    void *p = m_alloc->allocate (sizeof (push_decoder));
+    if (!p)
+    {
+      m_failed = true;
+      return false;
+    }
+    m_dec = new (p) push_decoder (m_codec, dest, m_alloc);
+  }
+
+  bool started = false;
+
+  for (;;)
+  {
+    if ((m_pos == m_size) && !this->_fill ())
+    {
+      // a clean end only if no part of a record was read
+      m_failed = started;
+      return false;
+    }
+
+    if (!started && (m_codec == CODEC_JSON))
+    {
+      while ((m_pos < m_size) && ((m_data [m_pos] == ' ') || (m_data [m_pos] == '\n') || (m_data [m_pos] == '\r') || (m_data [m_pos] == '\t')))
+      {
+        ++m_pos;
+      }
+
+      if (m_pos == m_size)
+      {
+        continue;
+      }
+    }
+
+    started = true;
+
+    size_t used = 0;
+    push_decoder::status_t status = m_dec->feed (m_data + m_pos, m_size - m_pos, &used);
+    m_pos += used;
+
+    if (status == push_decoder::STATUS_DONE)
+    {
+      ++m_count;
+      return true;
+    }
+
+    if (status == push_decoder::STATUS_ERROR)
+    {
+      m_failed = true;
+      return false;
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::record_reader::next_batch (value **dests, size_t count)
+{
+  KVR_ASSERT_SAFE (dests || (count == 0), 0);
+
+  size_t n = 0;
+  while ((n < count) && this->next (dests [n]))
+  {
+    ++n;
+  }
+
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::record_reader::count () const
+{
+  return m_count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::record_reader::failed () const
+{
+  return m_failed;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::record_reader::_fill ()
+{
+  if (!m_istr)
+  {
+    return false;
+  }
+
+  m_size = m_istr->fetch (m_block, KVR_CONSTANT_ISTREAM_BLOCK_SZ);
+  m_pos = 0;
+
+  return m_size > 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::pull_encoder
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::pull_encoder::pull_encoder (codec_t codec, const value *src, allocator *alloc) : m_enc (NULL), m_encsz (0), m_src (src), m_staged (1024u, alloc), m_rpos (0), m_depth (0), m_started (false), m_done (false), m_ok (false)
+{
+  KVR_ASSERT (src);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_staging.m_stream = &m_staged;
+
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      m_encsz = sizeof (kvr::internal::json::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::json::stream_encoder> (m_alloc, &m_staging);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      m_encsz = sizeof (kvr::internal::msgpack::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::msgpack::stream_encoder> (m_alloc, &m_staging);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      m_encsz = sizeof (kvr::internal::cbor::stream_encoder);
+      m_enc = kvr_stream_encoder_create<kvr::internal::cbor::stream_encoder> (m_alloc, &m_staging);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
+  }
+
+  m_ok = (m_enc != NULL) && (m_src != NULL);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::pull_encoder::~pull_encoder ()
+{
+  if (m_enc)
+  {
+    m_enc->~stream_encoder ();
+    m_alloc->deallocate (m_enc, m_encsz);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::pull_encoder::produce (uint8_t *buf, size_t cap)
+{
+  KVR_ASSERT_SAFE (buf || (cap == 0), 0);
+
+  size_t written = 0;
+
+  while (m_ok && (written < cap))
+  {
+    size_t avail = m_staged.tell () - m_rpos;
+
+    if (avail > 0)
+    {
+      size_t n = (avail < (cap - written)) ? avail : (cap - written);
+      memcpy (&buf [written], m_staged.buffer () + m_rpos, n);
+      m_rpos += n;
+      written += n;
+    }
+    else if (!m_done)
+    {
+      m_staged.seek (0);
+      m_rpos = 0;
+
+      // a few tokens per flush keeps staging small without a virtual write per token
+      for (int i = 0; (i < 32) && m_ok && !m_done; ++i)
+      {
+        m_ok = this->_step ();
+      }
+
+      m_enc->finish ();
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  return written;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::pull_encoder::done () const
+{
+  return m_ok && m_done && (m_rpos == m_staged.tell ());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::pull_encoder::failed () const
+{
+  return !m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::pull_encoder::_step ()
+{
+  bool ok = false;
+
+  if (!m_started)
+  {
+    m_started = true;
+    ok = this->_value (m_src);
+  }
+  else
+  {
+    KVR_ASSERT_SAFE (m_depth > 0, false);
+
+    frame &f = m_stack [m_depth - 1];
+
+    if (f.val->is_map ())
+    {
+      pair p;
+      if (f.cur.get (&p))
+      {
+        key *k = p.get_key ();
+        ok = m_enc->key (k->get_string (), k->get_length ()) && this->_value (p.get_value ());
+      }
+      else
+      {
+        --m_depth;
+        ok = m_enc->end_map (true);
+      }
+    }
+    else
+    {
+      if (f.index < f.val->length ())
+      {
+        ok = this->_value (f.val->element (f.index++));
+      }
+      else
+      {
+        --m_depth;
+        ok = m_enc->end_array (true);
+      }
+    }
+  }
+
+  m_done = (m_depth == 0);
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::pull_encoder::_value (const value *val)
+{
+  KVR_ASSERT (val);
+
+  bool success = false;
+
+  if (val->is_map () || val->is_array ())
+  {
+    KVR_ASSERT_SAFE (m_depth < KVR_CONSTANT_MAX_TREE_DEPTH, false);
+
+    frame &f = m_stack [m_depth++];
+    f.val = val;
+    f.index = 0;
+
+    if (val->is_map ())
+    {
+      f.cur = value::cursor (val);
+      success = m_enc->begin_map (val->size (), true);
+    }
+    else
+    {
+      success = m_enc->begin_array (val->length (), true);
+    }
+  }
+
+  else if (val->is_string ())
+  {
+    sz_t slen = 0;
+    const char *str = val->get_string (&slen);
+    success = m_enc->string (str, slen);
+  }
+
+  else if (val->is_binary ())
+  {
+    sz_t size = 0;
+    const uint8_t *data = val->get_binary (&size);
+    success = m_enc->binary (data, size);
+  }
+
+  else if (val->is_integer ())
+  {
+    success = m_enc->integer (val->get_integer ());
+  }
+
+  else if (val->is_float ())
+  {
+    success = m_enc->floating (val->get_float ());
+  }
+
+  else if (val->is_boolean ())
+  {
+    success = m_enc->boolean (val->get_boolean ());
+  }
+
+  else if (val->is_null ())
+  {
+    success = m_enc->null ();
+  }
+
+  return success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::view
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef kvr::internal::view_ops<kvr::internal::msgpack::push_tokens<kvr::internal::view_ctx> > kvr_view_msgpack;
+typedef kvr::internal::view_ops<kvr::internal::cbor::push_tokens<kvr::internal::view_ctx> > kvr_view_cbor;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// size and type of the token at 'p'. 0 if malformed or truncated.
+static size_t kvr_view_token (kvr::codec_t codec, const uint8_t *p, size_t avail, kvr::internal::push_token_t *type, kvr::sz_t *count)
+{
+  KVR_ASSERT (type && count);
+
+  size_t n = 0;
+  *count = 0;
+
+  if (p)
+  {
+    switch (codec)
+    {
+      case kvr::CODEC_MSGPACK:
+      {
+        n = kvr_view_msgpack::token (p, avail);
+        *type = n ? kvr_view_msgpack::type (p, count) : kvr::internal::PUSH_TOKEN_BREAK;
+        break;
+      }
+
+      case kvr::CODEC_CBOR:
+      {
+        n = kvr_view_cbor::token (p, avail);
+        *type = n ? kvr_view_cbor::type (p, count) : kvr::internal::PUSH_TOKEN_BREAK;
+        break;
+      }
+
+      case kvr::CODEC_KVRB:
+      {
+        n = kvr::internal::kvrb::token (p, avail);
+        *type = n ? kvr::internal::kvrb::type (p, count) : kvr::internal::PUSH_TOKEN_BREAK;
+        break;
+      }
+
+      default:
+      {
+        break;
+      }
+    }
+  }
+
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t kvr_view_skip (kvr::codec_t codec, const uint8_t *p, size_t avail)
+{
+  size_t n = 0;
+
+  if (p)
+  {
+    switch (codec)
+    {
+      case kvr::CODEC_MSGPACK:  { n = kvr_view_msgpack::skip (p, avail); break; }
+      case kvr::CODEC_CBOR:     { n = kvr_view_cbor::skip (p, avail); break; }
+      case kvr::CODEC_KVRB:     { n = kvr::internal::kvrb::token (p, avail); break; }
+      default:                  { break; }
+    }
+  }
+
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// kvrb containers are not contiguous, so they are rebuilt through the view
+static bool kvr_view_materialize (const kvr::view &src, kvr::value *dest, size_t depth)
+{
+  KVR_ASSERT_SAFE (depth < KVR_CONSTANT_MAX_TREE_DEPTH, false);
+
+  kvr::view::cursor c (src);
+  kvr::view k, v;
+  bool ok = true;
+
+  dest->conv_null ();
+
+  if (src.is_map ())
+  {
+    dest->conv_map ();
+    while (ok && c.get (&k, &v))
+    {
+      kvr::sz_t klen = 0;
+      const char *key = k.get_string (&klen); // null-terminated in kvrb
+      kvr::value *child = key ? dest->insert_null (key) : NULL;
+      ok = child && ((v.is_map () || v.is_array ()) ? kvr_view_materialize (v, child, depth + 1) : v.materialize (child));
+    }
+  }
+  else
+  {
+    dest->conv_array ();
+    while (ok && c.get (&v))
+    {
+      kvr::value *child = dest->push_null ();
+      ok = child && ((v.is_map () || v.is_array ()) ? kvr_view_materialize (v, child, depth + 1) : v.materialize (child));
+    }
+  }
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view::view () : m_codec (CODEC_MSGPACK), m_data (NULL), m_avail (0)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view::view (codec_t codec, const uint8_t *data, size_t size) : m_codec (codec), m_data (data), m_avail (size)
+{
+  KVR_ASSERT (data);
+  KVR_ASSERT ((codec == CODEC_MSGPACK) || (codec == CODEC_CBOR) || (codec == CODEC_KVRB));
+
+  if ((codec == CODEC_JSON) || ((codec == CODEC_KVRB) && !kvr::internal::kvrb::open (data, size, &m_data, &m_avail)))
+  {
+    m_data = NULL;
+    m_avail = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view::view (codec_t codec, const mem_istream &istr) : m_codec (codec), m_data (istr.buffer ()), m_avail (istr.size ())
+{
+  KVR_ASSERT ((codec == CODEC_MSGPACK) || (codec == CODEC_CBOR) || (codec == CODEC_KVRB));
+
+  if ((codec == CODEC_JSON) || ((codec == CODEC_KVRB) && !kvr::internal::kvrb::open (istr.buffer (), istr.size (), &m_data, &m_avail)))
+  {
+    m_data = NULL;
+    m_avail = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_valid () const
+{
+  kvr::internal::push_token_t t;
+  sz_t count;
+  return kvr_view_token (m_codec, m_data, m_avail, &t, &count) && (t != kvr::internal::PUSH_TOKEN_BREAK);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_map () const
+{
+  kvr::internal::push_token_t t;
+  sz_t count;
+  return kvr_view_token (m_codec, m_data, m_avail, &t, &count) && ((t == kvr::internal::PUSH_TOKEN_MAP) || (t == kvr::internal::PUSH_TOKEN_MAP_INDEF));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_array () const
+{
+  kvr::internal::push_token_t t;
+  sz_t count;
+  return kvr_view_token (m_codec, m_data, m_avail, &t, &count) && ((t == kvr::internal::PUSH_TOKEN_ARRAY) || (t == kvr::internal::PUSH_TOKEN_ARRAY_INDEF));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_string () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_STRING);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_binary () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_BINARY);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_boolean () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_BOOLEAN);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_integer () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_INTEGER);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_float () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_FLOAT);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::is_null () const
+{
+  kvr::internal::view_ctx ctx;
+  return this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_NULL);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char * kvr::view::get_string (sz_t *len) const
+{
+  KVR_ASSERT (len);
+
+  kvr::internal::view_ctx ctx;
+  bool ok = this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_STRING);
+  KVR_ASSERT_SAFE (ok, NULL);
+
+  if (len) { *len = ctx.m_len; }
+  return ctx.m_s;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t * kvr::view::get_binary (sz_t *size) const
+{
+  KVR_ASSERT (size);
+
+  kvr::internal::view_ctx ctx;
+  bool ok = this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_BINARY);
+  KVR_ASSERT_SAFE (ok, NULL);
+
+  if (size) { *size = ctx.m_len; }
+  return (const uint8_t *) ctx.m_s;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int64_t kvr::view::get_integer () const
+{
+  kvr::internal::view_ctx ctx;
+  bool ok = this->_scalar (&ctx) && ((ctx.m_type == kvr::internal::view_ctx::VIEW_INTEGER) || (ctx.m_type == kvr::internal::view_ctx::VIEW_FLOAT));
+  KVR_ASSERT_SAFE (ok, 0);
+
+  return (ctx.m_type == kvr::internal::view_ctx::VIEW_INTEGER) ? ctx.m_i : static_cast<int64_t>(ctx.m_f);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+double kvr::view::get_float () const
+{
+  kvr::internal::view_ctx ctx;
+  bool ok = this->_scalar (&ctx) && ((ctx.m_type == kvr::internal::view_ctx::VIEW_INTEGER) || (ctx.m_type == kvr::internal::view_ctx::VIEW_FLOAT));
+  KVR_ASSERT_SAFE (ok, 0.0);
+
+  return (ctx.m_type == kvr::internal::view_ctx::VIEW_FLOAT) ? ctx.m_f : static_cast<double>(ctx.m_i);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::get_boolean () const
+{
+  kvr::internal::view_ctx ctx;
+  bool ok = this->_scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_BOOLEAN);
+  KVR_ASSERT_SAFE (ok, false);
+
+  return ctx.m_b;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::element (sz_t index) const
+{
+  KVR_ASSERT_SAFE (this->is_array (), view ());
+
+  if (m_codec == CODEC_KVRB)
+  {
+    view v;
+
+    if (index < this->length ())
+    {
+      const uint8_t *p = kvr::internal::kvrb::children (m_data) + (size_t (index) * kvr::internal::kvrb::SLOT_SIZE);
+      v.m_codec = m_codec;
+      v.m_data = p;
+      v.m_avail = m_avail - static_cast<size_t>(p - m_data);
+    }
+
+    return v;
+  }
+
+  cursor c (*this);
+  view v;
+
+  for (sz_t i = 0; i <= index; ++i)
+  {
+    if (!c.get (&v))
+    {
+      return view ();
+    }
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::view::length () const
+{
+  kvr::internal::push_token_t t;
+  sz_t count = 0;
+  size_t n = kvr_view_token (m_codec, m_data, m_avail, &t, &count);
+
+  KVR_ASSERT_SAFE (n && ((t == kvr::internal::PUSH_TOKEN_ARRAY) || (t == kvr::internal::PUSH_TOKEN_ARRAY_INDEF)), 0);
+
+  if (t == kvr::internal::PUSH_TOKEN_ARRAY_INDEF)
+  {
+    cursor c (*this);
+    view v;
+    while (c.get (&v)) { ++count; }
+  }
+
+  return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::find (const char *key) const
+{
+  KVR_ASSERT_SAFE (key, view ());
+  return this->find (key, (sz_t) strlen (key));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::find (const char *key, sz_t len) const
+{
+  KVR_ASSERT_SAFE (key, view ());
+  KVR_ASSERT_SAFE (this->is_map (), view ());
+
+  if (m_codec == CODEC_KVRB)
+  {
+    view v;
+
+    const uint8_t *p = kvr::internal::kvrb::find (m_data, m_avail, key, len);
+    if (p)
+    {
+      v.m_codec = m_codec;
+      v.m_data = p;
+      v.m_avail = m_avail - static_cast<size_t>(p - m_data);
+    }
+
+    return v;
+  }
+
+  cursor c (*this);
+  view k, v;
+
+  while (c.get (&k, &v))
+  {
+    kvr::internal::view_ctx ctx;
+    if (k._scalar (&ctx) && (ctx.m_type == kvr::internal::view_ctx::VIEW_STRING) && (ctx.m_len == len) && (memcmp (ctx.m_s, key, len) == 0))
+    {
+      return v;
+    }
+  }
+
+  return view ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::sz_t kvr::view::size () const
+{
+  kvr::internal::push_token_t t;
+  sz_t count = 0;
+  size_t n = kvr_view_token (m_codec, m_data, m_avail, &t, &count);
+
+  KVR_ASSERT_SAFE (n && ((t == kvr::internal::PUSH_TOKEN_MAP) || (t == kvr::internal::PUSH_TOKEN_MAP_INDEF)), 0);
+
+  if (t == kvr::internal::PUSH_TOKEN_MAP_INDEF)
+  {
+    cursor c (*this);
+    view k, v;
+    while (c.get (&k, &v)) { ++count; }
+  }
+
+  return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::search (const char *pathexpr) const
+{
+  KVR_ASSERT_SAFE ((is_map () || is_array ()), view ());
+  KVR_ASSERT_SAFE ((pathexpr && (pathexpr [0] != 0)), view ());
+
+  view v = *this;
+
+  const char delim = KVR_TOKEN_DELIMITER;
+  const char *e1 = pathexpr;
+  const char *e2 = strchr (e1, delim);
+
+  uint8_t kbuf [256];
+  kvr::mem_ostream kos (kbuf, 256);
+
+  while (v.is_valid () && e2)
+  {
+    size_t klen = static_cast<size_t>(e2 - e1);
+    char *k = (char *) kos.push (klen + 1);    
+    kvr_strncpy (k, kos.size (), e1, klen);
+
+    v = v._search_key (k);
+
+    e1 = ++e2;
+    e2 = strchr (e1, delim);
+    kos.seek (0);
+  }
+
+  if (v.is_valid () && (*e1 != 0))
+  {
+    v = v._search_key (e1);
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::search (const char **path, sz_t pathsz) const
+{
+  KVR_ASSERT (is_map () || is_array ());
+  KVR_ASSERT_SAFE (path, view ());
+
+  view v = *this;
+
+  sz_t pc = 0;
+  while (v.is_valid () && (pc < pathsz))
+  {
+    const char *key = path [pc++];
+    v = v._search_key (key);
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::view::encoded_size () const
+{
+  return kvr_view_skip (m_codec, m_data, m_avail);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::materialize (value *dest) const
+{
+  KVR_ASSERT_SAFE (dest, false);
+
+  if ((m_codec == CODEC_KVRB) && (this->is_map () || this->is_array ()))
+  {
+    return kvr_view_materialize (*this, dest, 0);
+  }
+
+  if (this->is_map () || this->is_array ())
+  {
+    size_t n = this->encoded_size ();
+    return (n > 0) && dest->decode (m_codec, m_data, n);
+  }
+
+  kvr::internal::view_ctx ctx;
+  if (!this->_scalar (&ctx))
+  {
+    // a packed array (numeric column, typed array) is one token that reads as an array
+    size_t n = (m_codec != CODEC_KVRB) ? this->encoded_size () : 0;
+    return (n > 0) && dest->decode (m_codec, m_data, n);
+  }
+
+  switch (ctx.m_type)
+  {
+    case kvr::internal::view_ctx::VIEW_NULL:    { dest->conv_null (); break; }
+    case kvr::internal::view_ctx::VIEW_BOOLEAN: { dest->conv_boolean ()->set_boolean (ctx.m_b); break; }
+    case kvr::internal::view_ctx::VIEW_INTEGER: { dest->conv_integer ()->set_integer (ctx.m_i); break; }
+    case kvr::internal::view_ctx::VIEW_FLOAT:   { dest->conv_float ()->set_float (ctx.m_f); break; }
+    case kvr::internal::view_ctx::VIEW_STRING:  { dest->conv_string ()->set_string (ctx.m_s, ctx.m_len); break; }
+    case kvr::internal::view_ctx::VIEW_BINARY:  { dest->conv_binary ()->set_binary ((const uint8_t *) ctx.m_s, ctx.m_len); break; }
+    default:                                    { return false; }
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::verify (codec_t codec, const uint8_t *data, size_t size)
+{
+  KVR_ASSERT_SAFE (data, false);
+
+  if (codec == CODEC_KVRB)
+  {
+    return kvr::internal::kvrb::verify (data, size);
+  }
+
+  return (codec != CODEC_JSON) && (kvr_view_skip (codec, data, size) == size);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::_scalar (internal::view_ctx *ctx) const
+{
+  KVR_ASSERT (ctx);
+
+  kvr::internal::push_token_t t;
+  sz_t count;
+  size_t n = kvr_view_token (m_codec, m_data, m_avail, &t, &count);
+
+  bool ok = false;
+
+  if (n && (t == kvr::internal::PUSH_TOKEN_SCALAR))
+  {
+    switch (m_codec)
+    {
+      case kvr::CODEC_MSGPACK:  { ok = kvr_view_msgpack::scalar (m_data, n, *ctx); break; }
+      case kvr::CODEC_CBOR:     { ok = kvr_view_cbor::scalar (m_data, n, *ctx); break; }
+      case kvr::CODEC_KVRB:     { ok = kvr::internal::kvrb::scalar (m_data, *ctx); break; }
+      default:                  { break; }
+    }
+  }
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view kvr::view::_search_key (const char *keystr) const
+{
+  KVR_ASSERT (keystr);
+
+  view v;
+
+  //////////////////////////////////
+  if (this->is_map ())
+  //////////////////////////////////
+  {
+    v = this->find (keystr);
+  }
+
+  //////////////////////////////////
+  else if (this->is_array ())
+  //////////////////////////////////
+  {
+    char k0 = keystr [0];
+    switch (k0)
+    {
+      case KVR_TOKEN_MAP_GREP: // pattern match in array of maps
+      {
+        const char eq = '=';
+        const char *pattern = &keystr [1];
+        const char *s = strchr (pattern, eq);
+
+        if (s)
+        {
+          sz_t sklen = static_cast<sz_t>(s - pattern);
+          const char *sk = pattern;
+          const char *sv = s + 1;
+
+          cursor c (*this);
+          view m;
+
+          while (!v.is_valid () && c.get (&m))
+          {
+            view pv = m.is_map () ? m.find (sk, sklen) : view ();
+
+            kvr::internal::view_ctx ctx;
+            if (!pv._scalar (&ctx))
+            {
+              continue;
+            }
+
+            bool match = false;
+
+            switch (ctx.m_type)
+            {
+              case kvr::internal::view_ctx::VIEW_STRING:
+              {
+                match = (strlen (sv) == ctx.m_len) && (strncmp (sv, ctx.m_s, ctx.m_len) == 0);
+                break;
+              }
+
+              case kvr::internal::view_ctx::VIEW_FLOAT:
+              {
+                match = kvr::internal::fp_equal (strtod (sv, NULL), ctx.m_f);
+                break;
+              }
+
+              case kvr::internal::view_ctx::VIEW_INTEGER:
+              {
+                char *end = NULL;
+                int64_t svi = strtoll (sv, &end, 10);
+                match = end && (!*end) && (svi == ctx.m_i);
+                break;
+              }
+
+              case kvr::internal::view_ctx::VIEW_BOOLEAN:
+              {
+                int valid = (strcmp (sv, kvr_const_str_false) == 0) ? 0 : (strcmp (sv, kvr_const_str_true) == 0) ? 1 : -1;
+                match = (valid != -1) && ((valid ? true : false) == ctx.m_b);
+                break;
+              }
+
+              case kvr::internal::view_ctx::VIEW_NULL:
+              {
+                match = (strcmp (sv, kvr_const_str_null) == 0);
+                break;
+              }
+
+              default:
+              {
+                break;
+              }
+            }
+
+            if (match)
+            {
+              v = m;
+            }
+          }
+        }        
+        break;
+      }
+
+      default:
+      {
+        char *end = NULL;
+        int64_t ki64 = strtoll (keystr, &end, 10);
+        KVR_ASSERT_SAFE ((end && (!*end) && "non-integral array index"), view ());
+        KVR_ASSERT (ki64 >= 0);
+        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
+        sz_t ki = (sz_t) ki64;
+        v = this->element (ki);
+        break;
+      }
+    }
+  }
+
+  return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::view::cursor::cursor (const view &container) : m_codec (container.m_codec), m_pos (NULL), m_end (NULL), m_left (0), m_indef (false)
+{
+  KVR_ASSERT (container.is_map () || container.is_array ());
+
+  kvr::internal::push_token_t t;
+  sz_t count = 0;
+  size_t n = kvr_view_token (container.m_codec, container.m_data, container.m_avail, &t, &count);
+
+  if (n && (t != kvr::internal::PUSH_TOKEN_SCALAR) && (t != kvr::internal::PUSH_TOKEN_BREAK))
+  {
+    m_pos = (m_codec == CODEC_KVRB) ? kvr::internal::kvrb::children (container.m_data) : (container.m_data + n);
+    m_end = container.m_data + container.m_avail;
+    m_left = (t == kvr::internal::PUSH_TOKEN_MAP) ? (size_t (count) * 2) : size_t (count);
+    m_indef = (t == kvr::internal::PUSH_TOKEN_MAP_INDEF) || (t == kvr::internal::PUSH_TOKEN_ARRAY_INDEF);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::cursor::get (view *key, view *val)
+{
+  KVR_ASSERT (key && val);
+  return this->_next (key) && this->_next (val);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::cursor::get (view *val)
+{
+  KVR_ASSERT (val);
+  return this->_next (val);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::view::cursor::_next (view *v)
+{
+  if (!m_pos || (!m_indef && (m_left == 0)))
+  {
+    return false;
+  }
+
+  size_t avail = static_cast<size_t>(m_end - m_pos);
+
+  kvr::internal::push_token_t t;
+  sz_t count;
+  size_t n = kvr_view_token (m_codec, m_pos, avail, &t, &count);
+
+  // end of an indefinite-length container, or malformed
+  if ((n == 0) || (t == kvr::internal::PUSH_TOKEN_BREAK))
+  {
+    m_pos = NULL;
+    return false;
+  }
+
+  n = kvr_view_skip (m_codec, m_pos, avail);
+  if (n == 0)
+  {
+    m_pos = NULL;
+    return false;
+  }
+
+  v->m_codec = m_codec;
+  v->m_data = m_pos;
+  v->m_avail = avail;
+
+  m_pos += n;
+  m_left -= m_indef ? 0 : 1;
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::parallel_decoder
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// one thread's share of the records
+struct kvr_parallel_task
+{
+  kvr::codec_t      codec;
+  const uint8_t *   data;
+  size_t            size;
+  kvr::ctx *        ctx;
+  kvr::allocator *  alloc;
+  kvr::value **     records;
+  size_t            count;
+  bool              ok;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void kvr_parallel_decode_task (void *arg)
+{
+  kvr_parallel_task *task = (kvr_parallel_task *) arg;
+  kvr::record_reader reader (task->codec, task->data, task->size, task->alloc);
+
+  task->ok = true;
+
+  for (size_t i = 0; (i < task->count) && task->ok; ++i)
+  {
+    task->records [i] = task->ctx->create_value ();
+    task->ok = reader.next (task->records [i]);
+  }
+
+  if (task->ok)
+  {
+    // the share must hold exactly the records found by the split
+    kvr::value *extra = task->ctx->create_value ();
+    task->ok = !reader.next (extra) && !reader.failed ();
+    task->ctx->destroy_value (extra);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// records [first, last) of 'count' for task 't' of 'ntasks'
+static void kvr_parallel_range (size_t t, size_t ntasks, size_t count, size_t *first, size_t *last)
+{
+  *first = (size_t) (((uint64_t) t * count) / ntasks);
+  *last = (size_t) (((uint64_t) (t + 1) * count) / ntasks);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::parallel_decoder::parallel_decoder (size_t nthreads, allocator *alloc) : m_ctxs (NULL), m_records (NULL), m_offsets (NULL), m_count (0), m_capacity (0)
+{
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_nthreads = nthreads ? nthreads : kvr::internal::thread::hardware_concurrency ();
+  m_ctxs = (ctx **) m_alloc->allocate (sizeof (ctx *) * m_nthreads);
+  KVR_ASSERT (m_ctxs);
+
+  if (m_ctxs)
+  {
+    for (size_t t = 0; t < m_nthreads; ++t)
+    {
+      m_ctxs [t] = ctx::create (m_alloc);
+    }
+  }
+  else
+  {
+    m_nthreads = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+kvr::parallel_decoder::~parallel_decoder ()
+{
+  this->clear ();
+
+  for (size_t t = 0; t < m_nthreads; ++t)
+  {
+    ctx::destroy (m_ctxs [t]);
+  }
+
+  if (m_ctxs)
+  {
+    m_alloc->deallocate (m_ctxs, sizeof (ctx *) * m_nthreads);
+  }
+
+  if (m_capacity)
+  {
+    m_alloc->deallocate (m_records, sizeof (value *) * m_capacity);
+    m_alloc->deallocate (m_offsets, sizeof (size_t) * (m_capacity + 1));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::parallel_decoder::decode (codec_t codec, const uint8_t *data, size_t size)
+{
+  KVR_ASSERT_SAFE (data || (size == 0), false);
+
+  this->clear ();
+
+  // snapshots are mapped and viewed in place (see view), not read as records
+  if ((m_nthreads == 0) || (codec == CODEC_KVRB) || !this->_split (codec, data, size))
+  {
+    m_count = 0;
+    return false;
+  }
+
+  if (m_count == 0)
+  {
+    return true;
+  }
+
+  memset (m_records, 0, sizeof (value *) * m_count);
+
+  const size_t ntasks = (m_count < m_nthreads) ? m_count : m_nthreads;
+  const size_t tasksz = sizeof (kvr_parallel_task) * ntasks;
+  const size_t threadsz = sizeof (kvr::internal::thread) * ntasks;
+  kvr_parallel_task *tasks = (kvr_parallel_task *) m_alloc->allocate (tasksz);
+  kvr::internal::thread *threads = (kvr::internal::thread *) m_alloc->allocate (threadsz);
+
+  if (!tasks || !threads)
+  {
+    if (tasks) { m_alloc->deallocate (tasks, tasksz); }
+    if (threads) { m_alloc->deallocate (threads, threadsz); }
+    m_count = 0;
+    return false;
+  }
+
+  for (size_t t = 0; t < ntasks; ++t)
+  {
+    size_t first = 0, last = 0;
+    kvr_parallel_range (t, ntasks, m_count, &first, &last);
+
+    kvr_parallel_task &task = tasks [t];
+    task.codec = codec;
+    task.data = data + m_offsets [first];
+    task.size = m_offsets [last] - m_offsets [first];
+    task.ctx = m_ctxs [t];
+    task.alloc = m_alloc;
+    task.records = &m_records [first];
+    task.count = last - first;
+    task.ok = false;
+
+    new (&threads [t]) kvr::internal::thread ();
+  }
+
+  // the calling thread takes the first share
+  for (size_t t = 1; t < ntasks; ++t)
+  {
+    if (!threads [t].start (kvr_parallel_decode_task, &tasks [t]))
+    {
+      kvr_parallel_decode_task (&tasks [t]);
+    }
+  }
+
+  kvr_parallel_decode_task (&tasks [0]);
+
+  bool ok = true;
+  for (size_t t = 0; t < ntasks; ++t)
+  {
+    threads [t].join ();
+    threads [t].~thread ();
+    ok = ok && tasks [t].ok;
+  }
+
+  m_alloc->deallocate (tasks, tasksz);
+  m_alloc->deallocate (threads, threadsz);
+
+  if (!ok)
+  {
+    this->clear ();
+  }
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t kvr::parallel_decoder::count () const
+{
+  return m_count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+const kvr::value * kvr::parallel_decoder::get (size_t index) const
+{
+  KVR_ASSERT_SAFE (index < m_count, NULL);
+
+  return m_records [index];
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::parallel_decoder::merge (value *dest) const
+{
+  KVR_ASSERT_SAFE (dest, false);
+
+  dest->conv_array (m_count ? (sz_t) m_count : 8);
+
+  for (size_t i = 0; i < m_count; ++i)
+  {
+    dest->push_null ()->copy (m_records [i]);
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::parallel_decoder::clear ()
+{
+  const size_t ntasks = (m_count < m_nthreads) ? m_count : m_nthreads;
+
+  for (size_t t = 0; t < ntasks; ++t)
+  {
+    size_t first = 0, last = 0;
+    kvr_parallel_range (t, ntasks, m_count, &first, &last);
+
+    // newest first, the ctx finds recently created values quickest
+    for (size_t i = last; i > first; --i)
+    {
+      if (m_records [i - 1])
+      {
+        m_ctxs [t]->destroy_value (m_records [i - 1]);
+        m_records [i - 1] = NULL;
+      }
+    }
+  }
+
+  m_count = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::parallel_decoder::_split (codec_t codec, const uint8_t *data, size_t size)
+{
+  m_count = 0;
+
+  size_t pos = 0;
+
+  while (pos < size)
+  {
+    size_t end = 0;
+    bool record = false;
+
+    if (codec == CODEC_JSON)
+    {
+      // one record per non-blank line
+      const uint8_t *eol = (const uint8_t *) memchr (data + pos, '\n', size - pos);
+      end = eol ? (size_t) (eol - data) + 1 : size;
+
+      for (size_t i = pos; (i < end) && !record; ++i)
+      {
+        const uint8_t c = data [i];
+        record = (c != ' ') && (c != '\n') && (c != '\r') && (c != '\t');
+      }
+    }
+    else
+    {
+      size_t n = kvr_view_skip (codec, data + pos, size - pos);
+      if (n == 0)
+      {
+        return false;
+      }
+
+      end = pos + n;
+      record = true;
+    }
+
+    if (record)
+    {
+      if (!this->_reserve (m_count + 1))
+      {
+        return false;
+      }
+
+      m_offsets [m_count++] = pos;
     }
+
+    pos = end;
   }
 
-  //////////////////////////////////
-  else if (this->is_string ())
-  //////////////////////////////////
+  if (!this->_reserve (m_count))
+  {
+    return false;
+  }
+
+  m_offsets [m_count] = size;
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::parallel_decoder::_reserve (size_t count)
+{
+  if ((count <= m_capacity) && m_offsets)
   {
-    const char *str = this->get_string ();
-    std::fprintf (stderr, "value = %s -> [string]\n", str);
+    return true;
   }
 
-  //////////////////////////////////
-  else if (this->is_integer ())
-  //////////////////////////////////
+  size_t capacity = m_capacity ? m_capacity : 64u;
+  while (capacity < count)
   {
-    int64_t n = this->get_integer ();
-#if 0
-    std::fprintf (stderr, "value = %" PRId64 " -> [int]\n", n);
-#else
-    // PRId64 not supported by travis-ci
-    char ns [22];
-    size_t c = kvr::internal::i64toa (n, ns);
-    ns [c] = 0;
-    fprintf (stderr, "value = %s -> [int]\n", ns);
-#endif
+    capacity *= 2;
   }
 
-  //////////////////////////////////
-  else if (this->is_float ())
-  //////////////////////////////////
+  value **records = (value **) m_alloc->allocate (sizeof (value *) * capacity);
+  size_t *offsets = (size_t *) m_alloc->allocate (sizeof (size_t) * (capacity + 1));
+
+  if (!records || !offsets)
   {
-    double n = this->get_float ();
-    std::fprintf (stderr, "value = %g -> [float]\n", n);
+    if (records) { m_alloc->deallocate (records, sizeof (value *) * capacity); }
+    if (offsets) { m_alloc->deallocate (offsets, sizeof (size_t) * (capacity + 1)); }
+    return false;
   }
 
-  //////////////////////////////////
-  else if (this->is_boolean ())
-  //////////////////////////////////
+  if (m_capacity)
   {
-    bool b = this->get_boolean ();
-    std::fprintf (stderr, "value = %s -> [bool]\n", b ? kvr_const_str_true : kvr_const_str_false);
+    memcpy (offsets, m_offsets, sizeof (size_t) * m_count);
+    m_alloc->deallocate (m_records, sizeof (value *) * m_capacity);
+    m_alloc->deallocate (m_offsets, sizeof (size_t) * (m_capacity + 1));
   }
 
-  //////////////////////////////////
-  else if (this->is_null ())
-  //////////////////////////////////
+  m_records = records;
+  m_offsets = offsets;
+  m_capacity = capacity;
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::value::encode_parallel
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// a range of a container's items, encoded on its own thread
+struct kvr::value::segment
+{
+  codec_t             codec;
+  const value *       target;
+  sz_t                first;
+  sz_t                last;
+  kvr::mem_ostream *  out;
+  allocator *         alloc;
+  size_t              skip;
+  size_t              size;
+  bool                ok;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static kvr::internal::stream_encoder * kvr_stream_encoder_for (kvr::codec_t codec, kvr::allocator *a, kvr::ostream *ostr, size_t *encsz)
+{
+  kvr::internal::stream_encoder *enc = NULL;
+  *encsz = 0;
+
+  switch (codec)
   {
-    std::fprintf (stderr, "value = %s -> [null]\n", kvr_const_str_null);
+    case kvr::CODEC_JSON:
+    {
+      *encsz = sizeof (kvr::internal::json::stream_encoder);
+      enc = kvr_stream_encoder_create<kvr::internal::json::stream_encoder> (a, ostr);
+      break;
+    }
+
+    case kvr::CODEC_MSGPACK:
+    {
+      *encsz = sizeof (kvr::internal::msgpack::stream_encoder);
+      enc = kvr_stream_encoder_create<kvr::internal::msgpack::stream_encoder> (a, ostr);
+      break;
+    }
+
+    case kvr::CODEC_CBOR:
+    {
+      *encsz = sizeof (kvr::internal::cbor::stream_encoder);
+      enc = kvr_stream_encoder_create<kvr::internal::cbor::stream_encoder> (a, ostr);
+      break;
+    }
+
+    default:
+    {
+      break;
+    }
   }
-#else
-  KVR_REF_UNUSED (lpad);
-  KVR_REF_UNUSED (key);
-#endif
+
+  return enc;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_diff_set_rem (value *set, value *rem, const value *og, const value *md,
-                                const char **path, const sz_t pathsz, sz_t pathcnt)
+static kvr::sz_t kvr_encode_items (const kvr::value *v)
 {
-  KVR_ASSERT (set);
-  KVR_ASSERT (rem);
+  return v->is_map () ? v->size () : (v->is_array () ? v->length () : 0);
+}
 
-  // find og values in md that need to be updated
-  // if missing, mark for removal
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-  if (og)
+bool kvr::value::encode_parallel (codec_t codec, obuffer *obuf, size_t nthreads)
+{
+  KVR_ASSERT_SAFE (obuf, false);
+
+  nthreads = nthreads ? nthreads : kvr::internal::thread::hardware_concurrency ();
+
+  if ((nthreads < 2) || (this->_count (KVR_CONSTANT_ENCODE_PARALLEL_MIN_NODES) < KVR_CONSTANT_ENCODE_PARALLEL_MIN_NODES))
   {
-    //////////////////////////////////
-    if (md == NULL)
-    //////////////////////////////////
+    return this->encode (codec, obuf);
+  }
+
+  // go down from the root until a container has enough items to share out,
+  // following the child container with the most items
+  const value *path [KVR_CONSTANT_MAX_TREE_DEPTH];
+  size_t depth = 0;
+  const value *target = this;
+  path [depth++] = this;
+
+  while ((kvr_encode_items (target) < (nthreads * 4)) && (depth < KVR_CONSTANT_MAX_TREE_DEPTH))
+  {
+    const value *next = NULL;
+    sz_t most = kvr_encode_items (target);
+
+    if (target->is_map ())
     {
-      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
-      KVR_ASSERT (pathcnt > 0);
-      // add og to rem list
-      kvr::ctx *ctx = m_ctx;
-      value *v = ctx->_create_value_null (FLAG_PARENT_ARRAY);
-      v->conv_string ();
+      cursor c (target);
+      pair p;
+      while (c.get (&p))
+      {
+        const value *v = p.get_value ();
+        if (kvr_encode_items (v) > most) { next = v; most = kvr_encode_items (v); }
+      }
+    }
+    else if (target->is_array ())
+    {
+      for (sz_t i = 0; i < target->length (); ++i)
+      {
+        const value *v = target->element (i);
+        if (kvr_encode_items (v) > most) { next = v; most = kvr_encode_items (v); }
+      }
+    }
 
-      if (pathcnt == 1)
+    if (!next)
+    {
+      break;
+    }
+
+    target = next;
+    path [depth++] = next;
+  }
+
+  // maps are split by slot, some of which may be empty
+  const sz_t slots = target->is_map () ? target->m_data.m.m_len : kvr_encode_items (target);
+
+  if (kvr_encode_items (target) < 2)
+  {
+    return this->encode (codec, obuf);
+  }
+
+  ///////////////////////////////
+  // encode the segments
+  ///////////////////////////////
+
+  allocator *a = m_ctx->m_allocator;
+  const size_t nsegs = (slots < nthreads) ? slots : nthreads;
+  const size_t segsz = sizeof (segment) * nsegs;
+  const size_t streamsz = sizeof (kvr::mem_ostream) * nsegs;
+  const size_t threadsz = sizeof (kvr::internal::thread) * nsegs;
+
+  segment *segs = (segment *) a->allocate (segsz);
+  kvr::mem_ostream *streams = (kvr::mem_ostream *) a->allocate (streamsz);
+  kvr::internal::thread *threads = (kvr::internal::thread *) a->allocate (threadsz);
+
+  bool ok = segs && streams && threads;
+
+  if (ok)
+  {
+    for (size_t s = 0; s < nsegs; ++s)
+    {
+      size_t first = 0, last = 0;
+      kvr_parallel_range (s, nsegs, slots, &first, &last);
+
+      segment &seg = segs [s];
+      seg.codec = codec;
+      seg.target = target;
+      seg.first = (sz_t) first;
+      seg.last = (sz_t) last;
+      seg.out = new (&streams [s]) kvr::mem_ostream (KVR_CONSTANT_OSTREAM_BLOCK_SZ, a);
+      seg.alloc = a;
+      seg.skip = 0;
+      seg.size = 0;
+      seg.ok = false;
+
+      new (&threads [s]) kvr::internal::thread ();
+    }
+
+    // the calling thread takes the first range
+    for (size_t s = 1; s < nsegs; ++s)
+    {
+      if (!threads [s].start (&value::_encode_segment, &segs [s]))
       {
-        const char *pk = path [0];
-        v->set_string (pk);
+        value::_encode_segment (&segs [s]);
       }
-      else
+    }
+
+    value::_encode_segment (&segs [0]);
+
+    size_t total = 0;
+    for (size_t s = 0; s < nsegs; ++s)
+    {
+      threads [s].join ();
+      threads [s].~thread ();
+      ok = ok && segs [s].ok;
+      total += segs [s].size;
+    }
+
+    ///////////////////////////////
+    // stitch
+    ///////////////////////////////
+
+    obuf->m_stream.seek (0);
+
+    if (ok)
+    {
+      obuf->m_stream.reserve (total + KVR_CONSTANT_OSTREAM_BLOCK_SZ);
+
+      kvr::internal::mem_ostream_ref os (&obuf->m_stream);
+      size_t encsz = 0;
+      kvr::internal::stream_encoder *enc = kvr_stream_encoder_for (codec, a, &os, &encsz);
+
+      ok = enc && this->_encode_stitch (enc, codec, path, 0, depth, segs, nsegs);
+
+      if (enc)
       {
-        sz_t pksz = 0;
-        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-        v->_string_move (pk, pksz);
+        enc->finish ();
+        enc->~stream_encoder ();
+        a->deallocate (enc, encsz);
       }
+    }
 
-      rem->_push_v (v);
+    for (size_t s = 0; s < nsegs; ++s)
+    {
+      streams [s].~mem_ostream ();
     }
+  }
 
-    //////////////////////////////////
-    else if (!og->_type_equiv (md))
-    //////////////////////////////////
+  if (segs) { a->deallocate (segs, segsz); }
+  if (streams) { a->deallocate (streams, streamsz); }
+  if (threads) { a->deallocate (threads, threadsz); }
+
+  if (ok && obuf->m_pool)
+  {
+    obuf->m_pool->record (obuf->m_stream.tell ());
+  }
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::value::_encode_segment (void *arg)
+{
+  segment *seg = (segment *) arg;
+  const value *target = seg->target;
+
+  kvr::internal::mem_ostream_ref os (seg->out);
+  size_t encsz = 0;
+  kvr::internal::stream_encoder *enc = kvr_stream_encoder_for (seg->codec, seg->alloc, &os, &encsz);
+
+  bool ok = (enc != NULL);
+
+  if (ok)
+  {
+    // json items need the separators of their container, which is trimmed off after
+    const bool json = (seg->codec == CODEC_JSON);
+
+    if (json)
     {
-      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
-      KVR_ASSERT (pathcnt > 0);
+      ok = target->is_map () ? enc->begin_map (0, true) : enc->begin_array (0, true);
+    }
 
-      kvr::ctx *ctx = m_ctx;
-      key *k = NULL;
-      //if ((pathcnt == 1) && (ctx == og->m_ctx)) // path key must already be in the key store
-      if (pathcnt == 1)
+    if (target->is_map ())
+    {
+      const map &m = target->m_data.m;
+      for (sz_t i = seg->first; (i < seg->last) && ok; ++i)
       {
-        const char *pk = path [0];       
-        k = ctx->_create_key (pk); 
+        const map::node &n = m.m_ptr [i];
+        if (n.k)
+        {
+          ok = enc->key (n.k->get_string (), n.k->get_length ()) && enc->value (n.v);
+        }
       }
-      else
+    }
+    else
+    {
+      for (sz_t i = seg->first; (i < seg->last) && ok; ++i)
       {
-        sz_t pksz = 0;
-        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-        KVR_ASSERT (pk && pksz);
-        k = ctx->_create_key (pk, pksz - 1);
-        if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+        ok = enc->value (target->element (i));
       }
+    }
 
-      value *v = ctx->_create_value_null (FLAG_PARENT_MAP);
-      v->copy (md);
-      set->_insert_kv (k, v);
+    if (json && ok)
+    {
+      ok = target->is_map () ? enc->end_map (true) : enc->end_array (true);
     }
 
-    //////////////////////////////////
-    else if (og->is_map ())
-    //////////////////////////////////
+    enc->finish ();
+    enc->~stream_encoder ();
+    seg->alloc->deallocate (enc, encsz);
+
+    seg->skip = json ? 1 : 0;
+    seg->size = seg->out->tell () - (seg->skip * 2);
+  }
+
+  seg->ok = ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::value::_encode_stitch (internal::stream_encoder *enc, codec_t codec, const value * const *path, 
+                                 size_t level, size_t depth, const segment *segs, size_t nsegs) const
+{
+  KVR_ASSERT (path [level] == this);
+
+  bool ok = false;
+
+  if ((level + 1) == depth)
+  {
+    ok = this->is_map () ? enc->begin_map (this->size (), true) : enc->begin_array (this->length (), true);
+
+    bool first = true;
+    for (size_t s = 0; (s < nsegs) && ok; ++s)
     {
-      KVR_ASSERT (md->is_map ());
+      if (segs [s].size > 0)
+      {
+        if ((codec == CODEC_JSON) && !first)
+        {
+          ok = enc->raw ((const uint8_t *) ",", 1);
+        }
 
-      value::cursor c (og);
-      pair ogp;
+        ok = ok && enc->raw (segs [s].out->buffer () + segs [s].skip, segs [s].size);
+        first = false;
+      }
+    }
 
-      while (c.get (&ogp))
+    ok = ok && (this->is_map () ? enc->end_map (true) : enc->end_array (true));
+  }
+  else
+  {
+    const value *next = path [level + 1];
+
+    if (this->is_map ())
+    {
+      ok = enc->begin_map (this->size (), true);
+
+      cursor c (this);
+      pair p;
+      while (ok && c.get (&p))
       {
-        const char *k = ogp.get_key ()->get_string ();
+        const key *k = p.get_key ();
+        const value *v = p.get_value ();
+        ok = enc->key (k->get_string (), k->get_length ());
+        ok = ok && ((v == next) ? v->_encode_stitch (enc, codec, path, level + 1, depth, segs, nsegs) : enc->value (v));
+      }
 
-        KVR_ASSERT (pathcnt < pathsz);
-        path [pathcnt++] = k;
+      ok = ok && enc->end_map (true);
+    }
+    else
+    {
+      ok = enc->begin_array (this->length (), true);
 
-        value *mdv = md->find (k);
-        value *ogv = ogp.get_value ();
+      for (sz_t i = 0; (i < this->length ()) && ok; ++i)
+      {
+        const value *v = this->element (i);
+        ok = (v == next) ? v->_encode_stitch (enc, codec, path, level + 1, depth, segs, nsegs) : enc->value (v);
+      }
+
+      ok = ok && enc->end_array (true);
+    }
+  }
+
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::encode_batch
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-        this->_diff_set_rem (set, rem, ogv, mdv, path, pathsz, pathcnt);
+// one writer (and codec dispatch) for a run of documents. 'offsets' gets where each starts.
+static bool kvr_encode_batch_range (kvr::codec_t codec, const kvr::value * const *vals, size_t count, kvr::mem_ostream *out, size_t *offsets)
+{
+  bool ok = true;
 
-        path [--pathcnt] = NULL;
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      kvr::internal::json::ostream_memory wostr (out);
+      kvr::internal::json::writer<kvr::internal::json::ostream_memory> wrt (wostr);
+      for (size_t i = 0; (i < count) && ok; ++i)
+      {
+        KVR_ASSERT (vals [i]);
+        offsets [i] = out->tell ();
+        wrt.m_wrt.Reset (wostr); // a new root
+        ok = wrt.print (vals [i]);
+        out->put ('\n');
       }
+      break;
     }
 
-    //////////////////////////////////
-    else if (og->is_array ())
-    //////////////////////////////////
+    case kvr::CODEC_MSGPACK:
     {
-      KVR_ASSERT (md->is_array ());
+      kvr::internal::msgpack::write_ctx<kvr::mem_ostream> ctx (out);
+      kvr::internal::msgpack::writer<kvr::mem_ostream> wrt;
+      for (size_t i = 0; (i < count) && ok; ++i)
+      {
+        KVR_ASSERT (vals [i]);
+        offsets [i] = out->tell ();
+        ok = wrt.print (vals [i], ctx);
+      }
+      break;
+    }
 
-      char k [21];
-      for (sz_t i = 0, c = og->length (); i < c; ++i)
+    case kvr::CODEC_CBOR:
+    {
+      kvr::internal::cbor::write_ctx<kvr::mem_ostream> ctx (out);
+      kvr::internal::cbor::writer<kvr::mem_ostream> wrt;
+      for (size_t i = 0; (i < count) && ok; ++i)
       {
-        size_t kl = kvr::internal::u64toa (i, k);
-        k [kl] = 0;
+        KVR_ASSERT (vals [i]);
+        offsets [i] = out->tell ();
+        ok = wrt.print (vals [i], ctx);
+      }
+      break;
+    }
 
-        KVR_ASSERT (pathcnt < pathsz);
-        path [pathcnt++] = k;
+    default:
+    {
+      ok = false;
+      break;
+    }
+  }
 
-        value *mdv = md->element (i);
-        value *ogv = og->element (i);
+  return ok;
+}
 
-        this->_diff_set_rem (set, rem, ogv, mdv, path, pathsz, pathcnt);
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-        path [--pathcnt] = NULL;
-      }
-    }
+struct kvr_batch_task
+{
+  kvr::codec_t              codec;
+  const kvr::value * const *vals;
+  size_t                    count;
+  kvr::mem_ostream *        out;
+  size_t *                  offsets;
+  bool                      ok;
+};
 
-    //////////////////////////////////
-    else if (og->is_string ())
-    //////////////////////////////////
-    {
-      KVR_ASSERT (pathcnt > 0);
-      KVR_ASSERT (md->is_string ());
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-      sz_t mdstrlen = 0;
-      const char *ogstr = og->get_string ();
-      const char *mdstr = md->get_string (&mdstrlen);
+static void kvr_encode_batch_task (void *arg)
+{
+  kvr_batch_task *task = (kvr_batch_task *) arg;
+  task->ok = kvr_encode_batch_range (task->codec, task->vals, task->count, task->out, task->offsets);
+}
 
-      if (strcmp (ogstr, mdstr) != 0)
-      {
-        kvr::ctx *ctx = m_ctx;
-        key *k = NULL;
-        if (pathcnt == 1)
-        {
-          const char *pk = path [0];
-          k = ctx->_create_key (pk);
-        }
-        else
-        {
-          sz_t pksz = 0;
-          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-          KVR_ASSERT (pk && pksz);
-          k = ctx->_create_key (pk, pksz - 1);
-          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
-        }
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-        value *v = ctx->_create_value_string (FLAG_PARENT_MAP, mdstr, mdstrlen);
-        set->_insert_kv (k, v);
-      }
-    }
+bool kvr::encode_batch (codec_t codec, const value * const *vals, size_t count, obuffer *obuf, size_t *offsets, size_t nthreads)
+{
+  KVR_ASSERT_SAFE (vals || (count == 0), false);
+  KVR_ASSERT_SAFE (obuf && offsets, false);
 
-    //////////////////////////////////
-    else if (og->is_integer ())
-    //////////////////////////////////
-    {
-      KVR_ASSERT (pathcnt > 0);
-      KVR_ASSERT (md->_is_number ());
+  obuf->m_stream.seek (0);
 
-      if (md->is_integer ())
-      {
-        int64_t ogn = og->get_integer ();
-        int64_t mdn = md->get_integer ();
+  nthreads = nthreads ? nthreads : kvr::internal::thread::hardware_concurrency ();
+  const size_t ntasks = (count < nthreads) ? count : nthreads;
 
-        if (ogn != mdn)
-        {
-          kvr::ctx *ctx = m_ctx;
-          key *k = NULL;
-          if (pathcnt == 1)
-          {
-            const char *pk = path [0];
-            k = ctx->_create_key (pk);
-          }
-          else
-          {
-            sz_t pksz = 0;
-            char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-            KVR_ASSERT (pk && pksz);
-            k = ctx->_create_key (pk, pksz - 1);
-            if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
-          }
+  bool success = false;
 
-          value *v = ctx->_create_value_integer (FLAG_PARENT_MAP, mdn);
-          set->_insert_kv (k, v);
-        }
-      }
-      else if (md->is_float ())
+  if (ntasks <= 1)
+  {
+    success = kvr_encode_batch_range (codec, vals, count, &obuf->m_stream, offsets);
+  }
+  else
+  {
+    // the first run goes straight to 'obuf', the rest are appended after
+    allocator *a = get_default_allocator ();
+    const size_t tasksz = sizeof (kvr_batch_task) * ntasks;
+    const size_t streamsz = sizeof (mem_ostream) * ntasks;
+    const size_t threadsz = sizeof (kvr::internal::thread) * ntasks;
+    kvr_batch_task *tasks = (kvr_batch_task *) a->allocate (tasksz);
+    mem_ostream *streams = (mem_ostream *) a->allocate (streamsz);
+    kvr::internal::thread *threads = (kvr::internal::thread *) a->allocate (threadsz);
+
+    if (tasks && streams && threads)
+    {
+      for (size_t t = 0; t < ntasks; ++t)
       {
-        double ogn = og->get_float ();
-        double mdn = md->get_float ();
+        size_t first = 0, last = 0;
+        kvr_parallel_range (t, ntasks, count, &first, &last);
+
+        kvr_batch_task &task = tasks [t];
+        task.codec = codec;
+        task.vals = vals + first;
+        task.count = last - first;
+        task.out = (t == 0) ? &obuf->m_stream : new (&streams [t]) mem_ostream (KVR_CONSTANT_OSTREAM_BLOCK_SZ, a);
+        task.offsets = offsets + first;
+        task.ok = false;
+
+        new (&threads [t]) kvr::internal::thread ();
+      }
 
-        if (!kvr::internal::fp_equal (ogn, mdn, KVR_CONSTANT_DIFF_FP_EQ_EPSILON))
+      for (size_t t = 1; t < ntasks; ++t)
+      {
+        if (!threads [t].start (kvr_encode_batch_task, &tasks [t]))
         {
-          kvr::ctx *ctx = m_ctx;
-          key *k = NULL;
-          if (pathcnt == 1)
-          {
-            const char *pk = path [0];
-            k = ctx->_create_key (pk);
-          }
-          else
-          {
-            sz_t pksz = 0;
-            char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-            KVR_ASSERT (pk && pksz);
-            k = ctx->_create_key (pk, pksz - 1);
-            if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
-          }
-
-          value *v = ctx->_create_value_float (FLAG_PARENT_MAP, mdn);
-          set->_insert_kv (k, v);
+          kvr_encode_batch_task (&tasks [t]);
         }
       }
-    }
 
-    //////////////////////////////////
-    else if (og->is_float ())
-    //////////////////////////////////
-    {
-      KVR_ASSERT (pathcnt > 0);
-      KVR_ASSERT (md->_is_number ());
+      kvr_encode_batch_task (&tasks [0]);
 
-      double ogn = og->get_float ();
-      double mdn = md->get_float ();
+      success = true;
+      for (size_t t = 0; t < ntasks; ++t)
+      {
+        threads [t].join ();
+        threads [t].~thread ();
+        success = success && tasks [t].ok;
+      }
 
-      if (!kvr::internal::fp_equal (ogn, mdn, KVR_CONSTANT_DIFF_FP_EQ_EPSILON))
+      for (size_t t = 1; t < ntasks; ++t)
       {
-        kvr::ctx *ctx = m_ctx;
-        key *k = NULL;
-        if (pathcnt == 1)
-        {
-          const char *pk = path [0];
-          k = ctx->_create_key (pk);
-        }
-        else
+        if (success)
         {
-          sz_t pksz = 0;
-          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-          KVR_ASSERT (pk && pksz);
-          k = ctx->_create_key (pk, pksz - 1);
-          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
+          const size_t base = obuf->m_stream.tell ();
+          for (size_t i = 0; i < tasks [t].count; ++i)
+          {
+            tasks [t].offsets [i] += base;
+          }
+          obuf->m_stream.write (const_cast<uint8_t *> (tasks [t].out->buffer ()), tasks [t].out->tell ());
         }
 
-        value *v = ctx->_create_value_float (FLAG_PARENT_MAP, mdn);
-        set->_insert_kv (k, v);
+        tasks [t].out->~mem_ostream ();
       }
     }
 
-    //////////////////////////////////
-    else if (og->is_boolean ())
-    //////////////////////////////////
-    {
-      KVR_ASSERT (pathcnt > 0);
-      KVR_ASSERT (md->is_boolean ());
-
-      bool ogb = og->get_boolean ();
-      bool mdb = md->get_boolean ();
+    if (tasks) { a->deallocate (tasks, tasksz); }
+    if (streams) { a->deallocate (streams, streamsz); }
+    if (threads) { a->deallocate (threads, threadsz); }
+  }
 
-      if (ogb != mdb)
-      {
-        kvr::ctx *ctx = m_ctx;
-        key *k = NULL;
-        if (pathcnt == 1)
-        {
-          const char *pk = path [0];
-          k = ctx->_create_key (pk);
-        }
-        else
-        {
-          sz_t pksz = 0;
-          char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-          KVR_ASSERT (pk && pksz);
-          k = ctx->_create_key (pk, pksz - 1);
-          if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
-        }
+  if (success)
+  {
+    offsets [count] = obuf->m_stream.tell ();
 
-        value *v = ctx->_create_value_boolean (FLAG_PARENT_MAP, mdb);
-        set->_insert_kv (k, v);
-      }
+    if (codec == CODEC_JSON)
+    {
+      // null-terminate past the end for the json reader
+      obuf->m_stream.put (0);
+      obuf->m_stream.pop (1);
     }
 
-    //////////////////////////////////
-    else if (og->is_null ())
-    //////////////////////////////////
+    if (obuf->m_pool)
     {
-      KVR_ASSERT (md->is_null ());
-      // should already be taken care of in type check
+      obuf->m_pool->record (obuf->m_stream.tell ());
     }
   }
+
+  return success;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_diff_add (value *add, const value *og, const value *md,
-                            const char **path, const sz_t pathsz, sz_t pathcnt)
+bool kvr::decode_batch (codec_t codec, const uint8_t *data, const size_t *offsets, size_t count, value **dests)
 {
-  KVR_ASSERT (add);
+  KVR_ASSERT_SAFE (offsets && (dests || (count == 0)), false);
 
-  // go through md and og and look for nodes in md that are not in og
-
-  if (md)
+  for (size_t i = 0; i < count; ++i)
   {
-    //////////////////////////////////
-    if (og == NULL)
-    //////////////////////////////////
-    {
-      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
-      KVR_ASSERT (pathcnt > 0);
-      // add md to add list
+    KVR_ASSERT_SAFE (dests [i] && (offsets [i] <= offsets [i + 1]), false);
+  }
 
-      kvr::ctx *ctx = m_ctx;
-      key *k = NULL;      
-      //if ((pathcnt == 1) && (ctx == md->m_ctx))
-      if (pathcnt == 1)
-      {
-        const char *pk = path [0];
-        k = ctx->_create_key (pk);
-      }
-      else
-      {
-        sz_t pksz = 0;
-        char *pk = ctx->_create_path_expr (path, pathcnt, &pksz);
-        KVR_ASSERT (pk && pksz);
-        k = ctx->_create_key (pk, pksz - 1);
-        if (k->m_ref > 1) { ctx->_destroy_path_expr (pk, pksz); pk = NULL; }
-      }
+  bool success = false;
 
-      value *v = ctx->_create_value_null (FLAG_PARENT_MAP);
-      v->copy (md);
-      add->_insert_kv (k, v);
+  // one reader (and its string scratch and parse stack) serves every document
+  switch (codec)
+  {
+    case kvr::CODEC_JSON:
+    {
+      success = kvr::internal::json::read_batch (dests, data, offsets, count);
+      break;
     }
 
-    //////////////////////////////////
-    else if (!og->_type_equiv (md))
-    //////////////////////////////////
+    case kvr::CODEC_MSGPACK:
     {
-      // at this point og and md cannot be root values. therefore KVR_ASSERT (pathsz > 0)
-      KVR_ASSERT (pathcnt > 0);
-      // case handled by _diff_set_rem (which must be called before _diff_add)
+      success = kvr::internal::msgpack::read_batch (dests, data, offsets, count);
+      break;
     }
 
-    //////////////////////////////////
-    else if (md->is_map ())
-    //////////////////////////////////
+    case kvr::CODEC_CBOR:
     {
-      KVR_ASSERT (og->is_map ());
-
-      value::cursor c (md);
-      pair mdp;
+      success = kvr::internal::cbor::read_batch (dests, data, offsets, count);
+      break;
+    }
 
-      while (c.get (&mdp))
+    case kvr::CODEC_KVRB:
+    {
+      // snapshots are viewed in place: there is no reader state to share
+      success = true;
+      for (size_t i = 0; (i < count) && success; ++i)
       {
-        const char *k = mdp.get_key ()->get_string ();
-
-        KVR_ASSERT (pathcnt < pathsz);
-        path [pathcnt++] = k;
-
-        value *ogv = og->find (k);
-        value *mdv = mdp.get_value ();
-
-        _diff_add (add, ogv, mdv, path, pathsz, pathcnt);
-
-        path [--pathcnt] = NULL;
+        success = dests [i]->decode (codec, data + offsets [i], offsets [i + 1] - offsets [i]);
       }
+      break;
     }
 
-    //////////////////////////////////
-    else if (md->is_array ())
-    //////////////////////////////////
+    default:
     {
-      KVR_ASSERT (og->is_array ());
+      break;
+    }
+  }
 
-      char k [21];
-      for (sz_t i = 0, c = md->length (); i < c; ++i)
-      {
-        size_t kl = kvr::internal::u64toa (i, k); k [kl] = 0;
+  return success;
+}
 
-        KVR_ASSERT (pathcnt < pathsz);
-        path [pathcnt++] = k;
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::compressed_ostream
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-        value *ogv = og->element (i);
-        value *mdv = md->element (i);
+struct kvr_lz_task
+{
+  const uint8_t * src;
+  size_t          srcsz;
+  uint8_t *       dest;
+  size_t          destsz;
+  uint32_t *      table;
+  uint32_t        sum;
+  bool            ok;
+};
 
-        _diff_add (add, ogv, mdv, path, pathsz, pathcnt);
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-        path [--pathcnt] = NULL;
-      }
-    }
+static void kvr_lz_compress_task (void *arg)
+{
+  kvr_lz_task *task = (kvr_lz_task *) arg;
+  task->destsz = kvr::internal::lz::compress (task->src, task->srcsz, task->dest, task->table);
+  task->sum = kvr::internal::adler32 (task->src, task->srcsz);
+  task->ok = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// a packed size equal to the raw size is a stored block
+static void kvr_lz_decompress_task (void *arg)
+{
+  kvr_lz_task *task = (kvr_lz_task *) arg;
+
+  bool ok = true;
+  if (task->srcsz == task->destsz)
+  {
+    memcpy (task->dest, task->src, task->srcsz);
   }
-}                   
+  else
+  {
+    ok = kvr::internal::lz::decompress (task->src, task->srcsz, task->dest, task->destsz);
+  }
+
+  task->ok = ok && (kvr::internal::adler32 (task->dest, task->destsz) == task->sum);
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_patch_set (const value *set)
+// one thread per task. the calling thread takes the first (and any that can't be started)
+static bool kvr_lz_run (kvr::internal::thread::func_t fn, kvr_lz_task *tasks, size_t count, kvr::allocator *alloc)
 {
-  KVR_ASSERT (set);
-  
-  kvr::value *tg = this;
+  const size_t threadsz = sizeof (kvr::internal::thread) * count;
+  kvr::internal::thread *threads = (count > 1) ? (kvr::internal::thread *) alloc->allocate (threadsz) : NULL;
 
-  kvr::value::cursor cursor (set);
-  kvr::pair p;
+  for (size_t t = 1; t < count; ++t)
+  {
+    if (threads)
+    {
+      new (&threads [t]) kvr::internal::thread ();
+    }
+    if (!threads || !threads [t].start (fn, &tasks [t]))
+    {
+      fn (&tasks [t]);
+    }
+  }
 
-  while (cursor.get (&p))
+  if (count > 0)
   {
-    const char *skey = p.get_key ()->get_string ();
-    kvr::value *sval = p.get_value ();
-    kvr::value *tgv  = tg->_search_path_expr (skey);
+    fn (&tasks [0]);
+  }
 
-    if (tgv)
+  bool ok = true;
+  for (size_t t = 0; t < count; ++t)
+  {
+    if (threads && (t > 0))
     {
-      tgv->copy (sval);
+      threads [t].join ();
+      threads [t].~thread ();
     }
+    ok = ok && tasks [t].ok;
   }
+
+  if (threads)
+  {
+    alloc->deallocate (threads, threadsz);
+  }
+
+  return ok;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_patch_add (const value *add)
+kvr::compressed_ostream::compressed_ostream (ostream *dest, size_t blocksz, size_t nthreads, allocator *alloc) : m_dest (dest), m_rawpos (0), m_index (256u, alloc), m_offset (0), m_finished (false)
 {
-  KVR_ASSERT (add);
+  KVR_ASSERT (dest);
 
-  value *tg = this;
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  m_blocksz = kvr::internal::min (kvr::internal::max (blocksz, kvr::internal::lz::MIN_BLOCK_SIZE), kvr::internal::lz::MAX_BLOCK_SIZE);
+  m_nthreads = nthreads ? nthreads : kvr::internal::thread::hardware_concurrency ();
+  m_raw = (uint8_t *) m_alloc->allocate (m_blocksz * m_nthreads);
+  m_packed = (uint8_t *) m_alloc->allocate (kvr::internal::lz::bound (m_blocksz) * m_nthreads);
+  m_tables = (uint32_t *) m_alloc->allocate (sizeof (uint32_t) * kvr::internal::lz::HASH_SIZE * m_nthreads);
+  m_ok = m_raw && m_packed && m_tables;
 
-  kvr::value::cursor cursor (add);
-  kvr::pair p;
+  uint8_t header [kvr::internal::lz::FRAME_HEADER_SIZE];
+  memcpy (header, kvr::internal::lz::FRAME_MAGIC, 4);
+  kvr::internal::lz::set_u32 (header + 4, (uint32_t) m_blocksz);
+  this->_emit (header, sizeof (header));
+}
 
-  while (cursor.get (&p))
-  {
-    const char *akey = p.get_key ()->get_string ();
-    value *aval = p.get_value ();
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-    const char *tgk = NULL;
-    value *tgp = NULL;
-    value *tgv = tg->_search_path_expr (akey, &tgk, &tgp);
-    KVR_ASSERT (tgv == NULL); // path shouldn't exist but we're interested in key and parent
-    KVR_REF_UNUSED (tgv);
+kvr::compressed_ostream::~compressed_ostream ()
+{
+  this->finish ();
 
-    if (tgk && tgp)
-    {
-      KVR_ASSERT (tgp->is_map () || tgp->is_array ());
+  if (m_raw) { m_alloc->deallocate (m_raw, m_blocksz * m_nthreads); }
+  if (m_packed) { m_alloc->deallocate (m_packed, kvr::internal::lz::bound (m_blocksz) * m_nthreads); }
+  if (m_tables) { m_alloc->deallocate (m_tables, sizeof (uint32_t) * kvr::internal::lz::HASH_SIZE * m_nthreads); }
+}
 
-      if (tgp->is_map ())
-      {
-        value *v = tgp->insert_null (tgk);
-        KVR_ASSERT (v);
-        v->copy (aval);
-      }
-      else if (tgp->is_array ())
-      {
-#if KVR_DEBUG
-        char *end;
-        int64_t ki64 = strtoll (tgk, &end, 10); KVR_ASSERT (!*end);
-        KVR_ASSERT (ki64 >= 0);
-        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
-        sz_t ki = (sz_t) ki64;
-        sz_t sz = tgp->length ();
-        KVR_ASSERT (ki == sz);
-#endif
-        value *v = tgp->push_null ();
-        v->copy (aval);
-      }
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::compressed_ostream::put (uint8_t byte)
+{
+  KVR_ASSERT_SAFE (!m_finished, (void) 0);
+
+  if (m_ok)
+  {
+    m_raw [m_rawpos++] = byte;
+    if (m_rawpos == (m_blocksz * m_nthreads))
+    {
+      this->_blocks ();
     }
   }
 }
@@ -3294,48 +8499,23 @@ void kvr::value::_patch_add (const value *add)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_patch_rem (const value *rem)
+void kvr::compressed_ostream::write (uint8_t *bytes, size_t count)
 {
-  KVR_ASSERT (rem);
+  KVR_ASSERT_SAFE (!m_finished, (void) 0);
 
-  value *tg = this;
+  const size_t cap = m_blocksz * m_nthreads;
 
-  for (sz_t c = rem->length (); c >= 1; --c) // start from bottom (for array pop)
+  while (m_ok && (count > 0))
   {
-    sz_t i = c - 1;
-
-    value *rval = rem->element (i);
-    KVR_ASSERT (rval);
-
-    const char *rkey = rval->get_string ();
-    KVR_ASSERT (rkey);
-
-    const char *tgk = NULL;
-    value *tgp = NULL;
-    value *tgv = tg->_search_path_expr (rkey, &tgk, &tgp);
+    size_t n = kvr::internal::min (cap - m_rawpos, count);
+    memcpy (m_raw + m_rawpos, bytes, n);
+    m_rawpos += n;
+    bytes += n;
+    count -= n;
 
-    if (tgp && tgv)
+    if (m_rawpos == cap)
     {
-      KVR_ASSERT (tgp->is_map () || tgp->is_array ());
-
-      if (tgp->is_map ())
-      {
-        KVR_ASSERT (tgv == tgp->find (tgk));
-        tgp->remove (tgk);
-      }
-      else if (tgp->is_array ())
-      {
-#if KVR_DEBUG
-        char *end;
-        int64_t ki64 = strtoll (tgk, &end, 10); KVR_ASSERT (!*end);
-        KVR_ASSERT (ki64 >= 0);
-        KVR_ASSERT ((uint64_t) ki64 <= kvr::SZ_T_MAX);
-        sz_t ki = (sz_t) ki64;
-        sz_t sz = tgp->length ();
-        KVR_ASSERT ((ki + 1) == sz);
-#endif
-        tgp->pop ();
-      }
+      this->_blocks ();
     }
   }
 }
@@ -3344,923 +8524,1356 @@ void kvr::value::_patch_rem (const value *rem)
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_insert_kv (key *k, value *v)
+void kvr::compressed_ostream::flush ()
 {
-  KVR_ASSERT (k);
-  KVR_ASSERT (v);
-  KVR_ASSERT (is_map ());
+  if (!m_finished)
+  {
+    this->_blocks ();
+    m_dest->flush ();
+  }
+}
 
-  map::node *n = NULL;
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-#if KVR_DEBUG
-  n = (k->m_ref <= 1) ? NULL : m_data.m.find (k);
-  KVR_ASSERT (n == NULL);
-#endif
+bool kvr::compressed_ostream::finish ()
+{
+  if (m_finished)
+  {
+    return m_ok;
+  }
 
-  n = m_data.m.insert (k, v, m_ctx->m_allocator);
-  KVR_ASSERT (n != NULL);
+  this->_blocks ();
+
+  if (m_ok)
+  {
+    KVR_ASSERT (m_index.tell () <= 0xffffffff);
+
+    uint8_t end [kvr::internal::lz::BLOCK_HEADER_SIZE];
+    kvr::internal::lz::set_u32 (end, 0);
+    kvr::internal::lz::set_u32 (end + 4, (uint32_t) m_index.tell ());
+    kvr::internal::lz::set_u32 (end + 8, kvr::internal::adler32 (m_index.buffer (), m_index.tell ()));
+
+    uint8_t footer [kvr::internal::lz::FOOTER_SIZE];
+    kvr::internal::lz::set_u64 (footer, m_offset);
+    memcpy (footer + 8, kvr::internal::lz::FRAME_MAGIC, 4);
+
+    this->_emit (end, sizeof (end));
+    this->_emit (m_index.buffer (), m_index.tell ());
+    this->_emit (footer, sizeof (footer));
+    m_dest->flush ();
+  }
+
+  m_finished = true;
+
+  return m_ok;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::_push_v (value *v)
+bool kvr::compressed_ostream::failed () const
 {
-  KVR_ASSERT (v);
-  KVR_ASSERT (is_array ());
-
-  this->m_data.a.push (v, m_ctx->m_allocator);
+  return !m_ok;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value * kvr::value::_conv_map (sz_t cap)
+// compresses the buffered blocks (one per thread) and writes them out in order
+void kvr::compressed_ostream::_blocks ()
 {
-  if (!is_map ())
+  if (!m_ok || (m_rawpos == 0))
   {
-    this->_clear ();
-    m_flags |= FLAG_TYPE_MAP;
-    m_data.m.init (cap, m_ctx->m_allocator);
+    return;
   }
 
-  return this;
+  const size_t count = (m_rawpos + m_blocksz - 1) / m_blocksz;
+  const size_t bound = kvr::internal::lz::bound (m_blocksz);
+  const size_t tasksz = sizeof (kvr_lz_task) * count;
+  kvr_lz_task *tasks = (kvr_lz_task *) m_alloc->allocate (tasksz);
+
+  if (!tasks)
+  {
+    m_ok = false;
+    return;
+  }
+
+  for (size_t b = 0; b < count; ++b)
+  {
+    kvr_lz_task &task = tasks [b];
+    task.src = m_raw + (b * m_blocksz);
+    task.srcsz = kvr::internal::min (m_blocksz, m_rawpos - (b * m_blocksz));
+    task.dest = m_packed + (b * bound);
+    task.destsz = 0;
+    task.table = m_tables + (b * kvr::internal::lz::HASH_SIZE);
+    task.sum = 0;
+    task.ok = false;
+  }
+
+  kvr_lz_run (kvr_lz_compress_task, tasks, count, m_alloc);
+
+  for (size_t b = 0; b < count; ++b)
+  {
+    kvr_lz_task &task = tasks [b];
+
+    // incompressible: stored
+    const bool stored = (task.destsz >= task.srcsz);
+    const size_t size = stored ? task.srcsz : task.destsz;
+
+    uint8_t entry [8];
+    kvr::internal::lz::set_u64 (entry, m_offset);
+    m_index.write (entry, sizeof (entry));
+
+    uint8_t header [kvr::internal::lz::BLOCK_HEADER_SIZE];
+    kvr::internal::lz::set_u32 (header, (uint32_t) task.srcsz);
+    kvr::internal::lz::set_u32 (header + 4, (uint32_t) size);
+    kvr::internal::lz::set_u32 (header + 8, task.sum);
+
+    this->_emit (header, sizeof (header));
+    this->_emit (stored ? task.src : task.dest, size);
+  }
+
+  m_alloc->deallocate (tasks, tasksz);
+  m_rawpos = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value * kvr::value::_conv_array (sz_t cap)
+void kvr::compressed_ostream::_emit (const uint8_t *bytes, size_t count)
 {
-  if (!is_array ())
-  {
-    this->_clear ();
-    m_flags |= FLAG_TYPE_ARRAY;
-    m_data.a.init (cap, m_ctx->m_allocator);
-  }
-
-  return this;
+  m_dest->write (const_cast<uint8_t *> (bytes), count);
+  m_offset += count;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::value::string
+// kvr::compressed_istream
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const char *kvr::value::string::stt_str::get () const
+kvr::compressed_istream::compressed_istream (istream *src, size_t nthreads, allocator *alloc) : m_src (src), m_data (NULL), m_size (0), m_offsets (256u, alloc)
 {
-  return m_data;
+  KVR_ASSERT (src);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  this->_init (nthreads);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::sz_t kvr::value::string::stt_str::length () const
+kvr::compressed_istream::compressed_istream (const uint8_t *data, size_t size, size_t nthreads, allocator *alloc) : m_src (NULL), m_data (data), m_size (size), m_offsets (256u, alloc)
 {
-  size_t length = strlen (m_data);
-  return static_cast<sz_t>(length);
+  KVR_ASSERT (data || (size == 0));
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+  this->_init (nthreads);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::string::stt_str::set (const char *str, sz_t len)
+kvr::compressed_istream::~compressed_istream ()
 {
-  KVR_ASSERT (str);
-  KVR_ASSERT (len < stt_str::CAP);
-  kvr_strncpy (m_data, string::stt_str::CAP, str, len);
+  if (m_raw) { m_alloc->deallocate (m_raw, m_blocksz * m_nthreads); }
+  if (m_packed) { m_alloc->deallocate (m_packed, m_blocksz * m_nthreads); }
+  if (m_lens) { m_alloc->deallocate (m_lens, sizeof (size_t) * m_nthreads); }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const char *kvr::value::string::dyn_str::get () const
+bool kvr::compressed_istream::get (uint8_t *byte)
 {
-  return m_data;
+  return this->fetch (byte, 1) == 1;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::sz_t kvr::value::string::dyn_str::length () const
+bool kvr::compressed_istream::read (uint8_t *bytes, size_t count)
 {
-  return m_len;
+  return this->fetch (bytes, count) == count;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::string::dyn_str::set (const char *str, sz_t len, allocator *a)
+size_t kvr::compressed_istream::tell ()
 {
-  KVR_ASSERT (str);
-  KVR_ASSERT (len > 0);
-  KVR_ASSERT (a);
-
-  sz_t allocsz = ((len + 1) + string::dyn_str::PAD) & ~string::dyn_str::PAD;  
-  if (allocsz > m_size)
-  {
-    if (m_data) { a->deallocate (m_data, m_size); }
-    m_data = (char *) a->allocate (allocsz); KVR_ASSERT (m_data);
-    m_size = allocsz;
-  }
-
-  kvr_strncpy (m_data, m_size, str, len);
-  m_len = len;
+  return m_pos;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::string::dyn_str::cleanup (allocator *a)
+uint8_t kvr::compressed_istream::peek ()
 {
-  KVR_ASSERT (a);
-
-  if (m_data)
-  {
-    a->deallocate (m_data, m_size);
-    m_data = NULL;
-  }
+  return this->_ready () ? m_raw [(m_cur * m_blocksz) + m_rpos] : 0;
 }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::value::array
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::array::init (sz_t size, allocator *a)
+size_t kvr::compressed_istream::fetch (uint8_t *bytes, size_t count)
 {
-  KVR_ASSERT (size > 0);
-  KVR_ASSERT (a);
+  size_t n = 0;
 
-  sz_t allocsz = kvr::internal::align_size (size, CAP_INCR);
-  m_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * allocsz); KVR_ASSERT (m_ptr);
-#if KVR_DEBUG  
-  memset (m_ptr, 0, sizeof (kvr::value *) * allocsz); // debug-only
-#endif
-  m_cap = allocsz;
-  m_len = 0;
+  while ((n < count) && this->_ready ())
+  {
+    size_t take = kvr::internal::min (m_lens [m_cur] - m_rpos, count - n);
+    memcpy (bytes + n, m_raw + (m_cur * m_blocksz) + m_rpos, take);
+    m_rpos += take;
+    n += take;
+  }
+
+  m_pos += n;
+
+  return n;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::array::deinit (allocator *a)
+bool kvr::compressed_istream::failed () const
 {
-  KVR_ASSERT (m_ptr);
-  KVR_ASSERT (a);
-
-  a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
-  m_ptr = NULL;
+  return m_failed;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::array::push (value *v, allocator *a)
+void kvr::compressed_istream::_init (size_t nthreads)
 {
-  KVR_ASSERT (v);
-  KVR_ASSERT (a);
-
-  if (m_len >= m_cap)
-  {
-    // resize
-#if KVR_INTERNAL_FLAG_REALLOC_TYPE_FIXED
-    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - CAP_INCR));
-    KVR_ASSERT (m_ptr);
-
-    sz_t new_cap = m_cap + CAP_INCR;
-    value ** new_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * new_cap); KVR_ASSERT (new_ptr);
-    memcpy (new_ptr, m_ptr, sizeof (kvr::value *) * m_cap);
-#if KVR_DEBUG
-    memset (new_ptr + m_cap, 0, sizeof (kvr::value *) * CAP_INCR);
-#endif
-    a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
-#else
-    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - m_cap));
-    KVR_ASSERT (m_ptr);
-
-    sz_t new_cap = m_cap + m_cap;
-    value ** new_ptr = (kvr::value **) a->allocate (sizeof (kvr::value *) * new_cap); KVR_ASSERT (new_ptr);
-    memcpy (new_ptr, m_ptr, sizeof (kvr::value *) * m_cap);
-#if KVR_DEBUG
-    memset (new_ptr + m_cap, 0, sizeof (kvr::value *) * m_cap);
-#endif
-    a->deallocate (m_ptr, sizeof (kvr::value *) * m_cap);
-#endif
-    m_ptr = new_ptr;
-    m_cap = new_cap;
-  }
-
-  m_ptr [m_len++] = v;
+  m_blocksz = 0;
+  m_nthreads = nthreads ? nthreads : kvr::internal::thread::hardware_concurrency ();
+  m_raw = NULL;
+  m_packed = NULL;
+  m_lens = NULL;
+  m_count = 0;
+  m_cur = 0;
+  m_rpos = 0;
+  m_pos = 0;
+  m_index = NULL;
+  m_block = 0;
+  m_nblocks = 0;
+  m_offset = 0;
+  m_end = false;
+  m_failed = !this->_open ();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value *kvr::value::array::pop ()
+// reads the header. in memory, also the footer and the index, and 'm_size' becomes
+// where the blocks end.
+bool kvr::compressed_istream::_open ()
 {
-#if KVR_DEBUG
-  value *v = NULL;
+  namespace lz = kvr::internal::lz;
 
-  if (m_len > 0)
+  uint8_t header [lz::FRAME_HEADER_SIZE];
+
+  if (m_src)
   {
-    v = m_ptr [--m_len];
-    m_ptr [m_len] = NULL;
+    if (!m_src->read (header, sizeof (header)))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    if (m_size < (lz::FRAME_HEADER_SIZE + lz::BLOCK_HEADER_SIZE + lz::FOOTER_SIZE))
+    {
+      return false;
+    }
+    memcpy (header, m_data, sizeof (header));
   }
-#else
-  value *v = (m_len > 0) ? m_ptr [--m_len] : NULL;
-#endif
-
-  return v;
-}
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
+  m_blocksz = lz::get_u32 (header + 4);
+  m_offset = lz::FRAME_HEADER_SIZE;
 
-kvr::value * kvr::value::array::pop (sz_t index)
-{
-  value *v = NULL;
+  if ((memcmp (header, lz::FRAME_MAGIC, 4) != 0) || (m_blocksz < lz::MIN_BLOCK_SIZE) || (m_blocksz > lz::MAX_BLOCK_SIZE))
+  {
+    m_blocksz = 0;
+    return false;
+  }
 
-  if (index < m_len) // implies m_len > 0
+  if (!m_src)
   {
-    v = m_ptr [index];
+    const uint8_t *footer = m_data + m_size - lz::FOOTER_SIZE;
+    uint64_t end = lz::get_u64 (footer);
+    if ((memcmp (footer + 8, lz::FRAME_MAGIC, 4) != 0) || (end < lz::FRAME_HEADER_SIZE) || (end > (m_size - lz::FOOTER_SIZE - lz::BLOCK_HEADER_SIZE)))
+    {
+      return false;
+    }
 
-    for (sz_t i = index + 1; i < m_len; ++i)
+    const uint8_t *eb = m_data + end;
+    uint32_t indexsz = lz::get_u32 (eb + 4);
+    m_index = eb + lz::BLOCK_HEADER_SIZE;
+    if ((lz::get_u32 (eb) != 0) || ((indexsz % 8) != 0) || ((end + lz::BLOCK_HEADER_SIZE + indexsz) != (m_size - lz::FOOTER_SIZE)) ||
+        (kvr::internal::adler32 (m_index, indexsz) != lz::get_u32 (eb + 8)))
     {
-      m_ptr [i - 1] = m_ptr [i];
+      return false;
     }
 
-    m_ptr [--m_len] = NULL;
+    m_nblocks = indexsz / 8;
+    m_size = (size_t) end;
   }
 
-  return v;
+  m_raw = (uint8_t *) m_alloc->allocate (m_blocksz * m_nthreads);
+  m_packed = m_src ? (uint8_t *) m_alloc->allocate (m_blocksz * m_nthreads) : NULL;
+  m_lens = (size_t *) m_alloc->allocate (sizeof (size_t) * m_nthreads);
+
+  return m_raw && m_lens && (m_packed || !m_src);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value * kvr::value::array::elem (sz_t index) const
+// skips read-out blocks, decompressing the next ones when all are read
+bool kvr::compressed_istream::_ready ()
 {
-  value *v = (index < m_len) ? m_ptr [index] : NULL;
+  while ((m_cur < m_count) && (m_rpos == m_lens [m_cur]))
+  {
+    ++m_cur;
+    m_rpos = 0;
+  }
 
-  return v;
+  return (m_cur < m_count) || this->_fill ();
 }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::value::map
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::map::init (sz_t size, allocator *a)
+bool kvr::compressed_istream::_fill ()
 {
-  KVR_ASSERT (m_ptr == NULL);
-  KVR_ASSERT (a);
-  KVR_ASSERT (size > 0); //if (size == 0) { size = 1U; }
+  m_count = 0;
+  m_cur = 0;
+  m_rpos = 0;
 
-  sz_t allocsz = kvr::internal::align_size (size, CAP_INCR);
-  m_ptr = (node *) a->allocate (sizeof (node) * allocsz); KVR_ASSERT (m_ptr);
-  memset (m_ptr, 0, sizeof (node) * allocsz);
-  m_cap = allocsz;
-  m_len = 0;
-}
+  if (m_end || m_failed)
+  {
+    return false;
+  }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
+  const size_t tasksz = sizeof (kvr_lz_task) * m_nthreads;
+  kvr_lz_task *tasks = (kvr_lz_task *) m_alloc->allocate (tasksz);
 
-void kvr::value::map::deinit (allocator *a)
-{
-  KVR_ASSERT (a);
+  if (!tasks)
+  {
+    m_failed = true;
+    return false;
+  }
 
-#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
-  sz_t cap = _cap ();
-#else
-  sz_t cap = m_cap;
-#endif
-  a->deallocate (m_ptr, sizeof (node) * cap);
-  m_ptr = NULL;
+  size_t count = 0;
+  for (; count < m_nthreads; ++count)
+  {
+    uint32_t rawsz = 0, packedsz = 0, sum = 0;
+    const uint8_t *packed = NULL;
+    if (!this->_next (&rawsz, &packedsz, &sum, &packed, count))
+    {
+      break;
+    }
+
+    kvr_lz_task &task = tasks [count];
+    task.src = packed;
+    task.srcsz = packedsz;
+    task.dest = m_raw + (count * m_blocksz);
+    task.destsz = rawsz;
+    task.table = NULL;
+    task.sum = sum;
+    task.ok = false;
+    m_lens [count] = rawsz;
+  }
+
+  if (!m_failed && (count > 0))
+  {
+    m_failed = !kvr_lz_run (kvr_lz_decompress_task, tasks, count, m_alloc);
+    m_count = m_failed ? 0 : count;
+  }
+
+  m_alloc->deallocate (tasks, tasksz);
+
+  return m_count > 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value::map::node *kvr::value::map::insert (key *k, value *v, allocator *a)
+// the next block's header and packed bytes ('slot' stages them from a stream). 
+// false at the end block (m_end) or on damage (m_failed)
+bool kvr::compressed_istream::_next (uint32_t *rawsz, uint32_t *packedsz, uint32_t *sum, const uint8_t **packed, size_t slot)
 {
-  KVR_ASSERT (k);
-  KVR_ASSERT (v);
-  KVR_ASSERT (a);
-  KVR_ASSERT (m_ptr);
+  namespace lz = kvr::internal::lz;
 
-#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
+  uint8_t header [lz::BLOCK_HEADER_SIZE];
+  uint64_t offset = m_offset;
 
-  sz_t cap = _cap ();
-  // first, see if we can garbage-collect removed nodes
-  if ((m_len >= cap) && ((m_cap % CAP_INCR) != 0))
+  if (m_src)
   {
-    sz_t ir = 0, iw = 0;
-    while (ir < cap)
+    if (!m_src->read (header, sizeof (header)))
     {
-      if (m_ptr [ir].k)
-      {
-        m_ptr [iw++] = m_ptr [ir++];
-      }
-      else
-      {
-        ir++;
-      }
+      m_failed = true;
+      return false;
     }
-    m_len -= (ir - iw);
-    m_cap += (ir - iw);
-    KVR_ASSERT (m_len < cap);
-  }
-
-  // check again
-  if (m_len >= cap)
-  {
-    // resize
-    sz_t new_cap = cap + CAP_INCR;
-    node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
-    memcpy (new_ptr, m_ptr, sizeof (node) * cap);
-    memset (new_ptr + cap, 0, (sizeof (node) * CAP_INCR));
-    a->deallocate (m_ptr, sizeof (node) * cap);
-
-    m_ptr = new_ptr;
-    m_cap += CAP_INCR;
-    KVR_ASSERT (new_cap >= m_cap);
   }
-#else
-
-#if KVR_INTERNAL_FLAG_REALLOC_TYPE_FIXED
-
-  if (m_len >= m_cap)
+  else
   {
-    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - CAP_INCR));
-    KVR_ASSERT (m_ptr);
-
-    // first, see if we can garbage-collect removed nodes
-    sz_t ir = 0, iw = 0;
-    while (ir < m_cap)
+    if (m_block == m_nblocks)
     {
-      if (m_ptr [ir].k)
-      {
-        m_ptr [iw++] = m_ptr [ir++];
-      }
-      else
-      {
-        ir++;
-      }
+      m_end = true;
+      return false;
     }
-    m_len -= (ir - iw);
 
-    // now check again and if resize if necessary
-    if (m_len >= m_cap)
+    offset = lz::get_u64 (m_index + (m_block++ * 8));
+    if ((offset < lz::FRAME_HEADER_SIZE) || (offset > m_size) || ((m_size - offset) < lz::BLOCK_HEADER_SIZE))
     {
-      // resize
-      sz_t new_cap = m_cap + CAP_INCR;
-      node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
-      // copy over old nodes and set new nodes to null
-      memcpy (new_ptr, m_ptr, sizeof (node) * m_cap);      
-      memset (new_ptr + m_cap, 0, (sizeof (node) * CAP_INCR));
-      a->deallocate (m_ptr, sizeof (node) * m_cap);
-
-      m_ptr = new_ptr;
-      m_cap = new_cap;
+      m_failed = true;
+      return false;
     }
+    memcpy (header, m_data + offset, sizeof (header));
+  }
+
+  *rawsz = lz::get_u32 (header);
+  *packedsz = lz::get_u32 (header + 4);
+  *sum = lz::get_u32 (header + 8);
+
+  if (m_src && (*rawsz == 0))
+  {
+    m_failed = !this->_end (*packedsz, *sum);
+    m_end = !m_failed;
+    return false;
   }
-#else
-  if (m_len >= m_cap)
+
+  if ((*rawsz == 0) || (*rawsz > m_blocksz) || (*packedsz > *rawsz))
   {
-    KVR_ASSERT ((uint64_t) m_len < (SZ_T_MAX - m_cap));
-    KVR_ASSERT (m_ptr);
+    m_failed = true;
+    return false;
+  }
 
-    // first, see if we can garbage-collect removed nodes
-    sz_t ir = 0, iw = 0;
-    while (ir < m_cap)
+  if (m_src)
+  {
+    uint8_t *staged = m_packed + (slot * m_blocksz);
+    if (!m_src->read (staged, *packedsz))
     {
-      if (m_ptr [ir].k)
-      {
-        m_ptr [iw++] = m_ptr [ir++];
-      }
-      else
-      {
-        ir++;
-      }
+      m_failed = true;
+      return false;
     }
-    m_len -= (ir - iw);
+    *packed = staged;
 
-    // now check again and if resize if necessary
-    if (m_len >= m_cap)
+    uint8_t entry [8];
+    lz::set_u64 (entry, offset);
+    m_offsets.write (entry, sizeof (entry));
+    m_offset += lz::BLOCK_HEADER_SIZE + *packedsz;
+  }
+  else
+  {
+    if (*packedsz > (m_size - offset - lz::BLOCK_HEADER_SIZE))
     {
-      // resize
-      sz_t new_cap = m_cap + m_cap;
-      node *new_ptr = (node *) a->allocate (sizeof (node) * new_cap); KVR_ASSERT (new_ptr);
-      // copy over old nodes and set new nodes to null
-      memcpy (new_ptr, m_ptr, sizeof (node) * m_cap);
-      memset (new_ptr + m_cap, 0, (sizeof (node) * m_cap));
-      a->deallocate (m_ptr, sizeof (node) * m_cap);
-
-      m_ptr = new_ptr;
-      m_cap = new_cap;
+      m_failed = true;
+      return false;
     }
+    *packed = m_data + offset + lz::BLOCK_HEADER_SIZE;
   }
-#endif
-
-#endif
-  node *n = &m_ptr [m_len++];
-  n->k = k;
-  n->v = v;
 
-  return n;
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::value::map::remove (node *n)
+// streams: the index must list the blocks read, and the footer point at the end block
+bool kvr::compressed_istream::_end (uint32_t indexsz, uint32_t sum)
 {
-  KVR_ASSERT (n);
-  KVR_ASSERT (n->k);
-  KVR_ASSERT (n->v);
-  
-  if (m_len > 0)
+  namespace lz = kvr::internal::lz;
+
+  const uint8_t *expect = m_offsets.buffer ();
+  if ((indexsz != m_offsets.tell ()) || (kvr::internal::adler32 (expect, indexsz) != sum))
   {
-    n->k = NULL;
-    n->v = NULL;
-#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
-    --m_cap;
-#endif
+    return false;
   }
+
+  uint8_t chunk [256];
+  for (size_t i = 0; i < indexsz; i += sizeof (chunk))
+  {
+    size_t n = kvr::internal::min (sizeof (chunk), indexsz - i);
+    if (!m_src->read (chunk, n) || (memcmp (chunk, expect + i, n) != 0))
+    {
+      return false;
+    }
+  }
+
+  uint8_t footer [lz::FOOTER_SIZE];
+  return m_src->read (footer, sizeof (footer)) && (lz::get_u64 (footer) == m_offset) && (memcmp (footer + 8, lz::FRAME_MAGIC, 4) == 0);
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::mmap_istream
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value::map::node *kvr::value::map::find (const key *k) const
+kvr::mmap_istream::mmap_istream (const char *path, allocator *alloc) : m_data (NULL), m_size (0), m_stream (NULL), m_open (false)
 {
-  KVR_ASSERT (k);
+  KVR_ASSERT (path);
 
-#if KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE
-  sz_t cap = _cap ();
-#else
-  sz_t cap = m_cap;
-#endif
+  m_alloc = alloc ? alloc : get_default_allocator ();
 
-#if KVR_FLAG_ALLOW_DUPLICATE_MAP_KEYS // search from end (last inserted is active)
-  for (sz_t c = cap; c >= 1; --c)
+  // the view holds the file open; the handles are closed as soon as it is made
+#if defined (_WIN32)
+  HANDLE file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
   {
-    sz_t i = c - 1;
+    return;
+  }
+
+  LARGE_INTEGER size;
+  if (GetFileSizeEx (file, &size) && ((uint64_t) size.QuadPart <= (uint64_t) ((size_t) -1)))
+  {
+    m_size = (size_t) size.QuadPart;
+    m_open = true;
+
+    if (m_size > 0)
+    {
+      HANDLE mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+      m_data = mapping ? (const uint8_t *) MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+      m_open = (m_data != NULL);
+      if (mapping) { CloseHandle (mapping); }
+    }
+  }
+
+  CloseHandle (file);
 #else
-  for (sz_t i = 0, c = cap; i < c; ++i)
+  int fd = ::open (path, O_RDONLY);
+  if (fd < 0)
   {
-#endif
-    node *n = &m_ptr [i];
-    if (n->k == k)
+    return;
+  }
+
+  struct stat st;
+  if ((fstat (fd, &st) == 0) && ((uint64_t) st.st_size <= (uint64_t) ((size_t) -1)))
+  {
+    m_size = (size_t) st.st_size;
+    m_open = true;
+
+    if (m_size > 0)
     {
-      KVR_ASSERT (n->v);
-      return n;
+      void *p = mmap (NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      m_data = (p != MAP_FAILED) ? (const uint8_t *) p : NULL;
+      m_open = (m_data != NULL);
+      if (m_data) { posix_madvise (p, m_size, POSIX_MADV_SEQUENTIAL); }
     }
   }
 
-  return NULL;
+  ::close (fd);
+#endif
+
+  if (!m_open)
+  {
+    m_size = 0;
+  }
+  else if (m_data)
+  {
+    void *p = m_alloc->allocate (sizeof (mem_istream));
+    m_stream = p ? (new (p) mem_istream (m_data, m_size)) : NULL;
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::sz_t kvr::value::map::size_l () const // size in linear time
+kvr::mmap_istream::~mmap_istream ()
 {
-  sz_t size = 0;
-  sz_t i = 0;
-
-  while (i < m_len)
+  if (m_stream)
   {
-    if (m_ptr [i].k)
-    {
-      KVR_ASSERT (m_ptr [i].v);
-      ++size;
-    }
-    ++i;
+    m_stream->~mem_istream ();
+    m_alloc->deallocate (m_stream, sizeof (mem_istream));
   }
 
-  return size;
+  if (m_data)
+  {
+#if defined (_WIN32)
+    UnmapViewOfFile (m_data);
+#else
+    munmap (const_cast<uint8_t *> (m_data), m_size);
+#endif
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::sz_t kvr::value::map::size_c () const // size in constant time
+bool kvr::mmap_istream::is_open () const
 {
-  sz_t size = m_cap - (_cap () - m_len);
-  return size;
+  return m_open;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::sz_t kvr::value::map::_cap () const
+const uint8_t * kvr::mmap_istream::data () const
 {
-  // for experimental constant time map size calculator
-  // only called if #define KVR_INTERNAL_FLAG_EXPERIMENTAL_FAST_MAP_SIZE is enabled
+  return m_data;
+}
 
-  sz_t capa = 0;
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-  // (m_cap >= m_len) otherwise (m_cap % CAP_INCR) == 0) might not be correct 
-  // i.e might be less than actual capacity e.g. if m_cap is decremented to multiple of CAP_INCR
+size_t kvr::mmap_istream::size () const
+{
+  return m_size;
+}
 
-  if ((m_cap >= m_len) && ((m_cap % CAP_INCR) == 0))
-  {
-    capa = m_cap;
-  }
-  else if (m_len)
-  {
-    capa = kvr::internal::align_size (m_len, CAP_INCR);
-  }
-  else
-  {
-    capa = m_cap;
-  }
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-  return capa;
+kvr::mem_istream * kvr::mmap_istream::stream ()
+{
+  return m_stream;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::value::cursor
+// kvr::mmap_ostream
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::value::cursor::cursor (const value *map) : m_map (map), m_index (0)
+kvr::mmap_ostream::mmap_ostream (const char *path, size_t extent) : m_file (-1), m_data (NULL), m_size (0), m_pos (0), m_extent (extent), m_failed (false)
 {
-  KVR_ASSERT (map);
-  KVR_ASSERT (map->is_map ());
+  KVR_ASSERT (path);
+  KVR_ASSERT (extent > 0);
+
+#if defined (_WIN32)
+  HANDLE file = CreateFileA (path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  m_file = (intptr_t) file;
+#else
+  m_file = (intptr_t) ::open (path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+#endif
+
+  m_failed = (m_file == -1);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool kvr::value::cursor::get (pair *p)
+kvr::mmap_ostream::~mmap_ostream ()
 {
-  KVR_ASSERT (p);
-  const map::node *n = this->_get ();
-  if (p && n)
+  this->close ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mmap_ostream::put (uint8_t byte)
+{
+  if ((m_pos < m_size) || this->_reserve (m_pos + 1))
   {
-    KVR_ASSERT (n->k && n->v);
-    p->m_k = n->k;
-    p->m_v = n->v;
-    return true;
+    m_data [m_pos++] = byte;
   }
-  return false;
 }
 
-
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const kvr::value::map::node * kvr::value::cursor::_get ()
+void kvr::mmap_ostream::write (uint8_t *bytes, size_t count)
 {
-  const map::node *n = NULL;
+  uint8_t *dest = this->push (count);
+  if (dest)
+  {
+    memcpy (dest, bytes, count);
+  }
+}
 
-  if (m_map && m_map->is_map ())
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvr::mmap_ostream::flush ()
+{
+  if (m_data && (m_pos > 0))
   {
-    const map *m = &m_map->m_data.m;
+#if defined (_WIN32)
+    FlushViewOfFile (m_data, m_pos);
+#else
+    msync (m_data, m_pos, MS_ASYNC);
+#endif
+  }
+}
 
-    n = (m_index < m->m_len) ? &m->m_ptr [m_index++] : NULL;
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
 
-    while (n && !n->k)
-    {
-      KVR_ASSERT (!n->v);
-      n = (m_index < m->m_len) ? &m->m_ptr [m_index++] : NULL;
-    }
+uint8_t * kvr::mmap_ostream::push (size_t count)
+{
+  if (((m_pos + count) > m_size) && !this->_reserve (m_pos + count))
+  {
+    return NULL;
   }
 
-  return n;
+  uint8_t *dest = m_data + m_pos;
+  m_pos += count;
+  return dest;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::value::mem_ostream
+
+void kvr::mmap_ostream::pop (size_t count)
+{
+  KVR_ASSERT (count <= m_pos);
+  m_pos -= count;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const size_t kvr::mem_ostream::MIN_BUF_SZ = 64u;
+size_t kvr::mmap_ostream::tell () const
+{
+  return m_pos;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::mem_ostream::mem_ostream (uint8_t *buf, size_t sz, allocator *alloc) : m_buf (buf), m_sz (sz), m_pos (0), m_btype (BUF_EXTERNAL)
+bool kvr::mmap_ostream::close ()
 {
-  KVR_ASSERT (m_buf);
-  KVR_ASSERT (m_sz > 0);
+  if (m_file == -1)
+  {
+    return !m_failed;
+  }
 
-  m_alloc = alloc ? alloc : get_default_allocator ();
+  this->_unmap ();
+
+  // drop the unwritten tail of the last extent
+#if defined (_WIN32)
+  HANDLE file = (HANDLE) m_file;
+  LARGE_INTEGER size;
+  size.QuadPart = (LONGLONG) m_pos;
+  if (!SetFilePointerEx (file, size, NULL, FILE_BEGIN) || !SetEndOfFile (file))
+  {
+    m_failed = true;
+  }
+  CloseHandle (file);
+#else
+  int fd = (int) m_file;
+  if (ftruncate (fd, (off_t) m_pos) != 0)
+  {
+    m_failed = true;
+  }
+  ::close (fd);
+#endif
+
+  m_file = -1;
+
+  return !m_failed;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::mem_ostream::mem_ostream (size_t sz, allocator *alloc) : m_buf (NULL), m_sz (0), m_pos (0), m_btype (BUF_INTERNAL)
+bool kvr::mmap_ostream::is_open () const
 {
-  m_alloc = alloc ? alloc : get_default_allocator ();
-  m_sz = kvr::internal::max (MIN_BUF_SZ, sz);
-  m_buf = (uint8_t *) m_alloc->allocate (m_sz); KVR_ASSERT (m_buf);
+  return m_file != -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool kvr::mmap_ostream::failed () const
+{
+  return m_failed;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-kvr::mem_ostream::~mem_ostream ()
-{
-  if (m_btype == BUF_INTERNAL) { m_alloc->deallocate (m_buf, m_sz); }  
+// grows the file to hold 'sz' bytes, a whole number of extents, and maps it again
+bool kvr::mmap_ostream::_reserve (size_t sz)
+{
+  if (m_failed || (m_file == -1))
+  {
+    return false;
+  }
+
+  size_t size = m_size + m_extent;
+  if (size < sz)
+  {
+    size = sz + (m_extent - (sz % m_extent)) % m_extent;
+  }
+
+  this->_unmap ();
+
+#if defined (_WIN32)
+  // the mapping extends the file
+  HANDLE mapping = CreateFileMappingA ((HANDLE) m_file, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+  m_data = mapping ? (uint8_t *) MapViewOfFile (mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+  if (mapping) { CloseHandle (mapping); }
+#else
+  if (ftruncate ((int) m_file, (off_t) size) == 0)
+  {
+    void *p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, (int) m_file, 0);
+    m_data = (p != MAP_FAILED) ? (uint8_t *) p : NULL;
+  }
+#endif
+
+  if (!m_data)
+  {
+    m_failed = true;
+    return false;
+  }
+
+  m_size = size;
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::mem_ostream::put (uint8_t byte)
+void kvr::mmap_ostream::_unmap ()
 {
-  if (m_pos >= m_sz)
+  if (m_data)
   {
-    size_t sz = m_sz + m_sz;
-    this->reserve (sz);
+#if defined (_WIN32)
+    UnmapViewOfFile (m_data);
+#else
+    munmap (m_data, m_size);
+#endif
+    m_data = NULL;
+    m_size = 0;
   }
-  m_buf [m_pos++] = byte;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
-
-void kvr::mem_ostream::write (uint8_t *bytes, size_t count)
-{  
-  size_t desired_sz = m_pos + count;
-  if (desired_sz > m_sz)
-  {
-    size_t sz = m_sz;
-    do { sz += m_sz; } while (sz < desired_sz);
-    this->reserve (sz);
-  }
-  memcpy (&m_buf [m_pos], bytes, count);
-  m_pos += count;
-}
-
+// kvr::sync_policy
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-uint8_t * kvr::mem_ostream::push (size_t count)
+bool kvr::sync_policy::sync_on_write (uint64_t written, uint64_t unsynced)
 {
-  size_t desired_sz = m_pos + count;
-  if (desired_sz > m_sz)
-  {
-    size_t sz = m_sz;
-    do { sz += m_sz; } while (sz < desired_sz);
-    this->reserve (sz);
-  }
-
-  uint8_t *ret = &m_buf [m_pos];
-  m_pos += count;
-  return ret;
+  (void) written;
+  (void) unsynced;
+  return false;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-uint8_t * kvr::mem_ostream::pop (size_t count)
+bool kvr::sync_policy::sync_on_flush (uint64_t written)
 {
-  if (m_pos >= count)
-  {
-    m_pos -= count;
-    uint8_t *ret = &m_buf [m_pos];
-    return ret;
-  }
-  return NULL;
+  (void) written;
+  return false;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const uint8_t * kvr::mem_ostream::buffer () const
+bool kvr::sync_policy::sync_on_close (uint64_t written)
 {
-  return m_buf;
+  (void) written;
+  return false;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// kvr::async_file_ostream
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t kvr::mem_ostream::size () const
+static intptr_t kvr_file_create (const char *path)
 {
-  return m_sz;
+#if defined (_WIN32)
+  HANDLE file = CreateFileA (path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  return (intptr_t) file;
+#else
+  return (intptr_t) ::open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t kvr::mem_ostream::tell () const
+static bool kvr_file_write (intptr_t file, const uint8_t *bytes, size_t count)
 {
-  return m_pos;
+  while (count > 0)
+  {
+#if defined (_WIN32)
+    DWORD n = 0;
+    DWORD chunk = (DWORD) kvr::internal::min (count, (size_t) (1u << 30));
+    if (!WriteFile ((HANDLE) file, bytes, chunk, &n, NULL) || (n == 0))
+    {
+      return false;
+    }
+#else
+    ssize_t n = ::write ((int) file, bytes, count);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+#endif
+    bytes += n;
+    count -= (size_t) n;
+  }
+
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::mem_ostream::seek (size_t pos)
+static bool kvr_file_sync (intptr_t file)
 {
-  m_pos = pos;
+#if defined (_WIN32)
+  return FlushFileBuffers ((HANDLE) file) != 0;
+#else
+  return fsync ((int) file) == 0;
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::mem_ostream::flush ()
+static bool kvr_file_close (intptr_t file)
 {
-  // EOS == 0
-  KVR_ASSERT_SAFE ((m_pos < m_sz), (void) 0);
-  m_buf [m_pos] = 0;
+#if defined (_WIN32)
+  return CloseHandle ((HANDLE) file) != 0;
+#else
+  return ::close ((int) file) == 0;
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::mem_ostream::reserve (size_t sz)
+// the buffer ring behind an async_file_ostream. filled buffers are queued from m_head, in
+// order, and the one after the queue is being filled, so at most nbufs - 1 wait to be written
+class kvr::internal::async_writer
 {
-  if (sz > m_sz)
+public:
+
+  async_writer (intptr_t file, size_t bufsz, size_t nbufs, sync_policy *sync, allocator *alloc)
+    : m_file (file), m_sync (sync), m_alloc (alloc), m_bufs (NULL), m_slots (NULL), m_bufsz (bufsz), m_nbufs (nbufs),
+      m_head (0), m_count (0), m_written (0), m_synced (0), m_stop (false), m_failed (false), m_async (false)
   {
-    uint8_t *buf = (uint8_t *) m_alloc->allocate (sz); KVR_ASSERT (buf);
+    m_bufs = (uint8_t *) m_alloc->allocate (m_bufsz * m_nbufs);
+    m_slots = (slot *) m_alloc->allocate (sizeof (slot) * m_nbufs);
 
-    if (m_buf)
+    if (!m_bufs || !m_slots)
     {
-      memcpy (buf, m_buf, m_sz);
-      if (m_btype == BUF_INTERNAL) { m_alloc->deallocate (m_buf, m_sz); }
+      m_failed = true;
     }
+  }
 
-    m_buf = buf;
-    m_sz = sz;
-    m_btype = BUF_INTERNAL;
+  ////////////////////////////////////////////////////////////
+
+  ~async_writer ()
+  {
+    if (m_bufs) { m_alloc->deallocate (m_bufs, m_bufsz * m_nbufs); }
+    if (m_slots) { m_alloc->deallocate (m_slots, sizeof (slot) * m_nbufs); }
   }
-}
 
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-// kvr::mem_istream
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////
+  ////////////////////////////////////////////////////////////
 
-kvr::mem_istream::mem_istream (const uint8_t *buf, size_t sz) : m_buf (buf), m_sz (sz), m_pos (0)
-{
-  KVR_ASSERT (m_buf);
-  KVR_ASSERT (m_sz > 0);
-}
+  // the first buffer to fill (NULL if out of memory)
+  uint8_t * start ()
+  {
+    if (m_failed)
+    {
+      return NULL;
+    }
+
+    // no thread: buffers are written as they are handed over
+    m_async = m_thread.start (&async_writer::_run, this);
+
+    return m_bufs;
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  // hands over the buffer being filled and returns the next one, once it is free
+  uint8_t * submit (size_t size, bool flush)
+  {
+    m_lock.lock ();
+
+    size_t cur = (m_head + m_count) % m_nbufs;
+    m_slots [cur].size = size;
+    m_slots [cur].flush = flush;
+    ++m_count;
+
+    if (m_async)
+    {
+      m_filled.signal ();
+
+      while (m_count == m_nbufs)
+      {
+        m_freed.wait (&m_lock);
+      }
+    }
+    else
+    {
+      this->_write (cur);
+      m_head = (m_head + 1) % m_nbufs;
+      --m_count;
+    }
+
+    uint8_t *next = m_bufs + (((m_head + m_count) % m_nbufs) * m_bufsz);
+
+    m_lock.unlock ();
+
+    return next;
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  // waits for the queue to be written, then syncs and closes the file
+  bool finish ()
+  {
+    if (m_async)
+    {
+      m_lock.lock ();
+      m_stop = true;
+      m_filled.signal ();
+      m_lock.unlock ();
+
+      m_thread.join ();
+      m_async = false;
+    }
+
+    bool ok = !m_failed;
+
+    if (ok && m_sync && m_sync->sync_on_close (m_written))
+    {
+      ok = kvr_file_sync (m_file);
+    }
+
+    ok = kvr_file_close (m_file) && ok;
+
+    return ok;
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  bool failed ()
+  {
+    m_lock.lock ();
+    bool failed = m_failed;
+    m_lock.unlock ();
+    return failed;
+  }
+
+private:
+
+  async_writer (const async_writer &);
+  async_writer &operator=(const async_writer &);
+
+  struct slot
+  {
+    size_t  size;
+    bool    flush;
+  };
+
+  ////////////////////////////////////////////////////////////
+
+  static void _run (void *self)
+  {
+    async_writer *w = (async_writer *) self;
+
+    w->m_lock.lock ();
+
+    for (;;)
+    {
+      while ((w->m_count == 0) && !w->m_stop)
+      {
+        w->m_filled.wait (&w->m_lock);
+      }
+
+      if (w->m_count == 0)
+      {
+        break;
+      }
+
+      size_t head = w->m_head;
+
+      w->m_lock.unlock ();
+      bool ok = w->_write (head);
+      w->m_lock.lock ();
+
+      w->m_failed = w->m_failed || !ok;
+      w->m_head = (w->m_head + 1) % w->m_nbufs;
+      --w->m_count;
+
+      w->m_freed.signal ();
+    }
+
+    w->m_lock.unlock ();
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  // only the writing thread changes m_failed, m_written and m_synced while it runs
+  bool _write (size_t index)
+  {
+    if (m_failed)
+    {
+      return false;
+    }
+
+    const slot &s = m_slots [index];
+
+    bool ok = kvr_file_write (m_file, m_bufs + (index * m_bufsz), s.size);
+    m_written += s.size;
+
+    if (ok && m_sync)
+    {
+      bool sync = m_sync->sync_on_write (m_written, m_written - m_synced);
+      if (s.flush)
+      {
+        sync = m_sync->sync_on_flush (m_written) || sync;
+      }
+
+      if (sync)
+      {
+        ok = kvr_file_sync (m_file);
+        m_synced = m_written;
+      }
+    }
+
+    if (!m_async)
+    {
+      m_failed = m_failed || !ok;
+    }
+
+    return ok;
+  }
+
+  ////////////////////////////////////////////////////////////
+
+  intptr_t      m_file;
+  sync_policy * m_sync;
+  allocator *   m_alloc;
+  uint8_t *     m_bufs;
+  slot *        m_slots;
+  size_t        m_bufsz;
+  size_t        m_nbufs;
+  size_t        m_head;
+  size_t        m_count;
+  uint64_t      m_written;
+  uint64_t      m_synced;
+  bool          m_stop;
+  bool          m_failed;
+  bool          m_async;
+  thread        m_thread;
+  mutex         m_lock;
+  condition     m_filled;
+  condition     m_freed;
+};
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const uint8_t * kvr::mem_istream::buffer () const
+kvr::async_file_ostream::async_file_ostream (const char *path, size_t bufsz, size_t nbufs, sync_policy *sync, allocator *alloc)
+  : m_writer (NULL), m_buf (NULL), m_pos (0), m_bufsz (bufsz), m_failed (false)
 {
-  return m_buf;
+  KVR_ASSERT (path);
+  KVR_ASSERT (bufsz > 0);
+  KVR_ASSERT (nbufs >= 2);
+
+  m_alloc = alloc ? alloc : get_default_allocator ();
+
+  intptr_t file = kvr_file_create (path);
+  if (file != -1)
+  {
+    void *p = m_alloc->allocate (sizeof (internal::async_writer));
+    m_writer = p ? (new (p) internal::async_writer (file, bufsz, nbufs, sync, m_alloc)) : NULL;
+    m_buf = m_writer ? m_writer->start () : NULL;
+
+    if (!m_writer)
+    {
+      kvr_file_close (file);
+    }
+    else if (!m_buf)
+    {
+      // no buffers: release the writer (and its file) so the stream reads as unopened
+      m_writer->finish ();
+      m_writer->~async_writer ();
+      m_alloc->deallocate (m_writer, sizeof (internal::async_writer));
+      m_writer = NULL;
+    }
+  }
+
+  m_failed = (m_buf == NULL);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t kvr::mem_istream::size () const
+kvr::async_file_ostream::~async_file_ostream ()
 {
-  return m_sz;
+  this->close ();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t kvr::mem_istream::tell ()
+void kvr::async_file_ostream::put (uint8_t byte)
 {
-  return m_pos;
+  if (m_pos == m_bufsz)
+  {
+    this->_submit (false);
+  }
+
+  if (m_buf)
+  {
+    m_buf [m_pos++] = byte;
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-uint8_t kvr::mem_istream::peek ()
+void kvr::async_file_ostream::write (uint8_t *bytes, size_t count)
 {
-  return m_buf [m_pos];
+  while ((count > 0) && m_buf)
+  {
+    if (m_pos == m_bufsz)
+    {
+      this->_submit (false);
+    }
+
+    size_t n = kvr::internal::min (count, m_bufsz - m_pos);
+    memcpy (m_buf + m_pos, bytes, n);
+    m_pos += n;
+    bytes += n;
+    count -= n;
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-void kvr::mem_istream::seek (size_t pos)
+void kvr::async_file_ostream::flush ()
 {
-  m_pos = pos;
+  if (m_pos > 0)
+  {
+    this->_submit (true);
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool kvr::mem_istream::get (uint8_t *byte)
+bool kvr::async_file_ostream::close ()
 {
-  if (m_pos < m_sz)
+  if (m_writer)
   {
-    *byte = m_buf [m_pos++];
-    return true;
+    if (m_buf && (m_pos > 0))
+    {
+      this->_submit (false);
+    }
+
+    m_failed = !m_writer->finish () || m_failed;
+
+    m_writer->~async_writer ();
+    m_alloc->deallocate (m_writer, sizeof (internal::async_writer));
+    m_writer = NULL;
+    m_buf = NULL;
+    m_pos = 0;
   }
-  return false;
+
+  return !m_failed;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool kvr::mem_istream::read (uint8_t *bytes, size_t count)
+bool kvr::async_file_ostream::is_open () const
 {
-  if ((m_pos + count) <= m_sz)
-  {
-    memcpy (bytes, &m_buf [m_pos], count);
-    m_pos += count;
-    return true;
-  }
-  return false;
+  return m_writer != NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const uint8_t * kvr::mem_istream::push (size_t count)
+bool kvr::async_file_ostream::failed () const
 {
-  if ((m_pos + count) <= m_sz)
-  {
-    const uint8_t *start = &m_buf [m_pos];
-    m_pos += count;
-    return start;
-  }
-  return NULL;
+  return m_failed || (m_writer && m_writer->failed ());
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-const uint8_t * kvr::mem_istream::pop (size_t count)
+void kvr::async_file_ostream::_submit (bool flush)
 {
-  if (m_pos >= count)
+  if (m_writer)
   {
-    m_pos -= count;
-    const uint8_t *ret = &m_buf [m_pos];
-    return ret;
+    m_buf = m_writer->submit (m_pos, flush);
+    m_pos = 0;
   }
-  return NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +92,16 @@
 #define KVR_CONSTANT_DIFF_FP_EQ_EPSILON                 (1.0e-7)
 // memory (re)allocation element size for map & array
 #define KVR_CONSTANT_COMMON_BLOCK_SZ                    (8u)
+// read-ahead block size for decoding from custom input streams
+#define KVR_CONSTANT_ISTREAM_BLOCK_SZ                   (4096u)
+// write-combining block size for encoding to custom output streams
+#define KVR_CONSTANT_OSTREAM_BLOCK_SZ                   (4096u)
+// trees with fewer nodes skip the exact size pre-pass when encoding to an obuffer
+#define KVR_CONSTANT_ENCODE_PREPASS_MIN_NODES           (64u)
+// trees with fewer nodes are encoded on the calling thread by value::encode_parallel
+#define KVR_CONSTANT_ENCODE_PARALLEL_MIN_NODES          (4096u)
+// default chunk size for chunk_obuffer
+#define KVR_CONSTANT_CHUNK_OBUFFER_SZ                   (65536u)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -132,6 +142,25 @@ namespace kvr
     CODEC_JSON,
     CODEC_MSGPACK,
     CODEC_CBOR,
+    CODEC_KVRB,   // mappable snapshot for kvr::view. whole-buffer encode/decode only
+  };
+
+  enum encode_flag_t
+  {
+    // binary codecs write each repeated key once and refer to it by index after that 
+    // (cbor: stringref tags 25/256, msgpack: KEY_TABLE/KEY_REF ext types). ignored by json
+    // and kvrb. decoded by value::decode and kvr::scan only.
+    ENCODE_KEY_TABLE = 0x1,
+    // cbor writes arrays of only integers or only floats as rfc 8746 typed arrays (tags 64-87),
+    // packed little-endian in the smallest element type that holds every value. decoded 
+    // (any typed array tag, either byte order) as plain arrays. ignored by the other codecs.
+    ENCODE_TYPED_ARRAYS = 0x2,
+    // binary codecs compress arrays of 8 or more values: monotonic integers as zigzag varint
+    // deltas, floats as xor'd bit streams (cbor: private tags 0x6b64/0x6b78 over a byte string, 
+    // msgpack: DELTA/XOR ext types). takes precedence over typed arrays. decoded as plain 
+    // arrays by every binary reader; kvr::view sees a packed array as one value, which 
+    // materialize expands but element/find can't index. ignored by json and kvrb.
+    ENCODE_NUMERIC_COLUMNS = 0x4,
   };
 
   /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -174,6 +203,10 @@ namespace kvr
     virtual bool    read (uint8_t *bytes, size_t count) = 0;
     virtual size_t  tell () = 0;
     virtual uint8_t peek () = 0;
+    // reads up to 'count' bytes and returns the number read (0 at end of stream).
+    // decoders read ahead in blocks with this. the default reads a single byte, 
+    // override it to let decoding run at memory speed.
+    virtual size_t  fetch (uint8_t *bytes, size_t count);
 
   protected:
     ~istream () {}
@@ -183,9 +216,72 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
+  // decode events for kvr::scan. return false from any event to stop scanning.
+  // strings and keys are only valid during the call and may not be null-terminated.
+  class handler
+  {
+  public:
+    virtual bool on_null ();
+    virtual bool on_boolean (bool b);
+    virtual bool on_integer (int64_t i);
+    virtual bool on_float (double f);
+    virtual bool on_string (const char *str, sz_t length);
+    virtual bool on_binary (const uint8_t *data, sz_t size);
+    virtual bool on_key (const char *str, sz_t length);
+    // 'size' and 'length' are 0 if the codec doesn't know them up front (json)
+    virtual bool on_map_start (sz_t size);
+    virtual bool on_map_end (sz_t size);
+    virtual bool on_array_start (sz_t length);
+    virtual bool on_array_end (sz_t length);
+
+  protected:
+    ~handler () {}
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // decode to handler events without building a value tree
+  bool scan (codec_t codec, const uint8_t *data, size_t size, handler *h);
+  bool scan (codec_t codec, istream &istr, handler *h);
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
   class ctx;
+  class value;
   class obuffer;
+  class chunk_obuffer;
   class pair;
+  class pull_encoder;
+  namespace internal { class stream_encoder; }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // converts between codecs by piping decode events straight into the target encoder, 
+  // without building a value tree. json to msgpack/cbor takes an extra pass over the 
+  // source for container sizes, except for the stream version to cbor, which writes 
+  // indefinite-length containers in one pass instead. the stream version to msgpack 
+  // buffers the whole source and output in memory (msgpack needs sizes up front).
+  bool transcode (codec_t from, const uint8_t *data, size_t size, codec_t to, obuffer *obuf);
+  bool transcode (codec_t from, istream &istr, codec_t to, ostream *ostr);
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // encodes many independent documents back to back into 'obuf' with one writer, rather than
+  // a call (and buffer reset) per document. json documents are each followed by a newline, 
+  // so a batch is also valid record_reader/parallel_decoder input. 'offsets' gets count + 1 
+  // entries: where each document starts, then the total size. 'nthreads' other than 1
+  // (0: one per core) shares the documents out to threads.
+  bool encode_batch (codec_t codec, const value * const *vals, size_t count, obuffer *obuf, size_t *offsets, size_t nthreads = 1);
+  // decodes the documents of an encode_batch into 'dests' (count entries)
+  bool decode_batch (codec_t codec, const uint8_t *data, const size_t *offsets, size_t count, value **dests);
 
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -231,6 +327,7 @@ namespace kvr
     bool          is_map () const;
     bool          is_array () const;
     bool          is_string () const;
+    bool          is_binary () const;
     bool          is_boolean () const;
     bool          is_integer () const;
     bool          is_float () const;
@@ -240,6 +337,7 @@ namespace kvr
     value *       conv_map (sz_t sz = 8);
     value *       conv_array (sz_t sz = 8);
     value *       conv_string ();
+    value *       conv_binary ();
     value *       conv_boolean ();
     value *       conv_integer ();
     value *       conv_float ();
@@ -251,6 +349,10 @@ namespace kvr
     const char *  get_string () const;
     const char *  get_string (sz_t *len) const;
 
+    // binary variant operations (byte string: cbor major type 2, msgpack bin, base64 in json)
+    void          set_binary (const uint8_t *data, sz_t size);
+    const uint8_t * get_binary (sz_t *size) const;
+
     // integer variant operations
     void          set_integer (int64_t n);
     int64_t       get_integer () const;
@@ -286,6 +388,10 @@ namespace kvr
     value *       insert_map (const char *key);
     value *       insert_array (const char *key);
     value *       insert_null (const char *key);
+    // by key handle (from pair::get_key or the overload below) of this value's ctx, 
+    // skipping the key hash and intern. decoders use it for repeated keys.
+    value *       insert_null (key *handle);
+    value *       insert_null (const char *key, kvr::key **handle);
     value *       find (const char *key) const;
     void          remove (const char *key);
     sz_t          size () const;
@@ -307,14 +413,39 @@ namespace kvr
 
     // serialization (buffer)
     bool          encode (codec_t codec, obuffer *obuf);
+    bool          encode (codec_t codec, chunk_obuffer *cbuf);
+    bool          encode (codec_t codec, obuffer *obuf, uint32_t flags); // encode_flag_t
     bool          decode (codec_t codec, const uint8_t *data, size_t size);
+    // decodes only the subtrees at 'paths' ('/' delimited map keys and array indices). 
+    // the rest of the document is skipped without being decoded. selected array 
+    // elements keep their order but not their index.
+    bool          decode (codec_t codec, const uint8_t *data, size_t size, const char **paths, sz_t pathsz);
+    // byte-identical to encode, on 'nthreads' threads (0: one per core). the first container
+    // on the way down from the root with enough items is split into ranges which are 
+    // encoded concurrently, then stitched under its header. the workers allocate their 
+    // buffers through the ctx allocator at the same time, so it must be thread-safe.
+    bool          encode_parallel (codec_t codec, obuffer *obuf, size_t nthreads = 0);
 
     // serialization (stream)
     bool          encode (codec_t codec, ostream *ostr);
+    bool          encode (codec_t codec, ostream *ostr, uint32_t flags); // encode_flag_t
     bool          decode (codec_t codec, istream &istr);
 
-    // serialization (estimate buffer size)
+    // decode over the current tree, reusing its storage where the document matches
+    // (keys, values, containers); allocates and frees only where the structure differs
+    bool          decode_update (codec_t codec, const uint8_t *data, size_t size);
+    bool          decode_update (codec_t codec, istream &istr);
+
+    // serialization (file). the file is mapped (see kvr::mmap_istream, kvr::mmap_ostream)
+    // and decoded or encoded in place, with no copy in between. encode_file sizes the file
+    // with encode_bound (with its flags) and trims it to the encoded size.
+    bool          decode_file (codec_t codec, const char *path);
+    bool          encode_file (codec_t codec, const char *path, uint32_t flags = 0); // encode_flag_t
+
+    // serialization (exact buffer size)
     size_t        encode_bound (codec_t codec) const;
+    // upper bound with encode_flag_t 'flags', which can encode larger than the plain codec
+    size_t        encode_bound (codec_t codec, uint32_t flags) const;
     
     // debug stderr output
     void          dump () const;
@@ -355,6 +486,22 @@ namespace kvr
     ///////////////////////////////////////////
     ///////////////////////////////////////////
 
+    struct binary
+    {
+      static const sz_t PAD = (KVR_CONSTANT_COMMON_BLOCK_SZ - 1);
+      uint8_t * m_data;
+      sz_t      m_size;
+      sz_t      m_len;
+
+      void set (const uint8_t *data, sz_t len, allocator *a);
+      void append (const uint8_t *data, sz_t len, allocator *a);
+      void cleanup (allocator *a);
+    };
+
+    ///////////////////////////////////////////
+    ///////////////////////////////////////////
+    ///////////////////////////////////////////
+
     union number
     {
       int64_t   i;
@@ -425,6 +572,10 @@ namespace kvr
 
     private:
 
+      // unbound, for kvr::pull_encoder's traversal stack
+      cursor () : m_map (NULL), m_index (0) {}
+      friend class kvr::pull_encoder;
+
       const map::node * _get ();
       const value * m_map;
       sz_t          m_index;
@@ -442,6 +593,7 @@ namespace kvr
       map       m;
       array     a;
       string    s;
+      binary    bin;
       bool      b;
     };
 
@@ -462,6 +614,7 @@ namespace kvr
       FLAG_PARENT_CTX           = (1 << 8),
       FLAG_PARENT_MAP           = (1 << 9),
       FLAG_PARENT_ARRAY         = (1 << 10),
+      FLAG_TYPE_BINARY          = (1 << 11),
     };
 
     ///////////////////////////////////////////
@@ -479,8 +632,14 @@ namespace kvr
                                value **lastparent = NULL) const;
     value * _search_key (const char *key) const;
 
-    uint8_t _type () const;
+    uint32_t _type () const;
     bool    _type_equiv (const value *other) const;
+    sz_t    _count (sz_t limit) const;
+
+    struct  segment;
+    static void _encode_segment (void *seg);
+    bool    _encode_stitch (internal::stream_encoder *enc, codec_t codec, const value * const *path, 
+                            size_t level, size_t depth, const segment *segs, size_t nsegs) const;
 
     void    _destruct ();
     void    _clear ();
@@ -721,6 +880,58 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
+  // thread-safe allocator that caches freed buffers in power-of-two size classes.
+  // also keeps a histogram of encoded sizes to pick initial obuffer sizes.
+  class buffer_pool : public allocator
+  {
+  public:
+
+    buffer_pool (size_t max_cached_per_class = 8u, allocator *alloc = NULL);
+    ~buffer_pool ();
+
+    static buffer_pool * global ();
+
+    void *  allocate (size_t sz);
+    void    deallocate (void *p, size_t sz);
+
+    // buffer size that fits ~90% of recorded encodes
+    size_t  suggest_size () const;
+    void    record (size_t sz);
+    // frees all cached buffers
+    void    trim ();
+
+  private:
+
+    buffer_pool (const buffer_pool &);
+    buffer_pool &operator=(const buffer_pool &);
+
+    struct block
+    {
+      block * next;
+    };
+
+    enum
+    {
+      NUM_CLASSES = 26, // 64 bytes to 2 GB
+      MIN_CLASS_SHIFT = 6,
+      MAX_HISTOGRAM_SAMPLES = 1024,
+    };
+
+    static size_t _class (size_t sz);
+
+    block *         m_free [NUM_CLASSES];
+    size_t          m_nfree [NUM_CLASSES];
+    uint32_t        m_hist [NUM_CLASSES];
+    uint32_t        m_nsamples;
+    size_t          m_max_cached;
+    allocator *     m_alloc;
+    mutable volatile long m_lock;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
   class obuffer
   {
   public:
@@ -729,19 +940,701 @@ namespace kvr
     // outputs to external 'data' buffer. if size is insufficient, 
     // an internal buffer will be created 
     obuffer (uint8_t *data, size_t size, allocator *alloc = NULL);    
+    // outputs to internal buffer borrowed from 'pool', sized from its history
+    explicit obuffer (buffer_pool *pool);
 
     const uint8_t * get_data () const;
     size_t          get_size () const;
 
   private:
 
-    mem_ostream m_stream;
+    mem_ostream   m_stream;
+    buffer_pool * m_pool;
+    friend class value;
+    friend class stream_writer;
+    friend bool transcode (codec_t, const uint8_t *, size_t, codec_t, obuffer *);
+    friend bool encode_batch (codec_t, const value * const *, size_t, obuffer *, size_t *, size_t);
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // chunk descriptor (same layout as posix struct iovec, for writev)
+  struct iovec
+  {
+    const uint8_t * base;
+    size_t          len;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // memory output stream made of a chain of fixed-size chunks. 
+  // bytes are never moved once written.
+  class chunk_ostream
+  {
+  public:
+
+    chunk_ostream (size_t chunksz, allocator *alloc = NULL);
+    ~chunk_ostream ();
+
+    void            put (uint8_t byte);
+    void            write (uint8_t *bytes, size_t count);
+    void            flush ();
+    size_t          tell () const;
+    void            reset ();
+    size_t          chunk_count () const;
+    size_t          chunks (iovec *vec, size_t count) const;
+    const uint8_t * flatten ();
+
+  private:
+
+    chunk_ostream (const chunk_ostream &);
+    chunk_ostream &operator=(const chunk_ostream &);
+
+    struct chunk
+    {
+      chunk   * next;
+      size_t    len;
+      size_t    cap;
+      uint8_t * data () { return reinterpret_cast<uint8_t *>(this + 1); }
+    };
+
+    chunk *     _append (size_t cap);
+    void        _release (chunk *c);
+
+    chunk *     m_head;
+    chunk *     m_tail;
+    size_t      m_chunksz;
+    size_t      m_count;
+    size_t      m_sz;
+    allocator * m_alloc;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  class chunk_obuffer
+  {
+  public:
+    // outputs to a chain of 'chunksz' byte chunks instead of one growing buffer
+    chunk_obuffer (size_t chunksz = KVR_CONSTANT_CHUNK_OBUFFER_SZ, allocator *alloc = NULL);
+
+    size_t          get_size () const;
+    size_t          get_chunk_count () const;
+    // fills up to 'count' chunk descriptors, returns number filled
+    size_t          get_chunks (iovec *vec, size_t count) const;
+    // merges chunks into one contiguous block (allocates if there is more than one)
+    const uint8_t * flatten ();
+
+  private:
+
+    chunk_ostream m_stream;
     friend class value;
   };
 
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // incremental encoder. emits a document piece by piece without building a value tree.
+  // container sizes are the number of pairs/elements that will follow; if not known, 
+  // pass UNKNOWN_SIZE (cbor writes an indefinite-length container, json doesn't need 
+  // sizes and msgpack fails). calls out of sequence fail and make every later call fail.
+  class stream_writer
+  {
+  public:
+
+    static const sz_t UNKNOWN_SIZE = (sz_t) -1;
+
+    stream_writer (codec_t codec, ostream *ostr, allocator *alloc = NULL);
+    stream_writer (codec_t codec, obuffer *obuf, allocator *alloc = NULL);
+    ~stream_writer ();
+
+    bool begin_map (sz_t size = UNKNOWN_SIZE);
+    bool end_map ();
+    bool begin_array (sz_t length = UNKNOWN_SIZE);
+    bool end_array ();
+    bool key (const char *str);
+    bool key (const char *str, sz_t length);
+    bool null ();
+    bool boolean (bool b);
+    bool int64 (int64_t i);
+    bool float64 (double f);
+    bool string (const char *str);
+    bool string (const char *str, sz_t length);
+    bool binary (const uint8_t *data, sz_t size);
+    bool write_value (const value *val);
+    // checks the document is complete and flushes buffered output
+    bool finish ();
+
+  private:
+
+    stream_writer (const stream_writer &);
+    stream_writer &operator=(const stream_writer &);
+
+    // lets the encoder write to an obuffer
+    class obuffer_ostream : public ostream
+    {
+    public:
+      void put (uint8_t byte);
+      void write (uint8_t *bytes, size_t count);
+      void flush ();
+
+      mem_ostream *m_stream;
+    };
+
+    struct level
+    {
+      sz_t size;
+      sz_t count;
+      bool map;
+    };
+
+    void _init (codec_t codec, ostream *ostr);
+    bool _item ();
+    bool _end (bool map);
+
+    internal::stream_encoder *  m_enc;
+    allocator *                 m_alloc;
+    size_t                      m_encsz;
+    obuffer_ostream             m_obuf;
+    level                       m_stack [KVR_CONSTANT_MAX_TREE_DEPTH];
+    sz_t                        m_depth;
+    bool                        m_key;
+    bool                        m_done;
+    bool                        m_ok;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  namespace internal { class push_parser; }
+
+  // push-style decoder for input that arrives in pieces (e.g. non-blocking sockets).
+  // msgpack and cbor are decoded as bytes arrive; only a token split between two 
+  // feeds is copied. json is collected until the root map or array closes.
+  class push_decoder
+  {
+  public:
+
+    enum status_t
+    {
+      STATUS_NEED_MORE,
+      STATUS_DONE,
+      STATUS_ERROR,
+    };
+
+    push_decoder (codec_t codec, value *dest, allocator *alloc = NULL);
+    ~push_decoder ();
+
+    // bytes past the end of the document are not consumed, 'used' returns how many were.
+    // once done (or failed), feed does nothing until reset.
+    status_t feed (const uint8_t *data, size_t size, size_t *used = NULL);
+    // starts over for the next document (dest is reset to null)
+    void     reset ();
+    // starts over for the next document, decoding into 'dest' instead
+    void     reset (value *dest);
+
+  private:
+
+    push_decoder (const push_decoder &);
+    push_decoder &operator=(const push_decoder &);
+
+    internal::push_parser * m_parser;
+    allocator *             m_alloc;
+    size_t                  m_parsersz;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // reads a stream of concatenated documents one record at a time: newline-delimited
+  // JSON (or any whitespace between records) and back-to-back msgpack/CBOR. input is 
+  // pulled in blocks, so memory is bounded by the largest record, not the stream.
+  // JSON records must be maps or arrays.
+  class record_reader
+  {
+  public:
+
+    record_reader (codec_t codec, istream *istr, allocator *alloc = NULL);
+    record_reader (codec_t codec, const uint8_t *data, size_t size, allocator *alloc = NULL);
+    ~record_reader ();
+
+    // decodes the next record into 'dest', replacing its contents. 
+    // returns false at the end of input, or if the record is malformed (see failed).
+    bool    next (value *dest);
+    // decodes up to 'count' records, one into each of 'dests'. returns how many were read.
+    size_t  next_batch (value **dests, size_t count);
+    // records read so far
+    size_t  count () const;
+    bool    failed () const;
+
+  private:
+
+    record_reader (const record_reader &);
+    record_reader &operator=(const record_reader &);
+
+    bool _fill ();
+
+    codec_t         m_codec;
+    istream *       m_istr;
+    allocator *     m_alloc;
+    push_decoder *  m_dec;
+    uint8_t *       m_block;
+    const uint8_t * m_data;
+    size_t          m_size;
+    size_t          m_pos;
+    size_t          m_count;
+    bool            m_failed;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // decodes a buffer of records (see record_reader) on several threads. record boundaries
+  // are found with a quick serial pass (newlines for JSON, so JSON records must be one per
+  // line), then each thread decodes an equal share of the records into its own ctx.
+  // records are kept in input order and owned by the decoder. 'alloc' must be thread-safe.
+  // KVRB is not a record format and is refused.
+  class parallel_decoder
+  {
+  public:
+
+    // 'nthreads' of 0 uses one thread per core
+    explicit parallel_decoder (size_t nthreads = 0, allocator *alloc = NULL);
+    ~parallel_decoder ();
+
+    // decodes every record in 'data', releasing those of the previous call
+    bool          decode (codec_t codec, const uint8_t *data, size_t size);
+    size_t        count () const;
+    const value * get (size_t index) const;
+    // copies the records, in order, into 'dest' as an array
+    bool          merge (value *dest) const;
+    // releases the records
+    void          clear ();
+
+  private:
+
+    parallel_decoder (const parallel_decoder &);
+    parallel_decoder &operator=(const parallel_decoder &);
+
+    bool _split (codec_t codec, const uint8_t *data, size_t size);
+    bool _reserve (size_t count);
+
+    allocator * m_alloc;
+    ctx **      m_ctxs;
+    size_t      m_nthreads;
+    value **    m_records;
+    size_t *    m_offsets;
+    size_t      m_count;
+    size_t      m_capacity;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // pull-style encoder for sinks that take output in pieces (e.g. non-blocking sockets).
+  // the tree is walked with an explicit stack, a little at a time, so any number of 
+  // large documents can be interleaved. 'src' must not change until done.
+  class pull_encoder
+  {
+  public:
+
+    pull_encoder (codec_t codec, const value *src, allocator *alloc = NULL);
+    ~pull_encoder ();
+
+    // copies up to 'cap' bytes of the encoded document to 'buf', returns how many.
+    // returns less than 'cap' only once the document is done (or on failure).
+    size_t produce (uint8_t *buf, size_t cap);
+    bool   done () const;
+    bool   failed () const;
+
+  private:
+
+    pull_encoder (const pull_encoder &);
+    pull_encoder &operator=(const pull_encoder &);
+
+    // holds encoded bytes that have not been produced yet
+    class staging_ostream : public ostream
+    {
+    public:
+      void put (uint8_t byte);
+      void write (uint8_t *bytes, size_t count);
+      void flush ();
+
+      mem_ostream *m_stream;
+    };
+
+    struct frame
+    {
+      const value * val;
+      value::cursor cur;
+      sz_t          index;
+    };
+
+    bool _step ();
+    bool _value (const value *val);
+
+    internal::stream_encoder *  m_enc;
+    allocator *                 m_alloc;
+    size_t                      m_encsz;
+    const value *               m_src;
+    mem_ostream                 m_staged;
+    staging_ostream             m_staging;
+    size_t                      m_rpos;
+    frame                       m_stack [KVR_CONSTANT_MAX_TREE_DEPTH];
+    sz_t                        m_depth;
+    bool                        m_started;
+    bool                        m_done;
+    bool                        m_ok;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  namespace internal { struct view_ctx; }
+
+  // read-only view of an encoded msgpack or cbor document (json is not supported). 
+  // nothing is decoded up front: lookups skip over siblings by their length prefixes 
+  // and scalars are decoded on access. the buffer must outlive the view (and any 
+  // string it returns). an invalid view (e.g. a failed find) reports every type as false.
+  // kvrb snapshots are opened by checking the header only; element () is O(1) and 
+  // find () goes through the map's hash index, so they can be queried in place (mmap).
+  class view
+  {
+  public:
+
+    view ();
+    view (codec_t codec, const uint8_t *data, size_t size);
+    view (codec_t codec, const mem_istream &istr);
+
+    bool          is_valid () const;
+
+    // type checking    
+    bool          is_map () const;
+    bool          is_array () const;
+    bool          is_string () const;
+    bool          is_binary () const;
+    bool          is_boolean () const;
+    bool          is_integer () const;
+    bool          is_float () const;
+    bool          is_null () const;
+
+    // scalars (strings point into the buffer and are not null-terminated)
+    const char *  get_string (sz_t *len) const;
+    const uint8_t * get_binary (sz_t *size) const;
+    int64_t       get_integer () const;
+    double        get_float () const;
+    bool          get_boolean () const;
+
+    // array
+    view          element (sz_t index) const;
+    sz_t          length () const;
+
+    // map
+    view          find (const char *key) const;
+    view          find (const char *key, sz_t len) const;
+    sz_t          size () const;
+
+    // path search (map or array)
+    view          search (const char *pathexpr) const;
+    view          search (const char **path, sz_t pathsz) const;
+
+    // encoded bytes spanned by this value (0 if malformed). kvrb: the value's 
+    // slot, containers and strings are stored out of line
+    size_t        encoded_size () const;
+
+    // decodes this subtree into 'dest'
+    bool          materialize (value *dest) const;
+
+    // checks a whole document is well-formed, O(size). kvrb: header and checksum
+    static bool   verify (codec_t codec, const uint8_t *data, size_t size);
+
+    // visits the pairs of a map or the elements of an array, in encoded order
+    class cursor
+    {
+    public:
+
+      explicit cursor (const view &container);
+      bool get (view *key, view *val);
+      bool get (view *val);
+
+    private:
+
+      bool _next (view *v);
+
+      codec_t         m_codec;
+      const uint8_t * m_pos;
+      const uint8_t * m_end;
+      size_t          m_left;
+      bool            m_indef;
+    };
+
+  private:
+
+    bool          _scalar (internal::view_ctx *ctx) const;
+    view          _search_key (const char *key) const;
+
+    codec_t         m_codec;
+    const uint8_t * m_data;
+    size_t          m_avail;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // framed block compression for large documents (e.g. snapshots written with value::encode),
+  // with no external library. output is cut into 'blocksz' blocks, each compressed on its own
+  // (lz77) and checksummed (adler-32), and up to 'nthreads' blocks (0: one per core) are
+  // compressed at once. flush writes out a short block for what is buffered; finish (or the
+  // destructor) adds the block index. see internal/kvr_lz.h for the layout.
+  class compressed_ostream : public ostream
+  {
+  public:
+
+    compressed_ostream (ostream *dest, size_t blocksz = 1u << 20, size_t nthreads = 0, allocator *alloc = NULL);
+    ~compressed_ostream ();
+
+    void    put (uint8_t byte);
+    void    write (uint8_t *bytes, size_t count);
+    void    flush ();
+    // writes the last block and the index. nothing can be written after this
+    bool    finish ();
+    bool    failed () const;
+
+  private:
+
+    compressed_ostream (const compressed_ostream &);
+    compressed_ostream &operator=(const compressed_ostream &);
+
+    void _blocks ();
+    void _emit (const uint8_t *bytes, size_t count);
+
+    ostream *   m_dest;
+    allocator * m_alloc;
+    size_t      m_blocksz;
+    size_t      m_nthreads;
+    uint8_t *   m_raw;
+    size_t      m_rawpos;
+    uint8_t *   m_packed;
+    uint32_t *  m_tables;
+    mem_ostream m_index;
+    uint64_t    m_offset;
+    bool        m_finished;
+    bool        m_ok;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // reads a compressed_ostream container, decompressing up to 'nthreads' blocks at once 
+  // (0: one per core). every block is checked against its checksum, and the index against
+  // the blocks read. in memory, blocks are found through the index and not copied before 
+  // they are decompressed.
+  class compressed_istream : public istream
+  {
+  public:
+
+    compressed_istream (istream *src, size_t nthreads = 0, allocator *alloc = NULL);
+    compressed_istream (const uint8_t *data, size_t size, size_t nthreads = 0, allocator *alloc = NULL);
+    ~compressed_istream ();
+
+    bool    get (uint8_t *byte);
+    bool    read (uint8_t *bytes, size_t count);
+    size_t  tell ();
+    uint8_t peek ();
+    size_t  fetch (uint8_t *bytes, size_t count);
+    // damaged or truncated container
+    bool    failed () const;
+
+  private:
+
+    compressed_istream (const compressed_istream &);
+    compressed_istream &operator=(const compressed_istream &);
+
+    void _init (size_t nthreads);
+    bool _open ();
+    bool _ready ();
+    bool _fill ();
+    bool _next (uint32_t *rawsz, uint32_t *packedsz, uint32_t *sum, const uint8_t **packed, size_t slot);
+    bool _end (uint32_t indexsz, uint32_t sum);
+
+    istream *       m_src;
+    const uint8_t * m_data;
+    size_t          m_size;
+    allocator *     m_alloc;
+    size_t          m_blocksz;
+    size_t          m_nthreads;
+    uint8_t *       m_raw;
+    uint8_t *       m_packed;
+    size_t *        m_lens;
+    size_t          m_count;
+    size_t          m_cur;
+    size_t          m_rpos;
+    size_t          m_pos;
+    const uint8_t * m_index;
+    size_t          m_block;
+    size_t          m_nblocks;
+    mem_ostream     m_offsets;
+    uint64_t        m_offset;
+    bool            m_end;
+    bool            m_failed;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // read-only mapping of a whole file. pages come straight from the page cache as they are 
+  // read (read ahead for a front-to-back decode), so multi-gigabyte files cost no heap. 
+  // stream () gives the mapping as a mem_istream: decoders take their in-memory paths on it 
+  // (strings and binaries are pushed, not copied) and kvr::view can query it in place.
+  class mmap_istream
+  {
+  public:
+
+    explicit mmap_istream (const char *path, allocator *alloc = NULL);
+    ~mmap_istream ();
+
+    bool            is_open () const;
+    const uint8_t * data () const;
+    size_t          size () const;
+    // NULL if the file is not open or empty
+    mem_istream *   stream ();
+
+  private:
+
+    mmap_istream (const mmap_istream &);
+    mmap_istream &operator=(const mmap_istream &);
+
+    const uint8_t * m_data;
+    size_t          m_size;
+    mem_istream *   m_stream;
+    allocator *     m_alloc;
+    bool            m_open;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // writes a file (created or truncated) through a shared writable mapping. the file grows 
+  // 'extent' bytes at a time, so a large encode remaps only every few tens of megabytes, 
+  // and close (or the destructor) trims it to what was written. disk space is not reserved
+  // ahead: as with any shared mapping, running out of it while writing raises SIGBUS.
+  class mmap_ostream : public ostream
+  {
+  public:
+
+    explicit mmap_ostream (const char *path, size_t extent = 64u << 20);
+    ~mmap_ostream ();
+
+    void      put (uint8_t byte);
+    void      write (uint8_t *bytes, size_t count);
+    // starts write-back of what is written, without waiting for it
+    void      flush ();
+    // 'count' writable bytes at the write position, which moves past them (NULL on failure)
+    uint8_t * push (size_t count);
+    // moves the write position back 'count' bytes
+    void      pop (size_t count);
+    size_t    tell () const;
+    // unmaps and trims the file. nothing can be written after this
+    bool      close ();
+    bool      is_open () const;
+    bool      failed () const;
+
+  private:
+
+    mmap_ostream (const mmap_ostream &);
+    mmap_ostream &operator=(const mmap_ostream &);
+
+    bool _reserve (size_t sz);
+    void _unmap ();
+
+    intptr_t  m_file;
+    uint8_t * m_data;
+    size_t    m_size;
+    size_t    m_pos;
+    size_t    m_extent;
+    bool      m_failed;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // when an async_file_ostream syncs its file to disk (fsync, FlushFileBuffers). return true 
+  // from a hook to sync; the defaults never do. hooks run on the I/O thread, except 
+  // sync_on_close which runs on the closing thread after the last write.
+  class sync_policy
+  {
+  public:
+    // a buffer was written. 'written': bytes in the file, 'unsynced': of those, not yet synced
+    virtual bool sync_on_write (uint64_t written, uint64_t unsynced);
+    // the buffer handed over by a flush was written
+    virtual bool sync_on_flush (uint64_t written);
+    virtual bool sync_on_close (uint64_t written);
+
+  protected:
+    ~sync_policy () {}
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  namespace internal { class async_writer; }
+
+  // file output (created or truncated) written on a dedicated I/O thread, so encoding and
+  // disk writes overlap. the encoder fills one of 'nbufs' (2 or more) rotating 'bufsz' 
+  // buffers while the I/O thread writes out the filled ones in order; when all of them are 
+  // waiting to be written, the encoder waits too (backpressure). flush hands over what is 
+  // buffered without waiting for it to be written.
+  class async_file_ostream : public ostream
+  {
+  public:
+
+    async_file_ostream (const char *path, size_t bufsz = 1u << 20, size_t nbufs = 2, sync_policy *sync = NULL, allocator *alloc = NULL);
+    ~async_file_ostream ();
+
+    void    put (uint8_t byte);
+    void    write (uint8_t *bytes, size_t count);
+    void    flush ();
+    // writes out what is left, syncs per the policy and closes the file
+    bool    close ();
+    bool    is_open () const;
+    // a write or sync failed. later output is dropped
+    bool    failed () const;
+
+  private:
+
+    async_file_ostream (const async_file_ostream &);
+    async_file_ostream &operator=(const async_file_ostream &);
+
+    void _submit (bool flush);
+
+    internal::async_writer *  m_writer;
+    allocator *               m_alloc;
+    uint8_t *                 m_buf;
+    size_t                    m_pos;
+    size_t                    m_bufsz;
+    bool                      m_failed;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -26,6 +26,114 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
+  inline size_t istream::fetch (uint8_t *bytes, size_t count)
+  {
+    return ((count > 0) && this->get (bytes)) ? 1u : 0u;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_null ()
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_boolean (bool)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_integer (int64_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_float (double)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_string (const char *, sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_binary (const uint8_t *, sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_key (const char *, sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_map_start (sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_map_end (sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_array_start (sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline bool handler::on_array_end (sz_t)
+  {
+    return true;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
   inline const char *key::get_string () const
   {
     return m_str;
@@ -88,6 +196,15 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
+  inline bool value::is_binary () const
+  {
+    return (m_flags & FLAG_TYPE_BINARY) != 0;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
   inline bool value::is_boolean () const
   {
     return (m_flags & FLAG_TYPE_BOOLEAN) != 0;
@@ -168,7 +285,7 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
-  inline obuffer::obuffer (size_t size, allocator *alloc) : m_stream (size, alloc)
+  inline obuffer::obuffer (size_t size, allocator *alloc) : m_stream (size, alloc), m_pool (NULL)
   {
   }
 
@@ -176,7 +293,15 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
-  inline obuffer::obuffer (uint8_t *data, size_t size, allocator *alloc) : m_stream (data, size, alloc)
+  inline obuffer::obuffer (uint8_t *data, size_t size, allocator *alloc) : m_stream (data, size, alloc), m_pool (NULL)
+  {
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline obuffer::obuffer (buffer_pool *pool) : m_stream (pool->suggest_size (), pool), m_pool (pool)
   {
   }
 
@@ -201,6 +326,105 @@ namespace kvr
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline chunk_obuffer::chunk_obuffer (size_t chunksz, allocator *alloc) : m_stream (chunksz, alloc)
+  {
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline size_t chunk_obuffer::get_size () const
+  {
+    return m_stream.tell ();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline size_t chunk_obuffer::get_chunk_count () const
+  {
+    return m_stream.chunk_count ();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline size_t chunk_obuffer::get_chunks (iovec *vec, size_t count) const
+  {
+    return m_stream.chunks (vec, count);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline const uint8_t * chunk_obuffer::flatten ()
+  {
+    return m_stream.flatten ();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void stream_writer::obuffer_ostream::put (uint8_t byte)
+  {
+    m_stream->put (byte);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void stream_writer::obuffer_ostream::write (uint8_t *bytes, size_t count)
+  {
+    m_stream->write (bytes, count);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void stream_writer::obuffer_ostream::flush ()
+  {
+    // null-terminate past the end (for json), growing if needed
+    m_stream->put (0);
+    m_stream->pop (1);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void pull_encoder::staging_ostream::put (uint8_t byte)
+  {
+    m_stream->put (byte);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void pull_encoder::staging_ostream::write (uint8_t *bytes, size_t count)
+  {
+    m_stream->write (bytes, count);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+
+  inline void pull_encoder::staging_ostream::flush ()
+  {
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
 #endif
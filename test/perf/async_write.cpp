@@ -0,0 +1,139 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perf_util.h"
+#include "../../example/streams.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// syncs once, before the file is closed
+class perf_close_sync : public kvr::sync_policy
+{
+public:
+  bool sync_on_close (uint64_t) { return true; }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const size_t PERF_BUF_SZ = 65536u;
+
+static const char *perf_path = "perf_test_async_write.tmp";
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void perf_report (const char *name, double elapsed, size_t expect, int *result)
+{
+  kvr::mmap_istream file (perf_path);
+  if (file.size () != expect)
+  {
+    *result = 1;
+  }
+
+  double mbps = (elapsed > 0.0) ? ((double) expect / (elapsed * 1024.0 * 1024.0)) : 0.0;
+  printf ("%-36s %9.1f MB/s\n", name, mbps);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, char* argv [])
+{
+  // small by default so the memcheck run stays quick. the tree is encoded 'documents'
+  // times into one file, for files larger than the page cache write-back threshold
+  const size_t count = (argc > 1) ? (size_t) atol (argv [1]) : 2000u;
+  const int documents = (argc > 2) ? atoi (argv [2]) : 4;
+
+  kvr::ctx *ctx = kvr::ctx::create ();
+  kvr::value *root = perf_make_records (ctx, count);
+
+  const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK };
+  const char *names [] = { "json", "msgpack" };
+
+  int result = 0;
+
+  for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+  {
+    size_t docsz = root->encode_bound (codecs [c]);
+    kvr::obuffer obuf (docsz);
+    result = root->encode (codecs [c], &obuf) ? result : 1;
+    const size_t expect = obuf.get_size () * (size_t) documents;
+
+    char name [64];
+
+    // synchronous: encoding waits on every write
+    {
+      double start = perf_seconds ();
+      {
+        buffered_file_ostream<PERF_BUF_SZ> ostr (perf_path);
+        for (int d = 0; d < documents; ++d)
+        {
+          result = root->encode (codecs [c], &ostr) ? result : 1;
+        }
+      }
+      sprintf (name, "%s buffered_file_ostream", names [c]);
+      perf_report (name, perf_seconds () - start, expect, &result);
+    }
+
+    // background writer, 64KB buffers
+    for (size_t nbufs = 2; nbufs <= 8; nbufs *= 2)
+    {
+      double start = perf_seconds ();
+      {
+        kvr::async_file_ostream ostr (perf_path, PERF_BUF_SZ, nbufs);
+        for (int d = 0; d < documents; ++d)
+        {
+          result = root->encode (codecs [c], &ostr) ? result : 1;
+        }
+        result = ostr.close () ? result : 1;
+      }
+      sprintf (name, "%s async_file_ostream x%u", names [c], (unsigned) nbufs);
+      perf_report (name, perf_seconds () - start, expect, &result);
+    }
+
+    // durable: the write-back is waited for once, at close
+    {
+      perf_close_sync policy;
+      double start = perf_seconds ();
+      {
+        kvr::async_file_ostream ostr (perf_path, PERF_BUF_SZ, 4u, &policy);
+        for (int d = 0; d < documents; ++d)
+        {
+          result = root->encode (codecs [c], &ostr) ? result : 1;
+        }
+        result = ostr.close () ? result : 1;
+      }
+      sprintf (name, "%s async_file_ostream x4 fsync", names [c]);
+      perf_report (name, perf_seconds () - start, expect, &result);
+    }
+  }
+
+  remove (perf_path);
+
+  ctx->destroy_value (root);
+  kvr::ctx::destroy (ctx);
+
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
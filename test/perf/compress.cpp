@@ -0,0 +1,100 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perf_util.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// collects the container in memory
+class perf_ostream : public kvr::ostream
+{
+public:
+
+  perf_ostream () : m_os (1u << 20) {}
+  void put (uint8_t byte) { m_os.put (byte); }
+  void write (uint8_t *bytes, size_t count) { m_os.write (bytes, count); }
+  void flush () {}
+
+  kvr::mem_ostream m_os;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, char* argv [])
+{
+  // small by default so the memcheck run stays quick. keep under 65535 records
+  // (see perf_make_records)
+  const size_t count = (argc > 1) ? (size_t) atol (argv [1]) : 2000u;
+  const int iterations = (argc > 2) ? atoi (argv [2]) : 1;
+  const size_t maxthreads = (argc > 3) ? (size_t) atol (argv [3]) : 8u;
+  const size_t blocksz = (argc > 4) ? (size_t) atol (argv [4]) : 65536u;
+
+  kvr::ctx *ctx = kvr::ctx::create ();
+  // decoded trees get their own ctx, so keys aren't shared with 'root'
+  kvr::ctx *dctx = kvr::ctx::create ();
+  kvr::value *root = perf_make_records (ctx, count);
+  const uint32_t hash = root->hash ();
+
+  kvr::obuffer plain;
+  int result = root->encode (kvr::CODEC_MSGPACK, &plain) ? 0 : 1;
+  const double mb = ((double) plain.get_size () * (double) iterations) / (1024.0 * 1024.0);
+
+  for (size_t nthreads = 1; nthreads <= maxthreads; nthreads *= 2)
+  {
+    perf_ostream out;
+
+    double start = perf_seconds ();
+    for (int i = 0; i < iterations; ++i)
+    {
+      out.m_os.seek (0);
+      kvr::compressed_ostream costr (&out, blocksz, nthreads);
+      if (!root->encode (kvr::CODEC_MSGPACK, &costr) || !costr.finish ())
+      {
+        result = 1;
+      }
+    }
+    double tenc = perf_seconds () - start;
+
+    start = perf_seconds ();
+    for (int i = 0; i < iterations; ++i)
+    {
+      kvr::compressed_istream cistr (out.m_os.buffer (), out.m_os.tell (), nthreads);
+      kvr::value *val = dctx->create_value ();
+      if (!val->decode (kvr::CODEC_MSGPACK, cistr) || ((i == 0) && (val->hash () != hash)))
+      {
+        result = 1;
+      }
+      dctx->destroy_value (val);
+    }
+    double tdec = perf_seconds () - start;
+
+    printf ("msgpack %2u threads: %9u -> %9u bytes (x%.2f) encode %8.1f MB/s decode %8.1f MB/s\n", (unsigned) nthreads, (unsigned) plain.get_size (), 
+      (unsigned) out.m_os.tell (), (double) plain.get_size () / (double) out.m_os.tell (), (tenc > 0.0) ? (mb / tenc) : 0.0, (tdec > 0.0) ? (mb / tdec) : 0.0);
+  }
+
+  ctx->destroy_value (root);
+  kvr::ctx::destroy (dctx);
+  kvr::ctx::destroy (ctx);
+
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perf_util.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double perf_decode (kvr::ctx *ctx, kvr::codec_t codec, const kvr::obuffer &obuf, int iterations, int *result)
+{
+  double start = perf_seconds ();
+
+  for (int i = 0; i < iterations; ++i)
+  {
+    kvr::value *val = ctx->create_value ();
+    if (!val->decode (codec, obuf.get_data (), obuf.get_size ()))
+    {
+      *result = 1;
+    }
+    ctx->destroy_value (val);
+  }
+
+  return perf_seconds () - start;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, char* argv [])
+{
+  // small by default so the memcheck run stays quick. keep under 65535 records
+  // (see perf_make_records)
+  const size_t count = (argc > 1) ? (size_t) atol (argv [1]) : 1000u;
+  const int iterations = (argc > 2) ? atoi (argv [2]) : 1;
+
+  kvr::ctx *ctx = kvr::ctx::create ();
+  kvr::value *root = perf_make_records (ctx, count);
+  const uint32_t hash = root->hash ();
+
+  const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+  const char *names [] = { "msgpack", "cbor" };
+
+  int result = 0;
+
+  for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+  {
+    kvr::obuffer plain, keyed;
+    if (!root->encode (codecs [c], &plain) || !root->encode (codecs [c], &keyed, kvr::ENCODE_KEY_TABLE))
+    {
+      result = 1;
+      continue;
+    }
+
+    kvr::value *check = ctx->create_value ();
+    if (!check->decode (codecs [c], keyed.get_data (), keyed.get_size ()) || (check->hash () != hash))
+    {
+      result = 1;
+    }
+    ctx->destroy_value (check);
+
+    double tplain = perf_decode (ctx, codecs [c], plain, iterations, &result);
+    double tkeyed = perf_decode (ctx, codecs [c], keyed, iterations, &result);
+
+    printf ("%-8s plain: %9u bytes %8.2f ms\n", names [c], (unsigned) plain.get_size (), (tplain * 1000.0) / (double) iterations);
+    printf ("%-8s keyed: %9u bytes %8.2f ms (size x%.2f, decode x%.2f)\n", names [c], (unsigned) keyed.get_size (), (tkeyed * 1000.0) / (double) iterations,
+      (double) keyed.get_size () / (double) plain.get_size (), (tkeyed > 0.0) ? (tplain / tkeyed) : 0.0);
+  }
+
+  ctx->destroy_value (root);
+  kvr::ctx::destroy (ctx);
+
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perf_util.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// telemetry series: jittered timestamps, a counter and gauges sampled at 2 decimals
+static kvr::value * perf_make_series (kvr::ctx *ctx, size_t count)
+{
+  kvr::value *root = ctx->create_value ()->conv_map ();
+  root->insert ("host", "ingest-node-07.example.com");
+
+  kvr::value *ts = root->insert_array ("timestamp_ms");
+  kvr::value *bytes = root->insert_array ("bytes_total");
+  kvr::value *cpu = root->insert_array ("cpu");
+  kvr::value *temp = root->insert_array ("temperature");
+
+  srand (7);
+
+  int64_t t = 1400000000000LL, total = 0;
+  double c = 40.0;
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    t += 1000 + (rand () % 16) - 8;
+    total += rand () % 4096;
+    c += (double) ((rand () % 201) - 100) / 100.0;
+    c = (c < 0.0) ? 0.0 : (c > 100.0) ? 100.0 : c;
+
+    ts->push (t);
+    bytes->push (total);
+    cpu->push ((double) ((int64_t) (c * 100.0)) / 100.0);
+    temp->push (21.5 + (double) ((i / 60) % 4) * 0.5);
+  }
+
+  return root;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double perf_encode (kvr::value *root, kvr::codec_t codec, uint32_t flags, kvr::obuffer *obuf, int iterations, int *result)
+{
+  double start = perf_seconds ();
+
+  for (int i = 0; i < iterations; ++i)
+  {
+    if (!root->encode (codec, obuf, flags))
+    {
+      *result = 1;
+    }
+  }
+
+  return perf_seconds () - start;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double perf_decode (kvr::ctx *ctx, kvr::codec_t codec, const kvr::obuffer &obuf, uint32_t hash, int iterations, int *result)
+{
+  double start = perf_seconds ();
+
+  for (int i = 0; i < iterations; ++i)
+  {
+    kvr::value *val = ctx->create_value ();
+    if (!val->decode (codec, obuf.get_data (), obuf.get_size ()) || ((i == 0) && (val->hash () != hash)))
+    {
+      *result = 1;
+    }
+    ctx->destroy_value (val);
+  }
+
+  return perf_seconds () - start;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, char* argv [])
+{
+  // small by default so the memcheck run stays quick
+  const size_t count = (argc > 1) ? (size_t) atol (argv [1]) : 2000u;
+  const int iterations = (argc > 2) ? atoi (argv [2]) : 1;
+
+  kvr::ctx *ctx = kvr::ctx::create ();
+  kvr::value *root = perf_make_series (ctx, count);
+  const uint32_t hash = root->hash ();
+
+  const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+  const char *names [] = { "msgpack", "cbor" };
+  const uint32_t flags [] = { 0, kvr::ENCODE_NUMERIC_COLUMNS };
+  const char *modes [] = { "plain", "columns" };
+
+  int result = 0;
+
+  for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+  {
+    size_t base = 0;
+
+    for (size_t f = 0; f < (sizeof (flags) / sizeof (flags [0])); ++f)
+    {
+      kvr::obuffer obuf;
+      double tenc = perf_encode (root, codecs [c], flags [f], &obuf, iterations, &result);
+      double tdec = perf_decode (ctx, codecs [c], obuf, hash, iterations, &result);
+
+      // throughput in terms of the plain encoding, so the modes compare directly
+      base = (f == 0) ? obuf.get_size () : base;
+      double mb = ((double) base * (double) iterations) / (1024.0 * 1024.0);
+
+      printf ("%-8s %-8s %9u bytes (x%.2f) encode %8.1f MB/s decode %8.1f MB/s\n", names [c], modes [f], (unsigned) obuf.get_size (),
+        (double) base / (double) obuf.get_size (), (tenc > 0.0) ? (mb / tenc) : 0.0, (tdec > 0.0) ? (mb / tdec) : 0.0);
+    }
+  }
+
+  ctx->destroy_value (root);
+  kvr::ctx::destroy (ctx);
+
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
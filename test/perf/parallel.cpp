@@ -0,0 +1,101 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perf_util.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// concatenated records, newline-delimited for json
+static void perf_make_stream (kvr::ctx *ctx, kvr::codec_t codec, size_t count, kvr::mem_ostream *out)
+{
+  for (size_t r = 0; r < count; ++r)
+  {
+    kvr::value *rec = ctx->create_value ()->conv_map ();
+    perf_fill_record (rec, r);
+
+    kvr::value *tags = rec->insert_array ("tags");
+    for (size_t t = 0; t < 8; ++t)
+    {
+      tags->push ((int64_t) (r * t));
+    }
+
+    kvr::obuffer obuf;
+    rec->encode (codec, &obuf);
+    out->write (const_cast<uint8_t *> (obuf.get_data ()), obuf.get_size ());
+    if (codec == kvr::CODEC_JSON)
+    {
+      out->put ('\n');
+    }
+
+    ctx->destroy_value (rec);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, char* argv [])
+{
+  // small by default so the memcheck run stays quick
+  const size_t count = (argc > 1) ? (size_t) atol (argv [1]) : 2000u;
+  const int iterations = (argc > 2) ? atoi (argv [2]) : 1;
+  const size_t maxthreads = (argc > 3) ? (size_t) atol (argv [3]) : 8u;
+
+  kvr::ctx *ctx = kvr::ctx::create ();
+
+  const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+  const char *names [] = { "json", "msgpack", "cbor" };
+
+  int result = 0;
+
+  for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+  {
+    kvr::mem_ostream stream (4096u);
+    perf_make_stream (ctx, codecs [c], count, &stream);
+
+    double base = 0.0;
+
+    for (size_t nthreads = 1; nthreads <= maxthreads; nthreads *= 2)
+    {
+      kvr::parallel_decoder decoder (nthreads);
+
+      double start = perf_seconds ();
+      for (int i = 0; i < iterations; ++i)
+      {
+        if (!decoder.decode (codecs [c], stream.buffer (), stream.tell ()) || (decoder.count () != count))
+        {
+          result = 1;
+        }
+      }
+      double elapsed = perf_seconds () - start;
+
+      double mbps = (elapsed > 0.0) ? ((double) stream.tell () * (double) iterations) / (elapsed * 1024.0 * 1024.0) : 0.0;
+      base = (nthreads == 1) ? mbps : base;
+
+      printf ("%-8s %2u threads: %9.1f MB/s (x%.2f)\n", names [c], (unsigned) nthreads, mbps, (base > 0.0) ? (mbps / base) : 0.0);
+    }
+  }
+
+  kvr::ctx::destroy (ctx);
+
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
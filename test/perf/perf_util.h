@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copyright (c) 2015 Ubaka Onyechi
+ *
+ * kvr is free software distributed under the MIT license.
+ * See https://raw.githubusercontent.com/uonyx/kvr/master/LICENSE file for details.
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef KVR_PERF_UTIL_H
+#define KVR_PERF_UTIL_H
+
+#include "kvr.h"
+#include <cstdio>
+#include <cstdlib>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// wall clock seconds (cpu time would add up across threads)
+inline double perf_seconds ()
+{
+#if defined (_WIN32)
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return (double) now.QuadPart / (double) freq.QuadPart;
+#else
+  timeval tv;
+  gettimeofday (&tv, NULL);
+  return (double) tv.tv_sec + ((double) tv.tv_usec * 1e-6);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// fills 'rec' (a map) as the r-th record of a request log
+inline void perf_fill_record (kvr::value *rec, size_t r)
+{
+  rec->insert ("id", (int64_t) r);
+  rec->insert ("host", "ingest-node-07.example.com");
+  rec->insert ("latency", 0.25 * (double) (r % 1000));
+  rec->insert ("ok", (r % 7) != 0);
+
+  kvr::value *req = rec->insert_map ("request");
+  req->insert ("method", "GET");
+  req->insert ("path", "/api/v1/records/search?q=kvr&limit=100");
+  req->insert ("bytes", (int64_t) (r * 31));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// an array of 'count' records sharing one key set. keep under 65535 records if the tree is
+// decoded back into the same ctx (shared keys are reference counted in 16 bits)
+inline kvr::value * perf_make_records (kvr::ctx *ctx, size_t count)
+{
+  kvr::value *root = ctx->create_value ()->conv_array ();
+
+  for (size_t r = 0; r < count; ++r)
+  {
+    perf_fill_record (root->push_map (), r);
+  }
+
+  return root;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////
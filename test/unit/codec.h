@@ -24,6 +24,49 @@ class kvrTestSuiteCodec : public CxxTest::TestSuite
 {
   kvr::ctx * m_ctx;
 
+  ///////////////////////////////
+  // utility
+  ///////////////////////////////
+
+  class simple_istream : public kvr::istream
+  {
+  public:
+
+    simple_istream (const uint8_t *data, size_t size) : m_data (data), m_size (size), m_pos (0) {}
+    bool get (uint8_t *byte) { if (m_pos < m_size) { *byte = m_data [m_pos++]; return true; } return false; }
+    bool read (uint8_t *bytes, size_t count) { if ((m_pos + count) > m_size) { return false; } memcpy (bytes, &m_data [m_pos], count); m_pos += count; return true; }
+    size_t tell () { return m_pos; }
+    uint8_t peek () { return (m_pos < m_size) ? m_data [m_pos] : 0; }
+
+    const uint8_t *m_data;
+    size_t m_size, m_pos;
+  };
+
+  class simple_ostream : public kvr::ostream
+  {
+  public:
+
+    simple_ostream () : m_os (256), m_flushes (0) {}
+    void put (uint8_t byte) { m_os.put (byte); }
+    void write (uint8_t *bytes, size_t count) { m_os.write (bytes, count); }
+    void flush () { ++m_flushes; m_os.flush (); }
+
+    kvr::mem_ostream m_os;
+    size_t m_flushes;
+  };
+
+  class number_handler : public kvr::handler
+  {
+  public:
+
+    number_handler () : m_integers (0), m_floats (0), m_arrays (0) {}
+    bool on_integer (int64_t) { ++m_integers; return true; }
+    bool on_float (double) { ++m_floats; return true; }
+    bool on_array_start (kvr::sz_t) { ++m_arrays; return true; }
+
+    size_t m_integers, m_floats, m_arrays;
+  };
+
 public:
 
   ///////////////////////////////////////////////////////////////
@@ -448,6 +491,3337 @@ public:
 
     m_ctx->destroy_value (val);
   }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testInputStream ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    // custom stream over memory. 'chunk' limits bytes per fetch (0 = no fetch override)
+    class chunk_istream : public kvr::istream
+    {
+    public:
+
+      chunk_istream (const uint8_t *data, size_t size, size_t chunk) : m_data (data), m_size (size), m_pos (0), m_chunk (chunk) {}
+      bool get (uint8_t *byte) { if (m_pos < m_size) { *byte = m_data [m_pos++]; return true; } return false; }
+      bool read (uint8_t *bytes, size_t count) { if ((m_pos + count) > m_size) { return false; } memcpy (bytes, &m_data [m_pos], count); m_pos += count; return true; }
+      size_t tell () { return m_pos; }
+      uint8_t peek () { return (m_pos < m_size) ? m_data [m_pos] : 0; }
+      size_t fetch (uint8_t *bytes, size_t count)
+      {
+        if (m_chunk == 0) { return kvr::istream::fetch (bytes, count); }
+        size_t n = count < m_chunk ? count : m_chunk;
+        n = (m_pos + n) > m_size ? (m_size - m_pos) : n;
+        memcpy (bytes, &m_data [m_pos], n);
+        m_pos += n;
+        return n;
+      }
+
+    private:
+
+      const uint8_t * m_data;
+      size_t          m_size;
+      size_t          m_pos;
+      size_t          m_chunk;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", true);
+      val->insert ("f", false);
+      val->insert_null ("n");
+      val->insert ("i", 123);
+      val->insert ("pi", 3.1416);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 512; ++i)
+      {
+        a->push (i * 1000);
+        a->push ("straddle");
+      }
+
+      // longer than a read-ahead block
+      char big [6000];
+      memset (big, 'x', sizeof (big) - 1);
+      big [sizeof (big) - 1] = 0;
+      val->insert ("big", big);
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // decode from custom streams
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const size_t chunks [] = { 0, 1, 7, 65536 };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      for (size_t k = 0; k < (sizeof (chunks) / sizeof (chunks [0])); ++k)
+      {
+        chunk_istream istr (obuf.get_data (), obuf.get_size (), chunks [k]);
+        kvr::value *dval = m_ctx->create_value ();
+        ok = dval->decode (codecs [c], istr);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        m_ctx->destroy_value (dval);
+      }
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testOutputStream ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_ostream : public kvr::ostream
+    {
+    public:
+
+      counting_ostream () : m_os (256), m_calls (0), m_flushes (0) {}
+      void put (uint8_t byte) { m_os.put (byte); ++m_calls; }
+      void write (uint8_t *bytes, size_t count) { m_os.write (bytes, count); ++m_calls; }
+      void flush () { ++m_flushes; }
+
+      kvr::mem_ostream  m_os;
+      size_t            m_calls;
+      size_t            m_flushes;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("pi", 3.1416);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 1024; ++i)
+      {
+        a->push (i - 512);
+        a->push (true);
+      }
+
+      char big [6000];
+      memset (big, 'y', sizeof (big) - 1);
+      big [sizeof (big) - 1] = 0;
+      val->insert ("big", big);
+    }
+
+    kvr::value *str = m_ctx->create_value ();
+    str->set_string ("root");
+
+    ///////////////////////////////
+    // encode to custom stream and compare with memory
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::value *vals [] = { val, str };
+
+      for (size_t v = 0; v < 2; ++v)
+      {
+        kvr::obuffer obuf;
+        bool ok = vals [v]->encode (codecs [c], &obuf);
+        TS_ASSERT (ok);
+
+        counting_ostream ostr;
+        ok = vals [v]->encode (codecs [c], &ostr);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (ostr.m_os.tell (), obuf.get_size ());
+        TS_ASSERT_EQUALS (memcmp (ostr.m_os.buffer (), obuf.get_data (), obuf.get_size ()), 0);
+        TS_ASSERT_EQUALS (ostr.m_flushes, 1u);
+        TS_ASSERT (ostr.m_calls <= ((obuf.get_size () / KVR_CONSTANT_OSTREAM_BLOCK_SZ) + 2));
+      }
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (str);
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testEncodeBound ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_allocator : public kvr::allocator
+    {
+    public:
+
+      counting_allocator () : m_count (0) {}
+      void * allocate (size_t sz) { ++m_count; return malloc (sz); }
+      void   deallocate (void *p, size_t) { free (p); }
+
+      size_t m_count;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("quote", "say \"hi\"\n");
+      val->insert ("pi", 3.14159265358979);
+      val->insert ("e", 2.5e-300);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 300; ++i)
+      {
+        a->push (i * 7919 - 100000);
+        a->push (i * 0.1);
+        a->push ("element");
+      }
+      kvr::value *m = val->insert_map ("m");
+      {
+        m->insert_null ("n");
+        m->insert ("t", true);
+      }
+    }
+
+    ///////////////////////////////
+    // bound is exact, single allocation
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      size_t bound = val->encode_bound (codecs [c]);
+
+      counting_allocator alloc;
+      {
+        kvr::obuffer obuf (256, &alloc);
+        bool ok = val->encode (codecs [c], &obuf);
+        TS_ASSERT (ok);
+
+        size_t size = obuf.get_size ();
+        TS_ASSERT (bound > size);
+        TS_ASSERT (bound <= (size + 8));
+
+        // initial buffer + one exact reservation
+        TS_ASSERT_EQUALS (alloc.m_count, 2u);
+      }
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testChunkBuffer ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("pi", 3.1416);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 256; ++i)
+      {
+        a->push (i * 100);
+        a->push ("a string longer than a few bytes");
+      }
+    }
+
+    ///////////////////////////////
+    // encode to chunks and compare with contiguous buffer
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::chunk_obuffer cbuf (100);
+
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      ok = val->encode (codecs [c], &cbuf);
+      TS_ASSERT (ok);
+      TS_ASSERT_EQUALS (cbuf.get_size (), obuf.get_size ());
+      TS_ASSERT (cbuf.get_chunk_count () > 1);
+
+      kvr::iovec vec [512];
+      size_t n = cbuf.get_chunks (vec, 512);
+      TS_ASSERT_EQUALS (n, cbuf.get_chunk_count ());
+
+      size_t offset = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        TS_ASSERT (vec [i].len <= 100);
+        TS_ASSERT_EQUALS (memcmp (vec [i].base, obuf.get_data () + offset, vec [i].len), 0);
+        offset += vec [i].len;
+      }
+      TS_ASSERT_EQUALS (offset, obuf.get_size ());
+
+      const uint8_t *flat = cbuf.flatten ();
+      TS_ASSERT (flat);
+      TS_ASSERT_EQUALS (cbuf.get_chunk_count (), 1u);
+      TS_ASSERT_EQUALS (memcmp (flat, obuf.get_data (), obuf.get_size ()), 0);
+
+      kvr::value *dval = m_ctx->create_value ();
+      ok = dval->decode (codecs [c], flat, cbuf.get_size ());
+      TS_ASSERT (ok);
+      TS_ASSERT_EQUALS (dval->hash (), val->hash ());
+      m_ctx->destroy_value (dval);
+
+      // a failed re-encode leaves the kept head chunk empty
+      TS_ASSERT (!val->encode (kvr::CODEC_KVRB, &cbuf));
+      TS_ASSERT_EQUALS (cbuf.get_size (), 0u);
+      TS_ASSERT_EQUALS (cbuf.get_chunk_count (), 0u);
+      TS_ASSERT_EQUALS (cbuf.get_chunks (vec, 512), 0u);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testBufferPool ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_allocator : public kvr::allocator
+    {
+    public:
+
+      counting_allocator () : m_count (0), m_live (0) {}
+      void * allocate (size_t sz) { ++m_count; ++m_live; return malloc (sz); }
+      void   deallocate (void *p, size_t) { --m_live; free (p); }
+
+      size_t m_count;
+      size_t m_live;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 2000; ++i)
+      {
+        a->push (i);
+        a->push ("payload");
+      }
+    }
+
+    ///////////////////////////////
+    // steady state encodes don't allocate
+    ///////////////////////////////
+
+    counting_allocator heap;
+    {
+      kvr::buffer_pool pool (4, &heap);
+
+      size_t size = 0;
+      for (int i = 0; i < 4; ++i)
+      {
+        kvr::obuffer obuf (&pool);
+        bool ok = val->encode (kvr::CODEC_MSGPACK, &obuf);
+        TS_ASSERT (ok);
+        size = obuf.get_size ();
+      }
+
+      TS_ASSERT (pool.suggest_size () > size);
+
+      size_t count = heap.m_count;
+      for (int i = 0; i < 16; ++i)
+      {
+        kvr::obuffer obuf (&pool);
+        bool ok = val->encode (kvr::CODEC_MSGPACK, &obuf);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (obuf.get_size (), size);
+      }
+      TS_ASSERT_EQUALS (heap.m_count, count);
+
+      pool.trim ();
+      TS_ASSERT_EQUALS (heap.m_live, 0u);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testScan ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_handler : public kvr::handler
+    {
+    public:
+
+      counting_handler () : m_scalars (0), m_keys (0), m_maps (0), m_arrays (0), m_found (false), m_sum (0) {}
+
+      bool on_null () { ++m_scalars; return true; }
+      bool on_boolean (bool) { ++m_scalars; return true; }
+      bool on_integer (int64_t i) { ++m_scalars; m_sum += i; return true; }
+      bool on_float (double) { ++m_scalars; return true; }
+      bool on_string (const char *str, kvr::sz_t length)
+      {
+        ++m_scalars;
+        if (m_found) { m_match.assign (str, length); m_found = false; }
+        return true;
+      }
+      bool on_key (const char *str, kvr::sz_t length)
+      {
+        ++m_keys;
+        m_found = (length == 6) && (memcmp (str, "sesame", 6) == 0);
+        return true;
+      }
+      bool on_map_start (kvr::sz_t) { ++m_maps; return true; }
+      bool on_map_end (kvr::sz_t) { return true; }
+      bool on_array_start (kvr::sz_t) { ++m_arrays; return true; }
+      bool on_array_end (kvr::sz_t length) { TS_ASSERT_EQUALS (length, 4u); return true; }
+
+      size_t m_scalars, m_keys, m_maps, m_arrays;
+      bool m_found;
+      int64_t m_sum;
+      std::string m_match;
+    };
+
+    class stop_handler : public kvr::handler
+    {
+    public:
+
+      stop_handler () : m_keys (0) {}
+      bool on_key (const char *, kvr::sz_t) { return (++m_keys < 2); }
+
+      size_t m_keys;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("pi", 3.1416);
+      val->insert ("sesame", "street");
+      val->insert_null ("none");
+      kvr::value *a = val->insert_array ("a");
+      {
+        a->push (1);
+        a->push (20);
+        a->push (300);
+        a->push (false);
+      }
+      kvr::value *m = val->insert_map ("m");
+      {
+        m->insert ("b", 4000);
+      }
+    }
+
+    ///////////////////////////////
+    // events match the tree, memory and stream
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      for (int s = 0; s < 2; ++s)
+      {
+        counting_handler h;
+        simple_istream istr (obuf.get_data (), obuf.get_size ());
+        ok = (s == 0) ? kvr::scan (codecs [c], obuf.get_data (), obuf.get_size (), &h) : kvr::scan (codecs [c], istr, &h);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (h.m_scalars, 8u);
+        TS_ASSERT_EQUALS (h.m_keys, 6u);
+        TS_ASSERT_EQUALS (h.m_maps, 2u);
+        TS_ASSERT_EQUALS (h.m_arrays, 1u);
+        TS_ASSERT_EQUALS (h.m_sum, 4321);
+        TS_ASSERT_EQUALS (h.m_match, std::string ("street"));
+      }
+
+      stop_handler stop;
+      ok = kvr::scan (codecs [c], obuf.get_data (), obuf.get_size (), &stop);
+      TS_ASSERT (!ok);
+      TS_ASSERT_EQUALS (stop.m_keys, 2u);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testTranscode ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", true);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 40; ++i)
+      {
+        a->push (i * -4099);
+      }
+      kvr::value *m = val->insert_map ("m");
+      {
+        m->insert ("i", 70000);
+        m->insert_array ("e")->push ("x");
+      }
+    }
+
+    ///////////////////////////////
+    // every codec pair, memory and stream
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const size_t ncodecs = sizeof (codecs) / sizeof (codecs [0]);
+
+    for (size_t f = 0; f < ncodecs; ++f)
+    {
+      kvr::obuffer src;
+      bool ok = val->encode (codecs [f], &src);
+      TS_ASSERT (ok);
+
+      for (size_t t = 0; t < ncodecs; ++t)
+      {
+        kvr::obuffer ref;
+        ok = val->encode (codecs [t], &ref);
+        TS_ASSERT (ok);
+
+        kvr::obuffer obuf;
+        ok = kvr::transcode (codecs [f], src.get_data (), src.get_size (), codecs [t], &obuf);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (obuf.get_size (), ref.get_size ());
+        TS_ASSERT_EQUALS (memcmp (obuf.get_data (), ref.get_data (), ref.get_size ()), 0);
+
+        simple_istream istr (src.get_data (), src.get_size ());
+        simple_ostream ostr;
+        ok = kvr::transcode (codecs [f], istr, codecs [t], &ostr);
+        TS_ASSERT (ok);
+
+        if ((codecs [f] == kvr::CODEC_JSON) && (codecs [t] == kvr::CODEC_CBOR))
+        {
+          // streamed in one pass: indefinite-length containers
+          TS_ASSERT_EQUALS (ostr.m_os.buffer () [0], 0xbf);
+          TS_ASSERT_EQUALS (ostr.m_os.buffer () [ostr.m_os.tell () - 1], 0xff);
+        }
+        else
+        {
+          TS_ASSERT_EQUALS (ostr.m_os.tell (), ref.get_size ());
+          TS_ASSERT_EQUALS (memcmp (ostr.m_os.buffer (), ref.get_data (), ref.get_size ()), 0);
+        }
+
+        kvr::value *dst = m_ctx->create_value ();
+        ok = dst->decode (codecs [t], obuf.get_data (), obuf.get_size ());
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+        ok = dst->decode (codecs [t], ostr.m_os.buffer (), ostr.m_os.tell ());
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+        m_ctx->destroy_value (dst);
+      }
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testStreamWriter ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", true);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 100; ++i)
+      {
+        a->push (i * -4099);
+      }
+      kvr::value *m = val->insert_map ("m");
+      {
+        m->insert ("i", 70000);
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer ref;
+      bool ok = val->encode (codecs [c], &ref);
+      TS_ASSERT (ok);
+
+      ///////////////////////////////
+      // same bytes as encoding the tree
+      ///////////////////////////////
+
+      kvr::obuffer obuf;
+      {
+        kvr::stream_writer wrt (codecs [c], &obuf);
+        ok = wrt.begin_map (6);
+        ok = ok && wrt.key ("sesame") && wrt.string ("street");
+        ok = ok && wrt.key ("t") && wrt.boolean (true);
+        ok = ok && wrt.key ("n") && wrt.null ();
+        ok = ok && wrt.key ("pi") && wrt.float64 (3.1416);
+        ok = ok && wrt.key ("a") && wrt.begin_array (100);
+        for (int i = 0; ok && (i < 100); ++i)
+        {
+          ok = wrt.int64 (i * -4099);
+        }
+        ok = ok && wrt.end_array ();
+        ok = ok && wrt.key ("m") && wrt.write_value (val->find ("m"));
+        ok = ok && wrt.end_map ();
+        ok = ok && wrt.finish ();
+        TS_ASSERT (ok);
+      }
+      TS_ASSERT_EQUALS (obuf.get_size (), ref.get_size ());
+      TS_ASSERT_EQUALS (memcmp (obuf.get_data (), ref.get_data (), ref.get_size ()), 0);
+
+      ///////////////////////////////
+      // unknown sizes to an ostream (not msgpack)
+      ///////////////////////////////
+
+      simple_ostream ostr;
+      {
+        kvr::stream_writer wrt (codecs [c], &ostr);
+        ok = wrt.begin_array ();
+        if (codecs [c] == kvr::CODEC_MSGPACK)
+        {
+          TS_ASSERT (!ok);
+          TS_ASSERT (!wrt.int64 (1));
+          continue;
+        }
+        for (int i = 0; ok && (i < 5000); ++i)
+        {
+          ok = wrt.begin_map () && wrt.key ("id") && wrt.int64 (i) && wrt.end_map ();
+        }
+        ok = ok && wrt.end_array ();
+        ok = ok && wrt.finish ();
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (ostr.m_flushes, 1u);
+      }
+
+      kvr::value *dst = m_ctx->create_value ();
+      ok = dst->decode (codecs [c], ostr.m_os.buffer (), ostr.m_os.tell ());
+      TS_ASSERT (ok);
+      TS_ASSERT_EQUALS (dst->length (), 5000u);
+      TS_ASSERT_EQUALS (dst->element (4999)->find ("id")->get_integer (), 4999);
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // out of sequence calls fail
+    ///////////////////////////////
+
+    {
+      kvr::obuffer obuf;
+      kvr::stream_writer wrt (kvr::CODEC_CBOR, &obuf);
+      TS_ASSERT (wrt.begin_map (1));
+      TS_ASSERT (!wrt.int64 (1)); // no key
+      TS_ASSERT (!wrt.end_map ());
+      TS_ASSERT (!wrt.finish ());
+    }
+
+    {
+      kvr::obuffer obuf;
+      kvr::stream_writer wrt (kvr::CODEC_CBOR, &obuf);
+      TS_ASSERT (wrt.begin_array (2));
+      TS_ASSERT (wrt.int64 (1));
+      TS_ASSERT (!wrt.end_array ()); // short
+    }
+
+    {
+      kvr::obuffer obuf;
+      kvr::stream_writer wrt (kvr::CODEC_JSON, &obuf);
+      TS_ASSERT (wrt.int64 (1));
+      TS_ASSERT (!wrt.int64 (2)); // second root
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testPushDecoder ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("quote", "{\"[ \\\" ]}");
+      val->insert ("t", true);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      std::string big (3000, 'x');
+      val->insert ("big", big.c_str ());
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 100; ++i)
+      {
+        a->push (i * -4099);
+      }
+      kvr::value *m = val->insert_map ("m");
+      {
+        m->insert ("i", 70000);
+        m->insert_array ("e");
+        m->insert_map ("o");
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      const uint8_t *data = obuf.get_data ();
+      const size_t size = obuf.get_size ();
+
+      ///////////////////////////////
+      // any fragmentation gives the same tree
+      ///////////////////////////////
+
+      const size_t fragments [] = { 1, 7, 64, size };
+
+      for (size_t f = 0; f < (sizeof (fragments) / sizeof (fragments [0])); ++f)
+      {
+        kvr::value *dst = m_ctx->create_value ();
+        kvr::push_decoder dec (codecs [c], dst);
+
+        kvr::push_decoder::status_t st = kvr::push_decoder::STATUS_NEED_MORE;
+        size_t pos = 0;
+        while (pos < size)
+        {
+          TS_ASSERT_EQUALS (st, kvr::push_decoder::STATUS_NEED_MORE);
+          size_t n = ((pos + fragments [f]) < size) ? fragments [f] : (size - pos);
+          size_t used = 0;
+          st = dec.feed (&data [pos], n, &used);
+          TS_ASSERT_EQUALS (used, n);
+          pos += n;
+        }
+
+        TS_ASSERT_EQUALS (st, kvr::push_decoder::STATUS_DONE);
+        TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+        m_ctx->destroy_value (dst);
+      }
+
+      ///////////////////////////////
+      // back to back documents
+      ///////////////////////////////
+
+      kvr::mem_ostream two (size * 2);
+      two.write (const_cast<uint8_t *>(data), size);
+      two.write (const_cast<uint8_t *>(data), size);
+
+      kvr::value *dst = m_ctx->create_value ();
+      kvr::push_decoder dec (codecs [c], dst);
+
+      size_t used = 0;
+      TS_ASSERT_EQUALS (dec.feed (two.buffer (), two.tell (), &used), kvr::push_decoder::STATUS_DONE);
+      TS_ASSERT_EQUALS (used, size);
+      TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+
+      dec.reset ();
+      TS_ASSERT (dst->is_null ());
+      TS_ASSERT_EQUALS (dec.feed (two.buffer () + used, two.tell () - used, &used), kvr::push_decoder::STATUS_DONE);
+      TS_ASSERT_EQUALS (used, size);
+      TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+
+      ///////////////////////////////
+      // errors stick until reset
+      ///////////////////////////////
+
+      const uint8_t bad [] = { 0xc1, 0x5d, 0xc1 };
+      dec.reset ();
+      TS_ASSERT_EQUALS (dec.feed (bad, sizeof (bad)), kvr::push_decoder::STATUS_ERROR);
+      TS_ASSERT_EQUALS (dec.feed (data, size), kvr::push_decoder::STATUS_ERROR);
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // cbor indefinite-length, byte by byte
+    ///////////////////////////////
+
+    {
+      kvr::obuffer obuf;
+      kvr::stream_writer wrt (kvr::CODEC_CBOR, &obuf);
+      bool ok = wrt.begin_map () && wrt.key ("a") && wrt.begin_array ();
+      for (int i = 0; ok && (i < 10); ++i)
+      {
+        ok = wrt.int64 (i);
+      }
+      ok = ok && wrt.end_array () && wrt.key ("s") && wrt.string ("x") && wrt.end_map () && wrt.finish ();
+      TS_ASSERT (ok);
+
+      kvr::value *dst = m_ctx->create_value ();
+      kvr::push_decoder dec (kvr::CODEC_CBOR, dst);
+      kvr::push_decoder::status_t st = kvr::push_decoder::STATUS_NEED_MORE;
+      for (size_t i = 0; i < obuf.get_size (); ++i)
+      {
+        st = dec.feed (obuf.get_data () + i, 1);
+      }
+      TS_ASSERT_EQUALS (st, kvr::push_decoder::STATUS_DONE);
+      TS_ASSERT_EQUALS (dst->find ("a")->length (), 10u);
+      TS_ASSERT_EQUALS (dst->find ("a")->element (9)->get_integer (), 9);
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testPullEncoder ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", false);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      std::string big (5000, 'y');
+      val->insert ("big", big.c_str ());
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 200; ++i)
+      {
+        kvr::value *m = a->push_map ();
+        m->insert ("i", i * 70001);
+        m->insert_array ("e");
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      ///////////////////////////////
+      // same bytes whatever the chunk size
+      ///////////////////////////////
+
+      const size_t caps [] = { 1, 7, 4096 };
+
+      for (size_t k = 0; k < (sizeof (caps) / sizeof (caps [0])); ++k)
+      {
+        kvr::pull_encoder enc (codecs [c], val);
+        kvr::mem_ostream out (64u);
+        uint8_t chunk [4096];
+
+        size_t n = 0;
+        while ((n = enc.produce (chunk, caps [k])) == caps [k])
+        {
+          out.write (chunk, n);
+        }
+        out.write (chunk, n);
+
+        TS_ASSERT (enc.done ());
+        TS_ASSERT (!enc.failed ());
+        TS_ASSERT_EQUALS (enc.produce (chunk, caps [k]), 0u);
+        TS_ASSERT_EQUALS (out.tell (), obuf.get_size ());
+        TS_ASSERT_EQUALS (memcmp (out.buffer (), obuf.get_data (), obuf.get_size ()), 0);
+      }
+
+      ///////////////////////////////
+      // interleaved documents
+      ///////////////////////////////
+
+      kvr::pull_encoder enc0 (codecs [c], val);
+      kvr::pull_encoder enc1 (codecs [c], val->find ("a"));
+      kvr::mem_ostream out0 (64u);
+      kvr::mem_ostream out1 (64u);
+      uint8_t chunk [13];
+
+      while (!enc0.done () || !enc1.done ())
+      {
+        size_t n0 = enc0.produce (chunk, sizeof (chunk));
+        out0.write (chunk, n0);
+        size_t n1 = enc1.produce (chunk, sizeof (chunk));
+        out1.write (chunk, n1);
+        TS_ASSERT (!enc0.failed () && !enc1.failed ());
+      }
+
+      // json decode wants a terminated buffer
+      out0.put (0); out0.pop (1);
+      out1.put (0); out1.pop (1);
+
+      kvr::value *dst = m_ctx->create_value ();
+      TS_ASSERT (dst->decode (codecs [c], out0.buffer (), out0.tell ()));
+      TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+      TS_ASSERT (dst->decode (codecs [c], out1.buffer (), out1.tell ()));
+      TS_ASSERT_EQUALS (dst->hash (), val->find ("a")->hash ());
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testView ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", true);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      val->insert ("big", (int64_t) 5000000000LL);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 20; ++i)
+      {
+        kvr::value *m = a->push_map ();
+        m->insert ("i", i);
+        m->insert ("name", (i == 7) ? "bob" : "alice");
+        m->insert_array ("e");
+      }
+      val->insert_map ("empty");
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      kvr::mem_istream istr (obuf.get_data (), obuf.get_size ());
+      kvr::view root (codecs [c], istr);
+
+      TS_ASSERT (root.is_valid ());
+      TS_ASSERT (root.is_map ());
+      TS_ASSERT_EQUALS (root.size (), val->size ());
+      TS_ASSERT_EQUALS (root.encoded_size (), obuf.get_size ());
+
+      ///////////////////////////////
+      // scalars
+      ///////////////////////////////
+
+      kvr::sz_t len = 0;
+      const char *str = root.find ("sesame").get_string (&len);
+      TS_ASSERT_EQUALS (std::string (str, len), "street");
+      TS_ASSERT (root.find ("t").get_boolean ());
+      TS_ASSERT (root.find ("n").is_null ());
+      TS_ASSERT_DELTA (root.find ("pi").get_float (), 3.1416, 0.00001);
+      TS_ASSERT_EQUALS (root.find ("big").get_integer (), (int64_t) 5000000000LL);
+      TS_ASSERT (!root.find ("nope").is_valid ());
+      TS_ASSERT (!root.find ("nope").is_null ());
+
+      ///////////////////////////////
+      // containers and search
+      ///////////////////////////////
+
+      kvr::view a = root.find ("a");
+      TS_ASSERT (a.is_array ());
+      TS_ASSERT_EQUALS (a.length (), 20u);
+      TS_ASSERT_EQUALS (a.element (19).find ("i").get_integer (), 19);
+      TS_ASSERT (!a.element (20).is_valid ());
+      TS_ASSERT_EQUALS (root.search ("a/3/i").get_integer (), 3);
+      TS_ASSERT_EQUALS (root.search ("a/@name=bob/i").get_integer (), 7);
+      TS_ASSERT (!root.search ("a/@name=carol").is_valid ());
+      const char *path [] = { "a", "5", "e" };
+      TS_ASSERT (root.search (path, 3).is_array ());
+      TS_ASSERT_EQUALS (root.search (path, 3).length (), 0u);
+      TS_ASSERT_EQUALS (root.find ("empty").size (), 0u);
+
+      ///////////////////////////////
+      // cursors
+      ///////////////////////////////
+
+      kvr::view::cursor mc (root);
+      kvr::view k, v;
+      kvr::sz_t pairs = 0;
+      while (mc.get (&k, &v))
+      {
+        const char *ks = k.get_string (&len);
+        TS_ASSERT (val->find (std::string (ks, len).c_str ()));
+        ++pairs;
+      }
+      TS_ASSERT_EQUALS (pairs, val->size ());
+
+      kvr::view::cursor ac (a);
+      kvr::sz_t elems = 0;
+      while (ac.get (&v))
+      {
+        TS_ASSERT_EQUALS (v.find ("i").get_integer (), (int64_t) elems);
+        ++elems;
+      }
+      TS_ASSERT_EQUALS (elems, 20u);
+
+      ///////////////////////////////
+      // materialize
+      ///////////////////////////////
+
+      kvr::value *dst = m_ctx->create_value ();
+      TS_ASSERT (root.materialize (dst));
+      TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+      TS_ASSERT (root.search ("a/7").materialize (dst));
+      TS_ASSERT_EQUALS (dst->hash (), val->search ("a/7")->hash ());
+      TS_ASSERT (root.find ("pi").materialize (dst));
+      TS_ASSERT (dst->is_float ());
+      m_ctx->destroy_value (dst);
+
+      ///////////////////////////////
+      // truncated input
+      ///////////////////////////////
+
+      kvr::view cut (codecs [c], obuf.get_data (), obuf.get_size () - 1);
+      TS_ASSERT (cut.is_map ());
+      TS_ASSERT_EQUALS (cut.encoded_size (), 0u);
+      TS_ASSERT (cut.find ("sesame").is_string ());
+    }
+
+    ///////////////////////////////
+    // cbor indefinite-length
+    ///////////////////////////////
+
+    {
+      kvr::obuffer obuf;
+      kvr::stream_writer wrt (kvr::CODEC_CBOR, &obuf);
+      bool ok = wrt.begin_map () && wrt.key ("a") && wrt.begin_array ();
+      for (int i = 0; ok && (i < 10); ++i)
+      {
+        ok = wrt.int64 (i);
+      }
+      ok = ok && wrt.end_array () && wrt.key ("s") && wrt.string ("x") && wrt.end_map () && wrt.finish ();
+      TS_ASSERT (ok);
+
+      kvr::view root (kvr::CODEC_CBOR, obuf.get_data (), obuf.get_size ());
+      TS_ASSERT_EQUALS (root.size (), 2u);
+      TS_ASSERT_EQUALS (root.find ("a").length (), 10u);
+      TS_ASSERT_EQUALS (root.search ("a/9").get_integer (), 9);
+      TS_ASSERT (root.find ("s").is_string ());
+      TS_ASSERT_EQUALS (root.encoded_size (), obuf.get_size ());
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testDecodeProjection ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      char key [16];
+      for (int i = 0; i < 300; ++i)
+      {
+        sprintf (key, "f%d", i);
+        val->insert (key, i);
+      }
+      kvr::value *nested = val->insert_map ("nested");
+      {
+        kvr::value *a = nested->insert_array ("a");
+        for (int i = 0; i < 5; ++i)
+        {
+          a->push (i * 1.5);
+        }
+        kvr::value *b = nested->insert_map ("b");
+        b->insert ("s", "{[\"]}");
+        b->insert_array ("e");
+        nested->insert ("skip", "me");
+      }
+      kvr::value *arr = val->insert_array ("arr");
+      for (int i = 0; i < 3; ++i)
+      {
+        kvr::value *m = arr->push_map ();
+        m->insert ("x", i);
+        m->insert ("y", "why");
+      }
+      val->insert ("q\"k", true);
+    }
+
+    const char *paths [] = { "f17", "nested/a/2", "nested/b", "arr/1/x", "missing/x", "f5/deeper", "q\"k" };
+    const kvr::sz_t pathsz = sizeof (paths) / sizeof (paths [0]);
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      bool ok = val->encode (codecs [c], &obuf);
+      TS_ASSERT (ok);
+
+      kvr::value *dst = m_ctx->create_value ();
+      ok = dst->decode (codecs [c], obuf.get_data (), obuf.get_size (), paths, pathsz);
+      TS_ASSERT (ok);
+
+      TS_ASSERT_EQUALS (dst->size (), 4u);
+      TS_ASSERT_EQUALS (dst->find ("f17")->get_integer (), 17);
+      TS_ASSERT (!dst->find ("f5"));
+      TS_ASSERT (!dst->find ("missing"));
+      TS_ASSERT (dst->find ("q\"k")->get_boolean ());
+
+      kvr::value *nested = dst->find ("nested");
+      TS_ASSERT_EQUALS (nested->size (), 2u);
+      TS_ASSERT_EQUALS (nested->find ("a")->length (), 1u);
+      TS_ASSERT_DELTA (nested->find ("a")->element (0)->get_float (), 3.0, 0.0001);
+      TS_ASSERT_EQUALS (nested->find ("b")->hash (), val->search ("nested/b")->hash ());
+
+      kvr::value *arr = dst->find ("arr");
+      TS_ASSERT_EQUALS (arr->length (), 1u);
+      TS_ASSERT_EQUALS (arr->element (0)->size (), 1u);
+      TS_ASSERT_EQUALS (arr->element (0)->find ("x")->get_integer (), 1);
+
+      // no paths, empty root
+      ok = dst->decode (codecs [c], obuf.get_data (), obuf.get_size (), NULL, 0);
+      TS_ASSERT (ok);
+      TS_ASSERT (dst->is_map ());
+      TS_ASSERT_EQUALS (dst->size (), 0u);
+
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // json comments and whitespace
+    ///////////////////////////////
+
+    {
+      const char *json = " { \"a\" : [ 1 , { \"b\" : \"x]\" } , 3 ] ,\n \"c\" : { \"d\" : null } } ";
+      const char *jpaths [] = { "a/1/b", "c/d" };
+
+      kvr::value *dst = m_ctx->create_value ();
+      bool ok = dst->decode (kvr::CODEC_JSON, (const uint8_t *) json, strlen (json), jpaths, 2);
+      TS_ASSERT (ok);
+      TS_ASSERT_EQUALS (std::string (dst->search ("a/0/b")->get_string ()), "x]");
+      TS_ASSERT (dst->search ("c/d")->is_null ());
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testDecodeUpdate ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_allocator : public kvr::allocator
+    {
+    public:
+
+      counting_allocator () : m_count (0) {}
+      void * allocate (size_t sz) { ++m_count; return malloc (sz); }
+      void   deallocate (void *p, size_t) { free (p); }
+
+      size_t m_count;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *va = m_ctx->create_value ()->conv_map ();
+    kvr::value *vb = m_ctx->create_value ()->conv_map ();
+    {
+      char key [16];
+      for (int i = 0; i < 200; ++i)
+      {
+        sprintf (key, "k%d", i);
+        va->insert (key, i);
+        vb->insert (key, i + 1);
+      }
+
+      va->insert ("gone", "soon");
+      vb->insert ("new", "here");
+      va->insert ("type", 1);
+      vb->insert ("type", "changed to a long dynamic string value");
+      va->insert ("s", "a long dynamic string value, first version");
+      vb->insert ("s", "");
+
+      kvr::value *aa = va->insert_array ("arr");
+      kvr::value *ab = vb->insert_array ("arr");
+      for (int i = 0; i < 50; ++i)
+      {
+        aa->push_map ()->insert ("x", i);
+        if (i < 40) { ab->push_map ()->insert ("x", -i); }
+      }
+      ab->push (1.5);
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer bufa, bufb;
+      bool ok = va->encode (codecs [c], &bufa) && vb->encode (codecs [c], &bufb);
+      TS_ASSERT (ok);
+
+      counting_allocator heap;
+      kvr::ctx *ctx = kvr::ctx::create (&heap);
+      kvr::value *dst = ctx->create_value ();
+
+      ///////////////////////////////
+      // same result as a fresh decode
+      ///////////////////////////////
+
+      TS_ASSERT (dst->decode_update (codecs [c], bufa.get_data (), bufa.get_size ()));
+      TS_ASSERT_EQUALS (dst->hash (), va->hash ());
+
+      TS_ASSERT (dst->decode_update (codecs [c], bufb.get_data (), bufb.get_size ()));
+      TS_ASSERT_EQUALS (dst->hash (), vb->hash ());
+      TS_ASSERT (!dst->find ("gone"));
+      TS_ASSERT_EQUALS (dst->find ("arr")->length (), 41u);
+
+      TS_ASSERT (dst->decode_update (codecs [c], bufa.get_data (), bufa.get_size ()));
+      TS_ASSERT_EQUALS (dst->hash (), va->hash ());
+
+      ///////////////////////////////
+      // an unchanged document allocates nothing
+      ///////////////////////////////
+
+      size_t before = heap.m_count;
+      TS_ASSERT (dst->decode_update (codecs [c], bufa.get_data (), bufa.get_size ()));
+      TS_ASSERT_EQUALS (heap.m_count, before);
+      TS_ASSERT_EQUALS (dst->hash (), va->hash ());
+
+      ctx->destroy_value (dst);
+      kvr::ctx::destroy (ctx);
+    }
+
+    ///////////////////////////////
+    // repeated keys
+    ///////////////////////////////
+
+    // two events for "a" but one entry: "b" must still go
+    {
+      const char *olddoc = "{\"a\":0,\"b\":{\"c\":1,\"d\":2}}";
+      const char *newdoc = "{\"a\":1,\"a\":2,\"b\":{\"c\":3,\"c\":4}}";
+
+      kvr::value *dst = m_ctx->create_value ();
+      TS_ASSERT (dst->decode (kvr::CODEC_JSON, (const uint8_t *) olddoc, strlen (olddoc)));
+      TS_ASSERT (dst->decode_update (kvr::CODEC_JSON, (const uint8_t *) newdoc, strlen (newdoc)));
+
+      // the last of the repeated values wins
+      const char *refdoc = "{\"a\":2,\"b\":{\"c\":4}}";
+      kvr::value *ref = m_ctx->create_value ();
+      TS_ASSERT (ref->decode (kvr::CODEC_JSON, (const uint8_t *) refdoc, strlen (refdoc)));
+
+      TS_ASSERT_EQUALS (dst->size (), 2u);
+      TS_ASSERT_EQUALS (dst->find ("b")->size (), 1u);
+      TS_ASSERT (dst->find ("b")->find ("d") == NULL);
+      TS_ASSERT_EQUALS (dst->hash (), ref->hash ());
+
+      // again over itself, and over a map missing "b"
+      const char *shortdoc = "{\"a\":5,\"a\":6}";
+      TS_ASSERT (dst->decode_update (kvr::CODEC_JSON, (const uint8_t *) shortdoc, strlen (shortdoc)));
+      TS_ASSERT_EQUALS (dst->size (), 1u);
+      TS_ASSERT (dst->find ("b") == NULL);
+
+      m_ctx->destroy_value (ref);
+      m_ctx->destroy_value (dst);
+    }
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (va);
+    m_ctx->destroy_value (vb);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testRecordReader ()
+  {
+    class chunk_istream : public kvr::istream
+    {
+    public:
+
+      chunk_istream (const uint8_t *data, size_t size, size_t chunk) : m_data (data), m_size (size), m_pos (0), m_chunk (chunk) {}
+      bool get (uint8_t *byte) { if (m_pos < m_size) { *byte = m_data [m_pos++]; return true; } return false; }
+      bool read (uint8_t *bytes, size_t count) { if ((m_pos + count) > m_size) { return false; } memcpy (bytes, &m_data [m_pos], count); m_pos += count; return true; }
+      size_t tell () { return m_pos; }
+      uint8_t peek () { return (m_pos < m_size) ? m_data [m_pos] : 0; }
+      size_t fetch (uint8_t *bytes, size_t count)
+      {
+        size_t n = count < m_chunk ? count : m_chunk;
+        n = (m_pos + n) > m_size ? (m_size - m_pos) : n;
+        memcpy (bytes, &m_data [m_pos], n);
+        m_pos += n;
+        return n;
+      }
+
+    private:
+
+      const uint8_t * m_data;
+      size_t          m_size;
+      size_t          m_pos;
+      size_t          m_chunk;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    const size_t nrecords = 50;
+    kvr::value *records [nrecords];
+
+    for (size_t r = 0; r < nrecords; ++r)
+    {
+      records [r] = m_ctx->create_value ()->conv_map ();
+      records [r]->insert ("id", (int64_t) r);
+      records [r]->insert ("name", (r & 1) ? "odd\nrecord" : "even");
+      kvr::value *a = records [r]->insert_array ("a");
+      for (size_t i = 0; i < (r % 20); ++i)
+      {
+        a->push ((int64_t) (i * 1000));
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::mem_ostream stream (64u);
+      for (size_t r = 0; r < nrecords; ++r)
+      {
+        kvr::obuffer obuf;
+        bool ok = records [r]->encode (codecs [c], &obuf);
+        TS_ASSERT (ok);
+        stream.write (const_cast<uint8_t *> (obuf.get_data ()), obuf.get_size ());
+        if (codecs [c] == kvr::CODEC_JSON)
+        {
+          stream.put ('\n');
+        }
+      }
+
+      const uint8_t *data = stream.buffer ();
+      const size_t size = stream.tell ();
+
+      ///////////////////////////////
+      // memory, one record at a time into a reused value
+      ///////////////////////////////
+      {
+        kvr::record_reader reader (codecs [c], data, size);
+        kvr::value *dst = m_ctx->create_value ();
+
+        size_t r = 0;
+        while (reader.next (dst))
+        {
+          TS_ASSERT (r < nrecords);
+          TS_ASSERT_EQUALS (dst->hash (), records [r]->hash ());
+          ++r;
+        }
+
+        TS_ASSERT_EQUALS (r, nrecords);
+        TS_ASSERT_EQUALS (reader.count (), nrecords);
+        TS_ASSERT (!reader.failed ());
+        TS_ASSERT (!reader.next (dst));
+        m_ctx->destroy_value (dst);
+      }
+
+      ///////////////////////////////
+      // stream (records split across fetches), batches
+      ///////////////////////////////
+
+      const size_t chunks [] = { 1, 13, 4096 };
+
+      for (size_t k = 0; k < (sizeof (chunks) / sizeof (chunks [0])); ++k)
+      {
+        chunk_istream istr (data, size, chunks [k]);
+        kvr::record_reader reader (codecs [c], &istr);
+
+        kvr::value *batch [8];
+        for (size_t b = 0; b < 8; ++b)
+        {
+          batch [b] = m_ctx->create_value ();
+        }
+
+        size_t r = 0;
+        size_t n = 0;
+        while ((n = reader.next_batch (batch, 8)) > 0)
+        {
+          for (size_t b = 0; b < n; ++b, ++r)
+          {
+            TS_ASSERT_EQUALS (batch [b]->hash (), records [r]->hash ());
+          }
+        }
+
+        TS_ASSERT_EQUALS (r, nrecords);
+        TS_ASSERT (!reader.failed ());
+
+        for (size_t b = 0; b < 8; ++b)
+        {
+          m_ctx->destroy_value (batch [b]);
+        }
+      }
+
+      ///////////////////////////////
+      // truncated last record
+      ///////////////////////////////
+      {
+        kvr::record_reader reader (codecs [c], data, size - ((codecs [c] == kvr::CODEC_JSON) ? 3 : 1));
+        kvr::value *dst = m_ctx->create_value ();
+
+        size_t r = 0;
+        while (reader.next (dst))
+        {
+          ++r;
+        }
+
+        TS_ASSERT_EQUALS (r, nrecords - 1);
+        TS_ASSERT (reader.failed ());
+        m_ctx->destroy_value (dst);
+      }
+    }
+
+    ///////////////////////////////
+    // blank lines, crlf and garbage
+    ///////////////////////////////
+    {
+      const char *text = "\r\n{\"a\":1}\r\n\r\n\n[1,2]\n   \n";
+      kvr::record_reader reader (kvr::CODEC_JSON, (const uint8_t *) text, strlen (text));
+      kvr::value *dst = m_ctx->create_value ();
+
+      TS_ASSERT (reader.next (dst));
+      TS_ASSERT (dst->is_map () && dst->find ("a"));
+      TS_ASSERT (reader.next (dst));
+      TS_ASSERT (dst->is_array () && (dst->length () == 2));
+      TS_ASSERT (!reader.next (dst));
+      TS_ASSERT (!reader.failed ());
+
+      const char *bad = "{\"a\":1}\n{\"a\":}\n{\"a\":3}\n";
+      kvr::record_reader badreader (kvr::CODEC_JSON, (const uint8_t *) bad, strlen (bad));
+      TS_ASSERT (badreader.next (dst));
+      TS_ASSERT (!badreader.next (dst));
+      TS_ASSERT (badreader.failed ());
+      TS_ASSERT (!badreader.next (dst));
+
+      m_ctx->destroy_value (dst);
+    }
+
+    for (size_t r = 0; r < nrecords; ++r)
+    {
+      m_ctx->destroy_value (records [r]);
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testParallelDecoder ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    const size_t nrecords = 203;
+    kvr::value *records [nrecords];
+
+    for (size_t r = 0; r < nrecords; ++r)
+    {
+      records [r] = m_ctx->create_value ()->conv_map ();
+      records [r]->insert ("id", (int64_t) r);
+      records [r]->insert ("name", (r & 1) ? "odd\nrecord" : "even");
+      kvr::value *a = records [r]->insert_array ("a");
+      for (size_t i = 0; i < (r % 20); ++i)
+      {
+        a->push ((int64_t) (i * 1000));
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const size_t threads [] = { 1, 3, 8 };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::mem_ostream stream (64u);
+      for (size_t r = 0; r < nrecords; ++r)
+      {
+        kvr::obuffer obuf;
+        bool ok = records [r]->encode (codecs [c], &obuf);
+        TS_ASSERT (ok);
+        stream.write (const_cast<uint8_t *> (obuf.get_data ()), obuf.get_size ());
+        if (codecs [c] == kvr::CODEC_JSON)
+        {
+          stream.put ('\n');
+          if ((r % 50) == 0) { stream.put ('\n'); }
+        }
+      }
+
+      const uint8_t *data = stream.buffer ();
+      const size_t size = stream.tell ();
+
+      for (size_t t = 0; t < (sizeof (threads) / sizeof (threads [0])); ++t)
+      {
+        kvr::parallel_decoder decoder (threads [t]);
+
+        ///////////////////////////////
+        // in order, twice with the same decoder
+        ///////////////////////////////
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+          bool ok = decoder.decode (codecs [c], data, size);
+          TS_ASSERT (ok);
+          TS_ASSERT_EQUALS (decoder.count (), nrecords);
+
+          for (size_t r = 0; r < decoder.count (); ++r)
+          {
+            TS_ASSERT_EQUALS (decoder.get (r)->hash (), records [r]->hash ());
+          }
+        }
+
+        ///////////////////////////////
+        // merge
+        ///////////////////////////////
+
+        kvr::value *merged = m_ctx->create_value ();
+        TS_ASSERT (decoder.merge (merged));
+        TS_ASSERT (merged->is_array ());
+        TS_ASSERT_EQUALS (merged->length (), nrecords);
+        TS_ASSERT_EQUALS (merged->element (nrecords - 1)->hash (), records [nrecords - 1]->hash ());
+        m_ctx->destroy_value (merged);
+
+        ///////////////////////////////
+        // truncated input fails and releases everything
+        ///////////////////////////////
+
+        TS_ASSERT (!decoder.decode (codecs [c], data, size - 3));
+        TS_ASSERT_EQUALS (decoder.count (), 0);
+
+        TS_ASSERT (decoder.decode (codecs [c], data, 0));
+        TS_ASSERT_EQUALS (decoder.count (), 0);
+      }
+    }
+
+    ///////////////////////////////
+    // json records must be one per line
+    ///////////////////////////////
+    {
+      kvr::parallel_decoder decoder (2);
+
+      const char *good = "{\"a\":1}\n\r\n[2]\n{\"c\":3}";
+      TS_ASSERT (decoder.decode (kvr::CODEC_JSON, (const uint8_t *) good, strlen (good)));
+      TS_ASSERT_EQUALS (decoder.count (), 3);
+      TS_ASSERT (decoder.get (1)->is_array ());
+
+      const char *shared = "{\"a\":1}\n{\"b\":2} {\"c\":3}\n";
+      TS_ASSERT (!decoder.decode (kvr::CODEC_JSON, (const uint8_t *) shared, strlen (shared)));
+
+      const char *split = "{\"a\":\n1}\n{\"b\":2}\n";
+      TS_ASSERT (!decoder.decode (kvr::CODEC_JSON, (const uint8_t *) split, strlen (split)));
+      TS_ASSERT_EQUALS (decoder.count (), 0);
+    }
+
+    ///////////////////////////////
+    // snapshots are not records
+    ///////////////////////////////
+    {
+      kvr::parallel_decoder decoder (2);
+
+      kvr::obuffer obuf;
+      TS_ASSERT (records [0]->encode (kvr::CODEC_KVRB, &obuf));
+      TS_ASSERT (!decoder.decode (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size ()));
+      TS_ASSERT_EQUALS (decoder.count (), 0);
+    }
+
+    for (size_t r = 0; r < nrecords; ++r)
+    {
+      m_ctx->destroy_value (records [r]);
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testEncodeParallel ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    // large root array
+    kvr::value *rows = m_ctx->create_value ()->conv_array ();
+    for (int i = 0; i < 3000; ++i)
+    {
+      kvr::value *row = rows->push_map ();
+      row->insert ("id", (int64_t) i);
+      row->insert ("name", (i & 1) ? "odd \"row\"" : "even");
+      row->insert ("f", 0.5 * i);
+      row->insert_null ("n");
+    }
+    TS_ASSERT (rows->element (0)->is_map () && (rows->element (0)->size () == 4));
+
+    // large map (with holes) under a small root, next to other keys
+    kvr::value *doc = m_ctx->create_value ()->conv_map ();
+    doc->insert ("version", 3);
+    doc->insert_array ("empty");
+    kvr::value *meta = doc->insert_map ("meta");
+    meta->insert ("owner", "kvr");
+    kvr::value *index = doc->insert_map ("index");
+    for (int i = 0; i < 6000; ++i)
+    {
+      char key [32];
+      sprintf (key, "k%05d", i);
+      kvr::value *a = index->insert_array (key);
+      a->push ((int64_t) i * 7);
+      a->push (true);
+    }
+    for (int i = 0; i < 6000; i += 3)
+    {
+      char key [32];
+      sprintf (key, "k%05d", i);
+      index->remove (key);
+    }
+    doc->insert ("tail", "end");
+
+    // too small to split
+    kvr::value *small = m_ctx->create_value ()->conv_map ();
+    small->insert ("a", 1);
+    small->insert_array ("b")->push (2);
+
+    const kvr::value *trees [] = { rows, doc, small };
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const size_t threads [] = { 0, 1, 2, 3, 8 };
+
+    ///////////////////////////////
+    // byte-identical to serial encode
+    ///////////////////////////////
+
+    for (size_t t = 0; t < (sizeof (trees) / sizeof (trees [0])); ++t)
+    {
+      kvr::value *tree = const_cast<kvr::value *> (trees [t]);
+
+      for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+      {
+        kvr::obuffer serial;
+        TS_ASSERT (tree->encode (codecs [c], &serial));
+
+        for (size_t n = 0; n < (sizeof (threads) / sizeof (threads [0])); ++n)
+        {
+          kvr::obuffer parallel;
+          TS_ASSERT (tree->encode_parallel (codecs [c], &parallel, threads [n]));
+          TS_ASSERT_EQUALS (parallel.get_size (), serial.get_size ());
+          TS_ASSERT (memcmp (parallel.get_data (), serial.get_data (), serial.get_size ()) == 0);
+        }
+
+        kvr::value *back = m_ctx->create_value ();
+        TS_ASSERT (back->decode (codecs [c], serial.get_data (), serial.get_size ()));
+        TS_ASSERT_EQUALS (back->hash (), tree->hash ());
+        m_ctx->destroy_value (back);
+      }
+    }
+
+    m_ctx->destroy_value (small);
+    m_ctx->destroy_value (doc);
+    m_ctx->destroy_value (rows);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testEncodeBatch ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    const size_t nmsgs = 97;
+    kvr::value *msgs [nmsgs];
+
+    for (size_t m = 0; m < nmsgs; ++m)
+    {
+      msgs [m] = m_ctx->create_value ();
+
+      if ((m % 5) == 4)
+      {
+        msgs [m]->conv_array ()->push ((int64_t) m)->push ("tick");
+      }
+      else
+      {
+        msgs [m]->conv_map ();
+        msgs [m]->insert ("seq", (int64_t) m);
+        msgs [m]->insert ("topic", (m & 1) ? "prices" : "orders");
+        msgs [m]->insert ("px", 100.25 + (double) m);
+      }
+    }
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const size_t threads [] = { 1, 3, 0 };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      for (size_t t = 0; t < (sizeof (threads) / sizeof (threads [0])); ++t)
+      {
+        ///////////////////////////////
+        // each slice is the document's own encoding
+        ///////////////////////////////
+
+        kvr::obuffer batch;
+        size_t offsets [nmsgs + 1];
+        bool ok = kvr::encode_batch (codecs [c], msgs, nmsgs, &batch, offsets, threads [t]);
+        TS_ASSERT (ok);
+        TS_ASSERT_EQUALS (offsets [0], 0);
+        TS_ASSERT_EQUALS (offsets [nmsgs], batch.get_size ());
+
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          kvr::obuffer single;
+          msgs [m]->encode (codecs [c], &single);
+
+          size_t expected = single.get_size () + ((codecs [c] == kvr::CODEC_JSON) ? 1 : 0);
+          TS_ASSERT_EQUALS (offsets [m + 1] - offsets [m], expected);
+          TS_ASSERT (memcmp (batch.get_data () + offsets [m], single.get_data (), single.get_size ()) == 0);
+        }
+
+        ///////////////////////////////
+        // decode
+        ///////////////////////////////
+
+        kvr::value *dests [nmsgs];
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          dests [m] = m_ctx->create_value ();
+        }
+
+        ok = kvr::decode_batch (codecs [c], batch.get_data (), offsets, nmsgs, dests);
+        TS_ASSERT (ok);
+
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          TS_ASSERT_EQUALS (dests [m]->hash (), msgs [m]->hash ());
+        }
+
+        // again into the decoded values, shifted by one: each is replaced, not merged into
+        kvr::value *shifted [nmsgs];
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          shifted [m] = dests [(m + 1) % nmsgs];
+        }
+
+        ok = kvr::decode_batch (codecs [c], batch.get_data (), offsets, nmsgs, shifted);
+        TS_ASSERT (ok);
+
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          TS_ASSERT_EQUALS (shifted [m]->hash (), msgs [m]->hash ());
+        }
+
+        // a damaged document fails the batch
+        size_t cut [3] = { offsets [0], offsets [1] - ((codecs [c] == kvr::CODEC_JSON) ? 2 : 1), offsets [2] };
+        TS_ASSERT (!kvr::decode_batch (codecs [c], batch.get_data (), cut, 2, dests));
+
+        for (size_t m = 0; m < nmsgs; ++m)
+        {
+          m_ctx->destroy_value (dests [m]);
+        }
+
+        ///////////////////////////////
+        // also a record stream
+        ///////////////////////////////
+
+        kvr::record_reader reader (codecs [c], batch.get_data (), batch.get_size ());
+        kvr::value *rec = m_ctx->create_value ();
+        size_t n = 0;
+        while (reader.next (rec))
+        {
+          TS_ASSERT_EQUALS (rec->hash (), msgs [n]->hash ());
+          ++n;
+        }
+        TS_ASSERT_EQUALS (n, nmsgs);
+        TS_ASSERT (!reader.failed ());
+        m_ctx->destroy_value (rec);
+      }
+    }
+
+    for (size_t m = 0; m < nmsgs; ++m)
+    {
+      m_ctx->destroy_value (msgs [m]);
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testSnapshot ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert ("sesame", "street");
+      val->insert ("t", true);
+      val->insert ("f", false);
+      val->insert_null ("n");
+      val->insert ("pi", 3.1416);
+      val->insert ("big", (int64_t) -5000000000LL);
+      kvr::value *a = val->insert_array ("a");
+      for (int i = 0; i < 200; ++i)
+      {
+        kvr::value *m = a->push_map ();
+        m->insert ("i", i);
+        m->insert ("name", (i == 7) ? "bob" : "alice");
+        m->insert_array ("e");
+      }
+      val->insert_map ("empty");
+    }
+
+    kvr::obuffer obuf;
+    bool ok = val->encode (kvr::CODEC_KVRB, &obuf);
+    TS_ASSERT (ok);
+    TS_ASSERT (obuf.get_size () <= val->encode_bound (kvr::CODEC_KVRB));
+    TS_ASSERT_EQUALS (obuf.get_size () % 8, 0u);
+    TS_ASSERT (kvr::view::verify (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size ()));
+
+    // the 200 nested maps share their keys: sesame t f n pi big a empty i name e
+    const uint8_t *h = obuf.get_data ();
+    TS_ASSERT_EQUALS (h [20], 11);
+
+    ///////////////////////////////
+    // in-place queries
+    ///////////////////////////////
+
+    kvr::view root (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size ());
+    TS_ASSERT (root.is_map ());
+    TS_ASSERT_EQUALS (root.size (), val->size ());
+
+    kvr::sz_t len = 0;
+    const char *str = root.find ("sesame").get_string (&len);
+    TS_ASSERT_EQUALS (std::string (str, len), "street");
+    TS_ASSERT (root.find ("t").get_boolean ());
+    TS_ASSERT (root.find ("f").is_boolean () && !root.find ("f").get_boolean ());
+    TS_ASSERT (root.find ("n").is_null ());
+    TS_ASSERT_DELTA (root.find ("pi").get_float (), 3.1416, 0.00001);
+    TS_ASSERT_EQUALS (root.find ("big").get_integer (), (int64_t) -5000000000LL);
+    TS_ASSERT (!root.find ("nope").is_valid ());
+
+    kvr::view a = root.find ("a");
+    TS_ASSERT_EQUALS (a.length (), 200u);
+    TS_ASSERT_EQUALS (a.element (199).find ("i").get_integer (), 199);
+    TS_ASSERT (!a.element (200).is_valid ());
+    TS_ASSERT_EQUALS (root.search ("a/42/i").get_integer (), 42);
+    TS_ASSERT_EQUALS (root.search ("a/@name=bob/i").get_integer (), 7);
+    TS_ASSERT_EQUALS (root.search ("a/5/e").length (), 0u);
+    TS_ASSERT_EQUALS (root.find ("empty").size (), 0u);
+    TS_ASSERT (!root.find ("empty").find ("x").is_valid ());
+
+    kvr::view::cursor mc (root);
+    kvr::view k, v;
+    kvr::sz_t pairs = 0;
+    while (mc.get (&k, &v))
+    {
+      str = k.get_string (&len);
+      TS_ASSERT (val->find (std::string (str, len).c_str ()));
+      ++pairs;
+    }
+    TS_ASSERT_EQUALS (pairs, val->size ());
+
+    ///////////////////////////////
+    // decode
+    ///////////////////////////////
+
+    kvr::value *dst = m_ctx->create_value ();
+    TS_ASSERT (dst->decode (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size ()));
+    TS_ASSERT_EQUALS (dst->hash (), val->hash ());
+    TS_ASSERT (root.search ("a/7").materialize (dst));
+    TS_ASSERT_EQUALS (dst->hash (), val->search ("a/7")->hash ());
+
+    // small snapshots, some of which fill a default obuffer exactly
+    for (int n = 0; n < 40; ++n)
+    {
+      kvr::value *small = m_ctx->create_value ()->conv_map ();
+      small->insert ("id", (int64_t) n);
+      small->insert ("name", (n & 1) ? "odd\nrecord" : "even");
+      kvr::value *sa = small->insert_array ("a");
+      for (int i = 0; i < n; ++i)
+      {
+        sa->push ((int64_t) (i * 1000));
+      }
+
+      kvr::obuffer sbuf;
+      TS_ASSERT (small->encode (kvr::CODEC_KVRB, &sbuf));
+      TS_ASSERT (dst->decode (kvr::CODEC_KVRB, sbuf.get_data (), sbuf.get_size ()));
+      TS_ASSERT_EQUALS (dst->hash (), small->hash ());
+      m_ctx->destroy_value (small);
+    }
+
+    m_ctx->destroy_value (dst);
+
+    ///////////////////////////////
+    // damaged input
+    ///////////////////////////////
+
+    kvr::view cut (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size () - 8);
+    TS_ASSERT (!cut.is_valid ());
+    TS_ASSERT (!kvr::view::verify (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size () - 8));
+
+    uint8_t *data = const_cast<uint8_t *>(obuf.get_data ());
+    data [obuf.get_size () / 2] ^= 0x5a;
+    TS_ASSERT (!kvr::view::verify (kvr::CODEC_KVRB, obuf.get_data (), obuf.get_size ()));
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testKeyTable ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class key_handler : public kvr::handler
+    {
+    public:
+
+      key_handler () : m_keys (0), m_hosts (0) {}
+      bool on_key (const char *str, kvr::sz_t length)
+      {
+        ++m_keys;
+        m_hosts += ((length == 8) && (memcmp (str, "hostname", 8) == 0)) ? 1 : 0;
+        return true;
+      }
+
+      size_t m_keys, m_hosts;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_array ();
+    for (int i = 0; i < 100; ++i)
+    {
+      kvr::value *m = val->push_map ();
+      m->insert ("identifier", i);
+      m->insert ("hostname", (i & 1) ? "node-a.example.com" : "node-b.example.com");
+      m->insert ("ok", (i % 3) != 0);
+      m->insert_map ("request")->insert ("hostname", "upstream");
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // smaller than plain, same tree back
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer plain, keyed;
+      TS_ASSERT (val->encode (codecs [c], &plain));
+      TS_ASSERT (val->encode (codecs [c], &keyed, kvr::ENCODE_KEY_TABLE));
+      TS_ASSERT (keyed.get_size () < (plain.get_size () * 2 / 3));
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (codecs [c], keyed.get_data (), keyed.get_size ()));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+
+      simple_istream istr (keyed.get_data (), keyed.get_size ());
+      dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (codecs [c], istr));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+
+      key_handler h;
+      TS_ASSERT (kvr::scan (codecs [c], keyed.get_data (), keyed.get_size (), &h));
+      TS_ASSERT_EQUALS (h.m_keys, 500u);
+      TS_ASSERT_EQUALS (h.m_hosts, 200u);
+    }
+
+    // cbor: stringref-namespace tag (256)
+    kvr::obuffer obuf;
+    TS_ASSERT (val->encode (kvr::CODEC_CBOR, &obuf, kvr::ENCODE_KEY_TABLE));
+    TS_ASSERT_EQUALS (obuf.get_data () [0], 0xd9);
+    TS_ASSERT_EQUALS (obuf.get_data () [1], 0x01);
+    TS_ASSERT_EQUALS (obuf.get_data () [2], 0x00);
+
+    // json ignores the flag
+    kvr::obuffer jbuf, jkeyed;
+    TS_ASSERT (val->encode (kvr::CODEC_JSON, &jbuf));
+    TS_ASSERT (val->encode (kvr::CODEC_JSON, &jkeyed, kvr::ENCODE_KEY_TABLE));
+    TS_ASSERT_EQUALS (jbuf.get_size (), jkeyed.get_size ());
+
+    ///////////////////////////////
+    // damaged input
+    ///////////////////////////////
+
+    // a reference past the table
+    const uint8_t badref [] = { 0xd9, 0x01, 0x00, 0xa1, 0xd8, 0x19, 0x05, 0x01 };
+    kvr::value *dval = m_ctx->create_value ();
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, badref, sizeof (badref)));
+    m_ctx->destroy_value (dval);
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testBinary ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class binary_handler : public kvr::handler
+    {
+    public:
+
+      binary_handler () : m_count (0), m_bytes (0) {}
+      bool on_binary (const uint8_t *, kvr::sz_t size) { ++m_count; m_bytes += size; return true; }
+
+      size_t m_count, m_bytes;
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    uint8_t blob [1000];
+    for (size_t i = 0; i < sizeof (blob); ++i)
+    {
+      blob [i] = (uint8_t) ((i * 7) ^ (i >> 3));
+    }
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      val->insert_null ("blob")->conv_binary ()->set_binary (blob, sizeof (blob));
+      val->insert_null ("small")->conv_binary ()->set_binary ((const uint8_t *) "foob", 4);
+      val->insert_null ("empty")->conv_binary ()->set_binary (NULL, 0);
+      kvr::value *a = val->insert_array ("a");
+      a->push_null ()->conv_binary ()->set_binary (blob, 300);
+      a->push ("text");
+    }
+
+    kvr::value *small = val->find ("small");
+    TS_ASSERT (small->is_binary () && !small->is_string ());
+
+    kvr::sz_t size = 0;
+    const uint8_t *data = val->find ("blob")->get_binary (&size);
+    TS_ASSERT_EQUALS (size, sizeof (blob));
+    TS_ASSERT_SAME_DATA (data, blob, sizeof (blob));
+    TS_ASSERT (val->find ("empty")->is_binary ());
+    TS_ASSERT (val->find ("empty")->get_binary (&size) && (size == 0));
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // round trip
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR, kvr::CODEC_KVRB };
+
+    for (size_t c = 0; c < (sizeof (codecs) / sizeof (codecs [0])); ++c)
+    {
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (codecs [c], &obuf));
+      TS_ASSERT (obuf.get_size () <= val->encode_bound (codecs [c]));
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (codecs [c], obuf.get_data (), obuf.get_size ()));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+
+      kvr::view root (codecs [c], obuf.get_data (), obuf.get_size ());
+      TS_ASSERT (root.find ("small").is_binary ());
+      data = root.find ("small").get_binary (&size);
+      TS_ASSERT ((size == 4) && (memcmp (data, "foob", 4) == 0));
+
+      if (codecs [c] != kvr::CODEC_KVRB)
+      {
+        simple_istream istr (obuf.get_data (), obuf.get_size ());
+        dval = m_ctx->create_value ();
+        TS_ASSERT (dval->decode (codecs [c], istr));
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        m_ctx->destroy_value (dval);
+
+        binary_handler h;
+        TS_ASSERT (kvr::scan (codecs [c], obuf.get_data (), obuf.get_size (), &h));
+        TS_ASSERT_EQUALS (h.m_count, 4u);
+        TS_ASSERT_EQUALS (h.m_bytes, sizeof (blob) + 4 + 300);
+      }
+    }
+
+    ///////////////////////////////
+    // wire types
+    ///////////////////////////////
+
+    kvr::value *arr = m_ctx->create_value ()->conv_array ();
+    arr->push_null ()->conv_binary ()->set_binary ((const uint8_t *) "foob", 4);
+
+    kvr::obuffer mbuf, cbuf, jbuf;
+    TS_ASSERT (arr->encode (kvr::CODEC_MSGPACK, &mbuf));
+    const uint8_t mexp [] = { 0x91, 0xc4, 0x04, 'f', 'o', 'o', 'b' };
+    TS_ASSERT_EQUALS (mbuf.get_size (), sizeof (mexp));
+    TS_ASSERT_SAME_DATA (mbuf.get_data (), mexp, sizeof (mexp));
+
+    TS_ASSERT (arr->encode (kvr::CODEC_CBOR, &cbuf));
+    const uint8_t cexp [] = { 0x81, 0x44, 'f', 'o', 'o', 'b' };
+    TS_ASSERT_EQUALS (cbuf.get_size (), sizeof (cexp));
+    TS_ASSERT_SAME_DATA (cbuf.get_data (), cexp, sizeof (cexp));
+
+    // json has no byte strings: base64, read back as a string
+    TS_ASSERT (arr->encode (kvr::CODEC_JSON, &jbuf));
+    TS_ASSERT_EQUALS (std::string ((const char *) jbuf.get_data (), jbuf.get_size ()), "[\"Zm9vYg==\"]");
+    TS_ASSERT (val->encode (kvr::CODEC_JSON, &jbuf));
+
+    kvr::value *dval = m_ctx->create_value ();
+    TS_ASSERT (dval->decode (kvr::CODEC_JSON, jbuf.get_data (), jbuf.get_size ()));
+    TS_ASSERT (dval->find ("small")->is_string ());
+    TS_ASSERT_EQUALS (std::string (dval->find ("small")->get_string ()), "Zm9vYg==");
+    TS_ASSERT_EQUALS (std::string (dval->find ("empty")->get_string ()), "");
+    m_ctx->destroy_value (dval);
+
+    const char *b64 [] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==" };
+    for (size_t n = 0; n <= 4; ++n)
+    {
+      kvr::obuffer obuf;
+      arr->element (0)->set_binary ((const uint8_t *) "foob", static_cast<kvr::sz_t>(n));
+      TS_ASSERT (arr->element (0)->encode (kvr::CODEC_JSON, &obuf));
+      TS_ASSERT_EQUALS (std::string ((const char *) obuf.get_data (), obuf.get_size ()), std::string ("\"") + b64 [n] + "\"");
+    }
+
+    // stream writer
+    kvr::obuffer sbuf;
+    {
+      kvr::stream_writer wrt (kvr::CODEC_CBOR, &sbuf);
+      TS_ASSERT (wrt.begin_array (1) && wrt.binary ((const uint8_t *) "foob", 4) && wrt.end_array () && wrt.finish ());
+    }
+    TS_ASSERT_EQUALS (sbuf.get_size (), sizeof (cexp));
+    TS_ASSERT_SAME_DATA (sbuf.get_data (), cexp, sizeof (cexp));
+
+    m_ctx->destroy_value (arr);
+
+    ///////////////////////////////
+    // tree operations
+    ///////////////////////////////
+
+    kvr::value *cval = m_ctx->create_value ()->copy (val);
+    TS_ASSERT_EQUALS (cval->hash (), hash);
+
+    cval->find ("small")->set_binary ((const uint8_t *) "fooc", 4);
+    TS_ASSERT (cval->hash () != hash);
+
+    kvr::value *diff = m_ctx->create_value ()->diff (val, cval);
+    TS_ASSERT (diff);
+    kvr::value *pval = m_ctx->create_value ()->copy (val);
+    pval->patch (diff);
+    TS_ASSERT_EQUALS (pval->hash (), cval->hash ());
+
+    m_ctx->destroy_value (pval);
+    m_ctx->destroy_value (diff);
+    m_ctx->destroy_value (cval);
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testTypedArray ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      kvr::value *ts = val->insert_array ("ts");
+      kvr::value *bytes = val->insert_array ("bytes");
+      kvr::value *deltas = val->insert_array ("deltas");
+      kvr::value *big = val->insert_array ("big");
+      kvr::value *half = val->insert_array ("half");
+      kvr::value *gauge = val->insert_array ("gauge");
+      for (int i = 0; i < 200; ++i)
+      {
+        ts->push ((int64_t) 1400000000 + (i * 15));
+        bytes->push ((i * 37) & 0xff);
+        deltas->push ((i & 1) ? -(i * 100) : (i * 100));
+        big->push ((int64_t) -5000000000LL * i);
+        half->push (0.5 * i);
+        gauge->push (0.1 * i);
+      }
+
+      // left as plain arrays
+      kvr::value *mixed = val->insert_array ("mixed");
+      for (int i = 0; i < 10; ++i)
+      {
+        (i == 5) ? mixed->push ("five") : mixed->push (i);
+      }
+      kvr::value *shrt = val->insert_array ("short");
+      shrt->push (1); shrt->push (2); shrt->push (3);
+      val->insert_array ("empty");
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // round trip
+    ///////////////////////////////
+
+    kvr::obuffer plain, typed, both;
+    TS_ASSERT (val->encode (kvr::CODEC_CBOR, &plain));
+    TS_ASSERT (val->encode (kvr::CODEC_CBOR, &typed, kvr::ENCODE_TYPED_ARRAYS));
+    TS_ASSERT (val->encode (kvr::CODEC_CBOR, &both, kvr::ENCODE_TYPED_ARRAYS | kvr::ENCODE_KEY_TABLE));
+    TS_ASSERT (typed.get_size () < (plain.get_size () * 3 / 4));
+
+    kvr::obuffer *bufs [] = { &typed, &both };
+    for (size_t b = 0; b < 2; ++b)
+    {
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (kvr::CODEC_CBOR, bufs [b]->get_data (), bufs [b]->get_size ()));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      TS_ASSERT (dval->find ("gauge")->element (3)->is_float ());
+      TS_ASSERT (dval->find ("ts")->element (3)->is_integer ());
+      m_ctx->destroy_value (dval);
+
+      simple_istream istr (bufs [b]->get_data (), bufs [b]->get_size ());
+      dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (kvr::CODEC_CBOR, istr));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+    }
+
+    number_handler h;
+    TS_ASSERT (kvr::scan (kvr::CODEC_CBOR, typed.get_data (), typed.get_size (), &h));
+    TS_ASSERT_EQUALS (h.m_integers, 800u + 9u + 3u);
+    TS_ASSERT_EQUALS (h.m_floats, 400u);
+    TS_ASSERT_EQUALS (h.m_arrays, 9u);
+
+    // msgpack and json ignore the flag
+    kvr::obuffer mplain, mtyped;
+    TS_ASSERT (val->encode (kvr::CODEC_MSGPACK, &mplain));
+    TS_ASSERT (val->encode (kvr::CODEC_MSGPACK, &mtyped, kvr::ENCODE_TYPED_ARRAYS));
+    TS_ASSERT_EQUALS (mplain.get_size (), mtyped.get_size ());
+
+    ///////////////////////////////
+    // wire format
+    ///////////////////////////////
+
+    kvr::value *arr = m_ctx->create_value ()->conv_array ();
+    for (int i = 1; i <= 8; ++i)
+    {
+      arr->push (i * 30);
+    }
+
+    kvr::obuffer obuf;
+    TS_ASSERT (arr->encode (kvr::CODEC_CBOR, &obuf, kvr::ENCODE_TYPED_ARRAYS));
+    const uint8_t u8exp [] = { 0xd8, 0x40, 0x48, 30, 60, 90, 120, 150, 180, 210, 240 };
+    TS_ASSERT_EQUALS (obuf.get_size (), sizeof (u8exp));
+    TS_ASSERT_SAME_DATA (obuf.get_data (), u8exp, sizeof (u8exp));
+
+    arr->element (0)->set_integer (-1);
+    arr->element (7)->set_integer (1000);
+    TS_ASSERT (arr->encode (kvr::CODEC_CBOR, &obuf, kvr::ENCODE_TYPED_ARRAYS));
+    const uint8_t s16head [] = { 0xd8, 0x4d, 0x50, 0xff, 0xff };
+    TS_ASSERT_EQUALS (obuf.get_size (), 3u + 16u);
+    TS_ASSERT_SAME_DATA (obuf.get_data (), s16head, sizeof (s16head));
+
+    m_ctx->destroy_value (arr);
+
+    // big-endian and half-precision tags from other encoders
+    const uint8_t u16be [] = { 0x82, 0xd8, 0x41, 0x44, 0x01, 0x02, 0x03, 0x04, 0xd8, 0x49, 0x42, 0xff, 0xfe };
+    kvr::value *dval = m_ctx->create_value ();
+    TS_ASSERT (dval->decode (kvr::CODEC_CBOR, u16be, sizeof (u16be)));
+    TS_ASSERT_EQUALS (dval->element (0)->length (), 2u);
+    TS_ASSERT_EQUALS (dval->element (0)->element (0)->get_integer (), 258);
+    TS_ASSERT_EQUALS (dval->element (0)->element (1)->get_integer (), 772);
+    TS_ASSERT_EQUALS (dval->element (1)->element (0)->get_integer (), -2);
+
+    const uint8_t f16le [] = { 0xd8, 0x54, 0x44, 0x00, 0x3c, 0x00, 0xc0 };
+    TS_ASSERT (dval->decode (kvr::CODEC_CBOR, f16le, sizeof (f16le)));
+    TS_ASSERT_EQUALS (dval->length (), 2u);
+    TS_ASSERT_DELTA (dval->element (0)->get_float (), 1.0, 0.00001);
+    TS_ASSERT_DELTA (dval->element (1)->get_float (), -2.0, 0.00001);
+
+    const uint8_t f64be [] = { 0xd8, 0x52, 0x48, 0x40, 0x09, 0x21, 0xfb, 0x54, 0x44, 0x2d, 0x18 };
+    TS_ASSERT (dval->decode (kvr::CODEC_CBOR, f64be, sizeof (f64be)));
+    TS_ASSERT_DELTA (dval->element (0)->get_float (), 3.14159265358979, 0.000000001);
+
+    ///////////////////////////////
+    // damaged input
+    ///////////////////////////////
+
+    const uint8_t partial [] = { 0xd8, 0x45, 0x43, 0x01, 0x02, 0x03 };   // 3 bytes of uint16
+    const uint8_t reserved [] = { 0xd8, 0x4c, 0x41, 0x01 };               // tag 76
+    const uint8_t notbytes [] = { 0xd8, 0x40, 0x81, 0x01 };               // array, not bytes
+    const uint8_t toobig [] = { 0xd8, 0x47, 0x48, 0, 0, 0, 0, 0, 0, 0, 0x80 };  // uint64 > int64 max
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, partial, sizeof (partial)));
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, reserved, sizeof (reserved)));
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, notbytes, sizeof (notbytes)));
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, toobig, sizeof (toobig)));
+    m_ctx->destroy_value (dval);
+
+    ///////////////////////////////
+    // clean up
+    ///////////////////////////////
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testNumericColumns ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      kvr::value *ts = val->insert_array ("ts");
+      kvr::value *down = val->insert_array ("down");
+      kvr::value *gauge = val->insert_array ("gauge");
+      kvr::value *steady = val->insert_array ("steady");
+      for (int i = 0; i < 1000; ++i)
+      {
+        ts->push ((int64_t) 1400000000000LL + (i * 1000) + (i % 7));
+        down->push ((int64_t) 5000 - (i / 3));
+        gauge->push (20.0 + (0.25 * (i % 40)) - (0.125 * (i % 3)));
+        steady->push (98.6);
+      }
+
+      // int64 extremes wrap through the deltas
+      kvr::value *extremes = val->insert_array ("extremes");
+      extremes->push ((int64_t) (-0x7fffffffffffffffLL - 1));
+      for (int i = 0; i < 7; ++i)
+      {
+        extremes->push ((int64_t) i);
+      }
+      extremes->push ((int64_t) 0x7fffffffffffffffLL);
+
+      kvr::value *special = val->insert_array ("special");
+      const double specials [] = { 1.0, -1.0, -0.0, 1.7976931348623157e308, -2.2250738585072014e-308, 1e-310, -1e300, 3.141592653589793, 0.1 };
+      for (size_t i = 0; i < (sizeof (specials) / sizeof (specials [0])); ++i)
+      {
+        special->push (specials [i]);
+      }
+
+      // left as plain arrays
+      kvr::value *zigzag = val->insert_array ("zigzag");
+      kvr::value *mixed = val->insert_array ("mixed");
+      for (int i = 0; i < 10; ++i)
+      {
+        zigzag->push ((i & 1) ? -i : i);
+        (i == 5) ? mixed->push (5.0) : mixed->push (i);
+      }
+      kvr::value *shrt = val->insert_array ("short");
+      shrt->push (1); shrt->push (2); shrt->push (3);
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // round trip
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const uint32_t flags [] = { kvr::ENCODE_NUMERIC_COLUMNS, kvr::ENCODE_NUMERIC_COLUMNS | kvr::ENCODE_KEY_TABLE, kvr::ENCODE_NUMERIC_COLUMNS | kvr::ENCODE_TYPED_ARRAYS };
+
+    for (size_t c = 0; c < 2; ++c)
+    {
+      kvr::obuffer plain;
+      TS_ASSERT (val->encode (codecs [c], &plain));
+
+      for (size_t f = 0; f < 3; ++f)
+      {
+        kvr::obuffer obuf;
+        TS_ASSERT (val->encode (codecs [c], &obuf, flags [f]));
+        TS_ASSERT (obuf.get_size () < (plain.get_size () / 3));
+
+        kvr::value *dval = m_ctx->create_value ();
+        TS_ASSERT (dval->decode (codecs [c], obuf.get_data (), obuf.get_size ()));
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        TS_ASSERT (dval->find ("gauge")->element (3)->is_float ());
+        TS_ASSERT (dval->find ("ts")->element (3)->is_integer ());
+        TS_ASSERT_EQUALS (dval->find ("extremes")->element (0)->get_integer (), (int64_t) (-0x7fffffffffffffffLL - 1));
+        m_ctx->destroy_value (dval);
+
+        simple_istream istr (obuf.get_data (), obuf.get_size ());
+        dval = m_ctx->create_value ();
+        TS_ASSERT (dval->decode (codecs [c], istr));
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        m_ctx->destroy_value (dval);
+
+        // streamed encode matches the buffered one
+        simple_ostream ostr;
+        TS_ASSERT (val->encode (codecs [c], &ostr, flags [f]));
+        TS_ASSERT_EQUALS (ostr.m_os.tell (), obuf.get_size ());
+        TS_ASSERT_SAME_DATA (ostr.m_os.buffer (), obuf.get_data (), obuf.get_size ());
+      }
+
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (codecs [c], &obuf, kvr::ENCODE_NUMERIC_COLUMNS));
+
+      number_handler h;
+      TS_ASSERT (kvr::scan (codecs [c], obuf.get_data (), obuf.get_size (), &h));
+      TS_ASSERT_EQUALS (h.m_integers, 2000u + 9u + 20u + 3u - 1u);
+      TS_ASSERT_EQUALS (h.m_floats, 2000u + 9u + 1u);
+      TS_ASSERT_EQUALS (h.m_arrays, 9u);
+    }
+
+    // json ignores the flag
+    kvr::obuffer jplain, jcols;
+    TS_ASSERT (val->encode (kvr::CODEC_JSON, &jplain));
+    TS_ASSERT (val->encode (kvr::CODEC_JSON, &jcols, kvr::ENCODE_NUMERIC_COLUMNS));
+    TS_ASSERT_EQUALS (jplain.get_size (), jcols.get_size ());
+
+    m_ctx->destroy_value (val);
+
+    ///////////////////////////////
+    // wire format
+    ///////////////////////////////
+
+    kvr::value *arr = m_ctx->create_value ()->conv_array ();
+    for (int i = 1; i <= 8; ++i)
+    {
+      arr->push (i * 10);
+    }
+
+    // count, zigzag(10), zigzag(10) x 7
+    kvr::obuffer obuf;
+    TS_ASSERT (arr->encode (kvr::CODEC_MSGPACK, &obuf, kvr::ENCODE_NUMERIC_COLUMNS));
+    const uint8_t mpexp [] = { 0xc7, 9, 0x44, 8, 20, 20, 20, 20, 20, 20, 20, 20 };
+    TS_ASSERT_EQUALS (obuf.get_size (), sizeof (mpexp));
+    TS_ASSERT_SAME_DATA (obuf.get_data (), mpexp, sizeof (mpexp));
+
+    TS_ASSERT (arr->encode (kvr::CODEC_CBOR, &obuf, kvr::ENCODE_NUMERIC_COLUMNS));
+    const uint8_t cbexp [] = { 0xd9, 0x6b, 0x64, 0x49, 8, 20, 20, 20, 20, 20, 20, 20, 20 };
+    TS_ASSERT_EQUALS (obuf.get_size (), sizeof (cbexp));
+    TS_ASSERT_SAME_DATA (obuf.get_data (), cbexp, sizeof (cbexp));
+
+    // repeated floats: first value, then a '0' bit each
+    for (int i = 0; i < 8; ++i)
+    {
+      arr->element (i)->set_float (1.0);
+    }
+    TS_ASSERT (arr->encode (kvr::CODEC_MSGPACK, &obuf, kvr::ENCODE_NUMERIC_COLUMNS));
+    const uint8_t xorexp [] = { 0xc7, 10, 0x58, 8, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0x00 };
+    TS_ASSERT_EQUALS (obuf.get_size (), sizeof (xorexp));
+    TS_ASSERT_SAME_DATA (obuf.get_data (), xorexp, sizeof (xorexp));
+
+    m_ctx->destroy_value (arr);
+
+    ///////////////////////////////
+    // worst cases fit the bound
+    ///////////////////////////////
+
+    kvr::value *worst = m_ctx->create_value ()->conv_map ();
+    {
+      // xors alternating between leading bits 0, trailing 1 and leading 1, trailing 0: 
+      // neither fits the other's window, so every value opens one (76 bits)
+      kvr::value *noise = worst->insert_array ("noise");
+      uint64_t x = 0x2000000000000000ULL;
+      for (int i = 0; i < 1000; ++i)
+      {
+        double d = 0.0;
+        memcpy (&d, &x, sizeof (d));
+        noise->push (d);
+        x ^= (i & 1) ? 0x4000000000000001ULL : 0x8000000000000002ULL;
+      }
+
+      // 9-byte delta varints, under repeated keys
+      kvr::value *runs = worst->insert_array ("runs");
+      for (int r = 0; r < 50; ++r)
+      {
+        kvr::value *steps = runs->push_map ()->insert_array ("run");
+        for (int i = -4; i < 4; ++i)
+        {
+          steps->push ((int64_t) (i * 0x2000000000000000LL));
+        }
+        steps->push ((int64_t) 0x7fffffffffffffffLL);
+      }
+    }
+
+    const char *path = "kvr_test_numeric_columns.tmp";
+
+    for (size_t c = 0; c < 2; ++c)
+    {
+      const uint32_t all = kvr::ENCODE_NUMERIC_COLUMNS | kvr::ENCODE_KEY_TABLE;
+
+      kvr::obuffer wbuf;
+      TS_ASSERT (worst->encode (codecs [c], &wbuf, all));
+      TS_ASSERT (wbuf.get_size () > worst->encode_bound (codecs [c]));
+      TS_ASSERT (wbuf.get_size () <= worst->encode_bound (codecs [c], all));
+
+      TS_ASSERT (worst->encode_file (codecs [c], path, all));
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode_file (codecs [c], path));
+      TS_ASSERT_EQUALS (dval->hash (), worst->hash ());
+      m_ctx->destroy_value (dval);
+    }
+
+    remove (path);
+    m_ctx->destroy_value (worst);
+
+    ///////////////////////////////
+    // damaged payloads
+    ///////////////////////////////
+
+    kvr::value *dval = m_ctx->create_value ();
+
+    // count larger than the payload
+    const uint8_t bigcount [] = { 0xc7, 3, 0x44, 0xff, 0x7f, 2 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_MSGPACK, bigcount, sizeof (bigcount)));
+
+    // unterminated varint
+    const uint8_t open [] = { 0xc7, 3, 0x44, 2, 4, 0x80 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_MSGPACK, open, sizeof (open)));
+
+    // trailing bytes
+    const uint8_t trailing [] = { 0xc7, 4, 0x44, 1, 4, 4, 4 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_MSGPACK, trailing, sizeof (trailing)));
+
+    // truncated bit stream
+    const uint8_t shortxor [] = { 0xd9, 0x6b, 0x78, 0x4a, 9, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0xc0 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, shortxor, sizeof (shortxor)));
+
+    // '10' before any window
+    const uint8_t nowindow [] = { 0xd9, 0x6b, 0x78, 0x4a, 2, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0x80 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, nowindow, sizeof (nowindow)));
+
+    // unknown ext type
+    const uint8_t unknown [] = { 0xc7, 1, 0x21, 0 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_MSGPACK, unknown, sizeof (unknown)));
+
+    m_ctx->destroy_value (dval);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testNumericColumnsReaders ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    {
+      kvr::value *ts = val->insert_array ("ts");
+      kvr::value *gauge = val->insert_array ("gauge");
+      for (int i = 0; i < 100; ++i)
+      {
+        ts->push ((int64_t) 1400000000000LL + (i * 1000));
+        gauge->push (20.0 + (0.25 * (i % 40)));
+      }
+      val->insert ("name", "sensor");
+    }
+
+    uint32_t hash = val->hash ();
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+    const uint32_t flags [] = { kvr::ENCODE_NUMERIC_COLUMNS, kvr::ENCODE_NUMERIC_COLUMNS | kvr::ENCODE_TYPED_ARRAYS };
+
+    for (size_t c = 0; c < 2; ++c)
+    {
+      for (size_t f = 0; f < 2; ++f)
+      {
+        kvr::obuffer obuf;
+        TS_ASSERT (val->encode (codecs [c], &obuf, flags [f]));
+        const uint8_t *data = obuf.get_data ();
+        const size_t size = obuf.get_size ();
+
+        ///////////////////////////////
+        // push decoder, a byte at a time
+        ///////////////////////////////
+
+        kvr::value *dval = m_ctx->create_value ();
+        {
+          kvr::push_decoder dec (codecs [c], dval);
+          kvr::push_decoder::status_t status = kvr::push_decoder::STATUS_NEED_MORE;
+          for (size_t i = 0; (i < size) && (status == kvr::push_decoder::STATUS_NEED_MORE); ++i)
+          {
+            status = dec.feed (&data [i], 1);
+          }
+          TS_ASSERT_EQUALS (status, kvr::push_decoder::STATUS_DONE);
+          TS_ASSERT_EQUALS (dval->hash (), hash);
+        }
+
+        ///////////////////////////////
+        // records
+        ///////////////////////////////
+
+        kvr::mem_ostream stream (64u);
+        for (int r = 0; r < 5; ++r)
+        {
+          stream.write (const_cast<uint8_t *> (data), size);
+        }
+
+        {
+          kvr::record_reader reader (codecs [c], stream.buffer (), stream.tell ());
+          size_t n = 0;
+          while (reader.next (dval))
+          {
+            TS_ASSERT_EQUALS (dval->hash (), hash);
+            ++n;
+          }
+          TS_ASSERT (!reader.failed ());
+          TS_ASSERT_EQUALS (n, 5u);
+        }
+
+        {
+          kvr::parallel_decoder decoder (2);
+          TS_ASSERT (decoder.decode (codecs [c], stream.buffer (), stream.tell ()));
+          TS_ASSERT_EQUALS (decoder.count (), 5u);
+          TS_ASSERT_EQUALS (decoder.get (4)->hash (), hash);
+        }
+
+        ///////////////////////////////
+        // view and projection
+        ///////////////////////////////
+
+        kvr::view root (codecs [c], data, size);
+        TS_ASSERT (kvr::view::verify (codecs [c], data, size));
+        TS_ASSERT_EQUALS (root.size (), 3u);
+        kvr::sz_t len = 0;
+        const char *name = root.find ("name").get_string (&len);
+        TS_ASSERT_EQUALS (std::string (name, len), std::string ("sensor"));
+
+        kvr::view gauge = root.find ("gauge");
+        TS_ASSERT (gauge.is_valid () && !gauge.is_array ());
+        TS_ASSERT (gauge.materialize (dval));
+        TS_ASSERT_EQUALS (dval->hash (), val->find ("gauge")->hash ());
+
+        const char *paths [] = { "ts/2", "ts/99", "gauge/1/x", "name" };
+        TS_ASSERT (dval->decode (codecs [c], data, size, paths, 4));
+        TS_ASSERT_EQUALS (dval->size (), 2u);
+        TS_ASSERT_EQUALS (dval->find ("ts")->length (), 2u);
+        TS_ASSERT_EQUALS (dval->find ("ts")->element (0)->get_integer (), (int64_t) 1400000002000LL);
+        TS_ASSERT_EQUALS (dval->find ("ts")->element (1)->get_integer (), (int64_t) 1400000099000LL);
+        TS_ASSERT (!dval->find ("gauge"));
+
+        // a column at the root
+        kvr::obuffer cbuf;
+        TS_ASSERT (val->find ("ts")->encode (codecs [c], &cbuf, flags [f]));
+        const char *rpaths [] = { "1" };
+        TS_ASSERT (dval->decode (codecs [c], cbuf.get_data (), cbuf.get_size (), rpaths, 1));
+        TS_ASSERT_EQUALS (dval->length (), 1u);
+        TS_ASSERT_EQUALS (dval->element (0)->get_integer (), (int64_t) 1400000001000LL);
+
+        m_ctx->destroy_value (dval);
+      }
+    }
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testNumericColumnsBadXorWindow ()
+  {
+    kvr::value *dval = m_ctx->create_value ();
+
+    // '11', leading zeros 31, length 64: past the 64 bits of a double
+    const uint8_t wide [] = { 0xd9, 0x6b, 0x78, 0x4b, 2, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0xff, 0xf8 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_CBOR, wide, sizeof (wide)));
+
+    // a good window (one bit), then the same bad one with values left in the block
+    const uint8_t later [] = { 0xc7, 13, 0x58, 4, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0xc0, 0x07, 0xff, 0xe0 };
+    TS_ASSERT (!dval->decode (kvr::CODEC_MSGPACK, later, sizeof (later)));
+
+    // the good part alone decodes
+    const uint8_t good [] = { 0xc7, 11, 0x58, 2, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0xc0, 0x04 };
+    TS_ASSERT (dval->decode (kvr::CODEC_MSGPACK, good, sizeof (good)));
+    TS_ASSERT_EQUALS (dval->length (), 2u);
+
+    m_ctx->destroy_value (dval);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testCompressedStream ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    kvr::value *val = m_ctx->create_value ()->conv_array ();
+    for (int r = 0; r < 2000; ++r)
+    {
+      kvr::value *rec = val->push_map ();
+      rec->insert ("id", (int64_t) r);
+      rec->insert ("host", "ingest-node-07.example.com");
+      rec->insert ("latency", 0.25 * (r % 1000));
+      rec->insert ("path", "/api/v1/records/search?q=kvr&limit=100");
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // round trip
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < 3; ++c)
+    {
+      kvr::obuffer plain;
+      TS_ASSERT (val->encode (codecs [c], &plain));
+
+      simple_ostream ostr;
+      {
+        kvr::compressed_ostream costr (&ostr, 4096u, 4u);
+        TS_ASSERT (val->encode (codecs [c], &costr));
+        TS_ASSERT (costr.finish ());
+        TS_ASSERT (!costr.failed ());
+      }
+      const uint8_t *data = ostr.m_os.buffer ();
+      const size_t size = ostr.m_os.tell ();
+      TS_ASSERT (size < (plain.get_size () / 4));
+      TS_ASSERT_SAME_DATA (data, "KVRZ", 4);
+
+      for (size_t nthreads = 1; nthreads <= 3; nthreads += 2)
+      {
+        kvr::compressed_istream mistr (data, size, nthreads);
+        kvr::value *dval = m_ctx->create_value ();
+        TS_ASSERT (dval->decode (codecs [c], mistr));
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        TS_ASSERT (!mistr.failed ());
+        m_ctx->destroy_value (dval);
+
+        simple_istream sistr (data, size);
+        kvr::compressed_istream istr (&sistr, nthreads);
+        dval = m_ctx->create_value ();
+        TS_ASSERT (dval->decode (codecs [c], istr));
+        TS_ASSERT_EQUALS (dval->hash (), hash);
+        TS_ASSERT (!istr.failed ());
+        m_ctx->destroy_value (dval);
+      }
+    }
+
+    m_ctx->destroy_value (val);
+
+    ///////////////////////////////
+    // raw bytes
+    ///////////////////////////////
+
+    // runs, repeats and noise (stored blocks), written in uneven pieces
+    kvr::mem_ostream raw (1024u);
+    uint32_t seed = 7;
+    for (int i = 0; i < 40000; ++i)
+    {
+      seed = (seed * 1103515245u) + 12345u;
+      uint8_t b = (i < 10000) ? uint8_t (i % 7) : (i < 20000) ? uint8_t ((i / 100) & 0xff) : (i < 25000) ? 'x' : uint8_t (seed >> 16);
+      raw.put (b);
+    }
+
+    simple_ostream ostr;
+    kvr::compressed_ostream costr (&ostr, 1000u, 3u);
+    for (size_t pos = 0, n = 1; pos < raw.tell (); pos += n, n = (n * 7) % 1500 + 1)
+    {
+      n = (n < (raw.tell () - pos)) ? n : (raw.tell () - pos);
+      if (n == 1)
+      {
+        costr.put (raw.buffer () [pos]);
+      }
+      else
+      {
+        costr.write (const_cast<uint8_t *> (raw.buffer ()) + pos, n);
+      }
+      if ((pos % 5) == 0)
+      {
+        costr.flush ();
+      }
+    }
+    TS_ASSERT (costr.finish ());
+    TS_ASSERT (ostr.m_flushes > 0);
+
+    const uint8_t *data = ostr.m_os.buffer ();
+    const size_t size = ostr.m_os.tell ();
+
+    {
+      kvr::compressed_istream istr (data, size, 2u);
+      kvr::mem_ostream back (1024u);
+      uint8_t buf [333];
+      size_t n = 0;
+      TS_ASSERT_EQUALS (istr.peek (), raw.buffer () [0]);
+      while ((n = istr.fetch (buf, sizeof (buf))) > 0)
+      {
+        back.write (buf, n);
+      }
+      TS_ASSERT (!istr.failed ());
+      TS_ASSERT_EQUALS (istr.tell (), raw.tell ());
+      TS_ASSERT_EQUALS (back.tell (), raw.tell ());
+      TS_ASSERT_SAME_DATA (back.buffer (), raw.buffer (), raw.tell ());
+      TS_ASSERT (!istr.get (buf));
+    }
+
+    ///////////////////////////////
+    // damage
+    ///////////////////////////////
+
+    kvr::mem_ostream copy (size);
+    copy.write (const_cast<uint8_t *> (data), size);
+    uint8_t *bytes = const_cast<uint8_t *> (copy.buffer ());
+    uint8_t buf [4096];
+
+    // a flipped bit in the first block
+    bytes [30] ^= 0x10;
+    {
+      kvr::compressed_istream istr (bytes, size, 2u);
+      while (istr.fetch (buf, sizeof (buf)) > 0) {}
+      TS_ASSERT (istr.failed ());
+
+      simple_istream sistr (bytes, size);
+      kvr::compressed_istream sstr (&sistr, 2u);
+      while (sstr.fetch (buf, sizeof (buf)) > 0) {}
+      TS_ASSERT (sstr.failed ());
+    }
+    bytes [30] ^= 0x10;
+
+    // truncated
+    {
+      kvr::compressed_istream istr (bytes, size - 1, 2u);
+      TS_ASSERT (istr.failed ());
+
+      simple_istream sistr (bytes, size - 1);
+      kvr::compressed_istream sstr (&sistr, 2u);
+      while (sstr.fetch (buf, sizeof (buf)) > 0) {}
+      TS_ASSERT (sstr.failed ());
+    }
+
+    // a damaged index
+    bytes [size - 20] ^= 0x01;
+    {
+      kvr::compressed_istream istr (bytes, size, 2u);
+      TS_ASSERT (istr.failed ());
+    }
+
+    // not a container
+    {
+      const uint8_t junk [] = "not a kvrz container, just some bytes";
+      kvr::compressed_istream istr (junk, sizeof (junk), 2u);
+      TS_ASSERT (istr.failed ());
+      TS_ASSERT_EQUALS (istr.fetch (buf, sizeof (buf)), 0u);
+    }
+
+    // empty
+    {
+      simple_ostream eostr;
+      kvr::compressed_ostream ecostr (&eostr, 4096u, 2u);
+      TS_ASSERT (ecostr.finish ());
+
+      kvr::compressed_istream istr (eostr.m_os.buffer (), eostr.m_os.tell (), 2u);
+      TS_ASSERT_EQUALS (istr.fetch (buf, sizeof (buf)), 0u);
+      TS_ASSERT (!istr.failed ());
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testMappedFile ()
+  {
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    const char *path = "kvr_test_mapped_file.tmp";
+
+    kvr::value *val = m_ctx->create_value ()->conv_map ();
+    kvr::value *recs = val->insert_array ("records");
+    for (int r = 0; r < 500; ++r)
+    {
+      kvr::value *rec = recs->push_map ();
+      rec->insert ("id", (int64_t) r);
+      rec->insert ("host", "ingest-node-07.example.com");
+      rec->insert ("latency", 0.25 * (r % 1000));
+      rec->insert ("ok", (r % 7) != 0);
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // encode_file/decode_file
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR, kvr::CODEC_KVRB };
+
+    for (size_t c = 0; c < 4; ++c)
+    {
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (codecs [c], &obuf));
+      TS_ASSERT (val->encode_file (codecs [c], path));
+
+      // trimmed to the encoded size, byte for byte
+      {
+        kvr::mmap_istream file (path);
+        TS_ASSERT (file.is_open ());
+        TS_ASSERT_EQUALS (file.size (), obuf.get_size ());
+        TS_ASSERT_SAME_DATA (file.data (), obuf.get_data (), obuf.get_size ());
+        TS_ASSERT (file.stream () != NULL);
+      }
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode_file (codecs [c], path));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+    }
+
+    // flagged encodings
+    {
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (kvr::CODEC_CBOR, &obuf, kvr::ENCODE_KEY_TABLE));
+      TS_ASSERT (val->encode_file (kvr::CODEC_CBOR, path, kvr::ENCODE_KEY_TABLE));
+
+      kvr::mmap_istream file (path);
+      TS_ASSERT_EQUALS (file.size (), obuf.get_size ());
+      TS_ASSERT_SAME_DATA (file.data (), obuf.get_data (), obuf.get_size ());
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode_file (kvr::CODEC_CBOR, path));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+    }
+
+    ///////////////////////////////
+    // mapped view
+    ///////////////////////////////
+
+    {
+      TS_ASSERT (val->encode_file (kvr::CODEC_KVRB, path));
+
+      kvr::mmap_istream file (path);
+      kvr::view root (kvr::CODEC_KVRB, *file.stream ());
+      TS_ASSERT (root.is_map ());
+      TS_ASSERT_EQUALS (root.find ("records").length (), 500u);
+    }
+
+    ///////////////////////////////
+    // mmap_ostream
+    ///////////////////////////////
+
+    // small extents: remapped many times over
+    {
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (kvr::CODEC_MSGPACK, &obuf));
+
+      kvr::mmap_ostream ostr (path, 100u);
+      TS_ASSERT (ostr.is_open ());
+      TS_ASSERT (val->encode (kvr::CODEC_MSGPACK, &ostr));
+      TS_ASSERT_EQUALS (ostr.tell (), obuf.get_size ());
+      TS_ASSERT (ostr.close ());
+      TS_ASSERT (!ostr.failed ());
+
+      kvr::mmap_istream file (path);
+      TS_ASSERT_EQUALS (file.size (), obuf.get_size ());
+      TS_ASSERT_SAME_DATA (file.data (), obuf.get_data (), obuf.get_size ());
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode (kvr::CODEC_MSGPACK, file.data (), file.size ()));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+    }
+
+    // push/pop, bytes past the extent
+    {
+      uint8_t bytes [300];
+      for (size_t i = 0; i < sizeof (bytes); ++i)
+      {
+        bytes [i] = (uint8_t) (i * 7);
+      }
+
+      kvr::mmap_ostream ostr (path, 64u);
+      ostr.put (bytes [0]);
+      ostr.write (bytes + 1, 199);
+      uint8_t *dest = ostr.push (150);
+      TS_ASSERT (dest != NULL);
+      memcpy (dest, bytes + 200, 100);
+      ostr.pop (50);
+      TS_ASSERT_EQUALS (ostr.tell (), 300u);
+      ostr.flush ();
+      TS_ASSERT (ostr.close ());
+
+      kvr::mmap_istream file (path);
+      TS_ASSERT_EQUALS (file.size (), 300u);
+      TS_ASSERT_SAME_DATA (file.data (), bytes, 300);
+    }
+
+    ///////////////////////////////
+    // truncated json filling whole pages
+    ///////////////////////////////
+
+    // nothing follows the mapping (no null): the parser has to stop at the file size
+    for (size_t pagesz = 4096; pagesz <= 65536; pagesz *= 16)
+    {
+      {
+        kvr::mmap_ostream ostr (path);
+        uint8_t *dest = ostr.push (pagesz);
+        TS_ASSERT (dest != NULL);
+        memset (dest, ' ', pagesz);
+        memcpy (dest, "{\"a\":[1,2", 9);
+        TS_ASSERT (ostr.close ());
+      }
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (!dval->decode_file (kvr::CODEC_JSON, path));
+
+      // the same document, complete
+      {
+        kvr::mmap_ostream ostr (path);
+        uint8_t *dest = ostr.push (pagesz);
+        memset (dest, ' ', pagesz);
+        memcpy (dest, "{\"a\":[1,2]}", 11);
+        TS_ASSERT (ostr.close ());
+      }
+
+      TS_ASSERT (dval->decode_file (kvr::CODEC_JSON, path));
+      TS_ASSERT_EQUALS (dval->find ("a")->length (), 2u);
+      m_ctx->destroy_value (dval);
+    }
+
+    ///////////////////////////////
+    // empty and missing files
+    ///////////////////////////////
+
+    {
+      kvr::mmap_ostream ostr (path);
+      TS_ASSERT (ostr.close ());
+    }
+    {
+      kvr::mmap_istream file (path);
+      TS_ASSERT (file.is_open ());
+      TS_ASSERT_EQUALS (file.size (), 0u);
+      TS_ASSERT (file.stream () == NULL);
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (!dval->decode_file (kvr::CODEC_JSON, path));
+      m_ctx->destroy_value (dval);
+    }
+
+    remove (path);
+
+    {
+      kvr::mmap_istream file (path);
+      TS_ASSERT (!file.is_open ());
+      TS_ASSERT (file.data () == NULL);
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (!dval->decode_file (kvr::CODEC_JSON, path));
+      m_ctx->destroy_value (dval);
+    }
+
+    TS_ASSERT (!val->encode_file (kvr::CODEC_JSON, "kvr_test_missing_dir/file.tmp"));
+
+    m_ctx->destroy_value (val);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+  ///////////////////////////////////////////////////////////////
+
+  void testAsyncFileStream ()
+  {
+    ///////////////////////////////
+    // utility
+    ///////////////////////////////
+
+    class counting_policy : public kvr::sync_policy
+    {
+    public:
+
+      counting_policy (uint64_t every) : m_every (every), m_writes (0), m_syncs (0), m_flushes (0), m_closes (0), m_written (0) {}
+      bool sync_on_write (uint64_t written, uint64_t unsynced) { ++m_writes; m_written = written; bool s = (unsynced >= m_every); m_syncs += s ? 1 : 0; return s; }
+      bool sync_on_flush (uint64_t) { ++m_flushes; return false; }
+      bool sync_on_close (uint64_t written) { ++m_closes; m_written = written; return true; }
+
+      uint64_t m_every;
+      size_t m_writes, m_syncs, m_flushes, m_closes;
+      uint64_t m_written;
+    };
+
+    class small_allocator : public kvr::allocator
+    {
+    public:
+
+      void * allocate (size_t sz) { return (sz < 65536) ? malloc (sz) : NULL; }
+      void   deallocate (void *p, size_t) { free (p); }
+    };
+
+    ///////////////////////////////
+    // set up
+    ///////////////////////////////
+
+    const char *path = "kvr_test_async_file.tmp";
+
+    kvr::value *val = m_ctx->create_value ()->conv_array ();
+    for (int r = 0; r < 1000; ++r)
+    {
+      kvr::value *rec = val->push_map ();
+      rec->insert ("id", (int64_t) r);
+      rec->insert ("host", "ingest-node-07.example.com");
+      rec->insert ("latency", 0.25 * (r % 1000));
+      rec->insert ("path", "/api/v1/records/search?q=kvr&limit=100");
+    }
+
+    uint32_t hash = val->hash ();
+
+    ///////////////////////////////
+    // encode
+    ///////////////////////////////
+
+    const kvr::codec_t codecs [] = { kvr::CODEC_JSON, kvr::CODEC_MSGPACK, kvr::CODEC_CBOR };
+
+    for (size_t c = 0; c < 3; ++c)
+    {
+      kvr::obuffer obuf;
+      TS_ASSERT (val->encode (codecs [c], &obuf));
+
+      for (size_t nbufs = 2; nbufs <= 4; ++nbufs)
+      {
+        {
+          kvr::async_file_ostream ostr (path, 1000u, nbufs);
+          TS_ASSERT (ostr.is_open ());
+          TS_ASSERT (val->encode (codecs [c], &ostr));
+          TS_ASSERT (ostr.close ());
+          TS_ASSERT (!ostr.failed ());
+        }
+
+        kvr::mmap_istream file (path);
+        TS_ASSERT_EQUALS (file.size (), obuf.get_size ());
+        TS_ASSERT_SAME_DATA (file.data (), obuf.get_data (), obuf.get_size ());
+      }
+
+      kvr::value *dval = m_ctx->create_value ();
+      TS_ASSERT (dval->decode_file (codecs [c], path));
+      TS_ASSERT_EQUALS (dval->hash (), hash);
+      m_ctx->destroy_value (dval);
+    }
+
+    m_ctx->destroy_value (val);
+
+    ///////////////////////////////
+    // raw bytes and sync policy
+    ///////////////////////////////
+
+    {
+      uint8_t bytes [5000];
+      for (size_t i = 0; i < sizeof (bytes); ++i)
+      {
+        bytes [i] = (uint8_t) (i * 13);
+      }
+
+      counting_policy policy (1000u);
+      {
+        kvr::async_file_ostream ostr (path, 256u, 3u, &policy);
+        ostr.put (bytes [0]);
+        ostr.write (bytes + 1, 99);
+        ostr.flush ();
+        ostr.flush ();
+        ostr.write (bytes + 100, 3000);
+        for (size_t i = 3100; i < 5000; ++i)
+        {
+          ostr.put (bytes [i]);
+        }
+        // the destructor closes
+      }
+
+      TS_ASSERT_EQUALS (policy.m_flushes, 1u);
+      TS_ASSERT_EQUALS (policy.m_closes, 1u);
+      TS_ASSERT_EQUALS (policy.m_written, 5000u);
+      // 100 bytes, then 256 at a time with a short last buffer
+      TS_ASSERT_EQUALS (policy.m_writes, 21u);
+      TS_ASSERT (policy.m_syncs >= 4u);
+
+      kvr::mmap_istream file (path);
+      TS_ASSERT_EQUALS (file.size (), 5000u);
+      TS_ASSERT_SAME_DATA (file.data (), bytes, 5000);
+    }
+
+    ///////////////////////////////
+    // unopened
+    ///////////////////////////////
+
+    remove (path);
+
+    {
+      kvr::async_file_ostream ostr ("kvr_test_missing_dir/file.tmp");
+      TS_ASSERT (!ostr.is_open ());
+      TS_ASSERT (ostr.failed ());
+      ostr.put (1);
+      ostr.flush ();
+      TS_ASSERT (!ostr.close ());
+    }
+
+    {
+      small_allocator alloc;
+      kvr::async_file_ostream ostr (path, 65536, 2, NULL, &alloc);
+      TS_ASSERT (!ostr.is_open ());
+      TS_ASSERT (ostr.failed ());
+      ostr.write ((uint8_t *) "abc", 3);
+      TS_ASSERT (!ostr.close ());
+    }
+
+    remove (path);
+  }
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////